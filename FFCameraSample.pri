@@ -1,7 +1,43 @@
+HEADERS += ../src/libffbb/ffbbcolor.h
+HEADERS += ../src/libffbb/ffbbcopy.h
 HEADERS += ../src/libffbb/ffbbdec.h
+HEADERS += ../src/libffbb/ffbbdenoise.h
 HEADERS += ../src/libffbb/ffbbenc.h
+HEADERS += ../src/libffbb/ffbbindex.h
+HEADERS += ../src/libffbb/ffbbmeter.h
+HEADERS += ../src/libffbb/ffbbmotion.h
+HEADERS += ../src/libffbb/ffbborient.h
+HEADERS += ../src/libffbb/ffbbplay.h
+HEADERS += ../src/libffbb/ffbbpool.h
+HEADERS += ../src/libffbb/ffbbquality.h
+HEADERS += ../src/libffbb/ffbbregress.h
+HEADERS += ../src/libffbb/ffbbscan.h
+HEADERS += ../src/libffbb/ffbbsched.h
+HEADERS += ../src/libffbb/ffbbscreen.h
+HEADERS += ../src/libffbb/ffbbsink.h
+HEADERS += ../src/libffbb/ffbbstats.h
+HEADERS += ../src/libffbb/ffbbthumb.h
+HEADERS += ../src/libffbb/ffbbtrace.h
 HEADERS += ../src/ffcamerasampleapp.hpp
 SOURCES += ../src/ffcamerasampleapp.cpp
+SOURCES += ../src/libffbb/ffbbcolor.cpp
+SOURCES += ../src/libffbb/ffbbcopy.cpp
 SOURCES += ../src/libffbb/ffbbdec.cpp
+SOURCES += ../src/libffbb/ffbbdenoise.cpp
 SOURCES += ../src/libffbb/ffbbenc.cpp
+SOURCES += ../src/libffbb/ffbbindex.cpp
+SOURCES += ../src/libffbb/ffbbmeter.cpp
+SOURCES += ../src/libffbb/ffbbmotion.cpp
+SOURCES += ../src/libffbb/ffbborient.cpp
+SOURCES += ../src/libffbb/ffbbplay.cpp
+SOURCES += ../src/libffbb/ffbbpool.cpp
+SOURCES += ../src/libffbb/ffbbquality.cpp
+SOURCES += ../src/libffbb/ffbbregress.cpp
+SOURCES += ../src/libffbb/ffbbscan.cpp
+SOURCES += ../src/libffbb/ffbbsched.cpp
+SOURCES += ../src/libffbb/ffbbscreen.cpp
+SOURCES += ../src/libffbb/ffbbsink.cpp
+SOURCES += ../src/libffbb/ffbbstats.cpp
+SOURCES += ../src/libffbb/ffbbthumb.cpp
+SOURCES += ../src/libffbb/ffbbtrace.cpp
 SOURCES += ../src/main.cpp
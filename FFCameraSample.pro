@@ -6,6 +6,9 @@ CONFIG += qt warn_on debug_and_release cascades
 
 device {
 	ARCH = armle-v7
+	# the armle-v7 toolchain defaults to vfp, the NEON kernels need the flag
+	QMAKE_CFLAGS += -mfpu=neon
+	QMAKE_CXXFLAGS += -mfpu=neon
 	CONFIG(release, debug|release) {
 		DESTDIR = o.le-v7
 	}
@@ -26,8 +29,11 @@ simulator {
 }
 
 include($${TARGET}.pri)
+
+# record a Chrome trace of the pipeline, see ffbbtrace.h
+#DEFINES += FFTRACE
 INCLUDEPATH += ../ffmpeg/include ../libx264/include
-LIBS += -lcamapi -lscreen -L../ffmpeg/lib/gpl/$${ARCH} -lavformat -lavcodec -lavutil -L../libx264/lib/$${ARCH} -lx264 
+LIBS += -lcamapi -lscreen -L../ffmpeg/lib/gpl/$${ARCH} -lavformat -lavcodec -lswscale -lavutil -L../libx264/lib/$${ARCH} -lx264 
 
 OBJECTS_DIR = $${DESTDIR}/.obj
 MOC_DIR = $${DESTDIR}/.moc
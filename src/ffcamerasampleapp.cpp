@@ -44,12 +44,77 @@ using namespace bb::cascades;
 //#define VIDEO_HEIGHT 1920
 #define CODEC_ID CODEC_ID_MPEG2VIDEO
 #define FILENAME (char*)"/accounts/1000/shared/camera/VID_TEST.mpg"
+#define INDEX_FILENAME (char*)"/accounts/1000/shared/camera/VID_TEST.idx"
+#define TRACE_FILENAME (char*)"/accounts/1000/shared/camera/VID_TEST.json"
+#define QUALITY_FILENAME (char*)"/accounts/1000/shared/camera/VID_TEST.csv"
+#define RESULTS_FILENAME (char*)"/accounts/1000/shared/camera/ffregress.txt"
+
+// packaged from assets/ffregress.txt
+#define BASELINE_FILENAME (char*)"app/native/ffregress.txt"
+
+// decode the preview at 1/2 (1), 1/4 (2) or 1/8 (3) size, 0 for full size
+#define PREVIEW_LOWRES 1
+
+// decode the recording again to report its PSNR and SSIM against the camera frames
+#define MEASURE_QUALITY 0
+
+// repeat the last frame encoded (FFENC_SKIP_REPEAT) in place of camera frames whose
+// luma differs from it by less than SKIP_THRESHOLD on average
+#define SKIP_STATIC_FRAMES FFENC_SKIP_OFF
+#define SKIP_THRESHOLD 1.5
+
+// copy macroblocks whose luma differs from the last frame encoded by less than
+// this on average from that frame, so their bits go to the moving ones, 0 for none
+#define ROI_STATIC_THRESHOLD 0
+
+// filter sensor noise from the camera frames before they are encoded, keeping
+// 1/2^DENOISE_STRENGTH of pixels that changed by less than DENOISE_THRESHOLD, 0 for off
+#define DENOISE_STRENGTH 0
+#define DENOISE_THRESHOLD 16
+
+// with the regression, bisect for the bit rate at which the filtered low light clip
+// is as close to the camera frames as the unfiltered one encoded at DENOISE_BIT_RATE
+#define DENOISE_BIT_RATE 400000
+#define DENOISE_BISECT_STEPS 6
+
+// turn recordings clockwise, and mirror those of the front camera as the
+// viewfinder shows them, while the camera frames are copied to the encoder
+#define RECORD_ROTATION FFORIENT_ROTATE_0
+#define MIRROR_FRONT_RECORDING 0
+
+// copy planes of at least this many bytes with streaming stores, such as
+// FFCOPY_STREAM_THRESHOLD, once ffcopy_benchmark shows they are faster; 0 for memcpy
+#define STREAM_COPY_THRESHOLD 0
+
+// convert camera frames to the encoder on up to this many threads, 0 for
+// one per processor; frames of less than 256 KB stay on the camera thread
+#define CONVERSION_THREADS 1
+
+// print the time to convert 1080p and 4K frames on 1 to N threads, VIDEO_WIDTH x
+// VIDEO_HEIGHT frames with the generic and fixed kernels, and 1080p frames to RGBA
+// with ffcolor and swscale, at startup
+#define BENCHMARK_CONVERSION 0
+
+// pass the frames being recorded to an analytics tap on a thread of its own, with
+// up to this many waiting before the oldest is dropped, 0 for none
+#define TAP_DEPTH 0
+
+// encode and decode the golden clips with every codec on a worker at startup, compare
+// them with the packaged baseline and write the results to RESULTS_FILENAME
+#define RUN_REGRESSION 0
+
+// pin the ffpool workers to one processor each
+#define PIN_WORKERS 0
+
+// keep the camera callback and presentation on the first core ahead
+// of the UI, and encoding and decoding on the second
+#define SCHEDULE_THREADS 0
 
 // workaround a ForeignWindowControl race condition
 #define WORKAROUND_FWC
 
 FFCameraSampleApp::FFCameraSampleApp()
-        : mCameraHandle(CAMERA_HANDLE_INVALID), record(false), decode(false)
+        : mCameraHandle(CAMERA_HANDLE_INVALID), record(false), decode(false), tap_brightness(0), regression_task(NULL)
 {
     mViewfinderWindow = ForeignWindowControl::create().windowId(QString("cameraViewfinder"));
 
@@ -94,27 +159,221 @@ FFCameraSampleApp::FFCameraSampleApp()
 
     Application::instance()->setScene(Page::create().content(container));
 
+    // report the frame rate from the UI thread, not the camera callback
+    mFpsTimer = new QTimer(this);
+    mFpsTimer->setInterval(SECOND / 1000);
+    QObject::connect(mFpsTimer, SIGNAL(timeout()), this, SLOT(onPrintFps()));
+
+    ffpool_config pool_config;
+    pool_config.max_threads = 0;
+    pool_config.pin_workers = PIN_WORKERS;
+    ffpool_configure(&pool_config);
+
+    ffcopy_set_stream_threshold(STREAM_COPY_THRESHOLD);
+
+    if (SCHEDULE_THREADS)
+    {
+        ffsched_policy capture = { 0x1, 0, FFSCHED_RR, 12 };
+        ffsched_policy present = { 0x1, 0, FFSCHED_RR, 11 };
+        ffsched_policy codec = { 0x2, 0, FFSCHED_INHERIT, 0 };
+
+        ffsched_set_policy(FFSCHED_CAPTURE, &capture);
+        ffsched_set_policy(FFSCHED_PRESENT, &present);
+        ffsched_set_policy(FFSCHED_ENCODE, &codec);
+        ffsched_set_policy(FFSCHED_DECODE, &codec);
+    }
+
     ffe_context = ffenc_alloc();
     ffd_context = ffdec_alloc();
+    ffi_context = ffindex_alloc();
+    ffm_context = ffmeter_alloc();
+    ffq_context = ffquality_alloc();
 
     pthread_mutex_init(&reading_mutex, 0);
     pthread_cond_init(&read_cond, 0);
+
+    // the sweep takes minutes, so it stays off the UI thread
+    if (RUN_REGRESSION && ffpool_submit(&regression_thread, this, &regression_task) != FFPOOL_OK)
+    {
+        fprintf(stderr, "could not start regression\n");
+    }
+
+    if (BENCHMARK_CONVERSION) report_conversion();
 }
 
 FFCameraSampleApp::~FFCameraSampleApp()
 {
     delete mViewfinderWindow;
 
+    if (regression_task) ffpool_join(regression_task, NULL);
+    regression_task = NULL;
+
     ffenc_free(ffe_context);
     ffe_context = NULL;
 
     ffdec_free(ffd_context);
     ffd_context = NULL;
 
+    ffindex_free(ffi_context);
+    ffi_context = NULL;
+
+    ffmeter_free(ffm_context);
+    ffm_context = NULL;
+
+    ffquality_free(ffq_context);
+    ffq_context = NULL;
+
+    // what every role ended up with, including workers that could not restore theirs
+    ffsched_report(stderr);
+
+    ffpool_shutdown();
+
     pthread_mutex_destroy(&reading_mutex);
     pthread_cond_destroy(&read_cond);
 }
 
+void FFCameraSampleApp::run_regression()
+{
+    ffregress_context *ffr_context = ffregress_alloc();
+
+    ffregress_add_pattern(ffr_context, FFREGRESS_GRADIENT, VIDEO_WIDTH, VIDEO_HEIGHT);
+    ffregress_add_pattern(ffr_context, FFREGRESS_CHECKERS, VIDEO_WIDTH, VIDEO_HEIGHT);
+    ffregress_add_pattern(ffr_context, FFREGRESS_NOISE, VIDEO_WIDTH, VIDEO_HEIGHT);
+    ffregress_add_pattern(ffr_context, FFREGRESS_LOW_LIGHT, VIDEO_WIDTH, VIDEO_HEIGHT);
+    ffregress_add_pattern(ffr_context, FFREGRESS_CHECKERS, 720, 1280);
+
+    // every codec the app can record with
+    const CodecID codecs[] = { CODEC_ID_MPEG2VIDEO, CODEC_ID_H264 };
+
+    for (unsigned int i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++)
+    {
+        if (ffregress_add_codec(ffr_context, codecs[i], 400000, 15) != FFREGRESS_OK)
+        {
+            fprintf(stderr, "could not add codec %d to the regression\n", codecs[i]);
+        }
+    }
+
+    ffregress_error error = ffregress_run(ffr_context);
+
+    if (error != FFREGRESS_OK)
+    {
+        fprintf(stderr, "could not run regression: %d\n", error);
+    }
+    else
+    {
+        // the results replace assets/ffregress.txt when a change is meant to move them
+        if (ffregress_write_baseline(ffr_context, RESULTS_FILENAME) != FFREGRESS_OK)
+        {
+            fprintf(stderr, "could not write %s\n", RESULTS_FILENAME);
+        }
+
+        error = ffregress_compare(ffr_context, BASELINE_FILENAME, stderr);
+
+        if (error == FFREGRESS_READ_FAILED) fprintf(stderr, "could not read baseline %s\n", BASELINE_FILENAME);
+        else if (error == FFREGRESS_NO_BASELINE) fprintf(stderr, "regression failed, record the missing results in %s\n", BASELINE_FILENAME);
+        else fprintf(stderr, "regression %s\n", error == FFREGRESS_OK ? "passed" : "failed");
+    }
+
+    ffregress_free(ffr_context);
+
+    if (DENOISE_STRENGTH) report_denoise();
+}
+
+void* regression_thread(void* arg)
+{
+    FFCameraSampleApp *app = (FFCameraSampleApp*) arg;
+    app->run_regression();
+    return 0;
+}
+
+bool FFCameraSampleApp::run_denoise(int strength, int bit_rate, ffregress_result *result)
+{
+    ffregress_context *ffr_context = ffregress_alloc();
+    ffr_context->denoise_strength = strength;
+    ffr_context->denoise_threshold = DENOISE_THRESHOLD;
+
+    ffregress_add_pattern(ffr_context, FFREGRESS_LOW_LIGHT, VIDEO_WIDTH, VIDEO_HEIGHT);
+    ffregress_add_codec(ffr_context, CODEC_ID, bit_rate, 15);
+
+    const ffregress_result *results;
+    int result_count;
+
+    bool success = ffregress_run(ffr_context) == FFREGRESS_OK
+            && ffregress_get_results(ffr_context, &results, &result_count) == FFREGRESS_OK && result_count;
+
+    if (success) *result = results[0];
+
+    ffregress_free(ffr_context);
+
+    return success;
+}
+
+void FFCameraSampleApp::report_denoise()
+{
+    // the low light clip as it is, then filtered at the same bit rate
+    ffregress_result unfiltered;
+    ffregress_result filtered;
+
+    if (!run_denoise(0, DENOISE_BIT_RATE, &unfiltered) || !run_denoise(DENOISE_STRENGTH, DENOISE_BIT_RATE, &filtered))
+    {
+        fprintf(stderr, "could not run denoise comparison\n");
+        return;
+    }
+
+    fprintf(stderr, "denoise: %s at %d bit/s psnr %.3f -> %.3f dB, p50 %lld us p99 %lld us per frame\n",
+            filtered.name, DENOISE_BIT_RATE, unfiltered.psnr, filtered.psnr, filtered.denoise_p50, filtered.denoise_p99);
+
+    // the bit rate is bisected between one known to fall short of
+    // the unfiltered PSNR and one known to reach it
+    int low = DENOISE_BIT_RATE / 4;
+    int high = DENOISE_BIT_RATE;
+    ffregress_result match = filtered;
+
+    if (filtered.psnr < unfiltered.psnr)
+    {
+        low = DENOISE_BIT_RATE;
+        high = DENOISE_BIT_RATE * 2;
+
+        if (!run_denoise(DENOISE_STRENGTH, high, &match))
+        {
+            fprintf(stderr, "could not run denoise comparison\n");
+            return;
+        }
+
+        if (match.psnr < unfiltered.psnr)
+        {
+            fprintf(stderr, "denoise: psnr %.3f dB not reached below %d bit/s\n", unfiltered.psnr, high);
+            return;
+        }
+    }
+
+    for (int i = 0; i < DENOISE_BISECT_STEPS; i++)
+    {
+        int bit_rate = (low + high) / 2;
+
+        ffregress_result result;
+        if (!run_denoise(DENOISE_STRENGTH, bit_rate, &result))
+        {
+            fprintf(stderr, "could not run denoise comparison\n");
+            return;
+        }
+
+        if (result.psnr >= unfiltered.psnr)
+        {
+            high = bit_rate;
+            match = result;
+        }
+        else
+        {
+            low = bit_rate;
+        }
+    }
+
+    fprintf(stderr, "denoise: psnr %.3f dB at %d -> %d bit/s, %lld -> %lld bytes (%.1f%%)\n",
+            unfiltered.psnr, DENOISE_BIT_RATE, high, unfiltered.bytes, match.bytes,
+            (match.bytes - unfiltered.bytes) * 100.0 / FFMAX(unfiltered.bytes, 1));
+}
+
 void FFCameraSampleApp::onWindowAttached(screen_window_t win, const QString &group, const QString &id)
 {
     qDebug() << "onWindowAttached: " << group << ", " << id;
@@ -165,6 +424,8 @@ int FFCameraSampleApp::createViewfinder(camera_unit_t cameraUnit, const QString
             CAMERA_IMGPROP_WIDTH, VIDEO_WIDTH,
             CAMERA_IMGPROP_HEIGHT, VIDEO_HEIGHT);
 
+    ffmeter_reset(ffm_context);
+
     if (camera_start_video_viewfinder(mCameraHandle, vf_callback, NULL, this) != CAMERA_EOK)
     {
         camera_close(mCameraHandle);
@@ -172,6 +433,8 @@ int FFCameraSampleApp::createViewfinder(camera_unit_t cameraUnit, const QString
         return EIO;
     }
 
+    mFpsTimer->start();
+
     mStartFrontButton->setVisible(false);
     mStartRearButton->setVisible(false);
     mStartDecoderButton->setVisible(false);
@@ -208,6 +471,8 @@ void FFCameraSampleApp::onStopCamera()
     camera_close(mCameraHandle);
     mCameraHandle = CAMERA_HANDLE_INVALID;
 
+    mFpsTimer->stop();
+
     // reset button visibility
     mStartStopButton->setVisible(false);
     mStopButton->setVisible(false);
@@ -298,9 +563,14 @@ bool FFCameraSampleApp::start_decoder(CodecID codec_id)
 
     AVCodecContext *codec_context = avcodec_alloc_context3(codec);
     codec_context->pix_fmt = PIX_FMT_YUV420P;
-    codec_context->width = VIDEO_WIDTH;
-    codec_context->height = VIDEO_HEIGHT;
-    codec_context->thread_count = 2;
+
+    // the recording has the size of the turned frames
+    fforient_transform orientation;
+    recording_orientation(&orientation, &codec_context->width, &codec_context->height);
+
+    // a reduced preview is cheap enough for one thread,
+    // which leaves the other core to the encoder
+    codec_context->thread_count = PREVIEW_LOWRES ? 1 : 2;
 
     if (codec->capabilities & CODEC_CAP_TRUNCATED)
     {
@@ -310,11 +580,28 @@ bool FFCameraSampleApp::start_decoder(CodecID codec_id)
 
     decode_read = 0;
 
+    // while recording the encoder is filling in the index as we go
+    if (!record) ffindex_load(ffi_context, INDEX_FILENAME, buf.st_size);
+
     ffdec_reset(ffd_context);
     ffdec_set_close_callback(ffd_context, ffd_context_close, this);
     ffdec_set_read_callback(ffd_context, ffd_read_callback, this);
+    ffdec_set_seek_callback(ffd_context, ffd_seek_callback, this);
+    ffdec_set_index(ffd_context, ffi_context);
     ffd_context->codec_context = codec_context;
 
+    int lowres = FFMIN(PREVIEW_LOWRES, codec->max_lowres);
+
+    // MPEG-2 has no loop filter, only skip it for codecs that do
+    enum AVDiscard skip_loop_filter = AVDISCARD_DEFAULT;
+    if (lowres && codec->id == CODEC_ID_H264) skip_loop_filter = AVDISCARD_ALL;
+
+    ffdec_error preview_error = ffdec_set_preview(ffd_context, lowres, skip_loop_filter, AVDISCARD_DEFAULT);
+    if (preview_error != FFDEC_OK)
+    {
+        fprintf(stderr, "could not set preview lowres %d: %d, decoding at full resolution\n", lowres, preview_error);
+    }
+
     if (avcodec_open2(codec_context, codec, NULL) < 0)
     {
         av_free(codec_context);
@@ -340,6 +627,15 @@ bool FFCameraSampleApp::start_decoder(CodecID codec_id)
     return true;
 }
 
+void FFCameraSampleApp::recording_orientation(fforient_transform *transform, int *width, int *height)
+{
+    memset(transform, 0, sizeof(fforient_transform));
+    transform->rotation = RECORD_ROTATION;
+    transform->mirror = MIRROR_FRONT_RECORDING && mCameraUnit == CAMERA_UNIT_FRONT;
+
+    fforient_output_size(transform, VIDEO_WIDTH, VIDEO_HEIGHT, width, height);
+}
+
 bool FFCameraSampleApp::start_encoder(CodecID codec_id)
 {
     struct stat buf;
@@ -373,8 +669,8 @@ bool FFCameraSampleApp::start_encoder(CodecID codec_id)
 
     AVCodecContext *codec_context = avcodec_alloc_context3(codec);
     codec_context->pix_fmt = PIX_FMT_YUV420P;
-    codec_context->width = VIDEO_WIDTH;
-    codec_context->height = VIDEO_HEIGHT;
+    fforient_transform orientation;
+    recording_orientation(&orientation, &codec_context->width, &codec_context->height);
     codec_context->bit_rate = 400000;
     codec_context->time_base.num = 1;
     codec_context->time_base.den = 30;
@@ -383,9 +679,20 @@ bool FFCameraSampleApp::start_encoder(CodecID codec_id)
     codec_context->colorspace = AVCOL_SPC_SMPTE170M;
     codec_context->thread_count = 2;
 
+    ffindex_reset(ffi_context);
+    ffi_context->time_base = codec_context->time_base;
+    ffindex_open_sidecar(ffi_context, INDEX_FILENAME);
+
     ffenc_reset(ffe_context);
     ffenc_set_close_callback(ffe_context, ffe_context_close, this);
     ffenc_set_write_callback(ffe_context, ffe_write_callback, this);
+    if (TAP_DEPTH) ffenc_set_tap(ffe_context, TAP_DEPTH, FFENC_TAP_DROP_OLDEST, ffe_tap_callback, this);
+    ffenc_set_index(ffe_context, ffi_context);
+    ffenc_set_skip(ffe_context, SKIP_STATIC_FRAMES, SKIP_THRESHOLD);
+    ffenc_set_roi(ffe_context, ROI_STATIC_THRESHOLD, NULL, NULL);
+    ffenc_set_denoise(ffe_context, DENOISE_STRENGTH, DENOISE_THRESHOLD);
+    ffenc_set_orientation(ffe_context, &orientation);
+    ffenc_set_conversion_threads(ffe_context, CONVERSION_THREADS);
     ffe_context->codec_context = codec_context;
 
     if (avcodec_open2(codec_context, codec, NULL) < 0)
@@ -395,6 +702,20 @@ bool FFCameraSampleApp::start_encoder(CodecID codec_id)
         return false;
     }
 
+    if (MEASURE_QUALITY)
+    {
+        ffquality_reset(ffq_context);
+
+        if (ffquality_open(ffq_context, codec_context, QUALITY_FILENAME) == FFQUALITY_OK)
+        {
+            ffenc_set_quality(ffe_context, ffq_context);
+        }
+        else
+        {
+            fprintf(stderr, "could not measure quality\n");
+        }
+    }
+
     if (ffenc_start(ffe_context) != FFENC_OK)
     {
         fprintf(stderr, "could not start ffenc\n");
@@ -412,10 +733,19 @@ void vf_callback(camera_handle_t handle, camera_buffer_t* buf, void* arg)
     if (buf->frametype != CAMERA_FRAMETYPE_NV12) return;
 
     FFCameraSampleApp* app = (FFCameraSampleApp*) arg;
-    app->update_fps(buf);
-    app->print_fps(buf);
+    ffmeter_add(app->ffm_context, buf->frametimestamp);
+
+    // the camera service owns this thread, so it takes the role on its first frame
+    static __thread bool scheduled = false;
+    if (!scheduled) ffsched_apply(FFSCHED_CAPTURE);
+    scheduled = true;
+
+    FFTRACE_THREAD_NAME("camera");
+    FFTRACE_BEGIN("vf_callback", buf->frametimestamp);
 
     ffenc_add_frame(app->ffe_context, buf);
+
+    FFTRACE_END("vf_callback", buf->frametimestamp);
 }
 
 int ffd_read_callback(ffdec_context *ffd_context, uint8_t *buf, ssize_t size, void *arg)
@@ -442,6 +772,12 @@ int ffd_read_callback(ffdec_context *ffd_context, uint8_t *buf, ssize_t size, vo
     return read;
 }
 
+void ffd_seek_callback(ffdec_context *ffd_context, int64_t offset, void *arg)
+{
+    FFCameraSampleApp* app = (FFCameraSampleApp*) arg;
+    app->decode_read = offset;
+}
+
 void ffe_write_callback(ffenc_context *ffe_context, uint8_t *buf, ssize_t size, void *arg)
 {
     FFCameraSampleApp* app = (FFCameraSampleApp*) arg;
@@ -449,23 +785,39 @@ void ffe_write_callback(ffenc_context *ffe_context, uint8_t *buf, ssize_t size,
     pthread_cond_signal(&app->read_cond);
 }
 
-void FFCameraSampleApp::update_fps(camera_buffer_t* buf)
+void FFCameraSampleApp::onPrintFps()
 {
-    fps.push_back(buf->frametimestamp);
-    while (fps.back() - fps.front() > SECOND)
-    {
-        fps.pop_front();
-    }
+    ffmeter_stats stats;
+    ffmeter_get_stats(ffm_context, &stats);
+
+    qDebug() << "fps[" << stats.window_fps << "] jitter[" << stats.jitter << "us] gaps["
+            << stats.gaps << "] missed[" << stats.frames_missed << "]";
+
+    ffpool_stats pool_stats;
+    ffpool_get_stats(&pool_stats);
+
+    qDebug() << "ffpool threads[" << pool_stats.threads << "] idle[" << pool_stats.idle_threads
+            << "] queued[" << pool_stats.tasks_queued << "] latency p50[" << pool_stats.queue_latency.p50
+            << "us] p99[" << pool_stats.queue_latency.p99 << "us]";
 }
 
-void FFCameraSampleApp::print_fps(camera_buffer_t* buf)
+void ffe_tap_callback(ffenc_context *ffe_context, const AVFrame *frame, int64_t frame_number, void *arg)
 {
-    static int64_t frametimestamp = 0;
-    if (!frametimestamp || buf->frametimestamp - frametimestamp >= SECOND)
+    FFCameraSampleApp* app = (FFCameraSampleApp*) arg;
+    AVCodecContext *codec_context = ffe_context->codec_context;
+
+    // the average brightness of every 8th row, standing in for real analytics
+    int64_t sum = 0;
+    int64_t count = 0;
+
+    for (int y = 0; y < codec_context->height; y += 8)
     {
-        frametimestamp = buf->frametimestamp;
-        qDebug() << "fps[" << fps.size() << "]";
+        const uint8_t *row = &frame->data[0][y * frame->linesize[0]];
+        for (int x = 0; x < codec_context->width; x++) sum += row[x];
+        count += codec_context->width;
     }
+
+    app->tap_brightness = count ? sum / count : 0;
 }
 
 void ffe_context_close(ffenc_context *ffe_context, void *arg)
@@ -474,10 +826,60 @@ void ffe_context_close(ffenc_context *ffe_context, void *arg)
 
     FFCameraSampleApp* app = (FFCameraSampleApp*) arg;
 
+    ffenc_stats stats;
+    ffenc_get_stats(ffe_context, &stats);
+
+    fprintf(stderr, "ffenc: %lld in, %lld out, %lld dropped, queue peak %d, %lld stalls, "
+            "encode p50 %lld us p99 %lld us, latency p50 %lld us p99 %lld us\n",
+            stats.frames_in, stats.frames_out, stats.frames_dropped, stats.queue_peak, stats.stalls,
+            stats.encode_time.p50, stats.encode_time.p99, stats.latency.p50, stats.latency.p99);
+
+    if (SKIP_STATIC_FRAMES != FFENC_SKIP_OFF && stats.frames_in)
+    {
+        fprintf(stderr, "ffenc: %lld skipped (%.1f%%), detect %lld us, encode saved %lld us\n",
+                stats.frames_skipped, stats.frames_skipped * 100.0 / stats.frames_in,
+                stats.skip_detect_time, stats.skip_time_saved);
+    }
+
+    if (ROI_STATIC_THRESHOLD)
+    {
+        fprintf(stderr, "ffenc: %lld static macroblocks frozen in %lld us\n", stats.mbs_frozen, stats.roi_time);
+    }
+
+    if (DENOISE_STRENGTH)
+    {
+        fprintf(stderr, "ffenc: denoise p50 %lld us p99 %lld us per frame\n",
+                stats.denoise_time.p50, stats.denoise_time.p99);
+    }
+
+    if (TAP_DEPTH)
+    {
+        fprintf(stderr, "ffenc: tap %lld frames, %lld dropped, lag p50 %lld us p99 %lld us, brightness %d\n",
+                stats.tap_frames, stats.tap_dropped, stats.tap_lag.p50, stats.tap_lag.p99,
+                app->tap_brightness);
+    }
+
+    ffquality_summary summary;
+    if (ffquality_close(app->ffq_context) != FFQUALITY_NOT_OPEN
+            && ffquality_get_summary(app->ffq_context, &summary) == FFQUALITY_OK)
+    {
+        fprintf(stderr, "ffquality: %lld frames, psnr %.3f dB (y %.3f), ssim %.5f, %lld skipped\n",
+                summary.frames, summary.psnr, summary.psnr_y, summary.ssim, summary.frames_skipped);
+    }
+
     ffenc_close(ffe_context);
 
     fclose(app->write_file);
     app->write_file = NULL;
+
+    ffindex_close_sidecar(app->ffi_context);
+
+#if defined(FFTRACE)
+    if (fftrace_write(TRACE_FILENAME) != FFTRACE_OK)
+    {
+        fprintf(stderr, "could not write %s\n", TRACE_FILENAME);
+    }
+#endif
 }
 
 void ffd_context_close(ffdec_context *ffd_context, void *arg)
@@ -486,8 +888,72 @@ void ffd_context_close(ffdec_context *ffd_context, void *arg)
 
     FFCameraSampleApp* app = (FFCameraSampleApp*) arg;
 
+    ffdec_stats ffd_stats;
+    ffdec_get_stats(ffd_context, &ffd_stats);
+
+    if (ffd_stats.frames_in)
+    {
+        fprintf(stderr, "lowres %d: %lld us decode, %lld us cpu per frame over %lld frames\n",
+                ffd_stats.lowres, ffd_stats.total_decode_time / ffd_stats.frames_in,
+                ffd_stats.cpu_time / ffd_stats.frames_in, ffd_stats.frames_in);
+    }
+
+    fprintf(stderr, "ffdec: %lld in, %lld out, %lld dropped, queue peak %d, %lld stalls, "
+            "decode p50 %lld us p99 %lld us\n",
+            ffd_stats.frames_in, ffd_stats.frames_out, ffd_stats.frames_dropped, ffd_stats.queue_peak,
+            ffd_stats.stalls, ffd_stats.decode_time.p50, ffd_stats.decode_time.p99);
+
     ffdec_close(ffd_context);
 
     fclose(app->read_file);
     app->read_file = NULL;
 }
+
+void FFCameraSampleApp::report_conversion()
+{
+    static const int sizes[][2] = { { 1080, 1920 }, { 2160, 3840 } };
+
+    for (int i = 0; i < 2; i++)
+    {
+        for (int rotation = FFORIENT_ROTATE_0; rotation <= FFORIENT_ROTATE_90; rotation++)
+        {
+            fforient_scaling_result result;
+            fforient_benchmark_scaling(sizes[i][0], sizes[i][1], (fforient_rotation) rotation, 30, &result);
+
+            fprintf(stderr, "conversion %dx%d rotate %d (%s):", sizes[i][0], sizes[i][1],
+                    rotation * 90, fforient_implementation());
+
+            for (int threads = 1; threads <= result.threads; threads++)
+            {
+                fprintf(stderr, " %d:%.0f us x%.2f", threads, result.time[threads - 1],
+                        result.time[0] / FFMAX(result.time[threads - 1], 1));
+            }
+
+            fprintf(stderr, "\n");
+        }
+    }
+
+    fforient_fixed_result result;
+    fforient_benchmark_fixed(VIDEO_WIDTH, VIDEO_HEIGHT, 100, &result);
+
+    fprintf(stderr, "conversion %dx%d %s kernel: rotate 0 %.0f -> %.0f us, mirrored %.0f -> %.0f us, "
+            "rotate 180 %.0f -> %.0f us, mirrored %.0f -> %.0f us, %lld mismatches\n",
+            VIDEO_WIDTH, VIDEO_HEIGHT, result.fixed ? "fixed" : "no fixed",
+            result.generic_time[0][0], result.fixed_time[0][0], result.generic_time[0][1], result.fixed_time[0][1],
+            result.generic_time[1][0], result.fixed_time[1][0], result.generic_time[1][1], result.fixed_time[1][1],
+            result.mismatches);
+
+    // the converter and swscale are timed in the same run, so their figures compare
+    ffcolor_context *ffc_context = ffcolor_alloc();
+    ffcolor_benchmark_result color_result;
+
+    if (ffcolor_benchmark(ffc_context, sizes[0][0], sizes[0][1], 30, &color_result) == FFCOLOR_OK)
+    {
+        fprintf(stderr, "color %dx%d (%s): %.0f us, swscale %.0f us x%.2f, max difference %d\n",
+                sizes[0][0], sizes[0][1], ffcolor_implementation(), color_result.ffcolor_time,
+                color_result.swscale_time, color_result.swscale_time / FFMAX(color_result.ffcolor_time, 1),
+                color_result.max_difference);
+    }
+
+    ffcolor_free(ffc_context);
+}
@@ -18,32 +18,45 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QMetaType>
+#include <QtCore/QTimer>
 
 #include <bb/cascades/ForeignWindowControl>
 #include <bb/cascades/Button>
 #include <bb/cascades/Label>
 
+#include "libffbb/ffbbcolor.h"
 #include "libffbb/ffbbenc.h"
 #include "libffbb/ffbbdec.h"
-#include <deque>
+#include "libffbb/ffbbcopy.h"
+#include "libffbb/ffbbmeter.h"
+#include "libffbb/ffbbpool.h"
+#include "libffbb/ffbbsched.h"
+#include "libffbb/ffbbregress.h"
+#include "libffbb/ffbbtrace.h"
 
 using namespace bb::cascades;
 
 void ffd_context_close(ffdec_context *ffd_context, void *arg);
 int ffd_read_callback(ffdec_context *ffd_context, uint8_t *buf, ssize_t size, void *arg);
+void ffd_seek_callback(ffdec_context *ffd_context, int64_t offset, void *arg);
 
 void ffe_context_close(ffenc_context *ffe_context, void *arg);
 void vf_callback(camera_handle_t handle, camera_buffer_t* buf, void* arg);
 void ffe_write_callback(ffenc_context *ffe_context, uint8_t *buf, ssize_t size, void *arg);
+void ffe_tap_callback(ffenc_context *ffe_context, const AVFrame *frame, int64_t frame_number, void *arg);
+void* regression_thread(void* arg);
 
 class FFCameraSampleApp : public QObject
 {
     friend void ffd_context_close(ffdec_context *ffd_context, void *arg);
     friend int ffd_read_callback(ffdec_context *ffd_context, uint8_t *buf, ssize_t size, void *arg);
+    friend void ffd_seek_callback(ffdec_context *ffd_context, int64_t offset, void *arg);
 
     friend void ffe_context_close(ffenc_context *ffe_context, void *arg);
     friend void vf_callback(camera_handle_t handle, camera_buffer_t* buf, void* arg);
     friend void ffe_write_callback(ffenc_context *ffe_context, uint8_t *buf, ssize_t size, void *arg);
+    friend void ffe_tap_callback(ffenc_context *ffe_context, const AVFrame *frame, int64_t frame_number, void *arg);
+    friend void* regression_thread(void* arg);
 
 Q_OBJECT
     public slots:
@@ -54,6 +67,7 @@ Q_OBJECT
     void onStopCamera();
     void onStartStopDecoder();
     void onStartStopRecording();
+    void onPrintFps();
 
 public:
 
@@ -64,13 +78,17 @@ private:
 
     int createViewfinder(camera_unit_t cameraUnit, const QString &group, const QString &id);
 
-    void update_fps(camera_buffer_t* buf);
-    void print_fps(camera_buffer_t* buf);
     void show_frame(AVFrame *frame);
 
+    void recording_orientation(fforient_transform *transform, int *width, int *height);
     bool start_encoder(CodecID codec_id);
     bool start_decoder(CodecID codec_id);
 
+    void run_regression();
+    bool run_denoise(int strength, int bit_rate, ffregress_result *result);
+    void report_denoise();
+    void report_conversion();
+
     ForeignWindowControl *mViewfinderWindow;
     Button *mStartFrontButton;
     Button *mStartRearButton;
@@ -78,6 +96,7 @@ private:
     Button *mStopButton;
     Button *mStartStopButton;
     Label *mStatusLabel;
+    QTimer *mFpsTimer;
     camera_handle_t mCameraHandle;
     camera_unit_t mCameraUnit;
 
@@ -85,9 +104,13 @@ private:
     FILE *read_file;
     int decode_read;
     bool record, decode;
-    std::deque<int64_t> fps;
+    volatile int tap_brightness;
+    ffmeter_context *ffm_context;
     ffenc_context *ffe_context;
     ffdec_context *ffd_context;
+    ffindex_context *ffi_context;
+    ffquality_context *ffq_context;
+    ffpool_task *regression_task;
     pthread_mutex_t reading_mutex;
     pthread_cond_t read_cond;
 };
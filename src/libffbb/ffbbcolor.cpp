@@ -0,0 +1,538 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbcolor.h"
+
+extern "C"
+{
+#include <libswscale/swscale.h>
+}
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * All variants compute the same fixed point result. Inputs are centred
+ * and scaled by 128, multiplied by Q13 coefficients keeping the high 16
+ * bits, which leaves Q4 sums that fit 16 bit lanes with room to spare.
+ */
+typedef struct
+{
+    int16_t y_offset;
+    int16_t y;
+    int16_t v_r;
+    int16_t u_g;
+    int16_t v_g;
+    int16_t u_b;
+} ffcolor_coefficients;
+
+typedef struct
+{
+    bool valid;
+    ffcolor_matrix matrix;
+    ffcolor_range range;
+    ffcolor_coefficients coefficients;
+} ffcolor_reserved;
+
+ffcolor_context *ffcolor_alloc()
+{
+    ffcolor_context *ffc_context = (ffcolor_context*) malloc(sizeof(ffcolor_context));
+    memset(ffc_context, 0, sizeof(ffcolor_context));
+
+    ffcolor_reset(ffc_context);
+
+    return ffc_context;
+}
+
+void ffcolor_reset(ffcolor_context *ffc_context)
+{
+    ffcolor_reserved *ffc_reserved = (ffcolor_reserved*) ffc_context->reserved;
+
+    if (!ffc_reserved) ffc_reserved = (ffcolor_reserved*) malloc(sizeof(ffcolor_reserved));
+    memset(ffc_reserved, 0, sizeof(ffcolor_reserved));
+
+    memset(ffc_context, 0, sizeof(ffcolor_context));
+    ffc_context->matrix = FFCOLOR_BT601;
+    ffc_context->range = FFCOLOR_LIMITED;
+    ffc_context->format = FFCOLOR_RGBA;
+    ffc_context->reserved = ffc_reserved;
+}
+
+ffcolor_error ffcolor_free(ffcolor_context *ffc_context)
+{
+    ffcolor_reserved *ffc_reserved = (ffcolor_reserved*) ffc_context->reserved;
+    if (!ffc_reserved) return FFCOLOR_NOT_INITIALIZED;
+
+    free(ffc_reserved);
+    ffc_context->reserved = NULL;
+
+    free(ffc_context);
+
+    return FFCOLOR_OK;
+}
+
+ffcolor_error ffcolor_set_colorspace(ffcolor_context *ffc_context, const AVCodecContext *codec_context)
+{
+    ffcolor_reserved *ffc_reserved = (ffcolor_reserved*) ffc_context->reserved;
+    if (!ffc_reserved) return FFCOLOR_NOT_INITIALIZED;
+
+    ffc_context->matrix = codec_context->colorspace == AVCOL_SPC_BT709 ? FFCOLOR_BT709 : FFCOLOR_BT601;
+
+    bool full = codec_context->color_range == AVCOL_RANGE_JPEG || codec_context->pix_fmt == PIX_FMT_YUVJ420P;
+    ffc_context->range = full ? FFCOLOR_FULL : FFCOLOR_LIMITED;
+
+    return FFCOLOR_OK;
+}
+
+const char *ffcolor_implementation()
+{
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    return "neon";
+#else
+    return "c";
+#endif
+}
+
+static inline int16_t q13(double value)
+{
+    return (int16_t) lrint(value * 8192);
+}
+
+static const ffcolor_coefficients *get_coefficients(ffcolor_context *ffc_context)
+{
+    ffcolor_reserved *ffc_reserved = (ffcolor_reserved*) ffc_context->reserved;
+
+    if (ffc_reserved->valid && ffc_reserved->matrix == ffc_context->matrix &&
+            ffc_reserved->range == ffc_context->range) return &ffc_reserved->coefficients;
+
+    double kr = ffc_context->matrix == FFCOLOR_BT709 ? 0.2126 : 0.299;
+    double kb = ffc_context->matrix == FFCOLOR_BT709 ? 0.0722 : 0.114;
+    double kg = 1 - kr - kb;
+
+    bool full = ffc_context->range == FFCOLOR_FULL;
+    double y_scale = full ? 1 : 255.0 / 219;
+    double c_scale = full ? 1 : 255.0 / 224;
+
+    ffcolor_coefficients *c = &ffc_reserved->coefficients;
+    c->y_offset = full ? 0 : 16;
+    c->y = q13(y_scale);
+    c->v_r = q13(c_scale * 2 * (1 - kr));
+    c->u_g = q13(c_scale * 2 * (1 - kb) * kb / kg);
+    c->v_g = q13(c_scale * 2 * (1 - kr) * kr / kg);
+    c->u_b = q13(c_scale * 2 * (1 - kb));
+
+    ffc_reserved->matrix = ffc_context->matrix;
+    ffc_reserved->range = ffc_context->range;
+    ffc_reserved->valid = true;
+
+    return c;
+}
+
+static inline int mulhi(int a, int b)
+{
+    return (a * b) >> 16;
+}
+
+static inline uint8_t clip_uint8(int value)
+{
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+/**
+ * Convert one row. u and v point at the chroma samples of the row,
+ * chroma_step apart from one sample to the next: 1 for I420 planes
+ * and 2 for the interleaved NV12 plane.
+ */
+static void convert_row(const ffcolor_coefficients *c, const uint8_t *y,
+        const uint8_t *u, const uint8_t *v, int chroma_step,
+        uint8_t *dst, int width, bool bgra)
+{
+    int x = 0;
+
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi8(-1);
+    const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+    const __m256i round = _mm256_set1_epi16(8);
+    const __m256i chroma_offset = _mm256_set1_epi16(128);
+    const __m256i y_offset = _mm256_set1_epi16(c->y_offset);
+    const __m256i cy = _mm256_set1_epi16(c->y);
+    const __m256i cvr = _mm256_set1_epi16(c->v_r);
+    const __m256i cug = _mm256_set1_epi16(c->u_g);
+    const __m256i cvg = _mm256_set1_epi16(c->v_g);
+    const __m256i cub = _mm256_set1_epi16(c->u_b);
+
+    for (; x + 32 <= width; x += 32)
+    {
+        // the unpacks work within 128 bit lanes: lo holds pixels 0-7
+        // and 16-23, hi holds 8-15 and 24-31, and chroma lines up
+        __m256i yv = _mm256_loadu_si256((const __m256i*) &y[x]);
+        __m256i ylo = _mm256_unpacklo_epi8(yv, zero);
+        __m256i yhi = _mm256_unpackhi_epi8(yv, zero);
+        ylo = _mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(ylo, y_offset), 7), cy);
+        yhi = _mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(yhi, y_offset), 7), cy);
+
+        __m256i u16, v16;
+
+        if (chroma_step == 2)
+        {
+            __m256i uv = _mm256_loadu_si256((const __m256i*) &u[x]);
+            u16 = _mm256_and_si256(uv, low_bytes);
+            v16 = _mm256_srli_epi16(uv, 8);
+        }
+        else
+        {
+            u16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) &u[x / 2]));
+            v16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) &v[x / 2]));
+        }
+
+        u16 = _mm256_slli_epi16(_mm256_sub_epi16(u16, chroma_offset), 7);
+        v16 = _mm256_slli_epi16(_mm256_sub_epi16(v16, chroma_offset), 7);
+
+        __m256i r = _mm256_mulhi_epi16(v16, cvr);
+        __m256i g = _mm256_add_epi16(_mm256_mulhi_epi16(u16, cug), _mm256_mulhi_epi16(v16, cvg));
+        __m256i b = _mm256_mulhi_epi16(u16, cub);
+
+        ylo = _mm256_add_epi16(ylo, round);
+        yhi = _mm256_add_epi16(yhi, round);
+
+        __m256i rv = _mm256_packus_epi16(
+                _mm256_srai_epi16(_mm256_add_epi16(ylo, _mm256_unpacklo_epi16(r, r)), 4),
+                _mm256_srai_epi16(_mm256_add_epi16(yhi, _mm256_unpackhi_epi16(r, r)), 4));
+        __m256i gv = _mm256_packus_epi16(
+                _mm256_srai_epi16(_mm256_sub_epi16(ylo, _mm256_unpacklo_epi16(g, g)), 4),
+                _mm256_srai_epi16(_mm256_sub_epi16(yhi, _mm256_unpackhi_epi16(g, g)), 4));
+        __m256i bv = _mm256_packus_epi16(
+                _mm256_srai_epi16(_mm256_add_epi16(ylo, _mm256_unpacklo_epi16(b, b)), 4),
+                _mm256_srai_epi16(_mm256_add_epi16(yhi, _mm256_unpackhi_epi16(b, b)), 4));
+
+        __m256i first = bgra ? bv : rv;
+        __m256i third = bgra ? rv : bv;
+
+        __m256i fg_lo = _mm256_unpacklo_epi8(first, gv);
+        __m256i fg_hi = _mm256_unpackhi_epi8(first, gv);
+        __m256i ta_lo = _mm256_unpacklo_epi8(third, alpha);
+        __m256i ta_hi = _mm256_unpackhi_epi8(third, alpha);
+
+        __m256i p0 = _mm256_unpacklo_epi16(fg_lo, ta_lo);
+        __m256i p1 = _mm256_unpackhi_epi16(fg_lo, ta_lo);
+        __m256i p2 = _mm256_unpacklo_epi16(fg_hi, ta_hi);
+        __m256i p3 = _mm256_unpackhi_epi16(fg_hi, ta_hi);
+
+        __m256i *out = (__m256i*) &dst[4 * x];
+        _mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi8(-1);
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    const __m128i round = _mm_set1_epi16(8);
+    const __m128i chroma_offset = _mm_set1_epi16(128);
+    const __m128i y_offset = _mm_set1_epi16(c->y_offset);
+    const __m128i cy = _mm_set1_epi16(c->y);
+    const __m128i cvr = _mm_set1_epi16(c->v_r);
+    const __m128i cug = _mm_set1_epi16(c->u_g);
+    const __m128i cvg = _mm_set1_epi16(c->v_g);
+    const __m128i cub = _mm_set1_epi16(c->u_b);
+
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i yv = _mm_loadu_si128((const __m128i*) &y[x]);
+        __m128i ylo = _mm_unpacklo_epi8(yv, zero);
+        __m128i yhi = _mm_unpackhi_epi8(yv, zero);
+        ylo = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(ylo, y_offset), 7), cy);
+        yhi = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(yhi, y_offset), 7), cy);
+
+        __m128i u16, v16;
+
+        if (chroma_step == 2)
+        {
+            __m128i uv = _mm_loadu_si128((const __m128i*) &u[x]);
+            u16 = _mm_and_si128(uv, low_bytes);
+            v16 = _mm_srli_epi16(uv, 8);
+        }
+        else
+        {
+            u16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) &u[x / 2]), zero);
+            v16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) &v[x / 2]), zero);
+        }
+
+        u16 = _mm_slli_epi16(_mm_sub_epi16(u16, chroma_offset), 7);
+        v16 = _mm_slli_epi16(_mm_sub_epi16(v16, chroma_offset), 7);
+
+        // one product per chroma sample, then widened to both pixels
+        __m128i r = _mm_mulhi_epi16(v16, cvr);
+        __m128i g = _mm_add_epi16(_mm_mulhi_epi16(u16, cug), _mm_mulhi_epi16(v16, cvg));
+        __m128i b = _mm_mulhi_epi16(u16, cub);
+
+        ylo = _mm_add_epi16(ylo, round);
+        yhi = _mm_add_epi16(yhi, round);
+
+        __m128i rv = _mm_packus_epi16(
+                _mm_srai_epi16(_mm_add_epi16(ylo, _mm_unpacklo_epi16(r, r)), 4),
+                _mm_srai_epi16(_mm_add_epi16(yhi, _mm_unpackhi_epi16(r, r)), 4));
+        __m128i gv = _mm_packus_epi16(
+                _mm_srai_epi16(_mm_sub_epi16(ylo, _mm_unpacklo_epi16(g, g)), 4),
+                _mm_srai_epi16(_mm_sub_epi16(yhi, _mm_unpackhi_epi16(g, g)), 4));
+        __m128i bv = _mm_packus_epi16(
+                _mm_srai_epi16(_mm_add_epi16(ylo, _mm_unpacklo_epi16(b, b)), 4),
+                _mm_srai_epi16(_mm_add_epi16(yhi, _mm_unpackhi_epi16(b, b)), 4));
+
+        __m128i first = bgra ? bv : rv;
+        __m128i third = bgra ? rv : bv;
+
+        __m128i fg_lo = _mm_unpacklo_epi8(first, gv);
+        __m128i fg_hi = _mm_unpackhi_epi8(first, gv);
+        __m128i ta_lo = _mm_unpacklo_epi8(third, alpha);
+        __m128i ta_hi = _mm_unpackhi_epi8(third, alpha);
+
+        __m128i *out = (__m128i*) &dst[4 * x];
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(fg_lo, ta_lo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(fg_lo, ta_lo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(fg_hi, ta_hi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(fg_hi, ta_hi));
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    const int16x8_t chroma_offset = vdupq_n_s16(128);
+    const int16x8_t y_offset = vdupq_n_s16(c->y_offset);
+    const uint8x16_t alpha = vdupq_n_u8(255);
+
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16_t yv = vld1q_u8(&y[x]);
+        int16x8_t ylo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(yv)));
+        int16x8_t yhi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(yv)));
+
+        // vqdmulh doubles the product, so scale by 64 instead of 128
+        ylo = vqdmulhq_n_s16(vshlq_n_s16(vsubq_s16(ylo, y_offset), 6), c->y);
+        yhi = vqdmulhq_n_s16(vshlq_n_s16(vsubq_s16(yhi, y_offset), 6), c->y);
+
+        uint8x8_t u8, v8;
+
+        if (chroma_step == 2)
+        {
+            uint8x8x2_t uv = vld2_u8(&u[x]);
+            u8 = uv.val[0];
+            v8 = uv.val[1];
+        }
+        else
+        {
+            u8 = vld1_u8(&u[x / 2]);
+            v8 = vld1_u8(&v[x / 2]);
+        }
+
+        int16x8_t u16 = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), chroma_offset), 6);
+        int16x8_t v16 = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), chroma_offset), 6);
+
+        int16x8x2_t r = vzipq_s16(vqdmulhq_n_s16(v16, c->v_r), vqdmulhq_n_s16(v16, c->v_r));
+        int16x8_t gc = vaddq_s16(vqdmulhq_n_s16(u16, c->u_g), vqdmulhq_n_s16(v16, c->v_g));
+        int16x8x2_t g = vzipq_s16(gc, gc);
+        int16x8x2_t b = vzipq_s16(vqdmulhq_n_s16(u16, c->u_b), vqdmulhq_n_s16(u16, c->u_b));
+
+        uint8x16_t rv = vcombine_u8(vqrshrun_n_s16(vaddq_s16(ylo, r.val[0]), 4),
+                vqrshrun_n_s16(vaddq_s16(yhi, r.val[1]), 4));
+        uint8x16_t gv = vcombine_u8(vqrshrun_n_s16(vsubq_s16(ylo, g.val[0]), 4),
+                vqrshrun_n_s16(vsubq_s16(yhi, g.val[1]), 4));
+        uint8x16_t bv = vcombine_u8(vqrshrun_n_s16(vaddq_s16(ylo, b.val[0]), 4),
+                vqrshrun_n_s16(vaddq_s16(yhi, b.val[1]), 4));
+
+        uint8x16x4_t pixels;
+        pixels.val[0] = bgra ? bv : rv;
+        pixels.val[1] = gv;
+        pixels.val[2] = bgra ? rv : bv;
+        pixels.val[3] = alpha;
+        vst4q_u8(&dst[4 * x], pixels);
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        int yy = mulhi((y[x] - c->y_offset) * 128, c->y) + 8;
+        int uu = (u[(x / 2) * chroma_step] - 128) * 128;
+        int vv = (v[(x / 2) * chroma_step] - 128) * 128;
+
+        uint8_t r = clip_uint8((yy + mulhi(vv, c->v_r)) >> 4);
+        uint8_t g = clip_uint8((yy - (mulhi(uu, c->u_g) + mulhi(vv, c->v_g))) >> 4);
+        uint8_t b = clip_uint8((yy + mulhi(uu, c->u_b)) >> 4);
+
+        uint8_t *out = &dst[4 * x];
+        out[0] = bgra ? b : r;
+        out[1] = g;
+        out[2] = bgra ? r : b;
+        out[3] = 255;
+    }
+}
+
+ffcolor_error ffcolor_convert_i420(ffcolor_context *ffc_context,
+        const uint8_t *y, int y_stride,
+        const uint8_t *u, int u_stride,
+        const uint8_t *v, int v_stride,
+        uint8_t *dst, int dst_stride, int width, int height)
+{
+    ffcolor_reserved *ffc_reserved = (ffcolor_reserved*) ffc_context->reserved;
+    if (!ffc_reserved) return FFCOLOR_NOT_INITIALIZED;
+    if (width <= 0 || height <= 0) return FFCOLOR_INVALID_SIZE;
+
+    const ffcolor_coefficients *c = get_coefficients(ffc_context);
+    bool bgra = ffc_context->format == FFCOLOR_BGRA;
+
+    for (int i = 0; i < height; i++)
+    {
+        convert_row(c, &y[i * y_stride], &u[(i / 2) * u_stride], &v[(i / 2) * v_stride], 1,
+                &dst[i * dst_stride], width, bgra);
+    }
+
+    return FFCOLOR_OK;
+}
+
+ffcolor_error ffcolor_convert_nv12(ffcolor_context *ffc_context,
+        const uint8_t *y, int y_stride,
+        const uint8_t *uv, int uv_stride,
+        uint8_t *dst, int dst_stride, int width, int height)
+{
+    ffcolor_reserved *ffc_reserved = (ffcolor_reserved*) ffc_context->reserved;
+    if (!ffc_reserved) return FFCOLOR_NOT_INITIALIZED;
+    if (width <= 0 || height <= 0) return FFCOLOR_INVALID_SIZE;
+
+    const ffcolor_coefficients *c = get_coefficients(ffc_context);
+    bool bgra = ffc_context->format == FFCOLOR_BGRA;
+
+    for (int i = 0; i < height; i++)
+    {
+        const uint8_t *row = &uv[(i / 2) * uv_stride];
+        convert_row(c, &y[i * y_stride], row, row + 1, 2, &dst[i * dst_stride], width, bgra);
+    }
+
+    return FFCOLOR_OK;
+}
+
+ffcolor_error ffcolor_convert_frame(ffcolor_context *ffc_context, const AVFrame *frame,
+        uint8_t *dst, int dst_stride)
+{
+    switch (frame->format)
+    {
+        case PIX_FMT_YUV420P:
+        case PIX_FMT_YUVJ420P:
+            return ffcolor_convert_i420(ffc_context,
+                    frame->data[0], frame->linesize[0],
+                    frame->data[1], frame->linesize[1],
+                    frame->data[2], frame->linesize[2],
+                    dst, dst_stride, frame->width, frame->height);
+        case PIX_FMT_NV12:
+            return ffcolor_convert_nv12(ffc_context,
+                    frame->data[0], frame->linesize[0],
+                    frame->data[1], frame->linesize[1],
+                    dst, dst_stride, frame->width, frame->height);
+        default:
+            return FFCOLOR_UNSUPPORTED_FORMAT;
+    }
+}
+
+ffcolor_error ffcolor_benchmark(ffcolor_context *ffc_context, int width, int height,
+        int iterations, ffcolor_benchmark_result *result)
+{
+    ffcolor_reserved *ffc_reserved = (ffcolor_reserved*) ffc_context->reserved;
+    if (!ffc_reserved) return FFCOLOR_NOT_INITIALIZED;
+    if (width <= 0 || height <= 0 || iterations <= 0) return FFCOLOR_INVALID_SIZE;
+
+    memset(result, 0, sizeof(ffcolor_benchmark_result));
+
+    enum PixelFormat dst_format = ffc_context->format == FFCOLOR_BGRA ? PIX_FMT_BGRA : PIX_FMT_RGBA;
+
+    struct SwsContext *sws_context = sws_getContext(width, height, PIX_FMT_YUV420P,
+            width, height, dst_format, SWS_POINT, NULL, NULL, NULL);
+    if (!sws_context) return FFCOLOR_SWSCALE_FAILED;
+
+    const int *table = sws_getCoefficients(ffc_context->matrix == FFCOLOR_BT709 ? SWS_CS_ITU709 : SWS_CS_ITU601);
+    sws_setColorspaceDetails(sws_context, table, ffc_context->range == FFCOLOR_FULL, table, 1, 0, 1 << 16, 1 << 16);
+
+    AVPicture src;
+    AVPicture ours;
+    AVPicture theirs;
+    avpicture_alloc(&src, PIX_FMT_YUV420P, width, height);
+    avpicture_alloc(&ours, dst_format, width, height);
+    avpicture_alloc(&theirs, dst_format, width, height);
+
+    // gradients over the whole range, with saturated corners
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            src.data[0][i * src.linesize[0] + j] = (i + j) * 255 / (width + height);
+        }
+    }
+
+    for (int i = 0; i < (height + 1) / 2; i++)
+    {
+        for (int j = 0; j < (width + 1) / 2; j++)
+        {
+            src.data[1][i * src.linesize[1] + j] = j * 255 / ((width + 1) / 2);
+            src.data[2][i * src.linesize[2] + j] = i * 255 / ((height + 1) / 2);
+        }
+    }
+
+    int64_t start = av_gettime();
+
+    for (int n = 0; n < iterations; n++)
+    {
+        ffcolor_convert_i420(ffc_context,
+                src.data[0], src.linesize[0],
+                src.data[1], src.linesize[1],
+                src.data[2], src.linesize[2],
+                ours.data[0], ours.linesize[0], width, height);
+    }
+
+    result->ffcolor_time = (double) (av_gettime() - start) / iterations;
+
+    start = av_gettime();
+
+    for (int n = 0; n < iterations; n++)
+    {
+        sws_scale(sws_context, src.data, src.linesize, 0, height, theirs.data, theirs.linesize);
+    }
+
+    result->swscale_time = (double) (av_gettime() - start) / iterations;
+    result->iterations = iterations;
+
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width * 4; j++)
+        {
+            int difference = abs(ours.data[0][i * ours.linesize[0] + j] - theirs.data[0][i * theirs.linesize[0] + j]);
+            result->max_difference = FFMAX(result->max_difference, difference);
+        }
+    }
+
+    avpicture_free(&src);
+    avpicture_free(&ours);
+    avpicture_free(&theirs);
+
+    sws_freeContext(sws_context);
+    sws_context = NULL;
+
+    return FFCOLOR_OK;
+}
@@ -0,0 +1,149 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBCOLOR_H
+#define FFBBCOLOR_H
+
+// include math.h otherwise it will get included
+// by avformat.h and cause duplicate definition
+// errors because of C vs C++ functions
+#include <math.h>
+
+extern "C"
+{
+#define UINT64_C uint64_t
+#define INT64_C int64_t
+#include <libavformat/avformat.h>
+}
+
+#include <sys/types.h>
+
+typedef enum
+{
+    FFCOLOR_OK = 0,
+    FFCOLOR_NOT_INITIALIZED,
+    FFCOLOR_UNSUPPORTED_FORMAT,
+    FFCOLOR_INVALID_SIZE,
+    FFCOLOR_SWSCALE_FAILED
+} ffcolor_error;
+
+typedef enum
+{
+    FFCOLOR_BT601 = 0,
+    FFCOLOR_BT709
+} ffcolor_matrix;
+
+typedef enum
+{
+    /**
+     * Y in 16-235 and chroma in 16-240, as most video is.
+     */
+    FFCOLOR_LIMITED = 0,
+    FFCOLOR_FULL
+} ffcolor_range;
+
+typedef enum
+{
+    FFCOLOR_RGBA = 0,
+    FFCOLOR_BGRA
+} ffcolor_format;
+
+typedef struct
+{
+    int64_t iterations;
+
+    /**
+     * Microseconds per frame.
+     */
+    double ffcolor_time;
+    double swscale_time;
+
+    /**
+     * The largest difference of any channel between the two outputs.
+     */
+    int max_difference;
+} ffcolor_benchmark_result;
+
+typedef struct
+{
+    ffcolor_matrix matrix;
+    ffcolor_range range;
+    ffcolor_format format;
+
+    /**
+     * For internal use. Do not use.
+     */
+    void *reserved;
+} ffcolor_context;
+
+/**
+ * Allocate the context with default values.
+ */
+ffcolor_context *ffcolor_alloc(void);
+
+/**
+ * Reset the context with default values.
+ */
+void ffcolor_reset(ffcolor_context *ffc_context);
+
+/**
+ * Free the context.
+ */
+ffcolor_error ffcolor_free(ffcolor_context *ffc_context);
+
+/**
+ * Pick the matrix and range the codec context describes. BT.709 is used
+ * for AVCOL_SPC_BT709 and BT.601 for everything else, and full range for
+ * AVCOL_RANGE_JPEG or the YUVJ pixel formats.
+ */
+ffcolor_error ffcolor_set_colorspace(ffcolor_context *ffc_context, const AVCodecContext *codec_context);
+
+/**
+ * The instruction set used by the converters: "avx2", "sse2", "neon" or "c".
+ * This is fixed when libffbb is compiled.
+ */
+const char *ffcolor_implementation(void);
+
+/**
+ * Convert planar YUV 4:2:0 to 32 bit pixels in the context format.
+ */
+ffcolor_error ffcolor_convert_i420(ffcolor_context *ffc_context,
+        const uint8_t *y, int y_stride,
+        const uint8_t *u, int u_stride,
+        const uint8_t *v, int v_stride,
+        uint8_t *dst, int dst_stride, int width, int height);
+
+/**
+ * Convert YUV 4:2:0 with interleaved chroma, as the camera delivers it.
+ */
+ffcolor_error ffcolor_convert_nv12(ffcolor_context *ffc_context,
+        const uint8_t *y, int y_stride,
+        const uint8_t *uv, int uv_stride,
+        uint8_t *dst, int dst_stride, int width, int height);
+
+/**
+ * Convert a decoded YUV420P, YUVJ420P or NV12 frame.
+ */
+ffcolor_error ffcolor_convert_frame(ffcolor_context *ffc_context, const AVFrame *frame,
+        uint8_t *dst, int dst_stride);
+
+/**
+ * Time ffcolor_convert_i420 against sws_scale doing the same conversion
+ * on a synthetic width x height frame, and compare their output.
+ */
+ffcolor_error ffcolor_benchmark(ffcolor_context *ffc_context, int width, int height,
+        int iterations, ffcolor_benchmark_result *result);
+
+#endif
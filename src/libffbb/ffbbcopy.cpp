@@ -0,0 +1,201 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbcopy.h"
+
+// include math.h otherwise it will get included
+// by avformat.h and cause duplicate definition
+// errors because of C vs C++ functions
+#include <math.h>
+
+extern "C"
+{
+#define UINT64_C uint64_t
+#define INT64_C int64_t
+#include <libavformat/avformat.h>
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// rows of the source to prefetch ahead of the one being copied
+#define PREFETCH_ROWS 2
+
+#define CACHE_LINE 64
+
+#define BENCHMARK_WORKING_SET (64 * 1024 * 1024)
+
+// planes of at least this many bytes are streamed, 0 for none
+static volatile int stream_threshold = 0;
+
+static void copy_rows(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        memcpy(&dst[i * dst_stride], &src[i * src_stride], width);
+    }
+}
+
+static void stream_rows(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        uint8_t *d = &dst[i * dst_stride];
+        const uint8_t *s = &src[i * src_stride];
+        const uint8_t *ahead = i + PREFETCH_ROWS < height ? s + PREFETCH_ROWS * src_stride : NULL;
+        int n = width;
+
+#if defined(__SSE2__)
+        // stream whole cache lines only, partial lines are
+        // flushed from the write combining buffers one at a time
+        int head = FFMIN(n, (int) ((CACHE_LINE - ((uintptr_t) d & (CACHE_LINE - 1))) & (CACHE_LINE - 1)));
+        memcpy(d, s, head);
+        d += head;
+        s += head;
+        n -= head;
+
+        int offset = head;
+
+        for (; n >= CACHE_LINE; n -= CACHE_LINE, d += CACHE_LINE, s += CACHE_LINE, offset += CACHE_LINE)
+        {
+            if (ahead) _mm_prefetch((const char*) &ahead[offset], _MM_HINT_NTA);
+
+            __m128i a = _mm_loadu_si128((const __m128i*) &s[0]);
+            __m128i b = _mm_loadu_si128((const __m128i*) &s[16]);
+            __m128i c = _mm_loadu_si128((const __m128i*) &s[32]);
+            __m128i e = _mm_loadu_si128((const __m128i*) &s[48]);
+            _mm_stream_si128((__m128i*) &d[0], a);
+            _mm_stream_si128((__m128i*) &d[16], b);
+            _mm_stream_si128((__m128i*) &d[32], c);
+            _mm_stream_si128((__m128i*) &d[48], e);
+        }
+
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+        // ARMv7 has no non-temporal store, but wide copies with
+        // the source prefetched still beat memcpy on strided rows
+        int offset = 0;
+
+        for (; n >= CACHE_LINE; n -= CACHE_LINE, d += CACHE_LINE, s += CACHE_LINE, offset += CACHE_LINE)
+        {
+            if (ahead) __builtin_prefetch(&ahead[offset], 0, 0);
+
+            uint8x16_t a = vld1q_u8(&s[0]);
+            uint8x16_t b = vld1q_u8(&s[16]);
+            uint8x16_t c = vld1q_u8(&s[32]);
+            uint8x16_t e = vld1q_u8(&s[48]);
+            vst1q_u8(&d[0], a);
+            vst1q_u8(&d[16], b);
+            vst1q_u8(&d[32], c);
+            vst1q_u8(&d[48], e);
+        }
+#else
+        if (ahead) __builtin_prefetch(ahead, 0, 0);
+#endif
+
+        memcpy(d, s, n);
+    }
+
+#if defined(__SSE2__)
+    // make the streamed rows visible before another thread reads them
+    _mm_sfence();
+#endif
+}
+
+void ffcopy_plane(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride, int width, int height)
+{
+    if (width <= 0 || height <= 0) return;
+
+    int threshold = stream_threshold;
+
+    if (!threshold || (int64_t) width * height < threshold)
+    {
+        copy_rows(dst, dst_stride, src, src_stride, width, height);
+        return;
+    }
+
+    stream_rows(dst, dst_stride, src, src_stride, width, height);
+}
+
+void ffcopy_set_stream_threshold(int bytes)
+{
+    stream_threshold = FFMAX(bytes, 0);
+}
+
+const char *ffcopy_implementation()
+{
+#if defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    return "neon";
+#else
+    return "c";
+#endif
+}
+
+void ffcopy_benchmark(int width, int height, int iterations, ffcopy_benchmark_result *result)
+{
+    memset(result, 0, sizeof(ffcopy_benchmark_result));
+    if (width <= 0 || height <= 0 || iterations <= 0) return;
+
+    // strides that do not match the width, like a decoder and a pixmap
+    int src_stride = FFALIGN(width, 32) + 32;
+    int dst_stride = FFALIGN(width, 64) + 64;
+
+    // rotate through enough planes that they do not all stay cached
+    int plane_count = av_clip(BENCHMARK_WORKING_SET / (dst_stride * height), 2, 64);
+
+    uint8_t **src = (uint8_t**) av_malloc(plane_count * sizeof(uint8_t*));
+    uint8_t **dst = (uint8_t**) av_malloc(plane_count * sizeof(uint8_t*));
+
+    for (int i = 0; i < plane_count; i++)
+    {
+        src[i] = (uint8_t*) av_malloc(src_stride * height);
+        dst[i] = (uint8_t*) av_malloc(dst_stride * height);
+        memset(src[i], 0x80, src_stride * height);
+        memset(dst[i], 0, dst_stride * height);
+    }
+
+    int64_t bytes = (int64_t) width * height * iterations;
+
+    int64_t start = av_gettime();
+    for (int n = 0; n < iterations; n++)
+    {
+        copy_rows(dst[n % plane_count], dst_stride, src[n % plane_count], src_stride, width, height);
+    }
+    int64_t memcpy_time = FFMAX(1, av_gettime() - start);
+
+    start = av_gettime();
+    for (int n = 0; n < iterations; n++)
+    {
+        stream_rows(dst[n % plane_count], dst_stride, src[n % plane_count], src_stride, width, height);
+    }
+    int64_t ffcopy_time = FFMAX(1, av_gettime() - start);
+
+    result->bytes = bytes;
+    result->memcpy_bandwidth = (double) bytes / memcpy_time;
+    result->ffcopy_bandwidth = (double) bytes / ffcopy_time;
+
+    for (int i = 0; i < plane_count; i++)
+    {
+        av_free(src[i]);
+        av_free(dst[i]);
+    }
+
+    av_free(src);
+    av_free(dst);
+}
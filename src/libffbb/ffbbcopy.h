@@ -0,0 +1,70 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBCOPY_H
+#define FFBBCOPY_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/**
+ * A threshold for ffcopy_set_stream_threshold. Smaller planes are likely
+ * to still be in cache when they are read back, so they are not worth
+ * streaming.
+ */
+#define FFCOPY_STREAM_THRESHOLD (256 * 1024)
+
+typedef struct
+{
+    int64_t bytes;
+
+    /**
+     * Megabytes copied per second.
+     */
+    double memcpy_bandwidth;
+    double ffcopy_bandwidth;
+} ffcopy_benchmark_result;
+
+/**
+ * Copy width bytes of each of height rows between planes of any stride,
+ * with a memcpy per row unless ffcopy_set_stream_threshold was called.
+ * Use this for destinations the CPU does not read back, such as pixmaps
+ * and frames queued for another thread.
+ */
+void ffcopy_plane(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * Copy planes of at least bytes bytes with SSE2 non-temporal stores that
+ * bypass the cache, prefetching the source a few rows ahead. ARMv7 has no
+ * non-temporal store, so NEON builds only copy 64 bytes at a time with the
+ * prefetch. 0, the default, turns this off: on the x86 host it ran at less
+ * than half the bandwidth of memcpy, so only turn it on where
+ * ffcopy_benchmark shows it is faster. May be called from any thread.
+ */
+void ffcopy_set_stream_threshold(int bytes);
+
+/**
+ * The instruction set used by ffcopy_plane: "sse2", "neon" or "c".
+ */
+const char *ffcopy_implementation(void);
+
+/**
+ * Time the streaming copy against a memcpy per row on width x height
+ * planes with padded strides, as display_frame used to copy them,
+ * whatever the stream threshold.
+ */
+void ffcopy_benchmark(int width, int height, int iterations, ffcopy_benchmark_result *result);
+
+#endif
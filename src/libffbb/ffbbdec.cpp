@@ -14,36 +14,107 @@
  */
 
 #include "ffbbdec.h"
+#include "ffbbpool.h"
+#include "ffbbscan.h"
+#include "ffbbsched.h"
+#include "ffbbtrace.h"
+
+#if defined(__QNX__)
+#include "ffbbscreen.h"
+#endif
 
 #include <pthread.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <time.h>
+
+#define OFFLINE_READ_BUFFER_SIZE (64 * 1024)
+#define SEQUENCE_HEADER_CODE 0xB3
+#define SEQUENCE_END_CODE 0xB7
 
 typedef struct
 {
-    screen_context_t screen_context;
-    screen_window_t screen_window;
-    screen_buffer_t screen_buffer[1];
-    screen_buffer_t screen_pixel_buffer;
-    int stride;
-} ffdec_view;
+    int64_t frames_in;
+    int64_t frames_out;
+    int64_t frames_dropped;
+    int queue_depth;
+    int queue_peak;
+    int64_t bytes_in;
+    int64_t stalls;
+    ffstats_histogram decode_time;
+    int64_t total_decode_time;
+    int64_t cpu_time;
+    ffstats_rate rate;
+} ffdec_thread_stats;
 
 typedef struct
 {
     bool running;
+    ffpool_task *task;
     bool open;
-    ffdec_view *view;
+    ffsink_context *ffk_context;
+    bool owns_sink;
     void (*frame_callback)(ffdec_context *ffd_context, AVFrame *frame, void *arg);
     void *frame_callback_arg;
     int (*read_callback)(ffdec_context *ffd_context, uint8_t *buf, ssize_t size, void *arg);
     void *read_callback_arg;
     void (*close_callback)(ffdec_context *ffd_context, void *arg);
     void *close_callback_arg;
+    void (*seek_callback)(ffdec_context *ffd_context, int64_t offset, void *arg);
+    void *seek_callback_arg;
+    int (*pread_callback)(ffdec_context *ffd_context, int64_t offset, uint8_t *buf, ssize_t size, void *arg);
+    void *pread_callback_arg;
+    ffindex_context *ffi_context;
+    int64_t seek_offset;
+    int seek_skip_frames;
+    // written by the decoding thread only
+    volatile uint32_t stats_sequence;
+    ffdec_thread_stats stats;
 } ffdec_reserved;
 
+typedef struct
+{
+    AVFrame **frames;
+    int frame_count;
+    bool done;
+} ffdec_offline_slot;
+
+typedef struct
+{
+    ffdec_context *ffd_context;
+    ffindex_context *ffi_context;
+    uint8_t *sequence_header;
+    int sequence_header_size;
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;
+    pthread_cond_t space_cond;
+    // reorder buffer, GOP n decodes into slots[n % window]
+    ffdec_offline_slot *slots;
+    int window;
+    int64_t gop_count;
+    int64_t next_gop;
+    int64_t next_delivery;
+} ffdec_offline;
+
+typedef struct
+{
+    ffdec_offline *offline;
+    AVCodecContext *codec_context;
+    ffpool_task *task;
+} ffdec_offline_worker;
+
 void* decoding_thread(void* arg);
+void* offline_decoding_thread(void* arg);
 void display_frame(ffdec_context *ffd_context, AVFrame *frame);
 
+static int64_t thread_cpu_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 ffdec_context *ffdec_alloc()
 {
     ffdec_context *ffd_context = (ffdec_context*) malloc(sizeof(ffdec_context));
@@ -58,11 +129,15 @@ void ffdec_reset(ffdec_context *ffd_context)
 {
     ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
 
+    // the task of the last run must not outlive its context
+    if (ffd_reserved && ffd_reserved->task) ffpool_join(ffd_reserved->task, NULL);
+
     // don't carry over the view, it needs to be recreated
-    if (ffd_reserved && ffd_reserved->view) free(ffd_reserved->view);
+    if (ffd_reserved && ffd_reserved->owns_sink) ffsink_free(ffd_reserved->ffk_context);
 
     if (!ffd_reserved) ffd_reserved = (ffdec_reserved*) malloc(sizeof(ffdec_reserved));
     memset(ffd_reserved, 0, sizeof(ffdec_reserved));
+    ffd_reserved->seek_offset = -1;
 
     memset(ffd_context, 0, sizeof(ffdec_context));
     ffd_context->reserved = ffd_reserved;
@@ -101,6 +176,89 @@ ffdec_error ffdec_set_close_callback(ffdec_context *ffd_context,
     return FFDEC_OK;
 }
 
+ffdec_error ffdec_set_seek_callback(ffdec_context *ffd_context,
+        void (*seek_callback)(ffdec_context *ffd_context, int64_t offset, void *arg),
+        void *arg)
+{
+    ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
+    if (!ffd_reserved) return FFDEC_NOT_INITIALIZED;
+    ffd_reserved->seek_callback = seek_callback;
+    ffd_reserved->seek_callback_arg = arg;
+    return FFDEC_OK;
+}
+
+ffdec_error ffdec_set_pread_callback(ffdec_context *ffd_context,
+        int (*pread_callback)(ffdec_context *ffd_context, int64_t offset, uint8_t *buf, ssize_t size, void *arg),
+        void *arg)
+{
+    ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
+    if (!ffd_reserved) return FFDEC_NOT_INITIALIZED;
+    ffd_reserved->pread_callback = pread_callback;
+    ffd_reserved->pread_callback_arg = arg;
+    return FFDEC_OK;
+}
+
+ffdec_error ffdec_set_index(ffdec_context *ffd_context, ffindex_context *ffi_context)
+{
+    ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
+    if (!ffd_reserved) return FFDEC_NOT_INITIALIZED;
+    ffd_reserved->ffi_context = ffi_context;
+    return FFDEC_OK;
+}
+
+ffdec_error ffdec_set_preview(ffdec_context *ffd_context, int lowres,
+        enum AVDiscard skip_loop_filter, enum AVDiscard skip_idct)
+{
+    ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
+    if (!ffd_reserved) return FFDEC_NOT_INITIALIZED;
+
+    AVCodecContext *codec_context = ffd_context->codec_context;
+    if (!codec_context) return FFDEC_NO_CODEC_SPECIFIED;
+
+    if (lowres != codec_context->lowres)
+    {
+        if (avcodec_is_open(codec_context)) return FFDEC_CODEC_ALREADY_OPEN;
+
+        // codec_context->codec is only set by avcodec_open2
+        const AVCodec *codec = avcodec_find_decoder(codec_context->codec_id);
+        int max_lowres = codec ? codec->max_lowres : 0;
+        if (lowres < 0 || lowres > max_lowres) return FFDEC_INVALID_LOWRES;
+
+        codec_context->lowres = lowres;
+    }
+
+    codec_context->skip_loop_filter = skip_loop_filter;
+    codec_context->skip_idct = skip_idct;
+
+    return FFDEC_OK;
+}
+
+ffdec_error ffdec_get_stats(ffdec_context *ffd_context, ffdec_stats *stats)
+{
+    ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
+    if (!ffd_reserved) return FFDEC_NOT_INITIALIZED;
+
+    ffdec_thread_stats thread_stats;
+    ffstats_read(&ffd_reserved->stats_sequence, &ffd_reserved->stats,
+            &thread_stats, sizeof(ffdec_thread_stats));
+
+    memset(stats, 0, sizeof(ffdec_stats));
+    stats->frames_in = thread_stats.frames_in;
+    stats->frames_out = thread_stats.frames_out;
+    stats->frames_dropped = thread_stats.frames_dropped;
+    stats->queue_depth = thread_stats.queue_depth;
+    stats->queue_peak = thread_stats.queue_peak;
+    ffstats_histogram_times(&thread_stats.decode_time, &stats->decode_time);
+    stats->total_decode_time = thread_stats.total_decode_time;
+    stats->cpu_time = thread_stats.cpu_time;
+    if (ffd_context->codec_context) stats->lowres = ffd_context->codec_context->lowres;
+    stats->bytes_in = thread_stats.bytes_in;
+    stats->bitrate = thread_stats.rate.bitrate;
+    stats->stalls = thread_stats.stalls;
+
+    return FFDEC_OK;
+}
+
 ffdec_error ffdec_close(ffdec_context *ffd_context)
 {
     AVCodecContext *codec_context = ffd_context->codec_context;
@@ -125,8 +283,10 @@ ffdec_error ffdec_free(ffdec_context *ffd_context)
     {
         ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
 
-        if (ffd_reserved->view) free(ffd_reserved->view);
-        ffd_reserved->view = NULL;
+        if (ffd_reserved->task) ffpool_join(ffd_reserved->task, NULL);
+
+        if (ffd_reserved->owns_sink) ffsink_free(ffd_reserved->ffk_context);
+        ffd_reserved->ffk_context = NULL;
 
         free(ffd_context->reserved);
         ffd_context->reserved = NULL;
@@ -144,10 +304,18 @@ ffdec_error ffdec_start(ffdec_context *ffd_context)
     if (ffd_reserved->running) return FFDEC_ALREADY_RUNNING;
     if (!ffd_context->codec_context) return FFDEC_NO_CODEC_SPECIFIED;
 
+    // the last decoding task has returned once it closed, but
+    // it is joined here before the context is used again
+    if (ffd_reserved->task) ffpool_join(ffd_reserved->task, NULL);
+    ffd_reserved->task = NULL;
+
     ffd_reserved->running = true;
 
-    pthread_t pthread;
-    pthread_create(&pthread, 0, &decoding_thread, ffd_context);
+    if (ffpool_submit(&decoding_thread, ffd_context, &ffd_reserved->task) != FFPOOL_OK)
+    {
+        ffd_reserved->running = false;
+        return FFDEC_THREAD_FAILED;
+    }
 
     return FFDEC_OK;
 }
@@ -163,6 +331,32 @@ ffdec_error ffdec_stop(ffdec_context *ffd_context)
     return FFDEC_OK;
 }
 
+ffdec_error ffdec_seek(ffdec_context *ffd_context, int64_t pts)
+{
+    ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
+    if (!ffd_reserved) return FFDEC_NOT_INITIALIZED;
+    if (!ffd_reserved->ffi_context) return FFDEC_NO_INDEX;
+    if (!ffd_reserved->seek_callback) return FFDEC_NO_SEEK_CALLBACK;
+
+    ffindex_context *ffi_context = ffd_reserved->ffi_context;
+
+    int64_t position = ffindex_find(ffi_context, pts);
+    if (position < 0) return FFDEC_SEEK_OUT_OF_RANGE;
+
+    int64_t gop = ffindex_find_gop(ffi_context, position);
+    if (gop < 0) return FFDEC_SEEK_OUT_OF_RANGE;
+
+    ffindex_entry entry;
+    ffindex_get(ffi_context, gop, &entry);
+
+    // publish the skip count before the offset the decoding thread polls
+    ffd_reserved->seek_skip_frames = position - gop;
+    __sync_synchronize();
+    ffd_reserved->seek_offset = entry.offset;
+
+    return FFDEC_OK;
+}
+
 void* decoding_thread(void* arg)
 {
     ffdec_context *ffd_context = (ffdec_context*) arg;
@@ -178,13 +372,37 @@ void* decoding_thread(void* arg)
 
     AVFrame *frame = avcodec_alloc_frame();
 
+    int skip_frames = 0;
+
+    FFTRACE_THREAD_NAME("ffdec");
+    ffsched_apply(FFSCHED_DECODE);
+
     while (ffd_reserved->running)
     {
+        int64_t seek_offset = __sync_lock_test_and_set(&ffd_reserved->seek_offset, -1);
+
+        if (seek_offset >= 0)
+        {
+            ffd_reserved->seek_callback(ffd_context, seek_offset, ffd_reserved->seek_callback_arg);
+            avcodec_flush_buffers(codec_context);
+            skip_frames = ffd_reserved->seek_skip_frames;
+        }
+
+        FFTRACE_BEGIN("read", ffd_reserved->stats.bytes_in);
+
         if (ffd_reserved->read_callback) packet.size = ffd_reserved->read_callback(ffd_context,
                 decode_buffer, decode_buffer_length, ffd_reserved->read_callback_arg);
 
+        FFTRACE_END("read", ffd_reserved->stats.bytes_in);
+
         if (packet.size <= 0) break;
 
+        ffstats_write_begin(&ffd_reserved->stats_sequence);
+        ffd_reserved->stats.bytes_in += packet.size;
+        if (packet.size < decode_buffer_length) ffd_reserved->stats.stalls++;
+        ffstats_rate_add(&ffd_reserved->stats.rate, packet.size, av_gettime());
+        ffstats_write_end(&ffd_reserved->stats_sequence);
+
         packet.data = decode_buffer;
 
         while (ffd_reserved->running && packet.size > 0)
@@ -193,7 +411,24 @@ void* decoding_thread(void* arg)
             av_init_packet(&packet);
 
             got_frame = 0;
+
+            int64_t decode_start = av_gettime();
+            int64_t cpu_start = thread_cpu_time();
+
+            FFTRACE_BEGIN("avcodec_decode_video2", ffd_reserved->stats.frames_in);
             int decode_result = avcodec_decode_video2(codec_context, frame, &got_frame, &packet);
+            FFTRACE_END("avcodec_decode_video2", ffd_reserved->stats.frames_in);
+
+            int64_t decode_time = av_gettime() - decode_start;
+            int64_t cpu_time = thread_cpu_time() - cpu_start;
+
+            ffstats_write_begin(&ffd_reserved->stats_sequence);
+            ffstats_histogram_add(&ffd_reserved->stats.decode_time, decode_time);
+            ffd_reserved->stats.total_decode_time += decode_time;
+            ffd_reserved->stats.cpu_time += cpu_time;
+            if (got_frame) ffd_reserved->stats.frames_in++;
+            if (got_frame && skip_frames > 0) ffd_reserved->stats.frames_dropped++;
+            ffstats_write_end(&ffd_reserved->stats_sequence);
 
             if (decode_result < 0)
             {
@@ -202,7 +437,11 @@ void* decoding_thread(void* arg)
                 break;
             }
 
-            if (got_frame)
+            if (got_frame && skip_frames > 0)
+            {
+                skip_frames--;
+            }
+            else if (got_frame)
             {
                 if (ffd_reserved->frame_callback) ffd_reserved->frame_callback(
                         ffd_context, frame, ffd_reserved->frame_callback_arg);
@@ -227,6 +466,10 @@ void* decoding_thread(void* arg)
 
         if (got_frame)
         {
+            ffstats_write_begin(&ffd_reserved->stats_sequence);
+            ffd_reserved->stats.frames_in++;
+            ffstats_write_end(&ffd_reserved->stats_sequence);
+
             if (ffd_reserved->frame_callback) ffd_reserved->frame_callback(
                     ffd_context, frame, ffd_reserved->frame_callback_arg);
 
@@ -243,130 +486,450 @@ void* decoding_thread(void* arg)
     return 0;
 }
 
-ffdec_error ffdec_create_view(ffdec_context *ffd_context, QString group, QString id, screen_window_t *window)
+static int offline_read(ffdec_context *ffd_context, int64_t offset, uint8_t *buf, ssize_t size)
 {
     ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
-    if (!ffd_reserved) return FFDEC_NOT_INITIALIZED;
 
-    if (ffd_reserved->view)
+    ssize_t total = 0;
+    while (total < size)
     {
-        *window = ffd_reserved->view->screen_window;
-        return FFDEC_OK;
+        int read = ffd_reserved->pread_callback(ffd_context, offset + total,
+                buf + total, size - total, ffd_reserved->pread_callback_arg);
+        if (read <= 0) break;
+        total += read;
+    }
+    return total;
+}
+
+static void offline_free_slot(ffdec_offline_slot *slot)
+{
+    for (int i = 0; i < slot->frame_count; i++)
+    {
+        avpicture_free((AVPicture*) slot->frames[i]);
+        av_free(slot->frames[i]);
+    }
+    free(slot->frames);
+    slot->frames = NULL;
+    slot->frame_count = 0;
+    slot->done = false;
+}
+
+static void offline_keep_frame(ffdec_offline_slot *slot, int capacity, AVCodecContext *codec_context, AVFrame *frame)
+{
+    if (slot->frame_count >= capacity) return;
+
+    int width = codec_context->width;
+    int height = codec_context->height;
+    enum PixelFormat pix_fmt = codec_context->pix_fmt;
+
+    AVFrame *copy = avcodec_alloc_frame();
+    if (avpicture_alloc((AVPicture*) copy, pix_fmt, width, height) < 0)
+    {
+        av_free(copy);
+        return;
+    }
+
+    av_picture_copy((AVPicture*) copy, (const AVPicture*) frame, pix_fmt, width, height);
+    copy->width = width;
+    copy->height = height;
+    copy->format = pix_fmt;
+    copy->pict_type = frame->pict_type;
+    copy->key_frame = frame->key_frame;
+    copy->pts = frame->pts;
+
+    slot->frames[slot->frame_count++] = copy;
+}
+
+/**
+ * Decode GOP n on its own into the slot. The decoder is flushed first
+ * and the GOP is terminated with a sequence end code so its last
+ * picture comes out without waiting on the next GOP.
+ */
+static void offline_decode_gop(ffdec_offline *offline, AVCodecContext *codec_context,
+        AVFrame *frame, int64_t n, ffdec_offline_slot *slot)
+{
+    ffindex_gop gop;
+    if (ffindex_get_gop(offline->ffi_context, n, &gop) != FFINDEX_OK) return;
+
+    slot->frames = (AVFrame**) malloc(gop.entry_count * sizeof(AVFrame*));
+    slot->frame_count = 0;
+
+    int prefix = offline->sequence_header_size;
+    int64_t length = prefix + gop.size + 4;
+
+    uint8_t *buffer = (uint8_t*) av_malloc(length + FF_INPUT_BUFFER_PADDING_SIZE);
+    memset(buffer + length, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    uint8_t *data = buffer + prefix;
+    if (offline_read(offline->ffd_context, gop.offset, data, gop.size) != gop.size)
+    {
+        fprintf(stderr, "Error while reading GOP %lld\n", (long long) n);
+        av_free(buffer);
+        return;
+    }
+
+    // only put the sequence header in front of GOPs without their own
+    if (prefix && !(gop.size >= 4 && data[0] == 0x00 && data[1] == 0x00 &&
+            data[2] == 0x01 && data[3] == SEQUENCE_HEADER_CODE))
+    {
+        data = buffer;
+        memcpy(data, offline->sequence_header, prefix);
+    }
+
+    uint8_t *end = buffer + prefix + gop.size;
+    end[0] = 0x00;
+    end[1] = 0x00;
+    end[2] = 0x01;
+    end[3] = SEQUENCE_END_CODE;
+
+    avcodec_flush_buffers(codec_context);
+
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = data;
+    packet.size = end + 4 - data;
+
+    int got_frame;
+
+    while (packet.size > 0)
+    {
+        got_frame = 0;
+        int decode_result = avcodec_decode_video2(codec_context, frame, &got_frame, &packet);
+
+        if (decode_result < 0)
+        {
+            fprintf(stderr, "Error while decoding GOP %lld\n", (long long) n);
+            break;
+        }
+
+        if (got_frame) offline_keep_frame(slot, gop.entry_count, codec_context, frame);
+
+        packet.size -= decode_result;
+        packet.data += decode_result;
     }
 
+    do
+    {
+        // reset the AVPacket
+        av_init_packet(&packet);
+        packet.data = NULL;
+        packet.size = 0;
+
+        got_frame = 0;
+        avcodec_decode_video2(codec_context, frame, &got_frame, &packet);
+
+        if (got_frame) offline_keep_frame(slot, gop.entry_count, codec_context, frame);
+    }
+    while (got_frame);
+
+    av_free(buffer);
+    buffer = NULL;
+}
+
+void* offline_decoding_thread(void* arg)
+{
+    ffdec_offline_worker *worker = (ffdec_offline_worker*) arg;
+    ffdec_offline *offline = worker->offline;
+    ffdec_reserved *ffd_reserved = (ffdec_reserved*) offline->ffd_context->reserved;
+
+    ffsched_apply(FFSCHED_DECODE);
+
+    AVFrame *frame = avcodec_alloc_frame();
+
+    pthread_mutex_lock(&offline->mutex);
+
+    while (ffd_reserved->running && offline->next_gop < offline->gop_count)
+    {
+        // stay at most one window ahead of the frames being delivered
+        if (offline->next_gop - offline->next_delivery >= offline->window)
+        {
+            pthread_cond_wait(&offline->space_cond, &offline->mutex);
+            continue;
+        }
+
+        int64_t n = offline->next_gop++;
+        ffdec_offline_slot *slot = &offline->slots[n % offline->window];
+
+        pthread_mutex_unlock(&offline->mutex);
+
+        offline_decode_gop(offline, worker->codec_context, frame, n, slot);
+
+        pthread_mutex_lock(&offline->mutex);
+        slot->done = true;
+        pthread_cond_broadcast(&offline->done_cond);
+    }
+
+    pthread_mutex_unlock(&offline->mutex);
+
+    av_free(frame);
+    frame = NULL;
+
+    return 0;
+}
+
+ffdec_error ffdec_decode_offline(ffdec_context *ffd_context, int64_t length, int thread_count)
+{
+    ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
+    if (!ffd_reserved) return FFDEC_NOT_INITIALIZED;
+    if (ffd_reserved->running) return FFDEC_ALREADY_RUNNING;
+    if (!ffd_reserved->pread_callback) return FFDEC_NO_PREAD_CALLBACK;
+
     AVCodecContext *codec_context = ffd_context->codec_context;
     if (!codec_context) return FFDEC_NO_CODEC_SPECIFIED;
     if (!avcodec_is_open(codec_context)) return FFDEC_CODEC_NOT_OPEN;
 
-    ffdec_view *view = (ffdec_view*) malloc(sizeof(ffdec_view));
-    memset(view, 0, sizeof(ffdec_view));
+    if (thread_count <= 0) thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count <= 0) thread_count = 1;
 
-    QByteArray groupArr = group.toAscii();
-    QByteArray idArr = id.toAscii();
+    ffdec_offline offline;
+    memset(&offline, 0, sizeof(ffdec_offline));
+    offline.ffd_context = ffd_context;
+    offline.ffi_context = ffd_reserved->ffi_context;
 
-    screen_context_t screen_context;
-    screen_create_context(&screen_context, SCREEN_APPLICATION_CONTEXT);
+    uint8_t *buffer = (uint8_t*) av_malloc(OFFLINE_READ_BUFFER_SIZE);
 
-    screen_window_t screen_window;
-    screen_create_window_type(&screen_window, screen_context, SCREEN_CHILD_WINDOW);
-    screen_join_window_group(screen_window, groupArr.constData());
-    screen_set_window_property_cv(screen_window, SCREEN_PROPERTY_ID_STRING, idArr.length(), idArr.constData());
+    // without an index the GOPs have to be found first
+    if (!offline.ffi_context)
+    {
+        offline.ffi_context = ffindex_alloc();
 
-    int usage = SCREEN_USAGE_NATIVE;
-    screen_set_window_property_iv(screen_window, SCREEN_PROPERTY_USAGE, &usage);
+        ffscan_context *ffs_context = ffscan_alloc();
+        ffs_context->ffi_context = offline.ffi_context;
 
-    int video_size[] = { codec_context->width, codec_context->height };
-    screen_set_window_property_iv(screen_window, SCREEN_PROPERTY_BUFFER_SIZE, video_size);
-    screen_set_window_property_iv(screen_window, SCREEN_PROPERTY_SOURCE_SIZE, video_size);
+        int64_t offset = 0;
+        while (offset < length)
+        {
+            ssize_t size = FFMIN(OFFLINE_READ_BUFFER_SIZE, length - offset);
+            int read = offline_read(ffd_context, offset, buffer, size);
+            if (read <= 0) break;
+
+            ffscan_feed(ffs_context, buffer, read);
+            offset += read;
+        }
+
+        ffscan_finish(ffs_context);
+        ffscan_free(ffs_context);
+        ffs_context = NULL;
+    }
+
+    offline.gop_count = ffindex_gop_count(offline.ffi_context);
+
+    if (offline.gop_count)
+    {
+        ffindex_gop gop;
+        ffindex_get_gop(offline.ffi_context, 0, &gop);
 
-    int z = -1;
-    screen_set_window_property_iv(screen_window, SCREEN_PROPERTY_ZORDER, &z);
+        int size = offline_read(ffd_context, gop.offset, buffer, FFMIN(gop.size, OFFLINE_READ_BUFFER_SIZE));
 
-    int pos[] = { 0, 0 };
-    screen_set_window_property_iv(screen_window, SCREEN_PROPERTY_POSITION, pos);
+        int start;
+        int sequence_header_size = ffscan_find_sequence_header(buffer, size, &start);
 
-    screen_create_window_buffers(screen_window, 1);
+        if (sequence_header_size)
+        {
+            offline.sequence_header = (uint8_t*) av_malloc(sequence_header_size);
+            offline.sequence_header_size = sequence_header_size;
+            memcpy(offline.sequence_header, &buffer[start], sequence_header_size);
+        }
+    }
 
-    screen_pixmap_t screen_pix;
-    screen_create_pixmap(&screen_pix, screen_context);
+    av_free(buffer);
+    buffer = NULL;
 
-    usage = SCREEN_USAGE_WRITE | SCREEN_USAGE_NATIVE;
-    screen_set_pixmap_property_iv(screen_pix, SCREEN_PROPERTY_USAGE, &usage);
+    if (!offline.gop_count)
+    {
+        if (offline.ffi_context != ffd_reserved->ffi_context) ffindex_free(offline.ffi_context);
+        return FFDEC_NO_FRAMES;
+    }
 
-    int format = SCREEN_FORMAT_YUV420;
-    screen_set_pixmap_property_iv(screen_pix, SCREEN_PROPERTY_FORMAT, &format);
+    if (thread_count > offline.gop_count) thread_count = offline.gop_count;
 
-    screen_set_pixmap_property_iv(screen_pix, SCREEN_PROPERTY_BUFFER_SIZE, video_size);
+    offline.window = thread_count * 2;
+    offline.slots = (ffdec_offline_slot*) malloc(offline.window * sizeof(ffdec_offline_slot));
+    memset(offline.slots, 0, offline.window * sizeof(ffdec_offline_slot));
 
-    screen_create_pixmap_buffer(screen_pix);
+    pthread_mutex_init(&offline.mutex, 0);
+    pthread_cond_init(&offline.done_cond, 0);
+    pthread_cond_init(&offline.space_cond, 0);
 
-    screen_buffer_t screen_pixel_buffer;
-    screen_get_pixmap_property_pv(screen_pix, SCREEN_PROPERTY_RENDER_BUFFERS, (void**) &screen_pixel_buffer);
+    ffd_reserved->running = true;
 
-    int stride;
-    screen_get_buffer_property_iv(screen_pixel_buffer, SCREEN_PROPERTY_STRIDE, &stride);
+    // open the worker codecs here, avcodec_open2 is not thread safe
+    ffdec_offline_worker *workers = (ffdec_offline_worker*) malloc(thread_count * sizeof(ffdec_offline_worker));
+    int worker_count = 0;
 
-    view->screen_context = screen_context;
-    *window = view->screen_window = screen_window;
-    view->screen_pixel_buffer = screen_pixel_buffer;
-    view->stride = stride;
-    ffd_reserved->view = view;
+    for (int i = 0; i < thread_count; i++)
+    {
+        AVCodecContext *worker_context = avcodec_alloc_context3(codec_context->codec);
+        avcodec_copy_context(worker_context, codec_context);
+        worker_context->thread_count = 1;
 
-    return FFDEC_OK;
+        if (avcodec_open2(worker_context, codec_context->codec, NULL) < 0)
+        {
+            av_free(worker_context);
+            continue;
+        }
+
+        ffdec_offline_worker *worker = &workers[worker_count];
+        worker->offline = &offline;
+        worker->codec_context = worker_context;
+
+        if (ffpool_submit(&offline_decoding_thread, worker, &worker->task) != FFPOOL_OK)
+        {
+            avcodec_close(worker_context);
+            av_free(worker_context);
+            continue;
+        }
+
+        worker_count++;
+    }
+
+    ffdec_error error = worker_count ? FFDEC_OK : FFDEC_CODEC_NOT_OPEN;
+
+    for (int64_t n = 0; worker_count && n < offline.gop_count; n++)
+    {
+        ffdec_offline_slot *slot = &offline.slots[n % offline.window];
+
+        pthread_mutex_lock(&offline.mutex);
+        while (!slot->done && ffd_reserved->running)
+        {
+            pthread_cond_wait(&offline.done_cond, &offline.mutex);
+        }
+        pthread_mutex_unlock(&offline.mutex);
+
+        if (!slot->done) break;
+
+        for (int i = 0; i < slot->frame_count && ffd_reserved->running; i++)
+        {
+            if (ffd_reserved->frame_callback) ffd_reserved->frame_callback(
+                    ffd_context, slot->frames[i], ffd_reserved->frame_callback_arg);
+        }
+
+        pthread_mutex_lock(&offline.mutex);
+        offline_free_slot(slot);
+        offline.next_delivery++;
+        pthread_cond_broadcast(&offline.space_cond);
+        pthread_mutex_unlock(&offline.mutex);
+    }
+
+    pthread_mutex_lock(&offline.mutex);
+    ffd_reserved->running = false;
+    pthread_cond_broadcast(&offline.space_cond);
+    pthread_mutex_unlock(&offline.mutex);
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        ffpool_join(workers[i].task, NULL);
+        avcodec_close(workers[i].codec_context);
+        av_free(workers[i].codec_context);
+    }
+
+    free(workers);
+    workers = NULL;
+
+    for (int i = 0; i < offline.window; i++)
+    {
+        offline_free_slot(&offline.slots[i]);
+    }
+
+    free(offline.slots);
+    offline.slots = NULL;
+
+    pthread_mutex_destroy(&offline.mutex);
+    pthread_cond_destroy(&offline.done_cond);
+    pthread_cond_destroy(&offline.space_cond);
+
+    av_free(offline.sequence_header);
+    offline.sequence_header = NULL;
+
+    if (offline.ffi_context != ffd_reserved->ffi_context) ffindex_free(offline.ffi_context);
+    offline.ffi_context = NULL;
+
+    return error;
 }
 
-void display_frame(ffdec_context *ffd_context, AVFrame *frame)
+ffdec_error ffdec_set_sink(ffdec_context *ffd_context, ffsink_context *ffk_context)
 {
     ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
-    ffdec_view *view = ffd_reserved->view;
-    if (!view) return;
+    if (!ffd_reserved) return FFDEC_NOT_INITIALIZED;
+    if (ffd_reserved->running) return FFDEC_ALREADY_RUNNING;
 
-    screen_window_t screen_window = view->screen_window;
-    screen_buffer_t screen_pixel_buffer = view->screen_pixel_buffer;
-    screen_context_t screen_context = view->screen_context;
-    int stride = view->stride;
+    if (ffd_reserved->owns_sink) ffsink_free(ffd_reserved->ffk_context);
 
-    unsigned char *ptr = NULL;
-    screen_get_buffer_property_pv(screen_pixel_buffer, SCREEN_PROPERTY_POINTER, (void**) &ptr);
+    ffd_reserved->ffk_context = ffk_context;
+    ffd_reserved->owns_sink = false;
 
-    int width = frame->width;
-    int height = frame->height;
+    if (ffk_context && ffd_context->codec_context) ffk_context->codec_id = ffd_context->codec_context->codec_id;
 
-    uint8_t *srcy = frame->data[0];
-    uint8_t *srcu = frame->data[1];
-    uint8_t *srcv = frame->data[2];
+    return FFDEC_OK;
+}
 
-    unsigned char *y = ptr;
-    unsigned char *u = y + (height * stride);
-    unsigned char *v = u + (height * stride) / 4;
+#if defined(__QNX__)
+ffdec_error ffdec_create_view(ffdec_context *ffd_context, QString group, QString id, screen_window_t *window)
+{
+    ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
+    if (!ffd_reserved) return FFDEC_NOT_INITIALIZED;
 
-    for (int i = 0; i < height; i++)
+    if (ffd_reserved->owns_sink && ffsink_get_screen_window(ffd_reserved->ffk_context, window) == FFSINK_OK)
     {
-        int doff = i * stride;
-        int soff = i * frame->linesize[0];
-        memcpy(&y[doff], &srcy[soff], frame->width);
+        return FFDEC_OK;
     }
 
-    for (int i = 0; i < height / 2; i++)
+    AVCodecContext *codec_context = ffd_context->codec_context;
+    if (!codec_context) return FFDEC_NO_CODEC_SPECIFIED;
+    if (!avcodec_is_open(codec_context)) return FFDEC_CODEC_NOT_OPEN;
+
+    ffsink_context *ffk_context = ffsink_alloc();
+    ffsink_use_screen(ffk_context, group, id);
+
+    // avcodec_open2 has already reduced width and height by the lowres level
+    if (ffsink_open(ffk_context, codec_context->width, codec_context->height) != FFSINK_OK)
     {
-        int doff = i * stride / 2;
-        int soff = i * frame->linesize[1];
-        memcpy(&u[doff], &srcu[soff], frame->width / 2);
+        ffsink_free(ffk_context);
+        return FFDEC_CODEC_NOT_OPEN;
     }
 
-    for (int i = 0; i < height / 2; i++)
+    screen_window_t screen_window;
+    ffsink_get_screen_window(ffk_context, &screen_window);
+
+    if (codec_context->lowres)
     {
-        int doff = i * stride / 2;
-        int soff = i * frame->linesize[2];
-        memcpy(&v[doff], &srcv[soff], frame->width / 2);
+        // keep showing the preview at the full video size
+        int window_size[] = { codec_context->coded_width, codec_context->coded_height };
+        screen_set_window_property_iv(screen_window, SCREEN_PROPERTY_SIZE, window_size);
     }
 
-    screen_buffer_t screen_buffer;
-    screen_get_window_property_pv(screen_window, SCREEN_PROPERTY_RENDER_BUFFERS, (void**) &screen_buffer);
+    ffdec_set_sink(ffd_context, ffk_context);
+    ffd_reserved->owns_sink = true;
+
+    *window = screen_window;
+
+    return FFDEC_OK;
+}
+#endif
+
+void display_frame(ffdec_context *ffd_context, AVFrame *frame)
+{
+    ffdec_reserved *ffd_reserved = (ffdec_reserved*) ffd_context->reserved;
+
+    int queue_depth = 0;
 
-    int attribs[] = { SCREEN_BLIT_SOURCE_WIDTH, width, SCREEN_BLIT_SOURCE_HEIGHT, height, SCREEN_BLIT_END };
-    screen_blit(screen_context, screen_buffer, screen_pixel_buffer, attribs);
+    if (ffd_reserved->ffk_context)
+    {
+        FFTRACE_BEGIN("ffsink_present", ffd_reserved->stats.frames_out);
+        ffsink_error error = ffsink_present(ffd_reserved->ffk_context, frame);
+        FFTRACE_END("ffsink_present", ffd_reserved->stats.frames_out);
+
+        if (error != FFSINK_OK) fprintf(stderr, "Error while presenting frame: %d\n", error);
+
+        ffsink_stats sink_stats;
+        ffsink_get_stats(ffd_reserved->ffk_context, &sink_stats);
+        queue_depth = sink_stats.queued;
+        FFTRACE_COUNTER("ffsink_queue", queue_depth);
+    }
 
-    int dirty_rects[] = { 0, 0, width, height };
-    screen_post_window(screen_window, screen_buffer, 1, dirty_rects, 0);
+    ffstats_write_begin(&ffd_reserved->stats_sequence);
+    ffd_reserved->stats.frames_out++;
+    ffd_reserved->stats.queue_depth = queue_depth;
+    if (queue_depth > ffd_reserved->stats.queue_peak) ffd_reserved->stats.queue_peak = queue_depth;
+    ffstats_write_end(&ffd_reserved->stats_sequence);
 }
@@ -30,8 +30,14 @@ extern "C"
 
 #include <sys/types.h>
 
+#if defined(__QNX__)
 #include <screen/screen.h>
 #include <QString>
+#endif
+
+#include "ffbbindex.h"
+#include "ffbbsink.h"
+#include "ffbbstats.h"
 
 typedef enum
 {
@@ -40,9 +46,69 @@ typedef enum
     FFDEC_CODEC_NOT_OPEN,
     FFDEC_NO_CODEC_SPECIFIED,
     FFDEC_ALREADY_RUNNING,
-    FFDEC_ALREADY_STOPPED
+    FFDEC_ALREADY_STOPPED,
+    FFDEC_NO_INDEX,
+    FFDEC_NO_SEEK_CALLBACK,
+    FFDEC_SEEK_OUT_OF_RANGE,
+    FFDEC_NO_PREAD_CALLBACK,
+    FFDEC_NO_FRAMES,
+    FFDEC_CODEC_ALREADY_OPEN,
+    FFDEC_INVALID_LOWRES,
+    FFDEC_THREAD_FAILED
 } ffdec_error;
 
+typedef struct
+{
+    /**
+     * Frames output by the codec.
+     */
+    int64_t frames_in;
+
+    /**
+     * Frames passed to the frame callback and sink.
+     */
+    int64_t frames_out;
+
+    /**
+     * Frames decoded but not delivered, such as those skipped after a seek.
+     */
+    int64_t frames_dropped;
+
+    /**
+     * Frames waiting in the sink for presentation.
+     */
+    int queue_depth;
+    int queue_peak;
+
+    /**
+     * Time spent in avcodec_decode_video2 per call.
+     */
+    ffstats_times decode_time;
+
+    /**
+     * The lowres level of the codec context, 0 for full resolution.
+     */
+    int lowres;
+
+    /**
+     * Microseconds spent inside avcodec_decode_video2, and of CPU time
+     * used by the decoding thread meanwhile. Work done on codec threads
+     * is not included, so the CPU time covers all of it only with a
+     * codec thread_count of 1.
+     */
+    int64_t total_decode_time;
+    int64_t cpu_time;
+
+    int64_t bytes_in;
+    int64_t bitrate;
+
+    /**
+     * Reads that returned less than was asked for, when decoding caught
+     * up with the data available.
+     */
+    int64_t stalls;
+} ffdec_stats;
+
 typedef struct
 {
     /**
@@ -78,6 +144,48 @@ ffdec_error ffdec_set_close_callback(ffdec_context *ffd_context,
         void (*close_callback)(ffdec_context *ffd_context, void *arg),
         void *arg);
 
+/**
+ * Called on the decoding thread when a seek is carried out. The next
+ * read callback must return bytes starting at the given stream offset.
+ */
+ffdec_error ffdec_set_seek_callback(ffdec_context *ffd_context,
+        void (*seek_callback)(ffdec_context *ffd_context, int64_t offset, void *arg),
+        void *arg);
+
+/**
+ * Random access reads for ffdec_decode_offline. The callback must fill
+ * buf with up to size bytes starting at the given stream offset and
+ * return the number of bytes read. It is called from several threads.
+ */
+ffdec_error ffdec_set_pread_callback(ffdec_context *ffd_context,
+        int (*pread_callback)(ffdec_context *ffd_context, int64_t offset, uint8_t *buf, ssize_t size, void *arg),
+        void *arg);
+
+/**
+ * Use the index to locate frames for ffdec_seek. The index is
+ * not owned by the decoder and may still be growing.
+ */
+ffdec_error ffdec_set_index(ffdec_context *ffd_context, ffindex_context *ffi_context);
+
+/**
+ * Decode a reduced resolution preview: lowres 1, 2 or 3 makes the decoder
+ * output frames at 1/2, 1/4 or 1/8 size using a smaller IDCT, and 0
+ * restores full resolution. The skip settings trade further accuracy
+ * for speed, and are ignored by codecs that do not support them.
+ * The lowres level can only be changed before the codec context is
+ * opened; ffdec_create_view then sizes its buffers to match.
+ */
+ffdec_error ffdec_set_preview(ffdec_context *ffd_context, int lowres,
+        enum AVDiscard skip_loop_filter, enum AVDiscard skip_idct);
+
+/**
+ * Take a snapshot of the statistics of the decoding thread since the
+ * context was reset. This never blocks the decoding thread and may be
+ * called from any thread, as often as needed. Frames decoded by
+ * ffdec_decode_offline are not counted.
+ */
+ffdec_error ffdec_get_stats(ffdec_context *ffd_context, ffdec_stats *stats);
+
 /**
  * Close the context.
  * This will also close the AVCodecContext if not already closed.
@@ -85,13 +193,13 @@ ffdec_error ffdec_set_close_callback(ffdec_context *ffd_context,
 ffdec_error ffdec_close(ffdec_context *ffd_context);
 
 /**
- * Free the context.
+ * Free the context, waiting for the decoding task to return.
  */
 ffdec_error ffdec_free(ffdec_context *ffd_context);
 
 /**
  * Start decoding the camera frames.
- * Decoding will begin on a background thread.
+ * Decoding will begin as a task on the ffpool workers.
  */
 ffdec_error ffdec_start(ffdec_context *ffd_context);
 
@@ -100,6 +208,38 @@ ffdec_error ffdec_start(ffdec_context *ffd_context);
  */
 ffdec_error ffdec_stop(ffdec_context *ffd_context);
 
+/**
+ * Seek to the frame presented at the given pts, in units of the index
+ * time_base. Decoding restarts at the enclosing GOP and the frames
+ * before the target are decoded but not delivered.
+ */
+ffdec_error ffdec_seek(ffdec_context *ffd_context, int64_t pts);
+
+/**
+ * Decode a complete stream of the given length as fast as possible.
+ * The stream is split at GOP boundaries, from the index if one is set,
+ * and GOPs are decoded on thread_count workers with a codec context
+ * each, copied from codec_context. Pass 0 to use one per core.
+ * Frames are passed to the frame callback on the calling thread in
+ * presentation order. Returns once all frames were delivered or
+ * ffdec_stop was called. GOPs are assumed to be closed, as the
+ * encoder writes them.
+ */
+ffdec_error ffdec_decode_offline(ffdec_context *ffd_context, int64_t length, int thread_count);
+
+/**
+ * Present decoded frames through the sink instead of a view. The sink
+ * is not owned by the decoder and must be closed by the caller once
+ * decoding has finished. Pass NULL to present nothing.
+ */
+ffdec_error ffdec_set_sink(ffdec_context *ffd_context, ffsink_context *ffk_context);
+
+#if defined(__QNX__)
+/**
+ * Present decoded frames in a child window of the given window group,
+ * through a screen sink owned by the decoder.
+ */
 ffdec_error ffdec_create_view(ffdec_context *ffd_context, QString group, QString id, screen_window_t *window);
+#endif
 
 #endif
@@ -0,0 +1,115 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbdenoise.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+const char *ffdenoise_implementation()
+{
+#if defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    return "neon";
+#else
+    return "c";
+#endif
+}
+
+/**
+ * Filter one row. Blending is a rounded average with the history repeated
+ * strength times, the same in every implementation.
+ */
+static void denoise_row(uint8_t *row, uint8_t *history, int width, int strength, int threshold)
+{
+    int x = 0;
+
+#if defined(__SSE2__)
+    // d < threshold is the same as min(d, threshold - 1) == d
+    __m128i limit = _mm_set1_epi8((char) (threshold - 1));
+
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i current = _mm_loadu_si128((const __m128i*) &row[x]);
+        __m128i previous = _mm_loadu_si128((const __m128i*) &history[x]);
+
+        __m128i difference = _mm_or_si128(_mm_subs_epu8(current, previous), _mm_subs_epu8(previous, current));
+        __m128i still = _mm_cmpeq_epi8(_mm_min_epu8(difference, limit), difference);
+
+        __m128i blended = current;
+        for (int i = 0; i < strength; i++) blended = _mm_avg_epu8(blended, previous);
+
+        __m128i result = _mm_or_si128(_mm_and_si128(still, blended), _mm_andnot_si128(still, current));
+        _mm_storeu_si128((__m128i*) &row[x], result);
+        _mm_storeu_si128((__m128i*) &history[x], result);
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    uint8x16_t limit = vdupq_n_u8(threshold - 1);
+
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16_t current = vld1q_u8(&row[x]);
+        uint8x16_t previous = vld1q_u8(&history[x]);
+
+        uint8x16_t still = vcleq_u8(vabdq_u8(current, previous), limit);
+
+        uint8x16_t blended = current;
+        for (int i = 0; i < strength; i++) blended = vrhaddq_u8(blended, previous);
+
+        uint8x16_t result = vbslq_u8(still, blended, current);
+        vst1q_u8(&row[x], result);
+        vst1q_u8(&history[x], result);
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        int current = row[x];
+        int previous = history[x];
+        int difference = current < previous ? previous - current : current - previous;
+
+        if (difference < threshold)
+        {
+            for (int i = 0; i < strength; i++) current = (current + previous + 1) >> 1;
+        }
+
+        row[x] = history[x] = current;
+    }
+}
+
+void ffdenoise_plane(uint8_t *plane, int stride, uint8_t *history, int history_stride,
+        int width, int height, int strength, int threshold)
+{
+    if (strength < 0) strength = 0;
+    if (strength > FFDENOISE_MAX_STRENGTH) strength = FFDENOISE_MAX_STRENGTH;
+    if (threshold > 256) threshold = 256;
+
+    for (int y = 0; y < height; y++)
+    {
+        if (threshold <= 0 || !strength)
+        {
+            memcpy(&history[y * history_stride], &plane[y * stride], width);
+            continue;
+        }
+
+        denoise_row(&plane[y * stride], &history[y * history_stride], width, strength, threshold);
+    }
+}
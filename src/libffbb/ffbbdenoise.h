@@ -0,0 +1,43 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBDENOISE_H
+#define FFBBDENOISE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/**
+ * The largest strength, where a still pixel keeps 1/2^strength of
+ * the new frame and the rest of the history.
+ */
+#define FFDENOISE_MAX_STRENGTH 4
+
+/**
+ * Filter a plane in place against the history of the planes before it,
+ * and store the result as the new history. Pixels that moved by threshold
+ * or more from the history are taken as they are, so moving edges do not
+ * smear, while still pixels are blended with the history by strength.
+ * A threshold of 0 copies the plane to the history unchanged.
+ */
+void ffdenoise_plane(uint8_t *plane, int stride, uint8_t *history, int history_stride,
+        int width, int height, int strength, int threshold);
+
+/**
+ * The instruction set used by ffdenoise_plane: "sse2", "neon" or "c".
+ */
+const char *ffdenoise_implementation(void);
+
+#endif
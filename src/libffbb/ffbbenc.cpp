@@ -14,15 +14,84 @@
  */
 
 #include "ffbbenc.h"
+#include "ffbbdenoise.h"
+#include "ffbbmotion.h"
+#include "ffbborient.h"
+#include "ffbbpool.h"
+#include "ffbbsched.h"
+#include "ffbbtrace.h"
 
 #include <deque>
 #include <pthread.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 
+// frames added that are remembered until their packet is written,
+// more than could ever be waiting in the queue
+#define LATENCY_FRAMES 256
+
+// rows of luma compared with the last frame encoded to decide on a skip
+#define SKIP_ROW_STEP 4
+
+typedef struct
+{
+    int64_t frames_in;
+    int64_t frames_dropped;
+} ffenc_input_stats;
+
+typedef struct
+{
+    int64_t frames_dropped;
+    int64_t stalls;
+    ffstats_histogram encode_time;
+    int64_t frames_skipped;
+    int64_t skip_detect_time;
+    // encodes of new frames, and of repeated ones in FFENC_SKIP_REPEAT
+    int64_t full_frames;
+    int64_t full_encode_time;
+    int64_t repeat_encode_time;
+    int64_t mbs_frozen;
+    int64_t roi_time;
+    int64_t tap_dropped;
+} ffenc_output_stats;
+
+typedef struct
+{
+    int64_t frames_out;
+    int64_t bytes_out;
+    ffstats_histogram latency;
+    ffstats_rate rate;
+} ffenc_write_stats;
+
+/**
+ * The references to a frame shared with the tap, kept in AVFrame.opaque.
+ */
+typedef struct
+{
+    volatile int references;
+} ffenc_shared;
+
+typedef struct
+{
+    AVFrame *frame;
+    int64_t frame_number;
+    int64_t tap_time;
+} ffenc_tapped;
+
+/**
+ * A copy of a packet waiting for the writing thread, and when the
+ * frame it was encoded from was added, or -1 if that is not known.
+ */
+typedef struct
+{
+    ffenc_packet description;
+    int64_t add_time;
+} ffenc_outgoing;
+
 typedef struct
 {
     bool running;
+    ffpool_task *task;
     pthread_mutex_t reading_mutex;
     pthread_cond_t read_cond;
     std::deque<AVFrame*> frames;
@@ -30,11 +99,96 @@ typedef struct
     void *frame_callback_arg;
     void (*write_callback)(ffenc_context *ffe_context, uint8_t *buf, ssize_t size, void *arg);
     void *write_callback_arg;
+    void (*packet_callback)(ffenc_context *ffe_context, const ffenc_packet *packet, void *arg);
+    void *packet_callback_arg;
     void (*close_callback)(ffenc_context *ffe_context, void *arg);
     void *close_callback_arg;
+    ffindex_context *ffi_context;
+    ffquality_context *ffq_context;
+    // counted by the writing thread
+    int64_t bytes_written;
+    int64_t packets_written;
+    // input stats are written by the thread adding frames, output
+    // stats by the encoding thread and write stats by the writing thread
+    volatile uint32_t input_sequence;
+    ffenc_input_stats input_stats;
+    volatile uint32_t output_sequence;
+    ffenc_output_stats output_stats;
+    volatile uint32_t write_sequence;
+    ffenc_write_stats write_stats;
+    // written by the tapping thread
+    volatile uint32_t tap_sequence;
+    ffstats_histogram tap_lag;
+    int64_t tap_frames;
+    volatile int queue_depth;
+    volatile int queue_peak;
+    fforient_transform orientation;
+    int conversion_threads;
+    ffenc_skip_mode skip_mode;
+    double skip_threshold;
+    int roi_threshold;
+    void (*roi_callback)(ffenc_context *ffe_context, AVFrame *frame, uint8_t *map,
+            int mb_width, int mb_height, void *arg);
+    void *roi_callback_arg;
+    int denoise_strength;
+    int denoise_threshold;
+    ffpool_task *denoise_task;
+    // frames filtered by the denoising thread, waiting to be encoded
+    std::deque<AVFrame*> denoised;
+    pthread_cond_t denoised_cond;
+    bool denoising;
+    // written by the denoising thread
+    volatile uint32_t denoise_sequence;
+    ffstats_histogram denoise_time;
+    void (*tap_callback)(ffenc_context *ffe_context, const AVFrame *frame, int64_t frame_number, void *arg);
+    void *tap_callback_arg;
+    int tap_depth;
+    ffenc_tap_policy tap_policy;
+    ffpool_task *tap_task;
+    // frames waiting for the tapping thread
+    pthread_mutex_t tap_mutex;
+    pthread_cond_t tap_cond;
+    std::deque<ffenc_tapped> tapped;
+    bool tapping;
+    ffpool_task *write_task;
+    // packets waiting for the writing thread
+    pthread_mutex_t write_mutex;
+    pthread_cond_t write_cond;
+    std::deque<ffenc_outgoing> outgoing;
+    bool writing;
+    // when each frame was added, by the order it was added
+    int64_t add_times[LATENCY_FRAMES];
 } ffenc_reserved;
 
+/**
+ * A frame given to the encoder that has no packet yet.
+ */
+typedef struct
+{
+    int64_t pts;
+    int64_t frame_number;
+} ffenc_pending;
+
 void* encoding_thread(void* arg);
+void* denoising_thread(void* arg);
+void* tapping_thread(void* arg);
+void* writing_thread(void* arg);
+void write_packet(ffenc_context *ffe_context, AVPacket *packet, int64_t encode_time,
+        int64_t frame_number, std::deque<ffenc_pending> *pending);
+
+static void count_input(ffenc_reserved *ffe_reserved, bool accepted)
+{
+    ffstats_write_begin(&ffe_reserved->input_sequence);
+    if (accepted) ffe_reserved->input_stats.frames_in++;
+    else ffe_reserved->input_stats.frames_dropped++;
+    ffstats_write_end(&ffe_reserved->input_sequence);
+
+    if (!accepted) return;
+
+    int queue_depth = __sync_add_and_fetch(&ffe_reserved->queue_depth, 1);
+    ffstats_update_peak(&ffe_reserved->queue_peak, queue_depth);
+    FFTRACE_COUNTER("ffenc_queue", queue_depth);
+}
 
 ffenc_context *ffenc_alloc()
 {
@@ -46,6 +200,11 @@ ffenc_context *ffenc_alloc()
     ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
     pthread_mutex_init(&ffe_reserved->reading_mutex, 0);
     pthread_cond_init(&ffe_reserved->read_cond, 0);
+    pthread_cond_init(&ffe_reserved->denoised_cond, 0);
+    pthread_mutex_init(&ffe_reserved->tap_mutex, 0);
+    pthread_cond_init(&ffe_reserved->tap_cond, 0);
+    pthread_mutex_init(&ffe_reserved->write_mutex, 0);
+    pthread_cond_init(&ffe_reserved->write_cond, 0);
 
     return ffe_context;
 }
@@ -53,8 +212,16 @@ ffenc_context *ffenc_alloc()
 void ffenc_reset(ffenc_context *ffe_context)
 {
     ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+
+    // the task of the last run must not outlive its context
+    if (ffe_reserved && ffe_reserved->task) ffpool_join(ffe_reserved->task, NULL);
+    if (ffe_reserved && ffe_reserved->denoise_task) ffpool_join(ffe_reserved->denoise_task, NULL);
+    if (ffe_reserved && ffe_reserved->tap_task) ffpool_join(ffe_reserved->tap_task, NULL);
+    if (ffe_reserved && ffe_reserved->write_task) ffpool_join(ffe_reserved->write_task, NULL);
+
     if (!ffe_reserved) ffe_reserved = (ffenc_reserved*) malloc(sizeof(ffenc_reserved));
     memset(ffe_reserved, 0, sizeof(ffenc_reserved));
+    ffe_reserved->conversion_threads = 1;
 
     memset(ffe_context, 0, sizeof(ffenc_context));
     ffe_context->reserved = ffe_reserved;
@@ -71,6 +238,22 @@ ffenc_error ffenc_set_frame_callback(ffenc_context *ffe_context,
     return FFENC_OK;
 }
 
+ffenc_error ffenc_set_tap(ffenc_context *ffe_context, int depth, ffenc_tap_policy policy,
+        void (*tap_callback)(ffenc_context *ffe_context, const AVFrame *frame, int64_t frame_number, void *arg),
+        void *arg)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
+    if (ffe_reserved->running) return FFENC_ALREADY_RUNNING;
+
+    ffe_reserved->tap_callback = tap_callback;
+    ffe_reserved->tap_callback_arg = arg;
+    ffe_reserved->tap_depth = FFMAX(depth, 1);
+    ffe_reserved->tap_policy = policy;
+
+    return FFENC_OK;
+}
+
 ffenc_error ffenc_set_write_callback(ffenc_context *ffe_context,
         void (*write_callback)(ffenc_context *ffe_context, uint8_t *buf, ssize_t size, void *arg),
         void *arg)
@@ -82,6 +265,17 @@ ffenc_error ffenc_set_write_callback(ffenc_context *ffe_context,
     return FFENC_OK;
 }
 
+ffenc_error ffenc_set_packet_callback(ffenc_context *ffe_context,
+        void (*packet_callback)(ffenc_context *ffe_context, const ffenc_packet *packet, void *arg),
+        void *arg)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
+    ffe_reserved->packet_callback = packet_callback;
+    ffe_reserved->packet_callback_arg = arg;
+    return FFENC_OK;
+}
+
 ffenc_error ffenc_set_close_callback(ffenc_context *ffe_context,
         void (*close_callback)(ffenc_context *ffe_context, void *arg),
         void *arg)
@@ -93,6 +287,146 @@ ffenc_error ffenc_set_close_callback(ffenc_context *ffe_context,
     return FFENC_OK;
 }
 
+ffenc_error ffenc_set_index(ffenc_context *ffe_context, ffindex_context *ffi_context)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
+    ffe_reserved->ffi_context = ffi_context;
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_set_orientation(ffenc_context *ffe_context, const fforient_transform *transform)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
+    if (ffe_reserved->running) return FFENC_ALREADY_RUNNING;
+
+    if (transform) ffe_reserved->orientation = *transform;
+    else memset(&ffe_reserved->orientation, 0, sizeof(fforient_transform));
+
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_set_conversion_threads(ffenc_context *ffe_context, int threads)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
+    if (ffe_reserved->running) return FFENC_ALREADY_RUNNING;
+
+    ffe_reserved->conversion_threads = FFMAX(threads, 0);
+
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_set_skip(ffenc_context *ffe_context, ffenc_skip_mode mode, double threshold)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
+    if (ffe_reserved->running) return FFENC_ALREADY_RUNNING;
+
+    ffe_reserved->skip_mode = mode;
+    ffe_reserved->skip_threshold = threshold;
+
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_set_roi(ffenc_context *ffe_context, int threshold,
+        void (*roi_callback)(ffenc_context *ffe_context, AVFrame *frame, uint8_t *map,
+                int mb_width, int mb_height, void *arg),
+        void *arg)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
+    if (ffe_reserved->running) return FFENC_ALREADY_RUNNING;
+
+    ffe_reserved->roi_threshold = threshold;
+    ffe_reserved->roi_callback = roi_callback;
+    ffe_reserved->roi_callback_arg = arg;
+
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_set_denoise(ffenc_context *ffe_context, int strength, int threshold)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
+    if (ffe_reserved->running) return FFENC_ALREADY_RUNNING;
+
+    ffe_reserved->denoise_strength = FFMIN(strength, FFDENOISE_MAX_STRENGTH);
+    ffe_reserved->denoise_threshold = threshold;
+
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_get_stats(ffenc_context *ffe_context, ffenc_stats *stats)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
+
+    ffenc_input_stats input_stats;
+    ffstats_read(&ffe_reserved->input_sequence, &ffe_reserved->input_stats,
+            &input_stats, sizeof(ffenc_input_stats));
+
+    ffenc_output_stats output_stats;
+    ffstats_read(&ffe_reserved->output_sequence, &ffe_reserved->output_stats,
+            &output_stats, sizeof(ffenc_output_stats));
+
+    ffenc_write_stats write_stats;
+    ffstats_read(&ffe_reserved->write_sequence, &ffe_reserved->write_stats,
+            &write_stats, sizeof(ffenc_write_stats));
+
+    memset(stats, 0, sizeof(ffenc_stats));
+    stats->frames_in = input_stats.frames_in;
+    stats->frames_out = write_stats.frames_out;
+    stats->frames_dropped = input_stats.frames_dropped + output_stats.frames_dropped;
+    stats->queue_depth = ffe_reserved->queue_depth;
+    stats->queue_peak = ffe_reserved->queue_peak;
+    ffstats_histogram_times(&output_stats.encode_time, &stats->encode_time);
+    ffstats_histogram_times(&write_stats.latency, &stats->latency);
+    stats->frames_skipped = output_stats.frames_skipped;
+    stats->skip_detect_time = output_stats.skip_detect_time;
+
+    if (output_stats.full_frames)
+    {
+        int64_t skipped_time = output_stats.frames_skipped
+                * (output_stats.full_encode_time / output_stats.full_frames);
+        stats->skip_time_saved = skipped_time - output_stats.repeat_encode_time - output_stats.skip_detect_time;
+    }
+
+    stats->mbs_frozen = output_stats.mbs_frozen;
+    stats->roi_time = output_stats.roi_time;
+
+    ffstats_histogram denoise_time;
+    ffstats_read(&ffe_reserved->denoise_sequence, &ffe_reserved->denoise_time,
+            &denoise_time, sizeof(ffstats_histogram));
+    ffstats_histogram_times(&denoise_time, &stats->denoise_time);
+
+    ffstats_histogram tap_lag;
+    ffstats_read(&ffe_reserved->tap_sequence, &ffe_reserved->tap_lag,
+            &tap_lag, sizeof(ffstats_histogram));
+    ffstats_histogram_times(&tap_lag, &stats->tap_lag);
+
+    int64_t tap_frames;
+    ffstats_read(&ffe_reserved->tap_sequence, &ffe_reserved->tap_frames,
+            &tap_frames, sizeof(int64_t));
+    stats->tap_frames = tap_frames;
+    stats->tap_dropped = output_stats.tap_dropped;
+
+    stats->bytes_out = write_stats.bytes_out;
+    stats->bitrate = write_stats.rate.bitrate;
+    stats->stalls = output_stats.stalls;
+
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_set_quality(ffenc_context *ffe_context, ffquality_context *ffq_context)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
+    ffe_reserved->ffq_context = ffq_context;
+    return FFENC_OK;
+}
+
 ffenc_error ffenc_close(ffenc_context *ffe_context)
 {
     AVCodecContext *codec_context = ffe_context->codec_context;
@@ -114,8 +448,17 @@ ffenc_error ffenc_close(ffenc_context *ffe_context)
 ffenc_error ffenc_free(ffenc_context *ffe_context)
 {
     ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    if (ffe_reserved->task) ffpool_join(ffe_reserved->task, NULL);
+    if (ffe_reserved->denoise_task) ffpool_join(ffe_reserved->denoise_task, NULL);
+    if (ffe_reserved->tap_task) ffpool_join(ffe_reserved->tap_task, NULL);
+    if (ffe_reserved->write_task) ffpool_join(ffe_reserved->write_task, NULL);
     pthread_mutex_destroy(&ffe_reserved->reading_mutex);
     pthread_cond_destroy(&ffe_reserved->read_cond);
+    pthread_cond_destroy(&ffe_reserved->denoised_cond);
+    pthread_mutex_destroy(&ffe_reserved->tap_mutex);
+    pthread_cond_destroy(&ffe_reserved->tap_cond);
+    pthread_mutex_destroy(&ffe_reserved->write_mutex);
+    pthread_cond_destroy(&ffe_reserved->write_cond);
     free(ffe_reserved);
     ffe_reserved = (ffenc_reserved*) NULL;
     ffe_context->reserved = NULL;
@@ -123,6 +466,38 @@ ffenc_error ffenc_free(ffenc_context *ffe_context)
     return FFENC_OK;
 }
 
+/**
+ * Let the tapping thread pass the frames still waiting and wait for it to return.
+ */
+static void stop_tap(ffenc_reserved *ffe_reserved)
+{
+    if (!ffe_reserved->tap_task) return;
+
+    pthread_mutex_lock(&ffe_reserved->tap_mutex);
+    ffe_reserved->tapping = false;
+    pthread_cond_signal(&ffe_reserved->tap_cond);
+    pthread_mutex_unlock(&ffe_reserved->tap_mutex);
+
+    ffpool_join(ffe_reserved->tap_task, NULL);
+    ffe_reserved->tap_task = NULL;
+}
+
+/**
+ * Let the writing thread write the packets still waiting and wait for it to return.
+ */
+static void stop_writer(ffenc_reserved *ffe_reserved)
+{
+    if (!ffe_reserved->write_task) return;
+
+    pthread_mutex_lock(&ffe_reserved->write_mutex);
+    ffe_reserved->writing = false;
+    pthread_cond_signal(&ffe_reserved->write_cond);
+    pthread_mutex_unlock(&ffe_reserved->write_mutex);
+
+    ffpool_join(ffe_reserved->write_task, NULL);
+    ffe_reserved->write_task = NULL;
+}
+
 ffenc_error ffenc_start(ffenc_context *ffe_context)
 {
     ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
@@ -130,11 +505,77 @@ ffenc_error ffenc_start(ffenc_context *ffe_context)
     if (ffe_reserved->running) return FFENC_ALREADY_RUNNING;
     if (!ffe_context->codec_context) return FFENC_NO_CODEC_SPECIFIED;
 
+    // the last encoding task has returned once it closed, but
+    // it is joined here before the context is used again
+    if (ffe_reserved->task) ffpool_join(ffe_reserved->task, NULL);
+    ffe_reserved->task = NULL;
+    if (ffe_reserved->denoise_task) ffpool_join(ffe_reserved->denoise_task, NULL);
+    ffe_reserved->denoise_task = NULL;
+    if (ffe_reserved->tap_task) ffpool_join(ffe_reserved->tap_task, NULL);
+    ffe_reserved->tap_task = NULL;
+    if (ffe_reserved->write_task) ffpool_join(ffe_reserved->write_task, NULL);
+    ffe_reserved->write_task = NULL;
+
     ffe_reserved->running = true;
     ffe_reserved->frames.clear();
+    ffe_reserved->denoised.clear();
+    ffe_reserved->tapped.clear();
+    ffe_reserved->outgoing.clear();
+    ffe_reserved->bytes_written = 0;
+    ffe_reserved->packets_written = 0;
+
+    ffe_reserved->writing = true;
+
+    if (ffpool_submit(&writing_thread, ffe_context, &ffe_reserved->write_task) != FFPOOL_OK)
+    {
+        ffe_reserved->running = false;
+        ffe_reserved->writing = false;
+        return FFENC_THREAD_FAILED;
+    }
+
+    if (ffe_reserved->tap_callback)
+    {
+        ffe_reserved->tapping = true;
 
-    pthread_t pthread;
-    pthread_create(&pthread, 0, &encoding_thread, ffe_context);
+        if (ffpool_submit(&tapping_thread, ffe_context, &ffe_reserved->tap_task) != FFPOOL_OK)
+        {
+            ffe_reserved->running = false;
+            ffe_reserved->tapping = false;
+            stop_writer(ffe_reserved);
+            return FFENC_THREAD_FAILED;
+        }
+    }
+
+    if (ffe_reserved->denoise_strength > 0)
+    {
+        ffe_reserved->denoising = true;
+
+        if (ffpool_submit(&denoising_thread, ffe_context, &ffe_reserved->denoise_task) != FFPOOL_OK)
+        {
+            ffe_reserved->running = false;
+            ffe_reserved->denoising = false;
+            stop_tap(ffe_reserved);
+            stop_writer(ffe_reserved);
+            return FFENC_THREAD_FAILED;
+        }
+    }
+
+    if (ffpool_submit(&encoding_thread, ffe_context, &ffe_reserved->task) != FFPOOL_OK)
+    {
+        ffe_reserved->running = false;
+
+        if (ffe_reserved->denoise_task)
+        {
+            pthread_cond_signal(&ffe_reserved->read_cond);
+            ffpool_join(ffe_reserved->denoise_task, NULL);
+            ffe_reserved->denoise_task = NULL;
+        }
+
+        stop_tap(ffe_reserved);
+        stop_writer(ffe_reserved);
+
+        return FFENC_THREAD_FAILED;
+    }
 
     return FFENC_OK;
 }
@@ -152,6 +593,329 @@ ffenc_error ffenc_stop(ffenc_context *ffe_context)
     return FFENC_OK;
 }
 
+/**
+ * Whether the luma of the frame is within the threshold of the last one
+ * encoded, measured over every SKIP_ROW_STEP-th row.
+ */
+static bool is_static(ffenc_reserved *ffe_reserved, AVCodecContext *codec_context,
+        const AVFrame *frame, const AVFrame *reference)
+{
+    int width = codec_context->width;
+    int height = codec_context->height;
+
+    int64_t detect_start = av_gettime();
+    uint64_t sad = ffmotion_sad(frame->data[0], frame->linesize[0], reference->data[0],
+            reference->linesize[0], width, height, SKIP_ROW_STEP);
+    int64_t detect_time = av_gettime() - detect_start;
+
+    ffstats_write_begin(&ffe_reserved->output_sequence);
+    ffe_reserved->output_stats.skip_detect_time += detect_time;
+    ffstats_write_end(&ffe_reserved->output_sequence);
+
+    int64_t samples = (int64_t) width * ((height + SKIP_ROW_STEP - 1) / SKIP_ROW_STEP);
+
+    return sad < ffe_reserved->skip_threshold * samples;
+}
+
+/**
+ * Copy the macroblocks of the reference marked less important than the
+ * threshold over the frame, so the encoder finds nothing left to code in
+ * them and rate control spends their bits on the rest of the picture.
+ */
+static int freeze_macroblocks(AVCodecContext *codec_context, AVFrame *frame, const AVFrame *reference,
+        const uint8_t *map, int mb_width, int mb_height, int threshold)
+{
+    int frozen = 0;
+
+    for (int mb_y = 0; mb_y < mb_height; mb_y++)
+    {
+        for (int mb_x = 0; mb_x < mb_width; mb_x++)
+        {
+            if (map[mb_y * mb_width + mb_x] >= threshold) continue;
+
+            for (int plane = 0; plane < 3; plane++)
+            {
+                int shift = plane ? 1 : 0;
+                int size = 16 >> shift;
+                int plane_width = (codec_context->width + shift) >> shift;
+                int plane_height = (codec_context->height + shift) >> shift;
+                int columns = FFMIN(size, plane_width - mb_x * size);
+                int rows = FFMIN(size, plane_height - mb_y * size);
+
+                for (int y = mb_y * size; y < mb_y * size + rows; y++)
+                {
+                    memcpy(&frame->data[plane][y * frame->linesize[plane] + mb_x * size],
+                            &reference->data[plane][y * reference->linesize[plane] + mb_x * size], columns);
+                }
+            }
+
+            frozen++;
+        }
+    }
+
+    return frozen;
+}
+
+static void count_stall(ffenc_reserved *ffe_reserved)
+{
+    ffstats_write_begin(&ffe_reserved->output_sequence);
+    ffe_reserved->output_stats.stalls++;
+    ffstats_write_end(&ffe_reserved->output_sequence);
+}
+
+/**
+ * Take the next camera frame off the queue, or NULL once stopped and empty.
+ * Only the encoding thread counts stalls, as it writes the output stats.
+ */
+static AVFrame *next_frame(ffenc_reserved *ffe_reserved, int64_t frame_number, bool count_stalls)
+{
+    bool waiting = false;
+
+    while (ffe_reserved->running || !ffe_reserved->frames.empty())
+    {
+        if (!ffe_reserved->frames.empty())
+        {
+            AVFrame *frame = ffe_reserved->frames.front();
+            ffe_reserved->frames.pop_front();
+            __sync_sub_and_fetch(&ffe_reserved->queue_depth, 1);
+            FFTRACE_COUNTER("ffenc_queue", ffe_reserved->queue_depth);
+            return frame;
+        }
+
+        // count each wait for a frame once, however often it wakes up
+        if (!waiting && count_stalls) count_stall(ffe_reserved);
+        waiting = true;
+
+        FFTRACE_BEGIN("ffenc_wait", frame_number);
+        pthread_mutex_lock(&ffe_reserved->reading_mutex);
+        pthread_cond_wait(&ffe_reserved->read_cond, &ffe_reserved->reading_mutex);
+        pthread_mutex_unlock(&ffe_reserved->reading_mutex);
+        FFTRACE_END("ffenc_wait", frame_number);
+    }
+
+    return NULL;
+}
+
+/**
+ * Take the next frame the denoising thread filtered, or NULL once it
+ * has filtered the last one.
+ */
+static AVFrame *next_denoised_frame(ffenc_reserved *ffe_reserved, int64_t frame_number)
+{
+    AVFrame *frame = NULL;
+
+    pthread_mutex_lock(&ffe_reserved->reading_mutex);
+
+    if (ffe_reserved->denoised.empty() && ffe_reserved->denoising)
+    {
+        count_stall(ffe_reserved);
+        FFTRACE_BEGIN("ffenc_wait", frame_number);
+
+        while (ffe_reserved->denoised.empty() && ffe_reserved->denoising)
+        {
+            pthread_cond_wait(&ffe_reserved->denoised_cond, &ffe_reserved->reading_mutex);
+        }
+
+        FFTRACE_END("ffenc_wait", frame_number);
+    }
+
+    if (!ffe_reserved->denoised.empty())
+    {
+        frame = ffe_reserved->denoised.front();
+        ffe_reserved->denoised.pop_front();
+    }
+
+    pthread_mutex_unlock(&ffe_reserved->reading_mutex);
+
+    return frame;
+}
+
+/**
+ * Filter the camera frames between ffenc_add_frame and the encoding
+ * thread, keeping the filtered planes as the history of the next frame.
+ */
+void* denoising_thread(void* arg)
+{
+    ffenc_context* ffe_context = (ffenc_context*) arg;
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    AVCodecContext *codec_context = ffe_context->codec_context;
+
+    int width = codec_context->width;
+    int height = codec_context->height;
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+
+    uint8_t *history[3];
+    history[0] = (uint8_t*) malloc(width * height + 2 * chroma_width * chroma_height);
+    history[1] = &history[0][width * height];
+    history[2] = &history[1][chroma_width * chroma_height];
+
+    int strength = ffe_reserved->denoise_strength;
+    int threshold = ffe_reserved->denoise_threshold;
+    int64_t frame_number = 0;
+
+    FFTRACE_THREAD_NAME("ffenc_denoise");
+    ffsched_apply(FFSCHED_ENCODE);
+
+    AVFrame *frame;
+
+    while ((frame = next_frame(ffe_reserved, frame_number, false)))
+    {
+        // the quality of a filtered recording is measured against the camera frame
+        frame->pts = frame_number;
+        if (ffe_reserved->ffq_context) ffquality_add_source(ffe_reserved->ffq_context, frame);
+
+        int64_t denoise_start = av_gettime();
+        FFTRACE_BEGIN("ffenc_denoise", frame_number);
+
+        for (int plane = 0; plane < 3; plane++)
+        {
+            int plane_width = plane ? chroma_width : width;
+            int plane_height = plane ? chroma_height : height;
+
+            // the first frame only starts the history
+            ffdenoise_plane(frame->data[plane], frame->linesize[plane], history[plane], plane_width,
+                    plane_width, plane_height, frame_number ? strength : 0, threshold);
+        }
+
+        FFTRACE_END("ffenc_denoise", frame_number);
+
+        ffstats_write_begin(&ffe_reserved->denoise_sequence);
+        ffstats_histogram_add(&ffe_reserved->denoise_time, av_gettime() - denoise_start);
+        ffstats_write_end(&ffe_reserved->denoise_sequence);
+
+        pthread_mutex_lock(&ffe_reserved->reading_mutex);
+        ffe_reserved->denoised.push_back(frame);
+        pthread_cond_signal(&ffe_reserved->denoised_cond);
+        pthread_mutex_unlock(&ffe_reserved->reading_mutex);
+
+        frame_number++;
+    }
+
+    pthread_mutex_lock(&ffe_reserved->reading_mutex);
+    ffe_reserved->denoising = false;
+    pthread_cond_signal(&ffe_reserved->denoised_cond);
+    pthread_mutex_unlock(&ffe_reserved->reading_mutex);
+
+    free(history[0]);
+
+    return 0;
+}
+
+/**
+ * Drop a reference to the frame, and free it once the
+ * encoder and the tap are both done with it.
+ */
+static void release_frame(AVFrame *frame)
+{
+    ffenc_shared *shared = (ffenc_shared*) frame->opaque;
+    if (shared && __sync_sub_and_fetch(&shared->references, 1) > 0) return;
+
+    free(shared);
+    free(frame->data[0]);
+    av_free(frame);
+}
+
+/**
+ * Hand the frame to the tapping thread, dropping a frame
+ * by the policy if the tap is full rather than waiting.
+ */
+static void tap_frame(ffenc_reserved *ffe_reserved, AVFrame *frame, int64_t frame_number)
+{
+    ffenc_tapped tapped;
+    tapped.frame = frame;
+    tapped.frame_number = frame_number;
+    tapped.tap_time = av_gettime();
+
+    if (!frame->opaque)
+    {
+        ffenc_shared *shared = (ffenc_shared*) malloc(sizeof(ffenc_shared));
+        shared->references = 1;
+        frame->opaque = shared;
+    }
+
+    AVFrame *dropped = NULL;
+
+    pthread_mutex_lock(&ffe_reserved->tap_mutex);
+
+    if ((int) ffe_reserved->tapped.size() >= ffe_reserved->tap_depth)
+    {
+        if (ffe_reserved->tap_policy == FFENC_TAP_DROP_NEWEST)
+        {
+            pthread_mutex_unlock(&ffe_reserved->tap_mutex);
+
+            ffstats_write_begin(&ffe_reserved->output_sequence);
+            ffe_reserved->output_stats.tap_dropped++;
+            ffstats_write_end(&ffe_reserved->output_sequence);
+            return;
+        }
+
+        dropped = ffe_reserved->tapped.front().frame;
+        ffe_reserved->tapped.pop_front();
+    }
+
+    __sync_add_and_fetch(&((ffenc_shared*) frame->opaque)->references, 1);
+    ffe_reserved->tapped.push_back(tapped);
+    pthread_cond_signal(&ffe_reserved->tap_cond);
+
+    pthread_mutex_unlock(&ffe_reserved->tap_mutex);
+
+    if (dropped)
+    {
+        release_frame(dropped);
+
+        ffstats_write_begin(&ffe_reserved->output_sequence);
+        ffe_reserved->output_stats.tap_dropped++;
+        ffstats_write_end(&ffe_reserved->output_sequence);
+    }
+}
+
+/**
+ * Pass the frames the encoding thread shared to the tap callback,
+ * until the encoder stopped and none are left.
+ */
+void* tapping_thread(void* arg)
+{
+    ffenc_context* ffe_context = (ffenc_context*) arg;
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+
+    FFTRACE_THREAD_NAME("ffenc_tap");
+
+    while (true)
+    {
+        pthread_mutex_lock(&ffe_reserved->tap_mutex);
+
+        while (ffe_reserved->tapped.empty() && ffe_reserved->tapping)
+        {
+            pthread_cond_wait(&ffe_reserved->tap_cond, &ffe_reserved->tap_mutex);
+        }
+
+        if (ffe_reserved->tapped.empty())
+        {
+            pthread_mutex_unlock(&ffe_reserved->tap_mutex);
+            break;
+        }
+
+        ffenc_tapped tapped = ffe_reserved->tapped.front();
+        ffe_reserved->tapped.pop_front();
+
+        pthread_mutex_unlock(&ffe_reserved->tap_mutex);
+
+        ffstats_write_begin(&ffe_reserved->tap_sequence);
+        ffstats_histogram_add(&ffe_reserved->tap_lag, av_gettime() - tapped.tap_time);
+        ffe_reserved->tap_frames++;
+        ffstats_write_end(&ffe_reserved->tap_sequence);
+
+        FFTRACE_BEGIN("ffenc_tap", tapped.frame_number);
+        ffe_reserved->tap_callback(ffe_context, tapped.frame, tapped.frame_number, ffe_reserved->tap_callback_arg);
+        FFTRACE_END("ffenc_tap", tapped.frame_number);
+
+        release_frame(tapped.frame);
+    }
+
+    return 0;
+}
+
 void* encoding_thread(void* arg)
 {
     ffenc_context* ffe_context = (ffenc_context*) arg;
@@ -164,21 +928,87 @@ void* encoding_thread(void* arg)
     AVPacket packet;
     int got_packet;
 
-    while (ffe_reserved->running || !ffe_reserved->frames.empty())
+    bool denoise = ffe_reserved->denoise_strength > 0;
+    bool tap = ffe_reserved->tap_task != NULL;
+
+    // frames are encoded in the order they were added
+    int64_t frame_number = 0;
+
+    // the last frame encoded, kept to compare with when skipping
+    // or to copy static macroblocks from
+    AVFrame *reference = NULL;
+    ffenc_skip_mode skip_mode = ffe_reserved->skip_mode;
+    int gop_size = FFMAX(codec_context->gop_size, 1);
+
+    bool roi = ffe_reserved->roi_threshold > 0 || ffe_reserved->roi_callback;
+    bool keep_reference = skip_mode != FFENC_SKIP_OFF || roi;
+    int mb_width = (codec_context->width + 15) / 16;
+    int mb_height = (codec_context->height + 15) / 16;
+    uint8_t *mb_map = roi ? (uint8_t*) malloc(mb_width * mb_height) : NULL;
+
+    // frames given to the encoder, to find the frame of each packet
+    std::deque<ffenc_pending> pending;
+
+    FFTRACE_THREAD_NAME("ffenc");
+    ffsched_apply(FFSCHED_ENCODE);
+
+    AVFrame *frame;
+
+    while ((frame = denoise ? next_denoised_frame(ffe_reserved, frame_number)
+            : next_frame(ffe_reserved, frame_number, true)))
     {
-        if (ffe_reserved->frames.empty())
+        if (ffe_reserved->frame_callback) ffe_reserved->frame_callback(
+                ffe_context, frame, ffe_reserved->frame_callback_arg);
+
+        AVFrame *input = frame;
+
+        // the timestamps count the frames that are skipped, and match
+        // the packets to their quality sources
+        frame->pts = frame_number;
+
+        if (skip_mode != FFENC_SKIP_OFF)
         {
-            pthread_mutex_lock(&ffe_reserved->reading_mutex);
-            pthread_cond_wait(&ffe_reserved->read_cond, &ffe_reserved->reading_mutex);
-            pthread_mutex_unlock(&ffe_reserved->reading_mutex);
-            continue;
+            // keyframes stay where they would have been without skipping
+            bool key_frame = frame_number % gop_size == 0;
+            frame->pict_type = key_frame ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+
+            if (!key_frame && reference && is_static(ffe_reserved, codec_context, frame, reference))
+            {
+                ffstats_write_begin(&ffe_reserved->output_sequence);
+                ffe_reserved->output_stats.frames_skipped++;
+                ffstats_write_end(&ffe_reserved->output_sequence);
+
+                input = reference;
+                input->pict_type = AV_PICTURE_TYPE_NONE;
+                input->pts = frame_number;
+            }
         }
 
-        AVFrame *frame = ffe_reserved->frames.front();
-        ffe_reserved->frames.pop_front();
+        // measure against the camera frame, before macroblocks are frozen to the reference,
+        // which the denoising thread already added before filtering it
+        if (ffe_reserved->ffq_context && !denoise) ffquality_add_source(ffe_reserved->ffq_context, input);
 
-        if (ffe_reserved->frame_callback) ffe_reserved->frame_callback(
-                ffe_context, frame, ffe_reserved->frame_callback_arg);
+        // keyframes refresh the whole picture, so no macroblock stays frozen past one
+        if (roi && input == frame && reference && frame_number % gop_size != 0)
+        {
+            int64_t roi_start = av_gettime();
+
+            ffmotion_mb_map(frame->data[0], frame->linesize[0], reference->data[0], reference->linesize[0],
+                    codec_context->width, codec_context->height, mb_map, mb_width);
+
+            if (ffe_reserved->roi_callback) ffe_reserved->roi_callback(ffe_context, frame, mb_map,
+                    mb_width, mb_height, ffe_reserved->roi_callback_arg);
+
+            int frozen = freeze_macroblocks(codec_context, frame, reference, mb_map,
+                    mb_width, mb_height, ffe_reserved->roi_threshold);
+
+            ffstats_write_begin(&ffe_reserved->output_sequence);
+            ffe_reserved->output_stats.mbs_frozen += frozen;
+            ffe_reserved->output_stats.roi_time += av_gettime() - roi_start;
+            ffstats_write_end(&ffe_reserved->output_sequence);
+        }
+
+        if (tap) tap_frame(ffe_reserved, frame, frame_number);
 
         // reset the AVPacket
         av_init_packet(&packet);
@@ -186,19 +1016,64 @@ void* encoding_thread(void* arg)
         packet.size = encode_buffer_len;
 
         got_packet = 0;
-        int encode_result = avcodec_encode_video2(codec_context, &packet, frame, &got_packet);
+
+        ffenc_pending entry;
+        entry.pts = input->pts;
+        entry.frame_number = frame_number;
+        pending.push_back(entry);
+
+        // a codec that drops frames without an error never returns their packets
+        if (pending.size() > LATENCY_FRAMES) pending.pop_front();
+
+        int64_t encode_start = av_gettime();
+        FFTRACE_BEGIN("avcodec_encode_video2", frame_number);
+        int encode_result = avcodec_encode_video2(codec_context, &packet, input, &got_packet);
+        FFTRACE_END("avcodec_encode_video2", frame_number);
+        int64_t encode_time = av_gettime() - encode_start;
+
+        ffstats_write_begin(&ffe_reserved->output_sequence);
+        ffstats_histogram_add(&ffe_reserved->output_stats.encode_time, encode_time);
+        if (input != frame) ffe_reserved->output_stats.repeat_encode_time += encode_time;
+        else
+        {
+            ffe_reserved->output_stats.full_frames++;
+            ffe_reserved->output_stats.full_encode_time += encode_time;
+        }
+        if (encode_result < 0) ffe_reserved->output_stats.frames_dropped++;
+        ffstats_write_end(&ffe_reserved->output_sequence);
+
+        if (encode_result < 0) pending.pop_back();
 
         if (encode_result == 0 && got_packet > 0)
         {
-            if (ffe_reserved->write_callback) ffe_reserved->write_callback(ffe_context,
-                    packet.data, packet.size, ffe_reserved->write_callback_arg);
+            write_packet(ffe_context, &packet, encode_time, frame_number, &pending);
+        }
+
+        if (keep_reference && input == frame)
+        {
+            // the encoder has taken its copy, so the frame becomes the reference
+            if (reference) release_frame(reference);
+
+            reference = frame;
+        }
+        else
+        {
+            release_frame(frame);
         }
 
-        free(frame->data[0]);
-        av_free(frame);
         frame = NULL;
+
+        frame_number++;
     }
 
+    if (reference)
+    {
+        release_frame(reference);
+        reference = NULL;
+    }
+
+    free(mb_map);
+
     do
     {
         // reset the AVPacket
@@ -207,12 +1082,13 @@ void* encoding_thread(void* arg)
         packet.size = encode_buffer_len;
 
         got_packet = 0;
+        int64_t encode_start = av_gettime();
         int encode_result = avcodec_encode_video2(codec_context, &packet, NULL, &got_packet);
+        int64_t encode_time = av_gettime() - encode_start;
 
         if (encode_result == 0 && got_packet > 0)
         {
-            if (ffe_reserved->write_callback) ffe_reserved->write_callback(ffe_context,
-                    packet.data, packet.size, ffe_reserved->write_callback_arg);
+            write_packet(ffe_context, &packet, encode_time, frame_number, &pending);
         }
     }
     while (got_packet > 0);
@@ -221,18 +1097,208 @@ void* encoding_thread(void* arg)
     encode_buffer = NULL;
     encode_buffer_len = 0;
 
+    stop_tap(ffe_reserved);
+    stop_writer(ffe_reserved);
+
     if (ffe_reserved->close_callback) ffe_reserved->close_callback(
             ffe_context, ffe_reserved->close_callback_arg);
 
     return 0;
 }
 
+/**
+ * The average quantizer of the frame just coded, or -1 if the codec gives none.
+ */
+static double coded_qp(AVCodecContext *codec_context)
+{
+    AVFrame *coded_frame = codec_context->coded_frame;
+    if (!coded_frame) return -1;
+
+    if (coded_frame->qscale_table && coded_frame->qstride > 0)
+    {
+        int mb_width = (codec_context->width + 15) / 16;
+        int mb_height = (codec_context->height + 15) / 16;
+        int64_t sum = 0;
+
+        for (int y = 0; y < mb_height; y++)
+        {
+            const int8_t *row = &coded_frame->qscale_table[y * coded_frame->qstride];
+            for (int x = 0; x < mb_width; x++) sum += row[x];
+        }
+
+        return (double) sum / (mb_width * mb_height);
+    }
+
+    if (coded_frame->quality > 0) return (double) coded_frame->quality / FF_QP2LAMBDA;
+
+    return -1;
+}
+
+/**
+ * The number of the frame the packet was encoded from. Packets are matched by pts
+ * when the frames had one, and otherwise come out in the order frames went in.
+ */
+static int64_t packet_frame(AVPacket *packet, std::deque<ffenc_pending> *pending)
+{
+    if (pending->empty()) return -1;
+
+    std::deque<ffenc_pending>::iterator match = pending->begin();
+
+    if (packet->pts != AV_NOPTS_VALUE)
+    {
+        for (std::deque<ffenc_pending>::iterator it = pending->begin(); it != pending->end(); ++it)
+        {
+            if (it->pts == packet->pts)
+            {
+                match = it;
+                break;
+            }
+        }
+    }
+
+    int64_t frame_number = match->frame_number;
+    pending->erase(match);
+
+    return frame_number;
+}
+
+/**
+ * Copy the packet for the writing thread, which may fall behind
+ * the encoder without holding it up. frame_number is the last
+ * frame given to the encoder.
+ */
+void write_packet(ffenc_context *ffe_context, AVPacket *packet, int64_t encode_time,
+        int64_t frame_number, std::deque<ffenc_pending> *pending)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    AVCodecContext *codec_context = ffe_context->codec_context;
+
+    ffenc_outgoing outgoing;
+    ffenc_packet *description = &outgoing.description;
+    description->data = (uint8_t*) av_malloc(packet->size);
+    memcpy(description->data, packet->data, packet->size);
+    description->size = packet->size;
+    description->pts = packet->pts;
+    description->dts = packet->dts;
+    description->key_frame = packet->flags & AV_PKT_FLAG_KEY;
+    description->picture_type = codec_context->coded_frame ? codec_context->coded_frame->pict_type
+            : description->key_frame ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_P;
+    description->encode_time = encode_time;
+    description->qp = ffe_reserved->packet_callback ? coded_qp(codec_context) : -1;
+    description->frame_id = packet_frame(packet, pending);
+
+    // the time is lost once LATENCY_FRAMES more frames were added, counting
+    // those between the frame and the next one to be encoded and those queued
+    outgoing.add_time = -1;
+    int64_t frame_id = description->frame_id;
+    if (frame_id >= 0 && frame_number - frame_id + ffe_reserved->queue_depth < LATENCY_FRAMES)
+    {
+        outgoing.add_time = ffe_reserved->add_times[frame_id % LATENCY_FRAMES];
+    }
+
+    pthread_mutex_lock(&ffe_reserved->write_mutex);
+    ffe_reserved->outgoing.push_back(outgoing);
+    pthread_cond_signal(&ffe_reserved->write_cond);
+    pthread_mutex_unlock(&ffe_reserved->write_mutex);
+}
+
+static void output_packet(ffenc_context *ffe_context, ffenc_outgoing *outgoing)
+{
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+    ffenc_packet *description = &outgoing->description;
+
+    FFTRACE_BEGIN("write", ffe_reserved->packets_written);
+
+    if (ffe_reserved->write_callback) ffe_reserved->write_callback(ffe_context,
+            description->data, description->size, ffe_reserved->write_callback_arg);
+
+    if (ffe_reserved->packet_callback) ffe_reserved->packet_callback(ffe_context,
+            description, ffe_reserved->packet_callback_arg);
+
+    FFTRACE_END("write", ffe_reserved->packets_written);
+
+    if (ffe_reserved->ffq_context) ffquality_add_packet(ffe_reserved->ffq_context,
+            description->data, description->size, description->pts);
+
+    // index after the write so an entry never points past the data
+    if (ffe_reserved->ffi_context)
+    {
+        ffindex_entry entry;
+        entry.offset = ffe_reserved->bytes_written;
+        entry.size = description->size;
+        entry.pts = description->pts != AV_NOPTS_VALUE ? description->pts : ffe_reserved->packets_written;
+        entry.picture_type = description->picture_type;
+        entry.flags = description->key_frame ? FFINDEX_GOP_START : 0;
+        ffindex_add(ffe_reserved->ffi_context, &entry);
+    }
+
+    int64_t now = av_gettime();
+
+    ffe_reserved->bytes_written += description->size;
+    ffe_reserved->packets_written++;
+
+    ffstats_write_begin(&ffe_reserved->write_sequence);
+    if (outgoing->add_time >= 0) ffstats_histogram_add(&ffe_reserved->write_stats.latency, now - outgoing->add_time);
+    ffe_reserved->write_stats.frames_out++;
+    ffe_reserved->write_stats.bytes_out += description->size;
+    ffstats_rate_add(&ffe_reserved->write_stats.rate, description->size, now);
+    ffstats_write_end(&ffe_reserved->write_sequence);
+}
+
+/**
+ * Pass the packets the encoding thread copied to the write and packet
+ * callbacks under the writer's policy, until the encoder stopped and
+ * none are left.
+ */
+void* writing_thread(void* arg)
+{
+    ffenc_context* ffe_context = (ffenc_context*) arg;
+    ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
+
+    FFTRACE_THREAD_NAME("ffenc_write");
+    ffsched_apply(FFSCHED_WRITE);
+
+    while (true)
+    {
+        pthread_mutex_lock(&ffe_reserved->write_mutex);
+
+        while (ffe_reserved->outgoing.empty() && ffe_reserved->writing)
+        {
+            pthread_cond_wait(&ffe_reserved->write_cond, &ffe_reserved->write_mutex);
+        }
+
+        if (ffe_reserved->outgoing.empty())
+        {
+            pthread_mutex_unlock(&ffe_reserved->write_mutex);
+            break;
+        }
+
+        ffenc_outgoing outgoing = ffe_reserved->outgoing.front();
+        ffe_reserved->outgoing.pop_front();
+
+        pthread_mutex_unlock(&ffe_reserved->write_mutex);
+
+        output_packet(ffe_context, &outgoing);
+
+        av_free(outgoing.description.data);
+    }
+
+    return 0;
+}
+
 ffenc_error ffenc_add_frame(ffenc_context *ffe_context, AVFrame *frame)
 {
     ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
     if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
-    if (!ffe_reserved->running) return FFENC_NOT_RUNNING;
+    if (!ffe_reserved->running)
+    {
+        count_input(ffe_reserved, false);
+        return FFENC_NOT_RUNNING;
+    }
+    frame->opaque = NULL;
+    ffe_reserved->add_times[ffe_reserved->input_stats.frames_in % LATENCY_FRAMES] = av_gettime();
     ffe_reserved->frames.push_back(frame);
+    count_input(ffe_reserved, true);
     pthread_cond_signal(&ffe_reserved->read_cond);
     return FFENC_OK;
 }
@@ -243,15 +1309,33 @@ ffenc_error ffenc_add_frame(ffenc_context *ffe_context, camera_buffer_t* buf)
 
     ffenc_reserved *ffe_reserved = (ffenc_reserved*) ffe_context->reserved;
     if (!ffe_reserved) return FFENC_NOT_INITIALIZED;
-    if (!ffe_reserved->running) return FFENC_NOT_RUNNING;
+    if (!ffe_reserved->running)
+    {
+        count_input(ffe_reserved, false);
+        return FFENC_NOT_RUNNING;
+    }
 
     int64_t uv_offset = buf->framedesc.nv12.uv_offset;
     uint32_t height = buf->framedesc.nv12.height;
     uint32_t width = buf->framedesc.nv12.width;
     uint32_t stride = buf->framedesc.nv12.stride;
 
-    uint32_t _stride = width;
-    int64_t _uv_offset = _stride * height;
+    // the size of the frame once cropped and turned
+    int frame_width, frame_height;
+    AVCodecContext *codec_context = ffe_context->codec_context;
+
+    if (fforient_output_size(&ffe_reserved->orientation, width, height, &frame_width, &frame_height) != FFORIENT_OK
+            || frame_width != codec_context->width || frame_height != codec_context->height)
+    {
+        return FFENC_FRAME_NOT_SUPPORTED;
+    }
+
+    int64_t add_time = av_gettime();
+
+    FFTRACE_BEGIN("ffenc_add_frame", ffe_reserved->input_stats.frames_in);
+
+    uint32_t _stride = frame_width;
+    int64_t _uv_offset = _stride * frame_height;
 
     AVFrame *frame = avcodec_alloc_frame();
 
@@ -259,36 +1343,27 @@ ffenc_error ffenc_add_frame(ffenc_context *ffe_context, camera_buffer_t* buf)
     frame->linesize[1] = _stride / 2;
     frame->linesize[2] = _stride / 2;
 
-    frame->data[0] = (uint8_t*) malloc(width * height * 3 / 2);
+    frame->data[0] = (uint8_t*) malloc(frame_width * frame_height * 3 / 2);
     frame->data[1] = &frame->data[0][_uv_offset];
-    frame->data[2] = &frame->data[0][_uv_offset + ((width * height) / 4)];
+    frame->data[2] = &frame->data[0][_uv_offset + ((frame_width * frame_height) / 4)];
 
-    for (uint32_t i = 0; i < height; i++)
-    {
-        int64_t doff = i * _stride;
-        int64_t soff = i * stride;
-        memcpy(&frame->data[0][doff], &buf->framebuf[soff], width);
-    }
+    ffe_reserved->add_times[ffe_reserved->input_stats.frames_in % LATENCY_FRAMES] = add_time;
 
-    uint8_t *srcuv = &buf->framebuf[uv_offset];
-    uint8_t *destu = frame->data[1];
-    uint8_t *destv = frame->data[2];
-
-    for (uint32_t i = 0; i < height / 2; i++)
-    {
-        uint8_t* curuv = srcuv;
-        for (uint32_t j = 0; j < width / 2; j++)
-        {
-            *destu++ = *curuv++;
-            *destv++ = *curuv++;
-        }
-        srcuv += stride;
-    }
+    // one pass crops, turns and splits the chroma, and the luma of
+    // unturned frames is kept out of the camera thread's cache as
+    // the frame waits in the queue for the encoding thread
+    fforient_nv12_to_i420_parallel(&ffe_reserved->orientation, buf->framebuf, stride,
+            &buf->framebuf[uv_offset], stride, width, height,
+            frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1],
+            frame->data[2], frame->linesize[2], ffe_reserved->conversion_threads);
 
     ffe_reserved->frames.push_back(frame);
+    count_input(ffe_reserved, true);
 
     pthread_cond_signal(&ffe_reserved->read_cond);
 
+    FFTRACE_END("ffenc_add_frame", ffe_reserved->input_stats.frames_in - 1);
+
     return FFENC_OK;
 }
 
@@ -32,6 +32,11 @@ extern "C"
 
 #include <camera/camera_api.h>
 
+#include "ffbbindex.h"
+#include "ffbborient.h"
+#include "ffbbquality.h"
+#include "ffbbstats.h"
+
 typedef enum
 {
     FFENC_OK = 0,
@@ -40,9 +45,158 @@ typedef enum
     FFENC_FRAME_NOT_SUPPORTED,
     FFENC_NOT_RUNNING,
     FFENC_ALREADY_RUNNING,
-    FFENC_ALREADY_STOPPED
+    FFENC_ALREADY_STOPPED,
+    FFENC_THREAD_FAILED
 } ffenc_error;
 
+typedef enum
+{
+    FFENC_SKIP_OFF = 0,
+
+    /**
+     * Encode the last frame again in place of a static one. The encoder
+     * finds nothing has changed and writes a nearly empty frame, so raw
+     * streams keep their timing.
+     */
+    FFENC_SKIP_REPEAT
+} ffenc_skip_mode;
+
+typedef enum
+{
+    /**
+     * Leave the new frame out while the tap is full, so it sees runs
+     * of consecutive frames with gaps between them.
+     */
+    FFENC_TAP_DROP_NEWEST = 0,
+
+    /**
+     * Drop the oldest frame waiting for the tap to make room for the
+     * new one, so it always catches up to the latest frames.
+     */
+    FFENC_TAP_DROP_OLDEST
+} ffenc_tap_policy;
+
+/**
+ * A packet as it is written, with what the encoder knows of it, so
+ * muxers and indexers do not have to parse the stream for it.
+ */
+typedef struct
+{
+    uint8_t *data;
+    ssize_t size;
+
+    /**
+     * In codec_context->time_base, or AV_NOPTS_VALUE if the codec gave none.
+     */
+    int64_t pts;
+    int64_t dts;
+
+    bool key_frame;
+
+    /**
+     * An AVPictureType value, from codec_context->coded_frame, which
+     * describes the packet as long as there are no B-frames.
+     */
+    int picture_type;
+
+    /**
+     * Microseconds the avcodec_encode_video2 call that returned the
+     * packet took, which may have been for a later frame if the codec
+     * holds frames back.
+     */
+    int64_t encode_time;
+
+    /**
+     * The average quantizer of the macroblocks, or of the frame if the
+     * codec has no table of them, or -1 if it gives neither.
+     */
+    double qp;
+
+    /**
+     * The camera frame the packet was encoded from, numbered from 0 in
+     * the order frames were added, counting skipped ones, or -1 if it
+     * is not known.
+     */
+    int64_t frame_id;
+} ffenc_packet;
+
+typedef struct
+{
+    /**
+     * Frames accepted by ffenc_add_frame.
+     */
+    int64_t frames_in;
+
+    /**
+     * Packets written.
+     */
+    int64_t frames_out;
+
+    /**
+     * Frames added while the encoder was not running, or that failed to encode.
+     */
+    int64_t frames_dropped;
+
+    /**
+     * Frames waiting for the encoding thread.
+     */
+    int queue_depth;
+    int queue_peak;
+
+    /**
+     * Time spent in avcodec_encode_video2 per frame.
+     */
+    ffstats_times encode_time;
+
+    /**
+     * Time from ffenc_add_frame being called to the packet of the frame
+     * being written, for packets whose frame_id is known.
+     */
+    ffstats_times latency;
+
+    int64_t bytes_out;
+    int64_t bitrate;
+
+    /**
+     * Frames skipped as static, the time spent comparing frames, and
+     * an estimate of the encoding time saved less that time and the
+     * time spent encoding repeated frames, in microseconds.
+     */
+    int64_t frames_skipped;
+    int64_t skip_detect_time;
+    int64_t skip_time_saved;
+
+    /**
+     * Macroblocks copied from the previous frame as static, and the time
+     * spent mapping and copying them in microseconds.
+     */
+    int64_t mbs_frozen;
+    int64_t roi_time;
+
+    /**
+     * Microseconds the denoising thread spent filtering each frame.
+     */
+    ffstats_times denoise_time;
+
+    /**
+     * Frames passed to the tap callback, and those dropped because it
+     * had fallen behind.
+     */
+    int64_t tap_frames;
+    int64_t tap_dropped;
+
+    /**
+     * Time from the encoding thread handing a frame to the tap to the
+     * tap callback being called with it.
+     */
+    ffstats_times tap_lag;
+
+    /**
+     * Times the encoding thread ran out of frames and had to wait.
+     */
+    int64_t stalls;
+} ffenc_stats;
+
 typedef struct
 {
     /**
@@ -70,14 +224,123 @@ ffenc_error ffenc_set_frame_callback(ffenc_context *ffe_context,
         void (*frame_callback)(ffenc_context *ffe_context, AVFrame *frame, void *arg),
         void *arg);
 
+/**
+ * Share every frame with a callback on a thread of its own, for analytics
+ * that would slow the encoder down as a frame callback. The frames are
+ * passed as they are encoded, after macroblocks are frozen, without a
+ * copy: the planes are held by reference until the callback returns,
+ * and must not be written to. Their other fields may still be changed
+ * by the encoder. Up to depth frames wait for the callback, and the
+ * policy decides which is dropped when it falls further behind, so the
+ * encoding thread never waits for it. Frames still waiting when the
+ * encoder stops are passed before the close callback. Pass NULL to
+ * remove the tap. This may not be changed while running.
+ */
+ffenc_error ffenc_set_tap(ffenc_context *ffe_context, int depth, ffenc_tap_policy policy,
+        void (*tap_callback)(ffenc_context *ffe_context, const AVFrame *frame, int64_t frame_number, void *arg),
+        void *arg);
+
+/**
+ * Called with every packet on a writing thread of its own, which runs
+ * under the FFSCHED_WRITE policy and may fall behind the encoder without
+ * holding it up. Packets still waiting when the encoder stops are written
+ * before the close callback.
+ */
 ffenc_error ffenc_set_write_callback(ffenc_context *ffe_context,
         void (*write_callback)(ffenc_context *ffe_context, uint8_t *buf, ssize_t size, void *arg),
         void *arg);
 
+/**
+ * Called with every packet on the writing thread, after the write
+ * callback if both are set. The packet and its data are only valid
+ * during the call.
+ */
+ffenc_error ffenc_set_packet_callback(ffenc_context *ffe_context,
+        void (*packet_callback)(ffenc_context *ffe_context, const ffenc_packet *packet, void *arg),
+        void *arg);
+
 ffenc_error ffenc_set_close_callback(ffenc_context *ffe_context,
         void (*close_callback)(ffenc_context *ffe_context, void *arg),
         void *arg);
 
+/**
+ * Add an entry to the index for every packet written. The index is
+ * not owned by the encoder and must outlive the encoding thread.
+ */
+ffenc_error ffenc_set_index(ffenc_context *ffe_context, ffindex_context *ffi_context);
+
+/**
+ * Pass every camera frame encoded, as it was before denoising or freezing
+ * macroblocks, and every packet written to an open quality context to
+ * measure the output against. The context is not owned
+ * by the encoder and must be closed once the encoding thread died.
+ */
+ffenc_error ffenc_set_quality(ffenc_context *ffe_context, ffquality_context *ffq_context);
+
+/**
+ * Crop, turn and mirror camera frames as they are copied, rather than
+ * only when they are shown, so recordings come out the way the user saw
+ * them. The codec context must be opened with the size fforient_output_size
+ * gives, or camera frames are not supported. Pass NULL to copy frames as
+ * they are. This may not be changed while running.
+ */
+ffenc_error ffenc_set_orientation(ffenc_context *ffe_context, const fforient_transform *transform);
+
+/**
+ * Convert whole camera frames in bands of rows on up to threads threads,
+ * the camera thread and ffpool workers, or one per processor online for 0.
+ * Bands hold at least 128 KB of output, so small frames stay on the
+ * camera thread whatever the count, see fforient_nv12_to_i420_parallel.
+ * 1 by default. This may not be changed while running.
+ */
+ffenc_error ffenc_set_conversion_threads(ffenc_context *ffe_context, int threads);
+
+/**
+ * Skip frames whose luma differs from the last frame encoded by less than
+ * threshold on average, sampling every 4th row. Keyframes are still forced
+ * every codec_context->gop_size frames added and never skipped, and frames
+ * are numbered by the order they were added in pts. This may not be
+ * changed while running.
+ */
+ffenc_error ffenc_set_skip(ffenc_context *ffe_context, ffenc_skip_mode mode, double threshold);
+
+/**
+ * Map the importance of each 16x16 macroblock of every frame that is not
+ * a keyframe, and replace the macroblocks less important than threshold
+ * with those of the last frame encoded. The encoder codes them as skipped,
+ * so the bits of a static background go to the moving parts of the
+ * picture at the same bitrate.
+ *
+ * The map is the mean absolute luma difference from the last frame
+ * encoded, computed on the queued frame in place, row by row with a
+ * stride of mb_width. The callback may change it before it is used, or
+ * replace it with a map of its own, such as one marking faces with 255.
+ * The threshold may be 0 for a callback to only look at the map.
+ * This may not be changed while running.
+ */
+ffenc_error ffenc_set_roi(ffenc_context *ffe_context, int threshold,
+        void (*roi_callback)(ffenc_context *ffe_context, AVFrame *frame, uint8_t *map,
+                int mb_width, int mb_height, void *arg),
+        void *arg);
+
+/**
+ * Filter camera frames with a motion adaptive temporal denoiser on a
+ * thread of their own before they are encoded, so the encoder does not
+ * spend the bitrate on sensor noise in low light. Pixels of Y, U and V
+ * that changed by less than threshold since the last frame keep
+ * 1/2^strength of the new value, the rest of the filtered history,
+ * while those that moved more are left alone. A strength of 0 turns
+ * the filter off. This may not be changed while running.
+ */
+ffenc_error ffenc_set_denoise(ffenc_context *ffe_context, int strength, int threshold);
+
+/**
+ * Take a snapshot of the statistics since the context was reset. This
+ * never blocks the camera or encoding thread and may be called from any
+ * thread, as often as needed. Frames must only be added from one thread.
+ */
+ffenc_error ffenc_get_stats(ffenc_context *ffe_context, ffenc_stats *stats);
+
 /**
  * Close the context.
  * This will also close the AVCodecContext if not already closed.
@@ -85,13 +348,13 @@ ffenc_error ffenc_set_close_callback(ffenc_context *ffe_context,
 ffenc_error ffenc_close(ffenc_context *ffe_context);
 
 /**
- * Free the context.
+ * Free the context, waiting for the encoding task to return.
  */
 ffenc_error ffenc_free(ffenc_context *ffe_context);
 
 /**
  * Start recording and encoding the camera frames.
- * Encoding will begin on a background thread.
+ * Encoding will begin as a task on the ffpool workers.
  */
 ffenc_error ffenc_start(ffenc_context *ffe_context);
 
@@ -103,7 +366,8 @@ ffenc_error ffenc_stop(ffenc_context *ffe_context);
 
 /**
  * Add an AVFrame. The frame and frame->data[0] passed into this
- * method will be freed by the encoding thread.
+ * method will be freed by the encoding thread, and frame->opaque
+ * is used by the encoder.
  */
 ffenc_error ffenc_add_frame(ffenc_context *ffe_context, AVFrame *frame);
 
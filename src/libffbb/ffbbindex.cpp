@@ -0,0 +1,395 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbindex.h"
+
+extern "C"
+{
+#include <libavutil/intreadwrite.h>
+}
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FFINDEX_MAGIC "FFBBIDX1"
+#define FFINDEX_HEADER_SIZE 16
+#define FFINDEX_RECORD_SIZE 24
+
+typedef struct
+{
+    int fd;
+    pthread_mutex_t mutex;
+    ffindex_entry *entries;
+    int64_t count;
+    int64_t capacity;
+    // positions of the entries flagged FFINDEX_GOP_START
+    int64_t *gops;
+    int64_t gop_count;
+    int64_t gop_capacity;
+} ffindex_reserved;
+
+static void ffindex_free_entries(ffindex_reserved *ffi_reserved);
+static void ffindex_append(ffindex_reserved *ffi_reserved, const ffindex_entry *entry);
+
+ffindex_context *ffindex_alloc()
+{
+    ffindex_context *ffi_context = (ffindex_context*) malloc(sizeof(ffindex_context));
+    memset(ffi_context, 0, sizeof(ffindex_context));
+
+    ffindex_reset(ffi_context);
+
+    return ffi_context;
+}
+
+void ffindex_reset(ffindex_context *ffi_context)
+{
+    ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+
+    if (ffi_reserved)
+    {
+        if (ffi_reserved->fd >= 0) close(ffi_reserved->fd);
+        ffindex_free_entries(ffi_reserved);
+        pthread_mutex_destroy(&ffi_reserved->mutex);
+    }
+
+    if (!ffi_reserved) ffi_reserved = (ffindex_reserved*) malloc(sizeof(ffindex_reserved));
+    memset(ffi_reserved, 0, sizeof(ffindex_reserved));
+
+    ffi_reserved->fd = -1;
+    pthread_mutex_init(&ffi_reserved->mutex, 0);
+
+    memset(ffi_context, 0, sizeof(ffindex_context));
+    ffi_context->time_base.num = 1;
+    ffi_context->time_base.den = 30;
+    ffi_context->reserved = ffi_reserved;
+}
+
+ffindex_error ffindex_free(ffindex_context *ffi_context)
+{
+    if (ffi_context->reserved)
+    {
+        ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+
+        if (ffi_reserved->fd >= 0) close(ffi_reserved->fd);
+        ffindex_free_entries(ffi_reserved);
+        pthread_mutex_destroy(&ffi_reserved->mutex);
+
+        free(ffi_context->reserved);
+        ffi_context->reserved = NULL;
+    }
+
+    free(ffi_context);
+
+    return FFINDEX_OK;
+}
+
+ffindex_error ffindex_open_sidecar(ffindex_context *ffi_context, const char *path)
+{
+    ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+    if (!ffi_reserved) return FFINDEX_NOT_INITIALIZED;
+    if (ffi_reserved->fd >= 0) return FFINDEX_ALREADY_OPEN;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0)
+    {
+        fprintf(stderr, "could not open %s: %d: %s\n", path, errno, strerror(errno));
+        return FFINDEX_OPEN_FAILED;
+    }
+
+    uint8_t header[FFINDEX_HEADER_SIZE];
+    memcpy(header, FFINDEX_MAGIC, 8);
+    AV_WL32(&header[8], ffi_context->time_base.num);
+    AV_WL32(&header[12], ffi_context->time_base.den);
+
+    if (write(fd, header, FFINDEX_HEADER_SIZE) != FFINDEX_HEADER_SIZE)
+    {
+        close(fd);
+        return FFINDEX_WRITE_FAILED;
+    }
+
+    ffi_reserved->fd = fd;
+
+    return FFINDEX_OK;
+}
+
+ffindex_error ffindex_close_sidecar(ffindex_context *ffi_context)
+{
+    ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+    if (!ffi_reserved) return FFINDEX_NOT_INITIALIZED;
+    if (ffi_reserved->fd < 0) return FFINDEX_NOT_OPEN;
+
+    pthread_mutex_lock(&ffi_reserved->mutex);
+    fsync(ffi_reserved->fd);
+    close(ffi_reserved->fd);
+    ffi_reserved->fd = -1;
+    pthread_mutex_unlock(&ffi_reserved->mutex);
+
+    return FFINDEX_OK;
+}
+
+ffindex_error ffindex_load(ffindex_context *ffi_context, const char *path, int64_t stream_length)
+{
+    ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+    if (!ffi_reserved) return FFINDEX_NOT_INITIALIZED;
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "could not open %s: %d: %s\n", path, errno, strerror(errno));
+        return FFINDEX_OPEN_FAILED;
+    }
+
+    uint8_t header[FFINDEX_HEADER_SIZE];
+    if (fread(header, 1, FFINDEX_HEADER_SIZE, file) != FFINDEX_HEADER_SIZE ||
+            memcmp(header, FFINDEX_MAGIC, 8) != 0)
+    {
+        fclose(file);
+        return FFINDEX_INVALID_FILE;
+    }
+
+    pthread_mutex_lock(&ffi_reserved->mutex);
+
+    ffindex_free_entries(ffi_reserved);
+    ffi_context->time_base.num = AV_RL32(&header[8]);
+    ffi_context->time_base.den = AV_RL32(&header[12]);
+
+    uint8_t record[FFINDEX_RECORD_SIZE];
+
+    // a crash can leave a partial record at the end, fread drops it
+    while (fread(record, 1, FFINDEX_RECORD_SIZE, file) == FFINDEX_RECORD_SIZE)
+    {
+        ffindex_entry entry;
+        entry.offset = AV_RL64(&record[0]);
+        entry.pts = AV_RL64(&record[8]);
+        entry.size = AV_RL32(&record[16]);
+        entry.picture_type = record[20];
+        entry.flags = record[21];
+
+        // the stream may have lost its unflushed tail in the same crash
+        if (stream_length >= 0 && entry.offset + entry.size > stream_length) break;
+
+        ffindex_append(ffi_reserved, &entry);
+    }
+
+    pthread_mutex_unlock(&ffi_reserved->mutex);
+
+    fclose(file);
+
+    return FFINDEX_OK;
+}
+
+ffindex_error ffindex_add(ffindex_context *ffi_context, const ffindex_entry *entry)
+{
+    ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+    if (!ffi_reserved) return FFINDEX_NOT_INITIALIZED;
+
+    ffindex_error error = FFINDEX_OK;
+
+    pthread_mutex_lock(&ffi_reserved->mutex);
+
+    ffindex_append(ffi_reserved, entry);
+
+    if (ffi_reserved->fd >= 0)
+    {
+        uint8_t record[FFINDEX_RECORD_SIZE];
+        AV_WL64(&record[0], entry->offset);
+        AV_WL64(&record[8], entry->pts);
+        AV_WL32(&record[16], entry->size);
+        record[20] = entry->picture_type;
+        record[21] = entry->flags;
+        record[22] = 0;
+        record[23] = 0;
+
+        // one write per record keeps each record whole in the file
+        if (write(ffi_reserved->fd, record, FFINDEX_RECORD_SIZE) != FFINDEX_RECORD_SIZE)
+        {
+            error = FFINDEX_WRITE_FAILED;
+        }
+    }
+
+    pthread_mutex_unlock(&ffi_reserved->mutex);
+
+    return error;
+}
+
+int64_t ffindex_count(ffindex_context *ffi_context)
+{
+    ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+    if (!ffi_reserved) return 0;
+
+    pthread_mutex_lock(&ffi_reserved->mutex);
+    int64_t count = ffi_reserved->count;
+    pthread_mutex_unlock(&ffi_reserved->mutex);
+
+    return count;
+}
+
+ffindex_error ffindex_get(ffindex_context *ffi_context, int64_t position, ffindex_entry *entry)
+{
+    ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+    if (!ffi_reserved) return FFINDEX_NOT_INITIALIZED;
+
+    pthread_mutex_lock(&ffi_reserved->mutex);
+
+    bool found = position >= 0 && position < ffi_reserved->count;
+    if (found) *entry = ffi_reserved->entries[position];
+
+    pthread_mutex_unlock(&ffi_reserved->mutex);
+
+    return found ? FFINDEX_OK : FFINDEX_OUT_OF_RANGE;
+}
+
+int64_t ffindex_gop_count(ffindex_context *ffi_context)
+{
+    ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+    if (!ffi_reserved) return 0;
+
+    pthread_mutex_lock(&ffi_reserved->mutex);
+    int64_t count = ffi_reserved->gop_count;
+    pthread_mutex_unlock(&ffi_reserved->mutex);
+
+    return count;
+}
+
+ffindex_error ffindex_get_gop(ffindex_context *ffi_context, int64_t n, ffindex_gop *gop)
+{
+    ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+    if (!ffi_reserved) return FFINDEX_NOT_INITIALIZED;
+
+    pthread_mutex_lock(&ffi_reserved->mutex);
+
+    bool found = n >= 0 && n < ffi_reserved->gop_count;
+
+    if (found)
+    {
+        ffindex_entry *entries = ffi_reserved->entries;
+        int64_t first = ffi_reserved->gops[n];
+        int64_t next = n + 1 < ffi_reserved->gop_count ? ffi_reserved->gops[n + 1] : ffi_reserved->count;
+        int64_t end = next < ffi_reserved->count ? entries[next].offset
+                : entries[next - 1].offset + entries[next - 1].size;
+
+        gop->offset = entries[first].offset;
+        gop->size = end - gop->offset;
+        gop->first_entry = first;
+        gop->entry_count = next - first;
+    }
+
+    pthread_mutex_unlock(&ffi_reserved->mutex);
+
+    return found ? FFINDEX_OK : FFINDEX_OUT_OF_RANGE;
+}
+
+int64_t ffindex_find(ffindex_context *ffi_context, int64_t pts)
+{
+    ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+    if (!ffi_reserved) return -1;
+
+    pthread_mutex_lock(&ffi_reserved->mutex);
+
+    ffindex_entry *entries = ffi_reserved->entries;
+    int64_t *gops = ffi_reserved->gops;
+
+    // GOP starts are I-frames, so their pts increase even when B-frames reorder the rest
+    int64_t low = 0;
+    int64_t high = ffi_reserved->gop_count - 1;
+    while (low < high)
+    {
+        int64_t mid = (low + high + 1) / 2;
+        if (entries[gops[mid]].pts <= pts) low = mid;
+        else high = mid - 1;
+    }
+
+    int64_t found = -1;
+
+    if (ffi_reserved->gop_count && entries[gops[low]].pts <= pts)
+    {
+        int64_t start = gops[low];
+        int64_t end = low + 1 < ffi_reserved->gop_count ? gops[low + 1] : ffi_reserved->count;
+
+        found = start;
+        for (int64_t i = start + 1; i < end; i++)
+        {
+            if (entries[i].pts <= pts && entries[i].pts > entries[found].pts) found = i;
+        }
+    }
+
+    pthread_mutex_unlock(&ffi_reserved->mutex);
+
+    return found;
+}
+
+int64_t ffindex_find_gop(ffindex_context *ffi_context, int64_t position)
+{
+    ffindex_reserved *ffi_reserved = (ffindex_reserved*) ffi_context->reserved;
+    if (!ffi_reserved) return -1;
+
+    pthread_mutex_lock(&ffi_reserved->mutex);
+
+    int64_t *gops = ffi_reserved->gops;
+
+    int64_t low = 0;
+    int64_t high = ffi_reserved->gop_count - 1;
+    while (low < high)
+    {
+        int64_t mid = (low + high + 1) / 2;
+        if (gops[mid] <= position) low = mid;
+        else high = mid - 1;
+    }
+
+    int64_t found = ffi_reserved->gop_count && gops[low] <= position ? gops[low] : -1;
+
+    pthread_mutex_unlock(&ffi_reserved->mutex);
+
+    return found;
+}
+
+static void ffindex_append(ffindex_reserved *ffi_reserved, const ffindex_entry *entry)
+{
+    if (ffi_reserved->count == ffi_reserved->capacity)
+    {
+        ffi_reserved->capacity = ffi_reserved->capacity ? ffi_reserved->capacity * 2 : 1024;
+        ffi_reserved->entries = (ffindex_entry*) realloc(ffi_reserved->entries,
+                ffi_reserved->capacity * sizeof(ffindex_entry));
+    }
+
+    if (entry->flags & FFINDEX_GOP_START)
+    {
+        if (ffi_reserved->gop_count == ffi_reserved->gop_capacity)
+        {
+            ffi_reserved->gop_capacity = ffi_reserved->gop_capacity ? ffi_reserved->gop_capacity * 2 : 64;
+            ffi_reserved->gops = (int64_t*) realloc(ffi_reserved->gops,
+                    ffi_reserved->gop_capacity * sizeof(int64_t));
+        }
+
+        ffi_reserved->gops[ffi_reserved->gop_count++] = ffi_reserved->count;
+    }
+
+    ffi_reserved->entries[ffi_reserved->count++] = *entry;
+}
+
+static void ffindex_free_entries(ffindex_reserved *ffi_reserved)
+{
+    free(ffi_reserved->entries);
+    ffi_reserved->entries = NULL;
+    ffi_reserved->count = 0;
+    ffi_reserved->capacity = 0;
+
+    free(ffi_reserved->gops);
+    ffi_reserved->gops = NULL;
+    ffi_reserved->gop_count = 0;
+    ffi_reserved->gop_capacity = 0;
+}
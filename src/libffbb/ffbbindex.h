@@ -0,0 +1,166 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBINDEX_H
+#define FFBBINDEX_H
+
+// include math.h otherwise it will get included
+// by avformat.h and cause duplicate definition
+// errors because of C vs C++ functions
+#include <math.h>
+
+extern "C"
+{
+#define UINT64_C uint64_t
+#define INT64_C int64_t
+#include <libavformat/avformat.h>
+}
+
+#include <sys/types.h>
+
+/**
+ * Set on the first frame of a GOP, the frame decoding can start from.
+ */
+#define FFINDEX_GOP_START 0x01
+
+typedef enum
+{
+    FFINDEX_OK = 0,
+    FFINDEX_NOT_INITIALIZED,
+    FFINDEX_OPEN_FAILED,
+    FFINDEX_WRITE_FAILED,
+    FFINDEX_INVALID_FILE,
+    FFINDEX_ALREADY_OPEN,
+    FFINDEX_NOT_OPEN,
+    FFINDEX_OUT_OF_RANGE
+} ffindex_error;
+
+typedef struct
+{
+    /**
+     * Byte offset of the frame in the elementary stream.
+     */
+    int64_t offset;
+
+    /**
+     * Presentation timestamp in units of the index time_base.
+     */
+    int64_t pts;
+
+    int32_t size;
+
+    /**
+     * An AVPictureType value.
+     */
+    uint8_t picture_type;
+
+    uint8_t flags;
+} ffindex_entry;
+
+typedef struct
+{
+    /**
+     * Byte offset of the GOP start entry.
+     */
+    int64_t offset;
+
+    /**
+     * Bytes up to the next GOP, or to the end of the last entry.
+     */
+    int64_t size;
+
+    int64_t first_entry;
+    int64_t entry_count;
+} ffindex_gop;
+
+typedef struct
+{
+    /**
+     * The time base of each entry pts.
+     * This is written to and read from the sidecar header.
+     */
+    AVRational time_base;
+
+    /**
+     * For internal use. Do not use.
+     */
+    void *reserved;
+} ffindex_context;
+
+/**
+ * Allocate the context with default values.
+ */
+ffindex_context *ffindex_alloc(void);
+
+/**
+ * Reset the context with default values.
+ * This drops all entries and closes the sidecar if open.
+ */
+void ffindex_reset(ffindex_context *ffi_context);
+
+/**
+ * Free the context.
+ */
+ffindex_error ffindex_free(ffindex_context *ffi_context);
+
+/**
+ * Create the sidecar file at the given path. Every entry added after
+ * this is also appended to the file as a fixed size record, so a
+ * recording cut short by a crash keeps an index of what was written.
+ */
+ffindex_error ffindex_open_sidecar(ffindex_context *ffi_context, const char *path);
+
+ffindex_error ffindex_close_sidecar(ffindex_context *ffi_context);
+
+/**
+ * Read a sidecar written by ffindex_open_sidecar, replacing any entries.
+ * A partial trailing record is ignored, as are entries that reach past
+ * stream_length. Pass -1 if the stream length is not known.
+ */
+ffindex_error ffindex_load(ffindex_context *ffi_context, const char *path, int64_t stream_length);
+
+/**
+ * Append an entry. Entries must be added in stream order.
+ * Safe to call while other threads look entries up.
+ */
+ffindex_error ffindex_add(ffindex_context *ffi_context, const ffindex_entry *entry);
+
+int64_t ffindex_count(ffindex_context *ffi_context);
+
+/**
+ * Copy out the entry at the given position.
+ */
+ffindex_error ffindex_get(ffindex_context *ffi_context, int64_t position, ffindex_entry *entry);
+
+int64_t ffindex_gop_count(ffindex_context *ffi_context);
+
+/**
+ * Describe the n-th GOP, for decoding it on its own.
+ */
+ffindex_error ffindex_get_gop(ffindex_context *ffi_context, int64_t n, ffindex_gop *gop);
+
+/**
+ * Find the frame presented at the given pts: the last frame whose pts is
+ * not after it. Returns its position, or -1 if pts is before the first frame.
+ * Lookups binary search the GOP starts, then walk at most one GOP.
+ */
+int64_t ffindex_find(ffindex_context *ffi_context, int64_t pts);
+
+/**
+ * Return the position of the GOP start at or before the given position, or -1.
+ */
+int64_t ffindex_find_gop(ffindex_context *ffi_context, int64_t position);
+
+#endif
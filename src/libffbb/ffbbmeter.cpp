@@ -0,0 +1,168 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbmeter.h"
+#include "ffbbstats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SECOND 1000000
+
+// gaps are only looked for once the mean interval is this well known
+#define GAP_MIN_INTERVALS 4
+
+typedef struct
+{
+    // timestamp n is at timestamps[n % FFMETER_RING_SIZE], and the
+    // window holds first to count - 1 with the intervals between them
+    int64_t timestamps[FFMETER_RING_SIZE];
+    int64_t count;
+    int64_t first;
+    int64_t interval_sum;
+    int64_t interval_squares;
+    volatile uint32_t stats_sequence;
+    ffmeter_stats stats;
+} ffmeter_reserved;
+
+ffmeter_context *ffmeter_alloc()
+{
+    ffmeter_context *ffm_context = (ffmeter_context*) malloc(sizeof(ffmeter_context));
+    memset(ffm_context, 0, sizeof(ffmeter_context));
+
+    ffmeter_reset(ffm_context);
+
+    return ffm_context;
+}
+
+void ffmeter_reset(ffmeter_context *ffm_context)
+{
+    ffmeter_reserved *ffm_reserved = (ffmeter_reserved*) ffm_context->reserved;
+    if (!ffm_reserved) ffm_reserved = (ffmeter_reserved*) malloc(sizeof(ffmeter_reserved));
+    memset(ffm_reserved, 0, sizeof(ffmeter_reserved));
+
+    memset(ffm_context, 0, sizeof(ffmeter_context));
+    ffm_context->window = SECOND;
+    ffm_context->gap_threshold = 1.5;
+    ffm_context->reserved = ffm_reserved;
+}
+
+ffmeter_error ffmeter_free(ffmeter_context *ffm_context)
+{
+    free(ffm_context->reserved);
+    ffm_context->reserved = NULL;
+    free(ffm_context);
+    return FFMETER_OK;
+}
+
+static int64_t timestamp_at(ffmeter_reserved *ffm_reserved, int64_t n)
+{
+    return ffm_reserved->timestamps[n % FFMETER_RING_SIZE];
+}
+
+static void remove_first(ffmeter_reserved *ffm_reserved)
+{
+    int64_t interval = timestamp_at(ffm_reserved, ffm_reserved->first + 1)
+            - timestamp_at(ffm_reserved, ffm_reserved->first);
+
+    ffm_reserved->interval_sum -= interval;
+    ffm_reserved->interval_squares -= interval * interval;
+    ffm_reserved->first++;
+}
+
+ffmeter_error ffmeter_add(ffmeter_context *ffm_context, int64_t timestamp)
+{
+    ffmeter_reserved *ffm_reserved = (ffmeter_reserved*) ffm_context->reserved;
+    if (!ffm_reserved) return FFMETER_NOT_INITIALIZED;
+
+    ffmeter_stats stats = ffm_reserved->stats;
+
+    int64_t intervals = ffm_reserved->count - ffm_reserved->first - 1;
+    int64_t interval = 0;
+
+    if (ffm_reserved->count && timestamp >= stats.timestamp)
+    {
+        interval = timestamp - stats.timestamp;
+
+        if (intervals >= GAP_MIN_INTERVALS && ffm_reserved->interval_sum)
+        {
+            double mean = (double) ffm_reserved->interval_sum / intervals;
+
+            if (interval > ffm_context->gap_threshold * mean)
+            {
+                stats.gaps++;
+                stats.frames_missed += (int64_t) (interval / mean + 0.5) - 1;
+            }
+        }
+
+        // make room in the ring for the new timestamp
+        if (ffm_reserved->count - ffm_reserved->first == FFMETER_RING_SIZE) remove_first(ffm_reserved);
+
+        ffm_reserved->interval_sum += interval;
+        ffm_reserved->interval_squares += interval * interval;
+    }
+    else
+    {
+        // first frame, or the clock restarted
+        ffm_reserved->first = ffm_reserved->count;
+        ffm_reserved->interval_sum = 0;
+        ffm_reserved->interval_squares = 0;
+    }
+
+    ffm_reserved->timestamps[ffm_reserved->count % FFMETER_RING_SIZE] = timestamp;
+    ffm_reserved->count++;
+
+    while (timestamp - timestamp_at(ffm_reserved, ffm_reserved->first) > ffm_context->window)
+    {
+        remove_first(ffm_reserved);
+    }
+
+    intervals = ffm_reserved->count - ffm_reserved->first - 1;
+
+    stats.frames++;
+    stats.timestamp = timestamp;
+    stats.fps = interval ? (double) SECOND / interval : 0;
+    stats.window_frames = intervals + 1;
+    stats.window_fps = 0;
+    stats.interval = 0;
+    stats.jitter = 0;
+
+    if (ffm_reserved->interval_sum)
+    {
+        double mean = (double) ffm_reserved->interval_sum / intervals;
+        double variance = (double) ffm_reserved->interval_squares / intervals - mean * mean;
+
+        stats.window_fps = SECOND / mean;
+        stats.interval = mean;
+        stats.jitter = variance > 0 ? sqrt(variance) : 0;
+    }
+
+    ffstats_write_begin(&ffm_reserved->stats_sequence);
+    ffm_reserved->stats = stats;
+    ffstats_write_end(&ffm_reserved->stats_sequence);
+
+    return FFMETER_OK;
+}
+
+ffmeter_error ffmeter_get_stats(ffmeter_context *ffm_context, ffmeter_stats *stats)
+{
+    ffmeter_reserved *ffm_reserved = (ffmeter_reserved*) ffm_context->reserved;
+    if (!ffm_reserved) return FFMETER_NOT_INITIALIZED;
+
+    ffstats_read(&ffm_reserved->stats_sequence, &ffm_reserved->stats, stats, sizeof(ffmeter_stats));
+
+    return FFMETER_OK;
+}
@@ -0,0 +1,114 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBMETER_H
+#define FFBBMETER_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/**
+ * Timestamps kept for the window. At most this many frames are
+ * measured, however long the window is.
+ */
+#define FFMETER_RING_SIZE 512
+
+typedef enum
+{
+    FFMETER_OK = 0,
+    FFMETER_NOT_INITIALIZED
+} ffmeter_error;
+
+typedef struct
+{
+    int64_t frames;
+
+    /**
+     * The last timestamp added.
+     */
+    int64_t timestamp;
+
+    /**
+     * Frame rate from the last interval alone.
+     */
+    double fps;
+
+    /**
+     * Frame rate over the timestamps in the window.
+     */
+    double window_fps;
+    int window_frames;
+
+    /**
+     * Mean and standard deviation of the intervals in the window, in microseconds.
+     */
+    double interval;
+    double jitter;
+
+    /**
+     * Intervals longer than gap_threshold times the mean, and the
+     * number of frames they are estimated to have lost.
+     */
+    int64_t gaps;
+    int64_t frames_missed;
+} ffmeter_stats;
+
+typedef struct
+{
+    /**
+     * Microseconds of timestamps measured, 1 second by default.
+     */
+    int64_t window;
+
+    /**
+     * An interval this many times the mean of the window is a gap.
+     */
+    double gap_threshold;
+
+    /**
+     * For internal use. Do not use.
+     */
+    void *reserved;
+} ffmeter_context;
+
+/**
+ * Allocate the context with default values.
+ */
+ffmeter_context *ffmeter_alloc(void);
+
+/**
+ * Reset the context with default values.
+ */
+void ffmeter_reset(ffmeter_context *ffm_context);
+
+/**
+ * Free the context.
+ */
+ffmeter_error ffmeter_free(ffmeter_context *ffm_context);
+
+/**
+ * Measure a frame with the given timestamp in microseconds, such as the
+ * frametimestamp of a camera buffer. Frames must be added from one thread.
+ * A timestamp that goes backwards restarts the window.
+ */
+ffmeter_error ffmeter_add(ffmeter_context *ffm_context, int64_t timestamp);
+
+/**
+ * Take a snapshot of the measurements. This never blocks ffmeter_add
+ * and may be called from any thread.
+ */
+ffmeter_error ffmeter_get_stats(ffmeter_context *ffm_context, ffmeter_stats *stats);
+
+#endif
@@ -0,0 +1,153 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbmotion.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+const char *ffmotion_implementation()
+{
+#if defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    return "neon";
+#else
+    return "c";
+#endif
+}
+
+/**
+ * Sum of the absolute differences along one row.
+ */
+static uint64_t row_sad(const uint8_t *a, const uint8_t *b, int width)
+{
+    uint64_t sad = 0;
+    int x = 0;
+
+#if defined(__SSE2__)
+    __m128i sum = _mm_setzero_si128();
+
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*) &a[x]);
+        __m128i vb = _mm_loadu_si128((const __m128i*) &b[x]);
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+    }
+
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*) lanes, sum);
+    sad += lanes[0] + lanes[1];
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    uint32x4_t sum = vdupq_n_u32(0);
+
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16_t difference = vabdq_u8(vld1q_u8(&a[x]), vld1q_u8(&b[x]));
+        sum = vpadalq_u16(sum, vpaddlq_u8(difference));
+    }
+
+    uint64x2_t total = vpaddlq_u32(sum);
+    sad += vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+#endif
+
+    for (; x < width; x++)
+    {
+        int difference = a[x] - b[x];
+        sad += difference < 0 ? -difference : difference;
+    }
+
+    return sad;
+}
+
+uint64_t ffmotion_sad(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+        int width, int height, int row_step)
+{
+    if (row_step < 1) row_step = 1;
+
+    uint64_t sad = 0;
+
+    for (int y = 0; y < height; y += row_step)
+    {
+        sad += row_sad(&a[y * a_stride], &b[y * b_stride], width);
+    }
+
+    return sad;
+}
+
+/**
+ * Sum of the absolute differences of a whole 16x16 block.
+ */
+static uint32_t block_sad(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride)
+{
+#if defined(__SSE2__)
+    __m128i sum = _mm_setzero_si128();
+
+    for (int y = 0; y < 16; y++)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*) &a[y * a_stride]);
+        __m128i vb = _mm_loadu_si128((const __m128i*) &b[y * b_stride]);
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+    }
+
+    return _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    // 16 rows of 255 still fit in 16 bits per lane
+    uint16x8_t sum = vdupq_n_u16(0);
+
+    for (int y = 0; y < 16; y++)
+    {
+        uint8x16_t difference = vabdq_u8(vld1q_u8(&a[y * a_stride]), vld1q_u8(&b[y * b_stride]));
+        sum = vpadalq_u8(sum, difference);
+    }
+
+    uint64x2_t total = vpaddlq_u32(vpaddlq_u16(sum));
+    return vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+#else
+    return ffmotion_sad(a, a_stride, b, b_stride, 16, 16, 1);
+#endif
+}
+
+void ffmotion_mb_map(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+        int width, int height, uint8_t *map, int map_stride)
+{
+    int mb_width = (width + 15) / 16;
+    int mb_height = (height + 15) / 16;
+
+    for (int mb_y = 0; mb_y < mb_height; mb_y++)
+    {
+        int rows = height - mb_y * 16;
+        if (rows > 16) rows = 16;
+
+        for (int mb_x = 0; mb_x < mb_width; mb_x++)
+        {
+            int columns = width - mb_x * 16;
+            if (columns > 16) columns = 16;
+
+            const uint8_t *block_a = &a[mb_y * 16 * a_stride + mb_x * 16];
+            const uint8_t *block_b = &b[mb_y * 16 * b_stride + mb_x * 16];
+
+            uint64_t sad = rows == 16 && columns == 16
+                    ? block_sad(block_a, a_stride, block_b, b_stride)
+                    : ffmotion_sad(block_a, a_stride, block_b, b_stride, columns, rows, 1);
+
+            uint64_t mean = sad / (rows * columns);
+            map[mb_y * map_stride + mb_x] = mean > 255 ? 255 : mean;
+        }
+    }
+}
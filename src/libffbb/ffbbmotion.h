@@ -0,0 +1,42 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBMOTION_H
+#define FFBBMOTION_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/**
+ * Sum of the absolute differences between two planes over every
+ * row_step-th row, starting with the first.
+ */
+uint64_t ffmotion_sad(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+        int width, int height, int row_step);
+
+/**
+ * Fill map with one value per 16x16 macroblock of the planes, the mean
+ * absolute difference of the block clamped to 255. Blocks cut off by
+ * the right or bottom edge are averaged over the pixels they have.
+ */
+void ffmotion_mb_map(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+        int width, int height, uint8_t *map, int map_stride);
+
+/**
+ * The instruction set used by ffmotion_sad and ffmotion_mb_map: "sse2", "neon" or "c".
+ */
+const char *ffmotion_implementation(void);
+
+#endif
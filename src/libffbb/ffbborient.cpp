@@ -0,0 +1,1001 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbborient.h"
+#include "ffbbcopy.h"
+#include "ffbbpool.h"
+#include "ffbbtrace.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+// include math.h otherwise it will get included
+// by avformat.h and cause duplicate definition
+// errors because of C vs C++ functions
+#include <math.h>
+
+extern "C"
+{
+#define UINT64_C uint64_t
+#define INT64_C int64_t
+#include <libavformat/avformat.h>
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// output pixels of a side of the tiles transposed at a time, so the
+// 64 source rows a tile reads stay in the cache until it is done
+#define TILE 64
+
+// bands start on a tile of luma, which keeps every chroma block whole
+#define BAND_ALIGN TILE
+
+// less than this much output per band costs more to hand to a worker than it saves
+#define MIN_BAND_BYTES (128 * 1024)
+
+// the row helpers are inlined into the fixed kernels, so the
+// compiler sees the row length and unrolls them
+#define ALWAYS_INLINE __attribute__((always_inline))
+
+/**
+ * A plane of the cropped frame and of the output, in pixels of the plane.
+ */
+typedef struct
+{
+    fforient_rotation rotation;
+    bool mirror;
+    int width;
+    int height;
+    int out_width;
+    int out_height;
+} fforient_geometry;
+
+const char *fforient_implementation()
+{
+#if defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    return "neon";
+#else
+    return "c";
+#endif
+}
+
+/**
+ * Where the output pixel comes from in the cropped source.
+ */
+static inline void source_of(const fforient_geometry *geometry, int ox, int oy, int *sx, int *sy)
+{
+    int mx = geometry->mirror ? geometry->out_width - 1 - ox : ox;
+
+    switch (geometry->rotation)
+    {
+        case FFORIENT_ROTATE_90:
+            *sx = oy;
+            *sy = geometry->height - 1 - mx;
+            break;
+        case FFORIENT_ROTATE_180:
+            *sx = geometry->width - 1 - mx;
+            *sy = geometry->height - 1 - oy;
+            break;
+        case FFORIENT_ROTATE_270:
+            *sx = geometry->width - 1 - oy;
+            *sy = mx;
+            break;
+        default:
+            *sx = mx;
+            *sy = oy;
+            break;
+    }
+}
+
+/**
+ * Convert a rectangle of the output a pixel at a time. Pixels of two bytes
+ * are interleaved chroma, split into the two outputs.
+ */
+static void map_plane(const fforient_geometry *geometry, const uint8_t *src, int src_stride, int pixel_size,
+        uint8_t *dst_a, int a_stride, uint8_t *dst_b, int b_stride, int x0, int y0, int x1, int y1)
+{
+    for (int oy = y0; oy < y1; oy++)
+    {
+        for (int ox = x0; ox < x1; ox++)
+        {
+            int sx, sy;
+            source_of(geometry, ox, oy, &sx, &sy);
+
+            const uint8_t *pixel = &src[sy * src_stride + sx * pixel_size];
+            dst_a[oy * a_stride + ox] = pixel[0];
+            if (pixel_size == 2) dst_b[oy * b_stride + ox] = pixel[1];
+        }
+    }
+}
+
+#if defined(__SSE2__)
+static inline __m128i reverse_bytes(__m128i x)
+{
+    x = _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 1, 2, 3));
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_srli_epi16(x, 8), _mm_slli_epi16(x, 8));
+}
+
+static inline __m128i reverse_pairs(__m128i x)
+{
+    x = _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 1, 2, 3));
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+}
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+static inline uint8x16_t reverse_bytes(uint8x16_t x)
+{
+    x = vrev64q_u8(x);
+    return vcombine_u8(vget_high_u8(x), vget_low_u8(x));
+}
+#endif
+
+/**
+ * Copy a row of n pixels back to front.
+ */
+static inline ALWAYS_INLINE void reverse_row(uint8_t *dst, const uint8_t *src, int n)
+{
+    int x = 0;
+
+#if defined(__SSE2__)
+    for (; x + 16 <= n; x += 16)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i*) &src[n - 16 - x]);
+        _mm_storeu_si128((__m128i*) &dst[x], reverse_bytes(pixels));
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; x + 16 <= n; x += 16)
+    {
+        vst1q_u8(&dst[x], reverse_bytes(vld1q_u8(&src[n - 16 - x])));
+    }
+#endif
+
+    for (; x < n; x++)
+    {
+        dst[x] = src[n - 1 - x];
+    }
+}
+
+/**
+ * Split a row of n interleaved chroma pairs into U and V, back to front if reversed.
+ */
+static inline ALWAYS_INLINE void split_row(uint8_t *dst_u, uint8_t *dst_v, const uint8_t *src, int n, bool reverse)
+{
+    int x = 0;
+
+#if defined(__SSE2__)
+    __m128i mask = _mm_set1_epi16(0xFF);
+
+    for (; x + 16 <= n; x += 16)
+    {
+        const uint8_t *pairs = reverse ? &src[2 * (n - 16 - x)] : &src[2 * x];
+        __m128i first = _mm_loadu_si128((const __m128i*) pairs);
+        __m128i second = _mm_loadu_si128((const __m128i*) &pairs[16]);
+
+        if (reverse)
+        {
+            __m128i last = reverse_pairs(second);
+            second = reverse_pairs(first);
+            first = last;
+        }
+
+        __m128i u = _mm_packus_epi16(_mm_and_si128(first, mask), _mm_and_si128(second, mask));
+        __m128i v = _mm_packus_epi16(_mm_srli_epi16(first, 8), _mm_srli_epi16(second, 8));
+        _mm_storeu_si128((__m128i*) &dst_u[x], u);
+        _mm_storeu_si128((__m128i*) &dst_v[x], v);
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; x + 16 <= n; x += 16)
+    {
+        uint8x16x2_t uv = vld2q_u8(reverse ? &src[2 * (n - 16 - x)] : &src[2 * x]);
+
+        if (reverse)
+        {
+            uv.val[0] = reverse_bytes(uv.val[0]);
+            uv.val[1] = reverse_bytes(uv.val[1]);
+        }
+
+        vst1q_u8(&dst_u[x], uv.val[0]);
+        vst1q_u8(&dst_v[x], uv.val[1]);
+    }
+#endif
+
+    for (; x < n; x++)
+    {
+        const uint8_t *pair = &src[2 * (reverse ? n - 1 - x : x)];
+        dst_u[x] = pair[0];
+        dst_v[x] = pair[1];
+    }
+}
+
+/**
+ * dst[k][i] = src[i][k] for an 8x8 block of luma.
+ */
+static void transpose_luma(const uint8_t *const *src, uint8_t *const *dst)
+{
+#if defined(__SSE2__)
+    __m128i a0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) src[0]), _mm_loadl_epi64((const __m128i*) src[1]));
+    __m128i a1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) src[2]), _mm_loadl_epi64((const __m128i*) src[3]));
+    __m128i a2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) src[4]), _mm_loadl_epi64((const __m128i*) src[5]));
+    __m128i a3 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) src[6]), _mm_loadl_epi64((const __m128i*) src[7]));
+
+    __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+    __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+    __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+    __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+
+    // two columns of the source in each
+    __m128i columns[4];
+    columns[0] = _mm_unpacklo_epi32(b0, b2);
+    columns[1] = _mm_unpackhi_epi32(b0, b2);
+    columns[2] = _mm_unpacklo_epi32(b1, b3);
+    columns[3] = _mm_unpackhi_epi32(b1, b3);
+
+    for (int k = 0; k < 4; k++)
+    {
+        _mm_storel_epi64((__m128i*) dst[2 * k], columns[k]);
+        _mm_storel_epi64((__m128i*) dst[2 * k + 1], _mm_srli_si128(columns[k], 8));
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    uint8x8x2_t t0 = vtrn_u8(vld1_u8(src[0]), vld1_u8(src[1]));
+    uint8x8x2_t t1 = vtrn_u8(vld1_u8(src[2]), vld1_u8(src[3]));
+    uint8x8x2_t t2 = vtrn_u8(vld1_u8(src[4]), vld1_u8(src[5]));
+    uint8x8x2_t t3 = vtrn_u8(vld1_u8(src[6]), vld1_u8(src[7]));
+
+    uint16x4x2_t u0 = vtrn_u16(vreinterpret_u16_u8(t0.val[0]), vreinterpret_u16_u8(t1.val[0]));
+    uint16x4x2_t u1 = vtrn_u16(vreinterpret_u16_u8(t0.val[1]), vreinterpret_u16_u8(t1.val[1]));
+    uint16x4x2_t u2 = vtrn_u16(vreinterpret_u16_u8(t2.val[0]), vreinterpret_u16_u8(t3.val[0]));
+    uint16x4x2_t u3 = vtrn_u16(vreinterpret_u16_u8(t2.val[1]), vreinterpret_u16_u8(t3.val[1]));
+
+    uint32x2x2_t v0 = vtrn_u32(vreinterpret_u32_u16(u0.val[0]), vreinterpret_u32_u16(u2.val[0]));
+    uint32x2x2_t v1 = vtrn_u32(vreinterpret_u32_u16(u1.val[0]), vreinterpret_u32_u16(u3.val[0]));
+    uint32x2x2_t v2 = vtrn_u32(vreinterpret_u32_u16(u0.val[1]), vreinterpret_u32_u16(u2.val[1]));
+    uint32x2x2_t v3 = vtrn_u32(vreinterpret_u32_u16(u1.val[1]), vreinterpret_u32_u16(u3.val[1]));
+
+    vst1_u8(dst[0], vreinterpret_u8_u32(v0.val[0]));
+    vst1_u8(dst[1], vreinterpret_u8_u32(v1.val[0]));
+    vst1_u8(dst[2], vreinterpret_u8_u32(v2.val[0]));
+    vst1_u8(dst[3], vreinterpret_u8_u32(v3.val[0]));
+    vst1_u8(dst[4], vreinterpret_u8_u32(v0.val[1]));
+    vst1_u8(dst[5], vreinterpret_u8_u32(v1.val[1]));
+    vst1_u8(dst[6], vreinterpret_u8_u32(v2.val[1]));
+    vst1_u8(dst[7], vreinterpret_u8_u32(v3.val[1]));
+#else
+    for (int k = 0; k < 8; k++)
+    {
+        for (int i = 0; i < 8; i++) dst[k][i] = src[i][k];
+    }
+#endif
+}
+
+/**
+ * dst_u[k][i] = src[i][2k] and dst_v[k][i] = src[i][2k + 1]
+ * for an 8x8 block of interleaved chroma pairs.
+ */
+static void transpose_chroma(const uint8_t *const *src, uint8_t *const *dst_u, uint8_t *const *dst_v)
+{
+#if defined(__SSE2__)
+    __m128i a[8];
+    for (int i = 0; i < 8; i += 2)
+    {
+        __m128i r0 = _mm_loadu_si128((const __m128i*) src[i]);
+        __m128i r1 = _mm_loadu_si128((const __m128i*) src[i + 1]);
+        a[i] = _mm_unpacklo_epi16(r0, r1);
+        a[i + 1] = _mm_unpackhi_epi16(r0, r1);
+    }
+
+    __m128i b0 = _mm_unpacklo_epi32(a[0], a[2]);
+    __m128i b1 = _mm_unpackhi_epi32(a[0], a[2]);
+    __m128i b2 = _mm_unpacklo_epi32(a[1], a[3]);
+    __m128i b3 = _mm_unpackhi_epi32(a[1], a[3]);
+    __m128i b4 = _mm_unpacklo_epi32(a[4], a[6]);
+    __m128i b5 = _mm_unpackhi_epi32(a[4], a[6]);
+    __m128i b6 = _mm_unpacklo_epi32(a[5], a[7]);
+    __m128i b7 = _mm_unpackhi_epi32(a[5], a[7]);
+
+    __m128i columns[8];
+    columns[0] = _mm_unpacklo_epi64(b0, b4);
+    columns[1] = _mm_unpackhi_epi64(b0, b4);
+    columns[2] = _mm_unpacklo_epi64(b1, b5);
+    columns[3] = _mm_unpackhi_epi64(b1, b5);
+    columns[4] = _mm_unpacklo_epi64(b2, b6);
+    columns[5] = _mm_unpackhi_epi64(b2, b6);
+    columns[6] = _mm_unpacklo_epi64(b3, b7);
+    columns[7] = _mm_unpackhi_epi64(b3, b7);
+
+    __m128i mask = _mm_set1_epi16(0xFF);
+    __m128i zero = _mm_setzero_si128();
+
+    for (int k = 0; k < 8; k++)
+    {
+        _mm_storel_epi64((__m128i*) dst_u[k], _mm_packus_epi16(_mm_and_si128(columns[k], mask), zero));
+        _mm_storel_epi64((__m128i*) dst_v[k], _mm_packus_epi16(_mm_srli_epi16(columns[k], 8), zero));
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    uint16x8x2_t t0 = vtrnq_u16(vreinterpretq_u16_u8(vld1q_u8(src[0])), vreinterpretq_u16_u8(vld1q_u8(src[1])));
+    uint16x8x2_t t1 = vtrnq_u16(vreinterpretq_u16_u8(vld1q_u8(src[2])), vreinterpretq_u16_u8(vld1q_u8(src[3])));
+    uint16x8x2_t t2 = vtrnq_u16(vreinterpretq_u16_u8(vld1q_u8(src[4])), vreinterpretq_u16_u8(vld1q_u8(src[5])));
+    uint16x8x2_t t3 = vtrnq_u16(vreinterpretq_u16_u8(vld1q_u8(src[6])), vreinterpretq_u16_u8(vld1q_u8(src[7])));
+
+    // the even columns of the first four rows, and of the last four
+    uint32x4x2_t u0 = vtrnq_u32(vreinterpretq_u32_u16(t0.val[0]), vreinterpretq_u32_u16(t1.val[0]));
+    uint32x4x2_t u1 = vtrnq_u32(vreinterpretq_u32_u16(t0.val[1]), vreinterpretq_u32_u16(t1.val[1]));
+    uint32x4x2_t u2 = vtrnq_u32(vreinterpretq_u32_u16(t2.val[0]), vreinterpretq_u32_u16(t3.val[0]));
+    uint32x4x2_t u3 = vtrnq_u32(vreinterpretq_u32_u16(t2.val[1]), vreinterpretq_u32_u16(t3.val[1]));
+
+    uint32x4_t columns[8];
+    columns[0] = vcombine_u32(vget_low_u32(u0.val[0]), vget_low_u32(u2.val[0]));
+    columns[1] = vcombine_u32(vget_low_u32(u1.val[0]), vget_low_u32(u3.val[0]));
+    columns[2] = vcombine_u32(vget_low_u32(u0.val[1]), vget_low_u32(u2.val[1]));
+    columns[3] = vcombine_u32(vget_low_u32(u1.val[1]), vget_low_u32(u3.val[1]));
+    columns[4] = vcombine_u32(vget_high_u32(u0.val[0]), vget_high_u32(u2.val[0]));
+    columns[5] = vcombine_u32(vget_high_u32(u1.val[0]), vget_high_u32(u3.val[0]));
+    columns[6] = vcombine_u32(vget_high_u32(u0.val[1]), vget_high_u32(u2.val[1]));
+    columns[7] = vcombine_u32(vget_high_u32(u1.val[1]), vget_high_u32(u3.val[1]));
+
+    for (int k = 0; k < 8; k++)
+    {
+        uint16x8_t pairs = vreinterpretq_u16_u32(columns[k]);
+        vst1_u8(dst_u[k], vmovn_u16(pairs));
+        vst1_u8(dst_v[k], vshrn_n_u16(pairs, 8));
+    }
+#else
+    for (int k = 0; k < 8; k++)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            dst_u[k][i] = src[i][2 * k];
+            dst_v[k][i] = src[i][2 * k + 1];
+        }
+    }
+#endif
+}
+
+/**
+ * Copy or reverse whole rows y0 to y1 of the output, for 0 and 180 degrees.
+ */
+static void rows_plane(const fforient_geometry *geometry, const uint8_t *src, int src_stride, int pixel_size,
+        uint8_t *dst_a, int a_stride, uint8_t *dst_b, int b_stride, int y0, int y1)
+{
+    bool flip = geometry->rotation == FFORIENT_ROTATE_180;
+    bool reverse = flip != geometry->mirror;
+    int width = geometry->out_width;
+    int height = geometry->out_height;
+
+    if (pixel_size == 1 && !flip && !reverse)
+    {
+        ffcopy_plane(&dst_a[y0 * a_stride], a_stride, &src[y0 * src_stride], src_stride, width, y1 - y0);
+        return;
+    }
+
+    for (int oy = y0; oy < y1; oy++)
+    {
+        const uint8_t *row = &src[(flip ? height - 1 - oy : oy) * src_stride];
+
+        if (pixel_size == 2) split_row(&dst_a[oy * a_stride], &dst_b[oy * b_stride], row, width, reverse);
+        else if (reverse) reverse_row(&dst_a[oy * a_stride], row, width);
+        else memcpy(&dst_a[oy * a_stride], row, width);
+    }
+}
+
+/**
+ * Transpose 8x8 blocks of rows y0 to y1 of the output a tile at a time,
+ * for 90 and 270 degrees, and convert the edges that do not fill a block
+ * a pixel at a time. y0 must be a multiple of 8.
+ */
+static void transpose_plane(const fforient_geometry *geometry, const uint8_t *src, int src_stride, int pixel_size,
+        uint8_t *dst_a, int a_stride, uint8_t *dst_b, int b_stride, int y0, int y1)
+{
+    int block_width = geometry->out_width & ~7;
+    int block_height = FFMIN(geometry->out_height & ~7, y1);
+
+    for (int tile_y = y0; tile_y < block_height; tile_y += TILE)
+    {
+        for (int tile_x = 0; tile_x < block_width; tile_x += TILE)
+        {
+            int tile_bottom = FFMIN(tile_y + TILE, block_height);
+            int tile_right = FFMIN(tile_x + TILE, block_width);
+
+            for (int by = tile_y; by < tile_bottom; by += 8)
+            {
+                // each output row is a column of the source, which
+                // runs the other way at 270 degrees
+                int first_column, last_column, sy;
+                source_of(geometry, 0, by, &first_column, &sy);
+                source_of(geometry, 0, by + 7, &last_column, &sy);
+                bool ascending = first_column < last_column;
+                int column = FFMIN(first_column, last_column);
+
+                for (int bx = tile_x; bx < tile_right; bx += 8)
+                {
+                    const uint8_t *rows[8];
+                    uint8_t *a_rows[8];
+                    uint8_t *b_rows[8];
+
+                    for (int i = 0; i < 8; i++)
+                    {
+                        int sx;
+                        source_of(geometry, bx + i, by, &sx, &sy);
+                        rows[i] = &src[sy * src_stride + column * pixel_size];
+
+                        int oy = ascending ? by + i : by + 7 - i;
+                        a_rows[i] = &dst_a[oy * a_stride + bx];
+                        b_rows[i] = &dst_b[oy * b_stride + bx];
+                    }
+
+                    if (pixel_size == 2) transpose_chroma(rows, a_rows, b_rows);
+                    else transpose_luma(rows, a_rows);
+                }
+            }
+        }
+    }
+
+    map_plane(geometry, src, src_stride, pixel_size, dst_a, a_stride, dst_b, b_stride,
+            block_width, y0, geometry->out_width, block_height);
+    map_plane(geometry, src, src_stride, pixel_size, dst_a, a_stride, dst_b, b_stride,
+            0, FFMAX(block_height, y0), geometry->out_width, y1);
+}
+
+/**
+ * Convert rows y0 to y1 of a WIDTH x HEIGHT frame turned 0 or 180 degrees
+ * without a crop into planes WIDTH and WIDTH / 2 bytes apart, with the
+ * length of every reversed or split row known when this is compiled.
+ */
+template<int WIDTH, int HEIGHT, bool FLIP, bool REVERSE>
+static void fixed_rows(const fforient_geometry *luma, const uint8_t *y, int y_stride,
+        const uint8_t *uv, int uv_stride, uint8_t *dst_y, uint8_t *dst_u, uint8_t *dst_v, int y0, int y1)
+{
+    if (REVERSE)
+    {
+        for (int oy = y0; oy < y1; oy++)
+        {
+            reverse_row(&dst_y[oy * WIDTH], &y[(FLIP ? HEIGHT - 1 - oy : oy) * y_stride], WIDTH);
+        }
+    }
+    else
+    {
+        // plain copies gain nothing from a known length, and a
+        // memcpy of one is expanded into rep movs, which is slower
+        rows_plane(luma, y, y_stride, 1, dst_y, WIDTH, NULL, 0, y0, y1);
+    }
+
+    for (int oy = y0 / 2; oy < y1 / 2; oy++)
+    {
+        const uint8_t *row = &uv[(FLIP ? HEIGHT / 2 - 1 - oy : oy) * uv_stride];
+        split_row(&dst_u[oy * (WIDTH / 2)], &dst_v[oy * (WIDTH / 2)], row, WIDTH / 2, REVERSE);
+    }
+}
+
+typedef void (*fixed_kernel)(const fforient_geometry *luma, const uint8_t *y, int y_stride,
+        const uint8_t *uv, int uv_stride, uint8_t *dst_y, uint8_t *dst_u, uint8_t *dst_v, int y0, int y1);
+
+typedef struct
+{
+    int width;
+    int height;
+
+    /**
+     * By whether the rows are flipped and reversed.
+     */
+    fixed_kernel kernels[2][2];
+} fixed_geometry;
+
+#define FIXED_GEOMETRY(width, height) \
+    { width, height, { \
+        { &fixed_rows<width, height, false, false>, &fixed_rows<width, height, false, true> }, \
+        { &fixed_rows<width, height, true, false>, &fixed_rows<width, height, true, true> } } }
+
+/**
+ * The sizes the camera captures at, VIDEO_WIDTH x VIDEO_HEIGHT of the
+ * app and the larger size of the regression clips.
+ */
+static const fixed_geometry fixed_geometries[] = {
+    FIXED_GEOMETRY(288, 512),
+    FIXED_GEOMETRY(720, 1280),
+    FIXED_GEOMETRY(1080, 1920)
+};
+
+static const fixed_geometry *find_geometry(int width, int height)
+{
+    for (size_t i = 0; i < sizeof(fixed_geometries) / sizeof(fixed_geometry); i++)
+    {
+        const fixed_geometry *geometry = &fixed_geometries[i];
+        if (geometry->width == width && geometry->height == height) return geometry;
+    }
+
+    return NULL;
+}
+
+/**
+ * The fixed kernel for the conversion, or NULL if the
+ * generic kernels have to take the frame.
+ */
+static fixed_kernel find_kernel(const fforient_geometry *luma, int width, int height,
+        int dst_y_stride, int dst_u_stride, int dst_v_stride)
+{
+    if (luma->rotation != FFORIENT_ROTATE_0 && luma->rotation != FFORIENT_ROTATE_180) return NULL;
+    if (luma->width != width || luma->height != height) return NULL;
+    if (dst_y_stride != width || dst_u_stride != width / 2 || dst_v_stride != width / 2) return NULL;
+
+    const fixed_geometry *geometry = find_geometry(width, height);
+    if (!geometry) return NULL;
+
+    bool flip = luma->rotation == FFORIENT_ROTATE_180;
+    return geometry->kernels[flip][flip != luma->mirror];
+}
+
+/**
+ * A frame converted in bands by the calling thread and pool workers.
+ */
+typedef struct
+{
+    fforient_transform transform;
+    fforient_geometry luma;
+    fforient_geometry chroma;
+    const uint8_t *y;
+    int y_stride;
+    const uint8_t *uv;
+    int uv_stride;
+    uint8_t *dst_y;
+    int dst_y_stride;
+    uint8_t *dst_u;
+    int dst_u_stride;
+    uint8_t *dst_v;
+    int dst_v_stride;
+    fixed_kernel kernel;
+    int bands;
+    int band_rows;
+    volatile int next_band;
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;
+    int bands_done;
+    // the calling thread and every task submitted
+    int references;
+} fforient_job;
+
+/**
+ * Convert luma rows y0 to y1 of the output and the chroma rows
+ * beside them. y0 must be a multiple of 16.
+ */
+static void convert_rows(const fforient_transform *transform, const fforient_geometry *luma,
+        const fforient_geometry *chroma, fixed_kernel kernel, const uint8_t *y, int y_stride,
+        const uint8_t *uv, int uv_stride, uint8_t *dst_y, int dst_y_stride, uint8_t *dst_u, int dst_u_stride,
+        uint8_t *dst_v, int dst_v_stride, int y0, int y1)
+{
+    if (kernel)
+    {
+        kernel(luma, y, y_stride, uv, uv_stride, dst_y, dst_u, dst_v, y0, y1);
+        return;
+    }
+
+    const uint8_t *src_y = &y[transform->crop_y * y_stride + transform->crop_x];
+    const uint8_t *src_uv = &uv[transform->crop_y / 2 * uv_stride + transform->crop_x];
+
+    if (luma->rotation == FFORIENT_ROTATE_90 || luma->rotation == FFORIENT_ROTATE_270)
+    {
+        transpose_plane(luma, src_y, y_stride, 1, dst_y, dst_y_stride, NULL, 0, y0, y1);
+        transpose_plane(chroma, src_uv, uv_stride, 2, dst_u, dst_u_stride, dst_v, dst_v_stride, y0 / 2, y1 / 2);
+    }
+    else
+    {
+        rows_plane(luma, src_y, y_stride, 1, dst_y, dst_y_stride, NULL, 0, y0, y1);
+        rows_plane(chroma, src_uv, uv_stride, 2, dst_u, dst_u_stride, dst_v, dst_v_stride, y0 / 2, y1 / 2);
+    }
+}
+
+/**
+ * Fill in the luma and chroma geometry, or return false if the crop is invalid.
+ */
+static bool resolve(const fforient_transform *transform, int width, int height,
+        fforient_geometry *luma, fforient_geometry *chroma)
+{
+    int crop_width = transform->crop_width ? transform->crop_width : width - transform->crop_x;
+    int crop_height = transform->crop_height ? transform->crop_height : height - transform->crop_y;
+
+    if ((transform->crop_x | transform->crop_y | crop_width | crop_height) & 1) return false;
+    if (transform->crop_x < 0 || transform->crop_y < 0 || crop_width <= 0 || crop_height <= 0) return false;
+    if (transform->crop_x + crop_width > width || transform->crop_y + crop_height > height) return false;
+
+    bool turned = transform->rotation == FFORIENT_ROTATE_90 || transform->rotation == FFORIENT_ROTATE_270;
+
+    luma->rotation = transform->rotation;
+    luma->mirror = transform->mirror;
+    luma->width = crop_width;
+    luma->height = crop_height;
+    luma->out_width = turned ? crop_height : crop_width;
+    luma->out_height = turned ? crop_width : crop_height;
+
+    *chroma = *luma;
+    chroma->width /= 2;
+    chroma->height /= 2;
+    chroma->out_width /= 2;
+    chroma->out_height /= 2;
+
+    return true;
+}
+
+bool fforient_is_identity(const fforient_transform *transform)
+{
+    return transform->rotation == FFORIENT_ROTATE_0 && !transform->mirror && !transform->crop_x
+            && !transform->crop_y && !transform->crop_width && !transform->crop_height;
+}
+
+fforient_error fforient_output_size(const fforient_transform *transform, int width, int height,
+        int *out_width, int *out_height)
+{
+    fforient_geometry luma, chroma;
+    if (!resolve(transform, width, height, &luma, &chroma)) return FFORIENT_INVALID_CROP;
+
+    *out_width = luma.out_width;
+    *out_height = luma.out_height;
+
+    return FFORIENT_OK;
+}
+
+bool fforient_has_fixed_kernel(int width, int height)
+{
+    return find_geometry(width, height) != NULL;
+}
+
+static fforient_error convert(const fforient_transform *transform, bool fixed,
+        const uint8_t *y, int y_stride, const uint8_t *uv, int uv_stride, int width, int height,
+        uint8_t *dst_y, int dst_y_stride, uint8_t *dst_u, int dst_u_stride, uint8_t *dst_v, int dst_v_stride)
+{
+    fforient_geometry luma, chroma;
+    if (!resolve(transform, width, height, &luma, &chroma)) return FFORIENT_INVALID_CROP;
+
+    fixed_kernel kernel = fixed ? find_kernel(&luma, width, height, dst_y_stride, dst_u_stride, dst_v_stride) : NULL;
+
+    convert_rows(transform, &luma, &chroma, kernel, y, y_stride, uv, uv_stride,
+            dst_y, dst_y_stride, dst_u, dst_u_stride, dst_v, dst_v_stride, 0, luma.out_height);
+
+    return FFORIENT_OK;
+}
+
+fforient_error fforient_nv12_to_i420(const fforient_transform *transform,
+        const uint8_t *y, int y_stride,
+        const uint8_t *uv, int uv_stride,
+        int width, int height,
+        uint8_t *dst_y, int dst_y_stride,
+        uint8_t *dst_u, int dst_u_stride,
+        uint8_t *dst_v, int dst_v_stride)
+{
+    return convert(transform, true, y, y_stride, uv, uv_stride, width, height,
+            dst_y, dst_y_stride, dst_u, dst_u_stride, dst_v, dst_v_stride);
+}
+
+/**
+ * Take bands off the job until none are left.
+ */
+static void run_bands(fforient_job *job)
+{
+    int band;
+
+    while ((band = __sync_fetch_and_add(&job->next_band, 1)) < job->bands)
+    {
+        int y0 = band * job->band_rows;
+        int y1 = FFMIN(y0 + job->band_rows, job->luma.out_height);
+
+        FFTRACE_BEGIN("fforient_band", band);
+        convert_rows(&job->transform, &job->luma, &job->chroma, job->kernel, job->y, job->y_stride,
+                job->uv, job->uv_stride, job->dst_y, job->dst_y_stride, job->dst_u, job->dst_u_stride, job->dst_v, job->dst_v_stride, y0, y1);
+        FFTRACE_END("fforient_band", band);
+
+        pthread_mutex_lock(&job->mutex);
+        if (++job->bands_done == job->bands) pthread_cond_signal(&job->done_cond);
+        pthread_mutex_unlock(&job->mutex);
+    }
+}
+
+static void release_job(fforient_job *job)
+{
+    pthread_mutex_lock(&job->mutex);
+    bool last = --job->references == 0;
+    pthread_mutex_unlock(&job->mutex);
+
+    if (!last) return;
+
+    pthread_mutex_destroy(&job->mutex);
+    pthread_cond_destroy(&job->done_cond);
+    free(job);
+}
+
+static void *band_task(void *arg)
+{
+    fforient_job *job = (fforient_job*) arg;
+    run_bands(job);
+    release_job(job);
+    return 0;
+}
+
+int fforient_band_count(int out_width, int out_height, int threads)
+{
+    if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int bands = FFMIN(threads, FFORIENT_MAX_BANDS);
+    bands = FFMIN(bands, out_height / BAND_ALIGN);
+    bands = FFMIN(bands, out_width * out_height * 3 / 2 / MIN_BAND_BYTES);
+
+    return FFMAX(bands, 1);
+}
+
+fforient_error fforient_nv12_to_i420_parallel(const fforient_transform *transform,
+        const uint8_t *y, int y_stride,
+        const uint8_t *uv, int uv_stride,
+        int width, int height,
+        uint8_t *dst_y, int dst_y_stride,
+        uint8_t *dst_u, int dst_u_stride,
+        uint8_t *dst_v, int dst_v_stride,
+        int threads)
+{
+    fforient_geometry luma, chroma;
+    if (!resolve(transform, width, height, &luma, &chroma)) return FFORIENT_INVALID_CROP;
+
+    int bands = fforient_band_count(luma.out_width, luma.out_height, threads);
+
+    if (bands == 1)
+    {
+        return fforient_nv12_to_i420(transform, y, y_stride, uv, uv_stride, width, height,
+                dst_y, dst_y_stride, dst_u, dst_u_stride, dst_v, dst_v_stride);
+    }
+
+    // workers that start after the bands ran out still
+    // hold the job, so it is not on this thread's stack
+    fforient_job *job = (fforient_job*) malloc(sizeof(fforient_job));
+    memset(job, 0, sizeof(fforient_job));
+    job->transform = *transform;
+    job->luma = luma;
+    job->chroma = chroma;
+    job->y = y;
+    job->y_stride = y_stride;
+    job->uv = uv;
+    job->uv_stride = uv_stride;
+    job->dst_y = dst_y;
+    job->dst_y_stride = dst_y_stride;
+    job->dst_u = dst_u;
+    job->dst_u_stride = dst_u_stride;
+    job->dst_v = dst_v;
+    job->dst_v_stride = dst_v_stride;
+    job->kernel = find_kernel(&luma, width, height, dst_y_stride, dst_u_stride, dst_v_stride);
+    job->bands = bands;
+    job->band_rows = FFALIGN((luma.out_height + bands - 1) / bands, BAND_ALIGN);
+    job->references = bands;
+    pthread_mutex_init(&job->mutex, 0);
+    pthread_cond_init(&job->done_cond, 0);
+
+    for (int i = 1; i < bands; i++)
+    {
+        if (ffpool_submit(&band_task, job, NULL) != FFPOOL_OK)
+        {
+            // the calling thread converts whatever is left
+            pthread_mutex_lock(&job->mutex);
+            job->references -= bands - i;
+            pthread_mutex_unlock(&job->mutex);
+            break;
+        }
+    }
+
+    // the calling thread takes bands as well, so every band is done
+    // even if the pool has no worker free to start another
+    run_bands(job);
+
+    pthread_mutex_lock(&job->mutex);
+    while (job->bands_done < job->bands)
+    {
+        pthread_cond_wait(&job->done_cond, &job->mutex);
+    }
+    pthread_mutex_unlock(&job->mutex);
+
+    release_job(job);
+
+    return FFORIENT_OK;
+}
+
+static void reference_nv12_to_i420(const fforient_transform *transform,
+        const uint8_t *y, int y_stride, const uint8_t *uv, int uv_stride, int width, int height,
+        uint8_t *dst_y, int dst_y_stride, uint8_t *dst_u, int dst_u_stride, uint8_t *dst_v, int dst_v_stride)
+{
+    fforient_geometry luma, chroma;
+    if (!resolve(transform, width, height, &luma, &chroma)) return;
+
+    map_plane(&luma, y, y_stride, 1, dst_y, dst_y_stride, NULL, 0,
+            0, 0, luma.out_width, luma.out_height);
+    map_plane(&chroma, uv, uv_stride, 2, dst_u, dst_u_stride, dst_v, dst_v_stride,
+            0, 0, chroma.out_width, chroma.out_height);
+}
+
+void fforient_benchmark(int width, int height, int iterations, fforient_benchmark_result *result)
+{
+    memset(result, 0, sizeof(fforient_benchmark_result));
+    if (width <= 0 || height <= 0 || (width & 1) || (height & 1) || iterations <= 0) return;
+
+    // a padded stride, as the camera gives
+    int stride = FFALIGN(width, 64);
+    int size = FFMAX(width, height);
+
+    uint8_t *nv12 = (uint8_t*) av_malloc(stride * height * 3 / 2);
+    uint8_t *planes[2];
+
+    for (int i = 0; i < stride * height * 3 / 2; i++)
+    {
+        nv12[i] = (i * 7 + (i >> 8) * 13) & 0xFF;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        planes[i] = (uint8_t*) av_malloc(size * size * 3 / 2);
+    }
+
+    for (int rotation = 0; rotation < FFORIENT_ROTATION_COUNT; rotation++)
+    {
+        for (int mirror = 0; mirror < 2; mirror++)
+        {
+            fforient_transform transform;
+            memset(&transform, 0, sizeof(fforient_transform));
+            transform.rotation = (fforient_rotation) rotation;
+            transform.mirror = mirror;
+
+            int out_width, out_height;
+            fforient_output_size(&transform, width, height, &out_width, &out_height);
+            int out_size = out_width * out_height;
+
+            for (int i = 0; i < 2; i++)
+            {
+                uint8_t *dst = planes[i];
+                int64_t start = av_gettime();
+
+                for (int n = 0; n < iterations; n++)
+                {
+                    if (i) reference_nv12_to_i420(&transform, nv12, stride, &nv12[stride * height], stride,
+                            width, height, dst, out_width, &dst[out_size], out_width / 2,
+                            &dst[out_size * 5 / 4], out_width / 2);
+                    else fforient_nv12_to_i420(&transform, nv12, stride, &nv12[stride * height], stride,
+                            width, height, dst, out_width, &dst[out_size], out_width / 2,
+                            &dst[out_size * 5 / 4], out_width / 2);
+                }
+
+                double time = (double) (av_gettime() - start) / iterations;
+                if (i) result->reference_time[rotation][mirror] = time;
+                else result->time[rotation][mirror] = time;
+            }
+
+            for (int i = 0; i < out_size * 3 / 2; i++)
+            {
+                if (planes[0][i] != planes[1][i]) result->mismatches++;
+            }
+        }
+    }
+
+    result->iterations = iterations;
+
+    av_free(nv12);
+    av_free(planes[0]);
+    av_free(planes[1]);
+}
+
+void fforient_benchmark_scaling(int width, int height, fforient_rotation rotation, int iterations,
+        fforient_scaling_result *result)
+{
+    memset(result, 0, sizeof(fforient_scaling_result));
+    if (width <= 0 || height <= 0 || (width & 1) || (height & 1) || iterations <= 0) return;
+
+    fforient_transform transform;
+    memset(&transform, 0, sizeof(fforient_transform));
+    transform.rotation = rotation;
+
+    int out_width, out_height;
+    fforient_output_size(&transform, width, height, &out_width, &out_height);
+    int out_size = out_width * out_height;
+
+    int stride = FFALIGN(width, 64);
+    uint8_t *nv12 = (uint8_t*) av_malloc(stride * height * 3 / 2);
+    uint8_t *dst = (uint8_t*) av_malloc(out_size * 3 / 2);
+    memset(nv12, 0x80, stride * height * 3 / 2);
+
+    int max_threads = FFMIN(sysconf(_SC_NPROCESSORS_ONLN), FFORIENT_MAX_BANDS);
+
+    for (int threads = 1; threads <= max_threads; threads++)
+    {
+        // the first frame starts the workers
+        for (int n = -1; n < iterations; n++)
+        {
+            if (!n) result->time[threads - 1] = av_gettime();
+
+            fforient_nv12_to_i420_parallel(&transform, nv12, stride, &nv12[stride * height], stride,
+                    width, height, dst, out_width, &dst[out_size], out_width / 2,
+                    &dst[out_size * 5 / 4], out_width / 2, threads);
+        }
+
+        result->time[threads - 1] = (av_gettime() - result->time[threads - 1]) / iterations;
+        result->bands[threads - 1] = fforient_band_count(out_width, out_height, threads);
+    }
+
+    result->threads = max_threads;
+
+    av_free(nv12);
+    av_free(dst);
+}
+
+void fforient_benchmark_fixed(int width, int height, int iterations, fforient_fixed_result *result)
+{
+    memset(result, 0, sizeof(fforient_fixed_result));
+    if (width <= 0 || height <= 0 || (width & 1) || (height & 1) || iterations <= 0) return;
+
+    result->fixed = fforient_has_fixed_kernel(width, height);
+
+    int stride = FFALIGN(width, 64);
+    int size = width * height;
+
+    uint8_t *nv12 = (uint8_t*) av_malloc(stride * height * 3 / 2);
+    uint8_t *planes[2];
+
+    for (int i = 0; i < stride * height * 3 / 2; i++)
+    {
+        nv12[i] = (i * 7 + (i >> 8) * 13) & 0xFF;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        planes[i] = (uint8_t*) av_malloc(size * 3 / 2);
+    }
+
+    for (int flip = 0; flip < 2; flip++)
+    {
+        for (int mirror = 0; mirror < 2; mirror++)
+        {
+            fforient_transform transform;
+            memset(&transform, 0, sizeof(fforient_transform));
+            transform.rotation = flip ? FFORIENT_ROTATE_180 : FFORIENT_ROTATE_0;
+            transform.mirror = mirror;
+
+            for (int fixed = 0; fixed < 2; fixed++)
+            {
+                uint8_t *dst = planes[fixed];
+                int64_t start = 0;
+
+                // the first frame faults the output in
+                for (int n = -1; n < iterations; n++)
+                {
+                    if (!n) start = av_gettime();
+
+                    convert(&transform, fixed, nv12, stride, &nv12[stride * height], stride, width, height,
+                            dst, width, &dst[size], width / 2, &dst[size * 5 / 4], width / 2);
+                }
+
+                double time = (double) (av_gettime() - start) / iterations;
+                if (fixed) result->fixed_time[flip][mirror] = time;
+                else result->generic_time[flip][mirror] = time;
+            }
+
+            for (int i = 0; i < size * 3 / 2; i++)
+            {
+                if (planes[0][i] != planes[1][i]) result->mismatches++;
+            }
+        }
+    }
+
+    result->iterations = iterations;
+
+    av_free(nv12);
+    av_free(planes[0]);
+    av_free(planes[1]);
+}
@@ -0,0 +1,206 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBORIENT_H
+#define FFBBORIENT_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/**
+ * The most bands a frame is split into for fforient_nv12_to_i420_parallel.
+ */
+#define FFORIENT_MAX_BANDS 16
+
+typedef enum
+{
+    FFORIENT_OK = 0,
+
+    /**
+     * The crop is odd or reaches outside of the frame.
+     */
+    FFORIENT_INVALID_CROP
+} fforient_error;
+
+typedef enum
+{
+    FFORIENT_ROTATE_0 = 0,
+    FFORIENT_ROTATE_90,
+    FFORIENT_ROTATE_180,
+    FFORIENT_ROTATE_270,
+    FFORIENT_ROTATION_COUNT
+} fforient_rotation;
+
+typedef struct
+{
+    /**
+     * Turn the frame clockwise.
+     */
+    fforient_rotation rotation;
+
+    /**
+     * Flip the turned frame left to right, as the front camera is shown.
+     */
+    bool mirror;
+
+    /**
+     * The part of the camera frame to keep, before it is turned. All must
+     * be even, and a width or height of 0 keeps the rest of the frame.
+     */
+    int crop_x;
+    int crop_y;
+    int crop_width;
+    int crop_height;
+} fforient_transform;
+
+typedef struct
+{
+    int64_t iterations;
+
+    /**
+     * Microseconds per frame for every rotation, as it is and mirrored.
+     */
+    double time[FFORIENT_ROTATION_COUNT][2];
+
+    /**
+     * The same for a reference converting a pixel at a time.
+     */
+    double reference_time[FFORIENT_ROTATION_COUNT][2];
+
+    /**
+     * Pixels of every plane that differ from the reference.
+     */
+    int64_t mismatches;
+} fforient_benchmark_result;
+
+typedef struct
+{
+    /**
+     * Threads measured, from 1 up to the processors online.
+     */
+    int threads;
+
+    /**
+     * Microseconds per frame, and the bands it was split into,
+     * with n + 1 threads.
+     */
+    double time[FFORIENT_MAX_BANDS];
+    int bands[FFORIENT_MAX_BANDS];
+} fforient_scaling_result;
+
+typedef struct
+{
+    int iterations;
+
+    /**
+     * Whether a kernel was compiled for the size.
+     */
+    bool fixed;
+
+    /**
+     * Microseconds per frame turned 0 and 180 degrees, then mirrored
+     * or not, by the generic and the fixed kernels.
+     */
+    double generic_time[2][2];
+    double fixed_time[2][2];
+
+    /**
+     * Bytes that differ between the generic and fixed output.
+     */
+    int64_t mismatches;
+} fforient_fixed_result;
+
+/**
+ * Whether the transform leaves frames as they are.
+ */
+bool fforient_is_identity(const fforient_transform *transform);
+
+/**
+ * The size of a width x height frame once cropped and turned,
+ * which the codec context has to be opened with.
+ */
+fforient_error fforient_output_size(const fforient_transform *transform, int width, int height,
+        int *out_width, int *out_height);
+
+/**
+ * Crop, turn and mirror an NV12 frame into planar I420 in one pass.
+ * Rows are copied or reversed with SIMD for 0 and 180 degrees, and
+ * 90 and 270 degrees transpose 8x8 blocks a 64x64 tile at a time so
+ * the rows of the source a tile reads stay cached while it is written.
+ */
+fforient_error fforient_nv12_to_i420(const fforient_transform *transform,
+        const uint8_t *y, int y_stride,
+        const uint8_t *uv, int uv_stride,
+        int width, int height,
+        uint8_t *dst_y, int dst_y_stride,
+        uint8_t *dst_u, int dst_u_stride,
+        uint8_t *dst_v, int dst_v_stride);
+
+/**
+ * Convert as fforient_nv12_to_i420 does, in bands of rows of the output
+ * converted at once by the calling thread and ffpool workers, up to
+ * threads in all, or one per processor online for 0. Bands are whole
+ * tiles of 64 rows and no smaller than 128 KB of output, so small frames
+ * stay on the calling thread. The calling thread takes bands as well
+ * until none are left, so a busy pool only slows the conversion down.
+ */
+fforient_error fforient_nv12_to_i420_parallel(const fforient_transform *transform,
+        const uint8_t *y, int y_stride,
+        const uint8_t *uv, int uv_stride,
+        int width, int height,
+        uint8_t *dst_y, int dst_y_stride,
+        uint8_t *dst_u, int dst_u_stride,
+        uint8_t *dst_v, int dst_v_stride,
+        int threads);
+
+/**
+ * The bands fforient_nv12_to_i420_parallel splits an output of the size into.
+ */
+int fforient_band_count(int out_width, int out_height, int threads);
+
+/**
+ * Whether fforient_nv12_to_i420 has a kernel compiled for width x height
+ * frames, the sizes the app captures at. Such frames turned 0 or 180
+ * degrees without a crop into planes width and width / 2 bytes apart
+ * are converted with the size and layout known to the compiler, and
+ * every other frame by the generic kernels.
+ */
+bool fforient_has_fixed_kernel(int width, int height);
+
+/**
+ * The instruction set used by fforient_nv12_to_i420: "sse2", "neon" or "c".
+ */
+const char *fforient_implementation(void);
+
+/**
+ * Time fforient_nv12_to_i420 in every orientation against the reference
+ * on a synthetic width x height frame, and compare their output.
+ */
+void fforient_benchmark(int width, int height, int iterations, fforient_benchmark_result *result);
+
+/**
+ * Time fforient_nv12_to_i420_parallel turning a synthetic width x height
+ * frame with 1 thread and up to one per processor online.
+ */
+void fforient_benchmark_scaling(int width, int height, fforient_rotation rotation, int iterations,
+        fforient_scaling_result *result);
+
+/**
+ * Time the generic kernels against the fixed kernel of a synthetic
+ * width x height frame, which are the same if there is none.
+ */
+void fforient_benchmark_fixed(int width, int height, int iterations, fforient_fixed_result *result);
+
+#endif
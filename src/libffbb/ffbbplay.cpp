@@ -0,0 +1,907 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbplay.h"
+#include "ffbbpool.h"
+#include "ffbbscan.h"
+#include "ffbbsched.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define FFPLAY_DEFAULT_CACHE_SIZE (64 * 1024 * 1024)
+#define FFPLAY_SCAN_BUFFER_SIZE (64 * 1024)
+
+#define SEQUENCE_HEADER_CODE 0xB3
+#define SEQUENCE_END_CODE 0xB7
+
+typedef struct
+{
+    int64_t offset;
+    int64_t size;
+    int64_t first_frame;
+    int frame_count;
+} ffplay_gop;
+
+typedef struct ffplay_cached_gop
+{
+    int gop;
+    int frame_count;
+    int64_t bytes;
+    AVFrame **frames;
+    struct ffplay_cached_gop *prev;
+    struct ffplay_cached_gop *next;
+} ffplay_cached_gop;
+
+typedef struct
+{
+    bool open;
+    bool working;
+    bool running;
+    ffpool_task *worker_task;
+    // set until the playback is joined, even if it ran off the end by itself
+    ffpool_task *playing_task;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    ffindex_context *ffi_context;
+    bool owns_index;
+    ffplay_gop *gops;
+    int gop_count;
+    int gop_capacity;
+    int64_t frame_count;
+    uint8_t *sequence_header;
+    int sequence_header_size;
+    // most recently used first
+    ffplay_cached_gop *cache_head;
+    ffplay_cached_gop *cache_tail;
+    int64_t cache_limit;
+    int demand_gop;
+    int prefetch_gop;
+    int decoding_gop;
+    int failed_gop;
+    int pinned_gop;
+    int64_t position;
+    ffplay_direction direction;
+    ffplay_cache_stats stats;
+    void (*frame_callback)(ffplay_context *ffp_context, AVFrame *frame, int64_t frame_number, void *arg);
+    void *frame_callback_arg;
+    int (*read_callback)(ffplay_context *ffp_context, int64_t offset, uint8_t *buf, ssize_t size, void *arg);
+    void *read_callback_arg;
+} ffplay_reserved;
+
+void* ffplay_worker_thread(void* arg);
+void* ffplay_playing_thread(void* arg);
+
+static ffplay_error ffplay_scan(ffplay_context *ffp_context, int64_t length);
+static ffplay_error ffplay_load_index(ffplay_context *ffp_context);
+static void ffplay_load_sequence_header(ffplay_context *ffp_context);
+static ffplay_error ffplay_present(ffplay_context *ffp_context, int64_t frame_number, ffplay_direction direction);
+static void ffplay_free_gops(ffplay_reserved *ffp_reserved);
+static void ffplay_free_cache(ffplay_reserved *ffp_reserved);
+
+ffplay_context *ffplay_alloc()
+{
+    ffplay_context *ffp_context = (ffplay_context*) malloc(sizeof(ffplay_context));
+    memset(ffp_context, 0, sizeof(ffplay_context));
+
+    ffplay_reset(ffp_context);
+
+    return ffp_context;
+}
+
+void ffplay_reset(ffplay_context *ffp_context)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+
+    // the tasks of an open stream must not outlive its context, and
+    // don't carry over the index or cache, they belong to the old stream
+    if (ffp_reserved)
+    {
+        ffplay_close(ffp_context);
+        ffplay_free_cache(ffp_reserved);
+        ffplay_free_gops(ffp_reserved);
+    }
+
+    if (!ffp_reserved) ffp_reserved = (ffplay_reserved*) malloc(sizeof(ffplay_reserved));
+    memset(ffp_reserved, 0, sizeof(ffplay_reserved));
+
+    ffp_reserved->cache_limit = FFPLAY_DEFAULT_CACHE_SIZE;
+    ffp_reserved->demand_gop = -1;
+    ffp_reserved->prefetch_gop = -1;
+    ffp_reserved->decoding_gop = -1;
+    ffp_reserved->failed_gop = -1;
+    ffp_reserved->pinned_gop = -1;
+    ffp_reserved->position = -1;
+    ffp_reserved->direction = FFPLAY_FORWARD;
+
+    memset(ffp_context, 0, sizeof(ffplay_context));
+    ffp_context->reserved = ffp_reserved;
+}
+
+ffplay_error ffplay_set_frame_callback(ffplay_context *ffp_context,
+        void (*frame_callback)(ffplay_context *ffp_context, AVFrame *frame, int64_t frame_number, void *arg),
+        void *arg)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return FFPLAY_NOT_INITIALIZED;
+    ffp_reserved->frame_callback = frame_callback;
+    ffp_reserved->frame_callback_arg = arg;
+    return FFPLAY_OK;
+}
+
+ffplay_error ffplay_set_read_callback(ffplay_context *ffp_context,
+        int (*read_callback)(ffplay_context *ffp_context, int64_t offset, uint8_t *buf, ssize_t size, void *arg),
+        void *arg)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return FFPLAY_NOT_INITIALIZED;
+    ffp_reserved->read_callback = read_callback;
+    ffp_reserved->read_callback_arg = arg;
+    return FFPLAY_OK;
+}
+
+ffplay_error ffplay_set_index(ffplay_context *ffp_context, ffindex_context *ffi_context)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return FFPLAY_NOT_INITIALIZED;
+    if (ffp_reserved->open) return FFPLAY_ALREADY_OPEN;
+    ffp_reserved->ffi_context = ffi_context;
+    return FFPLAY_OK;
+}
+
+ffplay_error ffplay_set_cache_size(ffplay_context *ffp_context, int64_t bytes)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return FFPLAY_NOT_INITIALIZED;
+    if (ffp_reserved->open) pthread_mutex_lock(&ffp_reserved->mutex);
+    ffp_reserved->cache_limit = bytes;
+    if (ffp_reserved->open) pthread_mutex_unlock(&ffp_reserved->mutex);
+    return FFPLAY_OK;
+}
+
+ffplay_error ffplay_open(ffplay_context *ffp_context, int64_t length)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return FFPLAY_NOT_INITIALIZED;
+    if (ffp_reserved->open) return FFPLAY_ALREADY_OPEN;
+    if (!ffp_reserved->read_callback) return FFPLAY_NO_READ_CALLBACK;
+
+    AVCodecContext *codec_context = ffp_context->codec_context;
+    if (!codec_context) return FFPLAY_NO_CODEC_SPECIFIED;
+    if (!avcodec_is_open(codec_context)) return FFPLAY_CODEC_NOT_OPEN;
+
+    ffplay_error error;
+    if (ffp_reserved->ffi_context) error = ffplay_load_index(ffp_context);
+    else error = ffplay_scan(ffp_context, length);
+
+    if (error != FFPLAY_OK)
+    {
+        ffplay_free_gops(ffp_reserved);
+        return error;
+    }
+
+    ffplay_load_sequence_header(ffp_context);
+
+    pthread_mutex_init(&ffp_reserved->mutex, 0);
+    pthread_cond_init(&ffp_reserved->work_cond, 0);
+    pthread_cond_init(&ffp_reserved->done_cond, 0);
+
+    ffp_reserved->open = true;
+    ffp_reserved->working = true;
+
+    if (ffpool_submit(&ffplay_worker_thread, ffp_context, &ffp_reserved->worker_task) != FFPOOL_OK)
+    {
+        ffp_reserved->open = false;
+        ffp_reserved->working = false;
+        pthread_mutex_destroy(&ffp_reserved->mutex);
+        pthread_cond_destroy(&ffp_reserved->work_cond);
+        pthread_cond_destroy(&ffp_reserved->done_cond);
+        ffplay_free_gops(ffp_reserved);
+        return FFPLAY_THREAD_FAILED;
+    }
+
+    return FFPLAY_OK;
+}
+
+ffplay_error ffplay_close(ffplay_context *ffp_context)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+
+    if (ffp_reserved && ffp_reserved->open)
+    {
+        ffplay_stop(ffp_context);
+
+        pthread_mutex_lock(&ffp_reserved->mutex);
+        ffp_reserved->working = false;
+        pthread_cond_signal(&ffp_reserved->work_cond);
+        pthread_mutex_unlock(&ffp_reserved->mutex);
+
+        if (ffp_reserved->worker_task) ffpool_join(ffp_reserved->worker_task, NULL);
+        ffp_reserved->worker_task = NULL;
+
+        pthread_mutex_destroy(&ffp_reserved->mutex);
+        pthread_cond_destroy(&ffp_reserved->work_cond);
+        pthread_cond_destroy(&ffp_reserved->done_cond);
+
+        ffplay_free_cache(ffp_reserved);
+        ffplay_free_gops(ffp_reserved);
+
+        ffp_reserved->open = false;
+    }
+
+    AVCodecContext *codec_context = ffp_context->codec_context;
+
+    if (codec_context)
+    {
+        if (avcodec_is_open(codec_context))
+        {
+            avcodec_close(codec_context);
+        }
+
+        av_free(codec_context);
+        codec_context = ffp_context->codec_context = NULL;
+    }
+
+    return FFPLAY_OK;
+}
+
+ffplay_error ffplay_free(ffplay_context *ffp_context)
+{
+    if (ffp_context->reserved)
+    {
+        ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+
+        ffplay_close(ffp_context);
+        ffplay_free_cache(ffp_reserved);
+        ffplay_free_gops(ffp_reserved);
+
+        free(ffp_context->reserved);
+        ffp_context->reserved = NULL;
+    }
+
+    free(ffp_context);
+
+    return FFPLAY_OK;
+}
+
+int64_t ffplay_frame_count(ffplay_context *ffp_context)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return 0;
+    return ffp_reserved->frame_count;
+}
+
+int64_t ffplay_position(ffplay_context *ffp_context)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return -1;
+    return ffp_reserved->position;
+}
+
+ffplay_error ffplay_seek_frame(ffplay_context *ffp_context, int64_t frame_number)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return FFPLAY_NOT_INITIALIZED;
+    if (!ffp_reserved->open) return FFPLAY_NOT_OPEN;
+    if (ffp_reserved->running) return FFPLAY_ALREADY_RUNNING;
+
+    // guess the scrub direction so the right neighbour gets prefetched
+    ffplay_direction direction = ffp_reserved->direction;
+    if (ffp_reserved->position >= 0 && frame_number != ffp_reserved->position)
+    {
+        direction = frame_number < ffp_reserved->position ? FFPLAY_REVERSE : FFPLAY_FORWARD;
+    }
+
+    return ffplay_present(ffp_context, frame_number, direction);
+}
+
+ffplay_error ffplay_step(ffplay_context *ffp_context, ffplay_direction direction)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return FFPLAY_NOT_INITIALIZED;
+    if (!ffp_reserved->open) return FFPLAY_NOT_OPEN;
+    if (ffp_reserved->running) return FFPLAY_ALREADY_RUNNING;
+
+    int64_t position = ffp_reserved->position;
+    if (position < 0) position = direction == FFPLAY_REVERSE ? ffp_reserved->frame_count : -1;
+
+    return ffplay_present(ffp_context, position + direction, direction);
+}
+
+ffplay_error ffplay_start(ffplay_context *ffp_context, ffplay_direction direction)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return FFPLAY_NOT_INITIALIZED;
+    if (!ffp_reserved->open) return FFPLAY_NOT_OPEN;
+    if (ffp_reserved->running) return FFPLAY_ALREADY_RUNNING;
+
+    // reap the task of a playback that ran off the end by itself
+    if (ffp_reserved->playing_task) ffpool_join(ffp_reserved->playing_task, NULL);
+    ffp_reserved->playing_task = NULL;
+
+    if (ffp_reserved->position < 0)
+    {
+        ffp_reserved->position = direction == FFPLAY_REVERSE ? ffp_reserved->frame_count : -1;
+    }
+
+    ffp_reserved->direction = direction;
+    ffp_reserved->running = true;
+
+    if (ffpool_submit(&ffplay_playing_thread, ffp_context, &ffp_reserved->playing_task) != FFPOOL_OK)
+    {
+        ffp_reserved->running = false;
+        return FFPLAY_THREAD_FAILED;
+    }
+
+    return FFPLAY_OK;
+}
+
+ffplay_error ffplay_stop(ffplay_context *ffp_context)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return FFPLAY_NOT_INITIALIZED;
+
+    bool running = ffp_reserved->running;
+    ffp_reserved->running = false;
+
+    if (ffp_reserved->playing_task)
+    {
+        ffpool_join(ffp_reserved->playing_task, NULL);
+        ffp_reserved->playing_task = NULL;
+    }
+
+    return running ? FFPLAY_OK : FFPLAY_ALREADY_STOPPED;
+}
+
+ffplay_error ffplay_get_cache_stats(ffplay_context *ffp_context, ffplay_cache_stats *stats)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (!ffp_reserved) return FFPLAY_NOT_INITIALIZED;
+
+    if (ffp_reserved->open) pthread_mutex_lock(&ffp_reserved->mutex);
+    *stats = ffp_reserved->stats;
+    stats->bytes_limit = ffp_reserved->cache_limit;
+    if (ffp_reserved->open) pthread_mutex_unlock(&ffp_reserved->mutex);
+
+    return FFPLAY_OK;
+}
+
+static int ffplay_read(ffplay_context *ffp_context, int64_t offset, uint8_t *buf, ssize_t size)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+
+    ssize_t total = 0;
+    while (total < size)
+    {
+        int read = ffp_reserved->read_callback(ffp_context, offset + total,
+                buf + total, size - total, ffp_reserved->read_callback_arg);
+        if (read <= 0) break;
+        total += read;
+    }
+    return total;
+}
+
+static ffplay_gop *ffplay_add_gop(ffplay_reserved *ffp_reserved, int64_t offset)
+{
+    if (ffp_reserved->gop_count == ffp_reserved->gop_capacity)
+    {
+        ffp_reserved->gop_capacity = ffp_reserved->gop_capacity ? ffp_reserved->gop_capacity * 2 : 64;
+        ffp_reserved->gops = (ffplay_gop*) realloc(ffp_reserved->gops,
+                ffp_reserved->gop_capacity * sizeof(ffplay_gop));
+    }
+
+    ffplay_gop *gop = &ffp_reserved->gops[ffp_reserved->gop_count++];
+    gop->offset = offset;
+    gop->size = 0;
+    gop->first_frame = ffp_reserved->frame_count;
+    gop->frame_count = 0;
+    return gop;
+}
+
+/**
+ * Build an index of the stream with the start code scanner,
+ * for streams recorded without a sidecar.
+ */
+static ffplay_error ffplay_scan(ffplay_context *ffp_context, int64_t length)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+
+    ffp_reserved->ffi_context = ffindex_alloc();
+    ffp_reserved->owns_index = true;
+
+    ffscan_context *ffs_context = ffscan_alloc();
+    ffs_context->ffi_context = ffp_reserved->ffi_context;
+
+    uint8_t *buffer = (uint8_t*) av_malloc(FFPLAY_SCAN_BUFFER_SIZE);
+
+    int64_t offset = 0;
+    while (offset < length)
+    {
+        ssize_t size = FFMIN(FFPLAY_SCAN_BUFFER_SIZE, length - offset);
+        int read = ffplay_read(ffp_context, offset, buffer, size);
+        if (read <= 0) break;
+
+        ffscan_feed(ffs_context, buffer, read);
+        offset += read;
+    }
+
+    ffscan_finish(ffs_context);
+    ffscan_free(ffs_context);
+    ffs_context = NULL;
+
+    av_free(buffer);
+    buffer = NULL;
+
+    return ffplay_load_index(ffp_context);
+}
+
+/**
+ * Build the GOP table from an index instead of scanning the stream.
+ */
+static ffplay_error ffplay_load_index(ffplay_context *ffp_context)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    ffindex_context *ffi_context = ffp_reserved->ffi_context;
+
+    int64_t count = ffindex_gop_count(ffi_context);
+    for (int64_t i = 0; i < count; i++)
+    {
+        ffindex_gop index_gop;
+        ffindex_get_gop(ffi_context, i, &index_gop);
+
+        ffplay_gop *gop = ffplay_add_gop(ffp_reserved, index_gop.offset);
+        gop->size = index_gop.size;
+        gop->frame_count = index_gop.entry_count;
+        ffp_reserved->frame_count += index_gop.entry_count;
+    }
+
+    if (!ffp_reserved->gop_count) return FFPLAY_NO_FRAMES;
+
+    return FFPLAY_OK;
+}
+
+/**
+ * Keep a copy of the first sequence header, up to the GOP or picture
+ * that follows it, so GOPs without one can still be decoded on their own.
+ */
+static void ffplay_load_sequence_header(ffplay_context *ffp_context)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    ffplay_gop *gop = &ffp_reserved->gops[0];
+
+    int size = FFMIN(gop->size, FFPLAY_SCAN_BUFFER_SIZE);
+    uint8_t *buffer = (uint8_t*) av_malloc(size);
+    size = ffplay_read(ffp_context, gop->offset, buffer, size);
+
+    int start;
+    int length = ffscan_find_sequence_header(buffer, size, &start);
+
+    if (length)
+    {
+        ffp_reserved->sequence_header = (uint8_t*) av_malloc(length);
+        ffp_reserved->sequence_header_size = length;
+        memcpy(ffp_reserved->sequence_header, &buffer[start], length);
+    }
+
+    av_free(buffer);
+    buffer = NULL;
+}
+
+static int ffplay_find_gop(ffplay_reserved *ffp_reserved, int64_t frame_number)
+{
+    int low = 0;
+    int high = ffp_reserved->gop_count - 1;
+    while (low < high)
+    {
+        int mid = (low + high + 1) / 2;
+        if (ffp_reserved->gops[mid].first_frame <= frame_number) low = mid;
+        else high = mid - 1;
+    }
+    return low;
+}
+
+static ffplay_cached_gop *ffplay_find_cached(ffplay_reserved *ffp_reserved, int gop)
+{
+    for (ffplay_cached_gop *cached = ffp_reserved->cache_head; cached; cached = cached->next)
+    {
+        if (cached->gop == gop) return cached;
+    }
+    return NULL;
+}
+
+static void ffplay_unlink_cached(ffplay_reserved *ffp_reserved, ffplay_cached_gop *cached)
+{
+    if (cached->prev) cached->prev->next = cached->next;
+    else ffp_reserved->cache_head = cached->next;
+    if (cached->next) cached->next->prev = cached->prev;
+    else ffp_reserved->cache_tail = cached->prev;
+    cached->prev = cached->next = NULL;
+}
+
+static void ffplay_push_cached(ffplay_reserved *ffp_reserved, ffplay_cached_gop *cached)
+{
+    cached->prev = NULL;
+    cached->next = ffp_reserved->cache_head;
+    if (ffp_reserved->cache_head) ffp_reserved->cache_head->prev = cached;
+    else ffp_reserved->cache_tail = cached;
+    ffp_reserved->cache_head = cached;
+}
+
+static void ffplay_free_cached(ffplay_cached_gop *cached)
+{
+    for (int i = 0; i < cached->frame_count; i++)
+    {
+        avpicture_free((AVPicture*) cached->frames[i]);
+        av_free(cached->frames[i]);
+    }
+    free(cached->frames);
+    free(cached);
+}
+
+static void ffplay_free_cache(ffplay_reserved *ffp_reserved)
+{
+    while (ffp_reserved->cache_head)
+    {
+        ffplay_cached_gop *cached = ffp_reserved->cache_head;
+        ffplay_unlink_cached(ffp_reserved, cached);
+        ffplay_free_cached(cached);
+    }
+
+    ffp_reserved->stats.frames_cached = 0;
+    ffp_reserved->stats.bytes_cached = 0;
+}
+
+static void ffplay_free_gops(ffplay_reserved *ffp_reserved)
+{
+    if (ffp_reserved->owns_index)
+    {
+        ffindex_free(ffp_reserved->ffi_context);
+        ffp_reserved->ffi_context = NULL;
+        ffp_reserved->owns_index = false;
+    }
+
+    free(ffp_reserved->gops);
+    ffp_reserved->gops = NULL;
+    ffp_reserved->gop_count = 0;
+    ffp_reserved->gop_capacity = 0;
+    ffp_reserved->frame_count = 0;
+
+    av_free(ffp_reserved->sequence_header);
+    ffp_reserved->sequence_header = NULL;
+    ffp_reserved->sequence_header_size = 0;
+}
+
+/**
+ * Drop least recently used GOPs until the cache fits the limit.
+ * Must be called with the mutex held.
+ */
+static void ffplay_evict(ffplay_reserved *ffp_reserved, ffplay_cached_gop *keep)
+{
+    ffplay_cached_gop *cached = ffp_reserved->cache_tail;
+    while (cached && ffp_reserved->stats.bytes_cached > ffp_reserved->cache_limit)
+    {
+        ffplay_cached_gop *prev = cached->prev;
+
+        if (cached != keep && cached->gop != ffp_reserved->pinned_gop)
+        {
+            ffplay_unlink_cached(ffp_reserved, cached);
+            ffp_reserved->stats.bytes_cached -= cached->bytes;
+            ffp_reserved->stats.frames_cached -= cached->frame_count;
+            ffp_reserved->stats.evictions++;
+            ffplay_free_cached(cached);
+        }
+
+        cached = prev;
+    }
+}
+
+static bool ffplay_keep_frame(ffplay_cached_gop *cached, int capacity, AVCodecContext *codec_context, AVFrame *frame)
+{
+    if (cached->frame_count >= capacity) return false;
+
+    int width = codec_context->width;
+    int height = codec_context->height;
+    enum PixelFormat pix_fmt = codec_context->pix_fmt;
+
+    AVFrame *copy = avcodec_alloc_frame();
+    if (avpicture_alloc((AVPicture*) copy, pix_fmt, width, height) < 0)
+    {
+        av_free(copy);
+        return false;
+    }
+
+    av_picture_copy((AVPicture*) copy, (const AVPicture*) frame, pix_fmt, width, height);
+    copy->width = width;
+    copy->height = height;
+    copy->format = pix_fmt;
+    copy->pict_type = frame->pict_type;
+    copy->key_frame = frame->key_frame;
+    copy->pts = frame->pts;
+
+    cached->frames[cached->frame_count++] = copy;
+    cached->bytes += avpicture_get_size(pix_fmt, width, height);
+    return true;
+}
+
+/**
+ * Decode one GOP from its first byte into a new cache entry.
+ * The decoder is flushed first so no references leak in from
+ * whatever GOP was decoded before it.
+ */
+static ffplay_cached_gop *ffplay_decode_gop(ffplay_context *ffp_context, int index)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    AVCodecContext *codec_context = ffp_context->codec_context;
+    ffplay_gop *gop = &ffp_reserved->gops[index];
+
+    int prefix = ffp_reserved->sequence_header_size;
+    int64_t length = prefix + gop->size + 4;
+
+    uint8_t *buffer = (uint8_t*) av_malloc(length + FF_INPUT_BUFFER_PADDING_SIZE);
+    memset(buffer + length, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    uint8_t *data = buffer + prefix;
+    if (ffplay_read(ffp_context, gop->offset, data, gop->size) != gop->size)
+    {
+        av_free(buffer);
+        return NULL;
+    }
+
+    // only put the saved sequence header in front of GOPs without their own
+    if (prefix && !(gop->size >= 4 && data[0] == 0x00 && data[1] == 0x00 &&
+            data[2] == 0x01 && data[3] == SEQUENCE_HEADER_CODE))
+    {
+        data = buffer;
+        memcpy(data, ffp_reserved->sequence_header, prefix);
+    }
+
+    // terminate with a sequence end code so the last picture is flushed out
+    uint8_t *end = buffer + prefix + gop->size;
+    end[0] = 0x00;
+    end[1] = 0x00;
+    end[2] = 0x01;
+    end[3] = SEQUENCE_END_CODE;
+
+    ffplay_cached_gop *cached = (ffplay_cached_gop*) malloc(sizeof(ffplay_cached_gop));
+    memset(cached, 0, sizeof(ffplay_cached_gop));
+    cached->gop = index;
+    cached->frames = (AVFrame**) malloc(gop->frame_count * sizeof(AVFrame*));
+
+    avcodec_flush_buffers(codec_context);
+
+    AVFrame *frame = avcodec_alloc_frame();
+
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = data;
+    packet.size = end + 4 - data;
+
+    int got_frame;
+    bool failed = false;
+
+    while (packet.size > 0)
+    {
+        got_frame = 0;
+        int decode_result = avcodec_decode_video2(codec_context, frame, &got_frame, &packet);
+
+        if (decode_result < 0)
+        {
+            failed = true;
+            break;
+        }
+
+        if (got_frame) ffplay_keep_frame(cached, gop->frame_count, codec_context, frame);
+
+        packet.size -= decode_result;
+        packet.data += decode_result;
+    }
+
+    do
+    {
+        // reset the AVPacket
+        av_init_packet(&packet);
+        packet.data = NULL;
+        packet.size = 0;
+
+        got_frame = 0;
+        avcodec_decode_video2(codec_context, frame, &got_frame, &packet);
+
+        if (got_frame) ffplay_keep_frame(cached, gop->frame_count, codec_context, frame);
+    }
+    while (got_frame);
+
+    av_free(frame);
+    frame = NULL;
+
+    av_free(buffer);
+    buffer = NULL;
+
+    if (failed || !cached->frame_count)
+    {
+        ffplay_free_cached(cached);
+        return NULL;
+    }
+
+    return cached;
+}
+
+void* ffplay_worker_thread(void* arg)
+{
+    ffplay_context *ffp_context = (ffplay_context*) arg;
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+
+    ffsched_apply(FFSCHED_READ);
+
+    pthread_mutex_lock(&ffp_reserved->mutex);
+
+    while (ffp_reserved->working)
+    {
+        int gop = -1;
+        bool prefetch = false;
+
+        // a frame someone is waiting on always beats a prefetch
+        if (ffp_reserved->demand_gop >= 0)
+        {
+            gop = ffp_reserved->demand_gop;
+            ffp_reserved->demand_gop = -1;
+        }
+        else if (ffp_reserved->prefetch_gop >= 0)
+        {
+            gop = ffp_reserved->prefetch_gop;
+            ffp_reserved->prefetch_gop = -1;
+            prefetch = true;
+        }
+
+        if (gop < 0)
+        {
+            pthread_cond_wait(&ffp_reserved->work_cond, &ffp_reserved->mutex);
+            continue;
+        }
+
+        if (ffplay_find_cached(ffp_reserved, gop))
+        {
+            pthread_cond_broadcast(&ffp_reserved->done_cond);
+            continue;
+        }
+
+        ffp_reserved->decoding_gop = gop;
+        pthread_mutex_unlock(&ffp_reserved->mutex);
+
+        ffplay_cached_gop *cached = ffplay_decode_gop(ffp_context, gop);
+
+        pthread_mutex_lock(&ffp_reserved->mutex);
+        ffp_reserved->decoding_gop = -1;
+
+        if (cached)
+        {
+            ffplay_push_cached(ffp_reserved, cached);
+            ffp_reserved->stats.bytes_cached += cached->bytes;
+            ffp_reserved->stats.frames_cached += cached->frame_count;
+            if (prefetch) ffp_reserved->stats.prefetches++;
+            ffplay_evict(ffp_reserved, cached);
+        }
+        else
+        {
+            fprintf(stderr, "Error while decoding GOP %d\n", gop);
+            ffp_reserved->failed_gop = gop;
+        }
+
+        pthread_cond_broadcast(&ffp_reserved->done_cond);
+    }
+
+    pthread_cond_broadcast(&ffp_reserved->done_cond);
+    pthread_mutex_unlock(&ffp_reserved->mutex);
+
+    return 0;
+}
+
+static ffplay_error ffplay_present(ffplay_context *ffp_context, int64_t frame_number, ffplay_direction direction)
+{
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    if (frame_number < 0 || frame_number >= ffp_reserved->frame_count) return FFPLAY_OUT_OF_RANGE;
+
+    int gop = ffplay_find_gop(ffp_reserved, frame_number);
+
+    pthread_mutex_lock(&ffp_reserved->mutex);
+
+    ffplay_cached_gop *cached = ffplay_find_cached(ffp_reserved, gop);
+
+    if (cached)
+    {
+        ffp_reserved->stats.hits++;
+    }
+    else
+    {
+        ffp_reserved->stats.misses++;
+        ffp_reserved->failed_gop = -1;
+        ffp_reserved->demand_gop = gop;
+        pthread_cond_signal(&ffp_reserved->work_cond);
+
+        while (ffp_reserved->working && ffp_reserved->failed_gop != gop &&
+                !(cached = ffplay_find_cached(ffp_reserved, gop)))
+        {
+            pthread_cond_wait(&ffp_reserved->done_cond, &ffp_reserved->mutex);
+        }
+    }
+
+    if (!cached)
+    {
+        pthread_mutex_unlock(&ffp_reserved->mutex);
+        return FFPLAY_DECODE_FAILED;
+    }
+
+    // the pinned GOP is never evicted, so the frame stays
+    // valid after unlocking until the next one is presented
+    ffplay_unlink_cached(ffp_reserved, cached);
+    ffplay_push_cached(ffp_reserved, cached);
+    ffp_reserved->pinned_gop = gop;
+    ffp_reserved->direction = direction;
+
+    int next = gop + direction;
+    if (next >= 0 && next < ffp_reserved->gop_count && next != ffp_reserved->decoding_gop &&
+            !ffplay_find_cached(ffp_reserved, next))
+    {
+        ffp_reserved->prefetch_gop = next;
+        pthread_cond_signal(&ffp_reserved->work_cond);
+    }
+
+    pthread_mutex_unlock(&ffp_reserved->mutex);
+
+    // open GOPs may decode fewer frames than were counted
+    int index = frame_number - ffp_reserved->gops[gop].first_frame;
+    if (index >= cached->frame_count) index = cached->frame_count - 1;
+    AVFrame *frame = cached->frames[index];
+
+    ffp_reserved->position = frame_number;
+
+    if (ffp_reserved->frame_callback) ffp_reserved->frame_callback(
+            ffp_context, frame, frame_number, ffp_reserved->frame_callback_arg);
+
+    return FFPLAY_OK;
+}
+
+void* ffplay_playing_thread(void* arg)
+{
+    ffplay_context *ffp_context = (ffplay_context*) arg;
+    ffplay_reserved *ffp_reserved = (ffplay_reserved*) ffp_context->reserved;
+    AVCodecContext *codec_context = ffp_context->codec_context;
+
+    ffsched_apply(FFSCHED_PRESENT);
+
+    int64_t frame_duration = 1000000 / 30;
+    if (codec_context->time_base.num > 0 && codec_context->time_base.den > 0)
+    {
+        frame_duration = (int64_t) 1000000 * codec_context->time_base.num
+                * FFMAX(codec_context->ticks_per_frame, 1) / codec_context->time_base.den;
+    }
+
+    while (ffp_reserved->running)
+    {
+        int64_t start = av_gettime();
+
+        int64_t frame_number = ffp_reserved->position + ffp_reserved->direction;
+        if (frame_number < 0 || frame_number >= ffp_reserved->frame_count) break;
+
+        if (ffplay_present(ffp_context, frame_number, ffp_reserved->direction) != FFPLAY_OK) break;
+
+        int64_t elapsed = av_gettime() - start;
+        if (elapsed < frame_duration) usleep(frame_duration - elapsed);
+    }
+
+    ffp_reserved->running = false;
+
+    return 0;
+}
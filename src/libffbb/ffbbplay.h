@@ -0,0 +1,189 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBPLAY_H
+#define FFBBPLAY_H
+
+// include math.h otherwise it will get included
+// by avformat.h and cause duplicate definition
+// errors because of C vs C++ functions
+#include <math.h>
+
+extern "C"
+{
+#define UINT64_C uint64_t
+#define INT64_C int64_t
+#include <libavformat/avformat.h>
+}
+
+#include <sys/types.h>
+
+#include "ffbbindex.h"
+
+typedef enum
+{
+    FFPLAY_OK = 0,
+    FFPLAY_NOT_INITIALIZED,
+    FFPLAY_CODEC_NOT_OPEN,
+    FFPLAY_NO_CODEC_SPECIFIED,
+    FFPLAY_NO_READ_CALLBACK,
+    FFPLAY_NOT_OPEN,
+    FFPLAY_ALREADY_OPEN,
+    FFPLAY_NO_FRAMES,
+    FFPLAY_OUT_OF_RANGE,
+    FFPLAY_DECODE_FAILED,
+    FFPLAY_ALREADY_RUNNING,
+    FFPLAY_ALREADY_STOPPED,
+    FFPLAY_THREAD_FAILED
+} ffplay_error;
+
+typedef enum
+{
+    FFPLAY_FORWARD = 1,
+    FFPLAY_REVERSE = -1
+} ffplay_direction;
+
+typedef struct
+{
+    /**
+     * Frame requests answered from the cache.
+     */
+    int64_t hits;
+
+    /**
+     * Frame requests that had to wait for their GOP to be decoded.
+     */
+    int64_t misses;
+
+    /**
+     * GOPs decoded ahead of time by the prefetch worker.
+     */
+    int64_t prefetches;
+
+    /**
+     * GOPs dropped from the cache to stay within the size limit.
+     */
+    int64_t evictions;
+
+    int64_t frames_cached;
+    int64_t bytes_cached;
+    int64_t bytes_limit;
+} ffplay_cache_stats;
+
+typedef struct
+{
+    /**
+     * The codec context to use for decoding.
+     * This must not be shared with a running ffdec_context.
+     */
+    AVCodecContext *codec_context;
+
+    /**
+     * For internal use. Do not use.
+     */
+    void *reserved;
+} ffplay_context;
+
+/**
+ * Allocate the context with default values.
+ */
+ffplay_context *ffplay_alloc(void);
+
+/**
+ * Reset the context with default values.
+ * An open context is closed first.
+ */
+void ffplay_reset(ffplay_context *ffp_context);
+
+ffplay_error ffplay_set_frame_callback(ffplay_context *ffp_context,
+        void (*frame_callback)(ffplay_context *ffp_context, AVFrame *frame, int64_t frame_number, void *arg),
+        void *arg);
+
+/**
+ * Unlike ffdec, reads are random access. The callback must fill buf
+ * with up to size bytes starting at the given offset of the stream
+ * and return the number of bytes read.
+ */
+ffplay_error ffplay_set_read_callback(ffplay_context *ffp_context,
+        int (*read_callback)(ffplay_context *ffp_context, int64_t offset, uint8_t *buf, ssize_t size, void *arg),
+        void *arg);
+
+/**
+ * Take GOP boundaries from an index, such as the sidecar written while
+ * recording, instead of scanning the whole stream in ffplay_open.
+ * Entries must carry offsets and sizes; frames are numbered in index order.
+ */
+ffplay_error ffplay_set_index(ffplay_context *ffp_context, ffindex_context *ffi_context);
+
+/**
+ * Set the maximum number of bytes of decoded frames to keep cached.
+ * At least the GOP being presented is always kept, even if it alone
+ * exceeds the limit.
+ */
+ffplay_error ffplay_set_cache_size(ffplay_context *ffp_context, int64_t bytes);
+
+/**
+ * Locate the GOPs of a stream of the given length, from the index if
+ * one is set, and start the prefetch worker. The codec context must
+ * already be open.
+ */
+ffplay_error ffplay_open(ffplay_context *ffp_context, int64_t length);
+
+/**
+ * Stop playback and the prefetch worker and drop the cache.
+ * This will also close the AVCodecContext if not already closed.
+ */
+ffplay_error ffplay_close(ffplay_context *ffp_context);
+
+/**
+ * Free the context, closing it first if it is open.
+ */
+ffplay_error ffplay_free(ffplay_context *ffp_context);
+
+/**
+ * The number of frames found by ffplay_open.
+ */
+int64_t ffplay_frame_count(ffplay_context *ffp_context);
+
+/**
+ * The frame number last passed to the frame callback, or -1.
+ */
+int64_t ffplay_position(ffplay_context *ffp_context);
+
+/**
+ * Present the given frame, decoding its GOP if it is not cached.
+ */
+ffplay_error ffplay_seek_frame(ffplay_context *ffp_context, int64_t frame_number);
+
+/**
+ * Present the frame after or before the current position.
+ */
+ffplay_error ffplay_step(ffplay_context *ffp_context, ffplay_direction direction);
+
+/**
+ * Start stepping in the given direction at the stream frame rate.
+ * Playback will begin on a background thread and stops by itself
+ * at either end of the stream.
+ */
+ffplay_error ffplay_start(ffplay_context *ffp_context, ffplay_direction direction);
+
+/**
+ * Stop playback started by ffplay_start.
+ */
+ffplay_error ffplay_stop(ffplay_context *ffp_context);
+
+ffplay_error ffplay_get_cache_stats(ffplay_context *ffp_context, ffplay_cache_stats *stats);
+
+#endif
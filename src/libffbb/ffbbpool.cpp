@@ -0,0 +1,324 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbpool.h"
+#include "ffbbsched.h"
+#include "ffbbtrace.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__QNX__)
+#include <sys/neutrino.h>
+#endif
+
+struct ffpool_task
+{
+    void *(*function)(void *arg);
+    void *arg;
+    void *result;
+    int64_t submit_time;
+    pthread_t thread;
+    bool started;
+    bool done;
+    bool detached;
+    ffpool_task *next;
+};
+
+typedef struct
+{
+    pthread_t pthread;
+    int index;
+} ffpool_worker;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    // signalled when a task is queued or the pool shuts down
+    pthread_cond_t work_cond;
+    // broadcast when a joinable task returns or the pool goes idle
+    pthread_cond_t done_cond;
+    ffpool_config config;
+    bool shutting_down;
+    ffpool_task *first;
+    ffpool_task *last;
+    int running;
+    ffpool_worker **workers;
+    int worker_count;
+    int worker_capacity;
+    ffpool_stats stats;
+    ffstats_histogram queue_latency;
+} ffpool_state;
+
+static ffpool_state pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static int64_t now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (int64_t) time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+static void pin_worker(int index)
+{
+    int cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_count <= 0) return;
+
+    int cpu = index % cpu_count;
+
+#if defined(__QNX__)
+    ThreadCtl(_NTO_TCTL_RUNMASK, (void*) (uintptr_t) (1 << cpu));
+#elif defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set);
+#endif
+}
+
+static void *worker_thread(void *arg)
+{
+    ffpool_worker *worker = (ffpool_worker*) arg;
+
+    pthread_mutex_lock(&pool.mutex);
+    bool pin = pool.config.pin_workers;
+    pthread_mutex_unlock(&pool.mutex);
+
+    if (pin) pin_worker(worker->index);
+
+    pthread_mutex_lock(&pool.mutex);
+
+    while (true)
+    {
+        while (!pool.first && !pool.shutting_down)
+        {
+            pool.stats.idle_threads++;
+            pthread_cond_wait(&pool.work_cond, &pool.mutex);
+            pool.stats.idle_threads--;
+        }
+
+        ffpool_task *task = pool.first;
+        if (!task) break;
+
+        pool.first = task->next;
+        if (!pool.first) pool.last = NULL;
+
+        task->thread = pthread_self();
+        task->started = true;
+
+        pool.running++;
+        pool.stats.tasks_queued--;
+        ffstats_histogram_add(&pool.queue_latency, now() - task->submit_time);
+
+        pthread_mutex_unlock(&pool.mutex);
+
+        FFTRACE_THREAD_NAME("ffpool");
+        void *result = task->function(task->arg);
+
+        // the next task starts with the scheduling of the worker,
+        // what could not be restored is counted in ffsched_report
+        ffsched_restore();
+
+        pthread_mutex_lock(&pool.mutex);
+
+        pool.running--;
+        pool.stats.tasks_completed++;
+
+        if (task->detached)
+        {
+            free(task);
+        }
+        else
+        {
+            task->result = result;
+            task->done = true;
+        }
+
+        pthread_cond_broadcast(&pool.done_cond);
+    }
+
+    pool.stats.threads--;
+    pthread_mutex_unlock(&pool.mutex);
+
+    return 0;
+}
+
+/**
+ * Start a worker with the pool locked. If it fails, the
+ * task waits for one of the existing workers instead.
+ */
+static bool start_worker_locked()
+{
+    if (pool.worker_count == pool.worker_capacity)
+    {
+        int capacity = pool.worker_capacity ? pool.worker_capacity * 2 : 8;
+        pool.workers = (ffpool_worker**) realloc(pool.workers, capacity * sizeof(ffpool_worker*));
+        pool.worker_capacity = capacity;
+    }
+
+    ffpool_worker *worker = (ffpool_worker*) malloc(sizeof(ffpool_worker));
+    worker->index = pool.worker_count;
+
+    if (pthread_create(&worker->pthread, 0, &worker_thread, worker) != 0)
+    {
+        free(worker);
+        return false;
+    }
+
+    pool.workers[pool.worker_count++] = worker;
+    pool.stats.threads++;
+    if (pool.stats.threads > pool.stats.peak_threads) pool.stats.peak_threads = pool.stats.threads;
+
+    return true;
+}
+
+ffpool_error ffpool_configure(const ffpool_config *config)
+{
+    pthread_mutex_lock(&pool.mutex);
+
+    ffpool_error error = FFPOOL_OK;
+
+    if (pool.worker_count) error = FFPOOL_ALREADY_STARTED;
+    else pool.config = *config;
+
+    pthread_mutex_unlock(&pool.mutex);
+
+    return error;
+}
+
+ffpool_error ffpool_submit(void *(*function)(void *arg), void *arg, ffpool_task **task)
+{
+    ffpool_task *new_task = (ffpool_task*) malloc(sizeof(ffpool_task));
+    memset(new_task, 0, sizeof(ffpool_task));
+    new_task->function = function;
+    new_task->arg = arg;
+    new_task->detached = !task;
+
+    pthread_mutex_lock(&pool.mutex);
+
+    if (pool.shutting_down)
+    {
+        pthread_mutex_unlock(&pool.mutex);
+        free(new_task);
+        return FFPOOL_SHUTTING_DOWN;
+    }
+
+    // start a worker unless an idle one is left for this task
+    bool start_worker = pool.stats.tasks_queued >= pool.stats.idle_threads
+            && (pool.config.max_threads <= 0 || pool.stats.threads < pool.config.max_threads);
+
+    if (start_worker && !start_worker_locked() && !pool.stats.threads)
+    {
+        pthread_mutex_unlock(&pool.mutex);
+        free(new_task);
+        return FFPOOL_THREAD_FAILED;
+    }
+
+    new_task->submit_time = now();
+
+    if (pool.last) pool.last->next = new_task;
+    else pool.first = new_task;
+    pool.last = new_task;
+
+    pool.stats.tasks_queued++;
+    pool.stats.tasks_submitted++;
+    FFTRACE_COUNTER("ffpool_queue", pool.stats.tasks_queued);
+
+    pthread_cond_signal(&pool.work_cond);
+    pthread_mutex_unlock(&pool.mutex);
+
+    if (task) *task = new_task;
+
+    return FFPOOL_OK;
+}
+
+ffpool_error ffpool_join(ffpool_task *task, void **result)
+{
+    pthread_mutex_lock(&pool.mutex);
+
+    if (task->started && !task->done && pthread_equal(task->thread, pthread_self()))
+    {
+        pthread_mutex_unlock(&pool.mutex);
+        return FFPOOL_DEADLOCK;
+    }
+
+    while (!task->done)
+    {
+        pthread_cond_wait(&pool.done_cond, &pool.mutex);
+    }
+
+    pthread_mutex_unlock(&pool.mutex);
+
+    if (result) *result = task->result;
+    free(task);
+
+    return FFPOOL_OK;
+}
+
+ffpool_error ffpool_shutdown()
+{
+    pthread_mutex_lock(&pool.mutex);
+
+    if (pool.shutting_down)
+    {
+        pthread_mutex_unlock(&pool.mutex);
+        return FFPOOL_SHUTTING_DOWN;
+    }
+
+    while (pool.first || pool.running)
+    {
+        pthread_cond_wait(&pool.done_cond, &pool.mutex);
+    }
+
+    pool.shutting_down = true;
+    pthread_cond_broadcast(&pool.work_cond);
+
+    ffpool_worker **workers = pool.workers;
+    int worker_count = pool.worker_count;
+
+    pthread_mutex_unlock(&pool.mutex);
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_join(workers[i]->pthread, NULL);
+        free(workers[i]);
+    }
+
+    pthread_mutex_lock(&pool.mutex);
+
+    free(pool.workers);
+    pool.workers = NULL;
+    pool.worker_count = 0;
+    pool.worker_capacity = 0;
+    pool.shutting_down = false;
+
+    pthread_mutex_unlock(&pool.mutex);
+
+    return FFPOOL_OK;
+}
+
+ffpool_error ffpool_get_stats(ffpool_stats *stats)
+{
+    pthread_mutex_lock(&pool.mutex);
+    *stats = pool.stats;
+    ffstats_histogram_times(&pool.queue_latency, &stats->queue_latency);
+    pthread_mutex_unlock(&pool.mutex);
+
+    return FFPOOL_OK;
+}
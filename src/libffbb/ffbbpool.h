@@ -0,0 +1,102 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBPOOL_H
+#define FFBBPOOL_H
+
+#include "ffbbstats.h"
+
+#include <sys/types.h>
+#include <stdint.h>
+
+typedef enum
+{
+    FFPOOL_OK = 0,
+    FFPOOL_ALREADY_STARTED,
+    FFPOOL_SHUTTING_DOWN,
+    FFPOOL_THREAD_FAILED,
+
+    /**
+     * A task tried to join itself.
+     */
+    FFPOOL_DEADLOCK
+} ffpool_error;
+
+typedef struct ffpool_task ffpool_task;
+
+typedef struct
+{
+    /**
+     * Workers the pool may start, or 0 to start one whenever a task would
+     * otherwise wait. The encoder and decoder run as a task until they
+     * are stopped, so a limit lower than the tasks running at once
+     * leaves the rest queued until one returns.
+     */
+    int max_threads;
+
+    /**
+     * Pin worker n to processor n modulo the number online.
+     */
+    bool pin_workers;
+} ffpool_config;
+
+typedef struct
+{
+    /**
+     * Workers alive, waiting for a task, and the most ever alive at once.
+     */
+    int threads;
+    int idle_threads;
+    int peak_threads;
+
+    int tasks_queued;
+    int64_t tasks_submitted;
+    int64_t tasks_completed;
+
+    /**
+     * Microseconds from a task being submitted to a worker starting it.
+     */
+    ffstats_times queue_latency;
+} ffpool_stats;
+
+/**
+ * Set how the pool starts workers. This may only be called before the
+ * first task is submitted, or after ffpool_shutdown.
+ */
+ffpool_error ffpool_configure(const ffpool_config *config);
+
+/**
+ * Run function(arg) on a worker, starting one if none is idle. Workers are
+ * kept once started, so later tasks reuse them instead of creating threads.
+ * If task is not NULL the task must be passed to ffpool_join to release
+ * it, otherwise it is released when it returns.
+ */
+ffpool_error ffpool_submit(void *(*function)(void *arg), void *arg, ffpool_task **task);
+
+/**
+ * Wait for the task to return and release it. The result may be NULL.
+ */
+ffpool_error ffpool_join(ffpool_task *task, void **result);
+
+/**
+ * Wait for every task submitted to return, then stop and join the workers.
+ * Contexts with a running task must be stopped first. The pool starts
+ * again with the next task submitted.
+ */
+ffpool_error ffpool_shutdown(void);
+
+ffpool_error ffpool_get_stats(ffpool_stats *stats);
+
+#endif
@@ -0,0 +1,771 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbquality.h"
+#include "ffbbcopy.h"
+#include "ffbbpool.h"
+
+#include <deque>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// reported for planes without any error
+#define MAX_PSNR 100.0
+
+typedef struct
+{
+    // NULL when the frame was skipped
+    uint8_t *data;
+    int64_t pts;
+} ffquality_source;
+
+typedef struct
+{
+    uint8_t *data;
+    int size;
+    int64_t pts;
+} ffquality_packet;
+
+// sums over a 4x4 block of the source a and decoded b
+typedef struct
+{
+    int s1;
+    int s2;
+    int ss;
+    int s12;
+} ffquality_ssim_sums;
+
+typedef struct
+{
+    bool open;
+    bool closing;
+    AVCodecContext *codec_context;
+    int width;
+    int height;
+    FILE *file;
+    ffpool_task *task;
+    pthread_mutex_t mutex;
+    pthread_cond_t packet_cond;
+    std::deque<ffquality_source> *sources;
+    std::deque<ffquality_packet> *packets;
+    // sources with data that were not measured yet
+    int pending;
+    // the number of the next source, for sources without a pts
+    int64_t source_number;
+    ffquality_ssim_sums *ssim_rows[2];
+    // totals of the frames measured, under the mutex
+    int64_t frames;
+    int64_t frames_skipped;
+    int64_t sse[3];
+    int64_t samples[3];
+    double psnr_sum;
+    double min_psnr;
+    double ssim_sum;
+    double min_ssim;
+} ffquality_reserved;
+
+void* measuring_thread(void* arg);
+
+ffquality_context *ffquality_alloc()
+{
+    ffquality_context *ffq_context = (ffquality_context*) malloc(sizeof(ffquality_context));
+    memset(ffq_context, 0, sizeof(ffquality_context));
+
+    ffquality_reset(ffq_context);
+
+    return ffq_context;
+}
+
+void ffquality_reset(ffquality_context *ffq_context)
+{
+    ffquality_reserved *ffq_reserved = (ffquality_reserved*) ffq_context->reserved;
+
+    if (ffq_reserved && ffq_reserved->open) ffquality_close(ffq_context);
+
+    if (!ffq_reserved) ffq_reserved = (ffquality_reserved*) malloc(sizeof(ffquality_reserved));
+    memset(ffq_reserved, 0, sizeof(ffquality_reserved));
+
+    memset(ffq_context, 0, sizeof(ffquality_context));
+    ffq_context->max_pending = 32;
+    ffq_context->reserved = ffq_reserved;
+}
+
+ffquality_error ffquality_free(ffquality_context *ffq_context)
+{
+    ffquality_reserved *ffq_reserved = (ffquality_reserved*) ffq_context->reserved;
+
+    if (ffq_reserved && ffq_reserved->open) ffquality_close(ffq_context);
+
+    free(ffq_reserved);
+    ffq_reserved = NULL;
+    ffq_context->reserved = NULL;
+    free(ffq_context);
+
+    return FFQUALITY_OK;
+}
+
+const char *ffquality_implementation()
+{
+#if defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    return "neon";
+#else
+    return "c";
+#endif
+}
+
+/**
+ * Sum of the squared differences between two planes.
+ */
+static int64_t plane_sse(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int width, int height)
+{
+    int64_t sse = 0;
+
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t *row_a = a + y * a_stride;
+        const uint8_t *row_b = b + y * b_stride;
+
+        int x = 0;
+
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sum = zero;
+
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i*) &row_a[x]);
+            __m128i vb = _mm_loadu_si128((const __m128i*) &row_b[x]);
+
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+
+            sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+
+        int32_t lanes[4];
+        _mm_storeu_si128((__m128i*) lanes, sum);
+        sse += (int64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+        uint32x4_t sum = vdupq_n_u32(0);
+
+        for (; x + 16 <= width; x += 16)
+        {
+            uint8x16_t difference = vabdq_u8(vld1q_u8(&row_a[x]), vld1q_u8(&row_b[x]));
+
+            // a squared difference still fits in 16 bits
+            sum = vpadalq_u16(sum, vmull_u8(vget_low_u8(difference), vget_low_u8(difference)));
+            sum = vpadalq_u16(sum, vmull_u8(vget_high_u8(difference), vget_high_u8(difference)));
+        }
+
+        uint64x2_t total = vpaddlq_u32(sum);
+        sse += vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+#endif
+
+        for (; x < width; x++)
+        {
+            int difference = row_a[x] - row_b[x];
+            sse += difference * difference;
+        }
+    }
+
+    return sse;
+}
+
+/**
+ * Sum each of the 4x4 blocks along 4 rows of two planes.
+ */
+static void ssim_block_sums(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+        int blocks, ffquality_ssim_sums *sums)
+{
+    int block = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+
+    // two blocks at a time, as pairs of columns in each 32 bit lane
+    for (; block + 2 <= blocks; block += 2)
+    {
+        __m128i s1 = zero;
+        __m128i s2 = zero;
+        __m128i ss = zero;
+        __m128i s12 = zero;
+
+        for (int y = 0; y < 4; y++)
+        {
+            __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) &a[y * a_stride + 4 * block]), zero);
+            __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) &b[y * b_stride + 4 * block]), zero);
+
+            s1 = _mm_add_epi32(s1, _mm_madd_epi16(va, ones));
+            s2 = _mm_add_epi32(s2, _mm_madd_epi16(vb, ones));
+            ss = _mm_add_epi32(ss, _mm_add_epi32(_mm_madd_epi16(va, va), _mm_madd_epi16(vb, vb)));
+            s12 = _mm_add_epi32(s12, _mm_madd_epi16(va, vb));
+        }
+
+        // add the pairs, leaving the two blocks in lanes 0 and 2
+        s1 = _mm_add_epi32(s1, _mm_srli_epi64(s1, 32));
+        s2 = _mm_add_epi32(s2, _mm_srli_epi64(s2, 32));
+        ss = _mm_add_epi32(ss, _mm_srli_epi64(ss, 32));
+        s12 = _mm_add_epi32(s12, _mm_srli_epi64(s12, 32));
+
+        sums[block].s1 = _mm_cvtsi128_si32(s1);
+        sums[block].s2 = _mm_cvtsi128_si32(s2);
+        sums[block].ss = _mm_cvtsi128_si32(ss);
+        sums[block].s12 = _mm_cvtsi128_si32(s12);
+        sums[block + 1].s1 = _mm_cvtsi128_si32(_mm_srli_si128(s1, 8));
+        sums[block + 1].s2 = _mm_cvtsi128_si32(_mm_srli_si128(s2, 8));
+        sums[block + 1].ss = _mm_cvtsi128_si32(_mm_srli_si128(ss, 8));
+        sums[block + 1].s12 = _mm_cvtsi128_si32(_mm_srli_si128(s12, 8));
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; block + 2 <= blocks; block += 2)
+    {
+        uint16x4_t s1 = vdup_n_u16(0);
+        uint16x4_t s2 = vdup_n_u16(0);
+        uint32x4_t ss = vdupq_n_u32(0);
+        uint32x4_t s12 = vdupq_n_u32(0);
+
+        for (int y = 0; y < 4; y++)
+        {
+            uint8x8_t va = vld1_u8(&a[y * a_stride + 4 * block]);
+            uint8x8_t vb = vld1_u8(&b[y * b_stride + 4 * block]);
+
+            s1 = vadd_u16(s1, vpaddl_u8(va));
+            s2 = vadd_u16(s2, vpaddl_u8(vb));
+            ss = vpadalq_u16(ss, vmull_u8(va, va));
+            ss = vpadalq_u16(ss, vmull_u8(vb, vb));
+            s12 = vpadalq_u16(s12, vmull_u8(va, vb));
+        }
+
+        uint32x2_t block_s1 = vpaddl_u16(s1);
+        uint32x2_t block_s2 = vpaddl_u16(s2);
+        uint32x2_t block_ss = vpadd_u32(vget_low_u32(ss), vget_high_u32(ss));
+        uint32x2_t block_s12 = vpadd_u32(vget_low_u32(s12), vget_high_u32(s12));
+
+        sums[block].s1 = vget_lane_u32(block_s1, 0);
+        sums[block].s2 = vget_lane_u32(block_s2, 0);
+        sums[block].ss = vget_lane_u32(block_ss, 0);
+        sums[block].s12 = vget_lane_u32(block_s12, 0);
+        sums[block + 1].s1 = vget_lane_u32(block_s1, 1);
+        sums[block + 1].s2 = vget_lane_u32(block_s2, 1);
+        sums[block + 1].ss = vget_lane_u32(block_ss, 1);
+        sums[block + 1].s12 = vget_lane_u32(block_s12, 1);
+    }
+#endif
+
+    for (; block < blocks; block++)
+    {
+        ffquality_ssim_sums *sum = &sums[block];
+        memset(sum, 0, sizeof(ffquality_ssim_sums));
+
+        for (int y = 0; y < 4; y++)
+        {
+            for (int x = 4 * block; x < 4 * block + 4; x++)
+            {
+                int va = a[y * a_stride + x];
+                int vb = b[y * b_stride + x];
+
+                sum->s1 += va;
+                sum->s2 += vb;
+                sum->ss += va * va + vb * vb;
+                sum->s12 += va * vb;
+            }
+        }
+    }
+}
+
+/**
+ * SSIM of one 8x8 window from the sums of its pixels.
+ */
+static double ssim_window(int s1, int s2, int ss, int s12)
+{
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+
+    double mean_a = s1 / 64.0;
+    double mean_b = s2 / 64.0;
+    double variances = ss / 64.0 - mean_a * mean_a - mean_b * mean_b;
+    double covariance = s12 / 64.0 - mean_a * mean_b;
+
+    return (2 * mean_a * mean_b + c1) * (2 * covariance + c2)
+            / ((mean_a * mean_a + mean_b * mean_b + c1) * (variances + c2));
+}
+
+/**
+ * Mean SSIM of 8x8 windows every 4 pixels, which share their 4x4 block sums.
+ */
+static double plane_ssim(ffquality_reserved *ffq_reserved, const uint8_t *a, int a_stride,
+        const uint8_t *b, int b_stride, int width, int height)
+{
+    int blocks_x = width / 4;
+    int blocks_y = height / 4;
+    if (blocks_x < 2 || blocks_y < 2) return 1.0;
+
+    ffquality_ssim_sums **rows = ffq_reserved->ssim_rows;
+    ssim_block_sums(a, a_stride, b, b_stride, blocks_x, rows[0]);
+
+    double total = 0;
+
+    for (int y = 1; y < blocks_y; y++)
+    {
+        ffquality_ssim_sums *above = rows[(y - 1) & 1];
+        ffquality_ssim_sums *below = rows[y & 1];
+        ssim_block_sums(&a[4 * y * a_stride], a_stride, &b[4 * y * b_stride], b_stride, blocks_x, below);
+
+        for (int x = 0; x + 1 < blocks_x; x++)
+        {
+            total += ssim_window(
+                    above[x].s1 + above[x + 1].s1 + below[x].s1 + below[x + 1].s1,
+                    above[x].s2 + above[x + 1].s2 + below[x].s2 + below[x + 1].s2,
+                    above[x].ss + above[x + 1].ss + below[x].ss + below[x + 1].ss,
+                    above[x].s12 + above[x + 1].s12 + below[x].s12 + below[x + 1].s12);
+        }
+    }
+
+    return total / ((blocks_x - 1) * (blocks_y - 1));
+}
+
+static double psnr(int64_t sse, int64_t samples)
+{
+    if (!sse) return MAX_PSNR;
+    return 10 * log10(255.0 * 255.0 * samples / sse);
+}
+
+/**
+ * Free what ffquality_open set up once the measuring thread is done.
+ */
+static void release_measuring(ffquality_reserved *ffq_reserved)
+{
+    while (!ffq_reserved->sources->empty())
+    {
+        free(ffq_reserved->sources->front().data);
+        ffq_reserved->sources->pop_front();
+    }
+
+    delete ffq_reserved->sources;
+    ffq_reserved->sources = NULL;
+    delete ffq_reserved->packets;
+    ffq_reserved->packets = NULL;
+
+    free(ffq_reserved->ssim_rows[0]);
+    free(ffq_reserved->ssim_rows[1]);
+    ffq_reserved->ssim_rows[0] = ffq_reserved->ssim_rows[1] = NULL;
+
+    avcodec_close(ffq_reserved->codec_context);
+    av_free(ffq_reserved->codec_context);
+    ffq_reserved->codec_context = NULL;
+
+    pthread_mutex_destroy(&ffq_reserved->mutex);
+    pthread_cond_destroy(&ffq_reserved->packet_cond);
+
+    ffq_reserved->open = false;
+}
+
+ffquality_error ffquality_open(ffquality_context *ffq_context, const AVCodecContext *encoder_context,
+        const char *path)
+{
+    ffquality_reserved *ffq_reserved = (ffquality_reserved*) ffq_context->reserved;
+    if (!ffq_reserved) return FFQUALITY_NOT_INITIALIZED;
+    if (ffq_reserved->open) return FFQUALITY_ALREADY_OPEN;
+
+    AVCodec *codec = avcodec_find_decoder(encoder_context->codec_id);
+    if (!codec) return FFQUALITY_CODEC_NOT_FOUND;
+
+    FILE *file = NULL;
+
+    if (path)
+    {
+        file = fopen(path, "w");
+        if (!file) return FFQUALITY_WRITE_FAILED;
+    }
+
+    AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+
+    // decode on the measuring thread alone
+    codec_context->thread_count = 1;
+
+    if (avcodec_open2(codec_context, codec, NULL) < 0)
+    {
+        av_free(codec_context);
+        if (file) fclose(file);
+        return FFQUALITY_OPEN_FAILED;
+    }
+
+    int width = encoder_context->width;
+    int height = encoder_context->height;
+
+    if (file)
+    {
+        fprintf(file, "# codec %s\n", codec->name);
+        fprintf(file, "# size %dx%d\n", width, height);
+        fprintf(file, "# bit_rate %d\n", encoder_context->bit_rate);
+        fprintf(file, "# gop_size %d\n", encoder_context->gop_size);
+        fprintf(file, "# max_b_frames %d\n", encoder_context->max_b_frames);
+        fprintf(file, "# time_base %d/%d\n", encoder_context->time_base.num, encoder_context->time_base.den);
+        fprintf(file, "# implementation %s\n", ffquality_implementation());
+        fprintf(file, "frame,psnr_y,psnr_u,psnr_v,psnr,ssim\n");
+    }
+
+    memset(ffq_reserved, 0, sizeof(ffquality_reserved));
+    ffq_reserved->codec_context = codec_context;
+    ffq_reserved->width = width;
+    ffq_reserved->height = height;
+    ffq_reserved->file = file;
+    ffq_reserved->sources = new std::deque<ffquality_source>();
+    ffq_reserved->packets = new std::deque<ffquality_packet>();
+    ffq_reserved->ssim_rows[0] = (ffquality_ssim_sums*) malloc((width / 4 + 1) * sizeof(ffquality_ssim_sums));
+    ffq_reserved->ssim_rows[1] = (ffquality_ssim_sums*) malloc((width / 4 + 1) * sizeof(ffquality_ssim_sums));
+    ffq_reserved->min_psnr = MAX_PSNR;
+    ffq_reserved->min_ssim = 1.0;
+
+    pthread_mutex_init(&ffq_reserved->mutex, 0);
+    pthread_cond_init(&ffq_reserved->packet_cond, 0);
+
+    ffq_reserved->open = true;
+
+    if (ffpool_submit(&measuring_thread, ffq_context, &ffq_reserved->task) != FFPOOL_OK)
+    {
+        if (ffq_reserved->file) fclose(ffq_reserved->file);
+        ffq_reserved->file = NULL;
+
+        release_measuring(ffq_reserved);
+        return FFQUALITY_THREAD_FAILED;
+    }
+
+    return FFQUALITY_OK;
+}
+
+ffquality_error ffquality_add_source(ffquality_context *ffq_context, const AVFrame *frame)
+{
+    ffquality_reserved *ffq_reserved = (ffquality_reserved*) ffq_context->reserved;
+    if (!ffq_reserved) return FFQUALITY_NOT_INITIALIZED;
+    if (!ffq_reserved->open) return FFQUALITY_NOT_OPEN;
+
+    pthread_mutex_lock(&ffq_reserved->mutex);
+    bool keep = ffq_reserved->pending < ffq_context->max_pending;
+    if (keep) ffq_reserved->pending++;
+    else ffq_reserved->frames_skipped++;
+    pthread_mutex_unlock(&ffq_reserved->mutex);
+
+    ffquality_source source;
+    source.data = NULL;
+    source.pts = frame->pts;
+
+    if (keep)
+    {
+        int width = ffq_reserved->width;
+        int height = ffq_reserved->height;
+        int chroma_width = (width + 1) / 2;
+        int chroma_height = (height + 1) / 2;
+
+        source.data = (uint8_t*) malloc(width * height + 2 * chroma_width * chroma_height);
+        uint8_t *u = &source.data[width * height];
+        uint8_t *v = &u[chroma_width * chroma_height];
+
+        // the copy waits for the measuring thread, out of the encoder's cache
+        ffcopy_plane(source.data, width, frame->data[0], frame->linesize[0], width, height);
+        ffcopy_plane(u, chroma_width, frame->data[1], frame->linesize[1], chroma_width, chroma_height);
+        ffcopy_plane(v, chroma_width, frame->data[2], frame->linesize[2], chroma_width, chroma_height);
+    }
+
+    pthread_mutex_lock(&ffq_reserved->mutex);
+    ffq_reserved->sources->push_back(source);
+    pthread_mutex_unlock(&ffq_reserved->mutex);
+
+    return FFQUALITY_OK;
+}
+
+ffquality_error ffquality_add_packet(ffquality_context *ffq_context, const uint8_t *data, int size, int64_t pts)
+{
+    ffquality_reserved *ffq_reserved = (ffquality_reserved*) ffq_context->reserved;
+    if (!ffq_reserved) return FFQUALITY_NOT_INITIALIZED;
+    if (!ffq_reserved->open) return FFQUALITY_NOT_OPEN;
+
+    ffquality_packet packet;
+    packet.data = (uint8_t*) av_malloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
+    packet.size = size;
+    packet.pts = pts;
+    memcpy(packet.data, data, size);
+    memset(&packet.data[size], 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    pthread_mutex_lock(&ffq_reserved->mutex);
+    ffq_reserved->packets->push_back(packet);
+    pthread_cond_signal(&ffq_reserved->packet_cond);
+    pthread_mutex_unlock(&ffq_reserved->mutex);
+
+    return FFQUALITY_OK;
+}
+
+/**
+ * Compare a decoded frame with the source frame it was encoded from.
+ * Sources before the frame were dropped by the encoder and are skipped,
+ * so one lost frame does not shift every comparison after it.
+ */
+static void measure_frame(ffquality_reserved *ffq_reserved, AVFrame *frame)
+{
+    int64_t pts = frame->pkt_pts;
+
+    pthread_mutex_lock(&ffq_reserved->mutex);
+
+    while (pts != AV_NOPTS_VALUE && !ffq_reserved->sources->empty()
+            && ffq_reserved->sources->front().pts != AV_NOPTS_VALUE
+            && ffq_reserved->sources->front().pts < pts)
+    {
+        ffquality_source dropped = ffq_reserved->sources->front();
+        ffq_reserved->sources->pop_front();
+        ffq_reserved->source_number++;
+
+        if (dropped.data)
+        {
+            free(dropped.data);
+            ffq_reserved->pending--;
+            ffq_reserved->frames_skipped++;
+        }
+    }
+
+    // a source after the frame means its own source was already dropped
+    if (ffq_reserved->sources->empty() || (pts != AV_NOPTS_VALUE
+            && ffq_reserved->sources->front().pts != AV_NOPTS_VALUE
+            && ffq_reserved->sources->front().pts > pts))
+    {
+        pthread_mutex_unlock(&ffq_reserved->mutex);
+        return;
+    }
+
+    ffquality_source source = ffq_reserved->sources->front();
+    ffq_reserved->sources->pop_front();
+    int64_t number = source.pts != AV_NOPTS_VALUE ? source.pts : ffq_reserved->source_number;
+    ffq_reserved->source_number++;
+
+    pthread_mutex_unlock(&ffq_reserved->mutex);
+
+    if (!source.data) return;
+
+    int width = ffq_reserved->width;
+    int height = ffq_reserved->height;
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+
+    const uint8_t *planes[3];
+    planes[0] = source.data;
+    planes[1] = &planes[0][width * height];
+    planes[2] = &planes[1][chroma_width * chroma_height];
+
+    int64_t sse[3];
+    int64_t samples[3];
+    double plane_psnr[3];
+    double ssim = 0;
+
+    bool measured = frame->width == width && frame->height == height;
+
+    if (measured)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            int plane_width = i ? chroma_width : width;
+            int plane_height = i ? chroma_height : height;
+
+            sse[i] = plane_sse(planes[i], plane_width, frame->data[i], frame->linesize[i], plane_width, plane_height);
+            samples[i] = (int64_t) plane_width * plane_height;
+            plane_psnr[i] = psnr(sse[i], samples[i]);
+        }
+
+        ssim = plane_ssim(ffq_reserved, planes[0], width, frame->data[0], frame->linesize[0], width, height);
+    }
+
+    free(source.data);
+    source.data = NULL;
+
+    pthread_mutex_lock(&ffq_reserved->mutex);
+
+    if (!measured)
+    {
+        ffq_reserved->frames_skipped++;
+        ffq_reserved->pending--;
+        pthread_mutex_unlock(&ffq_reserved->mutex);
+        return;
+    }
+
+    double frame_psnr = psnr(sse[0] + sse[1] + sse[2], samples[0] + samples[1] + samples[2]);
+
+    for (int i = 0; i < 3; i++)
+    {
+        ffq_reserved->sse[i] += sse[i];
+        ffq_reserved->samples[i] += samples[i];
+    }
+
+    ffq_reserved->frames++;
+    ffq_reserved->psnr_sum += frame_psnr;
+    ffq_reserved->ssim_sum += ssim;
+    if (frame_psnr < ffq_reserved->min_psnr) ffq_reserved->min_psnr = frame_psnr;
+    if (ssim < ffq_reserved->min_ssim) ffq_reserved->min_ssim = ssim;
+    ffq_reserved->pending--;
+
+    pthread_mutex_unlock(&ffq_reserved->mutex);
+
+    if (ffq_reserved->file)
+    {
+        fprintf(ffq_reserved->file, "%lld,%.3f,%.3f,%.3f,%.3f,%.5f\n", (long long) number,
+                plane_psnr[0], plane_psnr[1], plane_psnr[2], frame_psnr, ssim);
+    }
+}
+
+/**
+ * Decode a packet and measure the frames it produces.
+ * A NULL packet drains the frames still held by the decoder.
+ */
+static void decode_packet(ffquality_reserved *ffq_reserved, AVFrame *frame, uint8_t *data, int size, int64_t pts)
+{
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = data;
+    packet.size = size;
+    packet.pts = pts;
+
+    int got_frame;
+
+    do
+    {
+        got_frame = 0;
+
+        int decode_result = avcodec_decode_video2(ffq_reserved->codec_context, frame, &got_frame, &packet);
+        if (decode_result < 0) break;
+
+        if (got_frame) measure_frame(ffq_reserved, frame);
+
+        if (data)
+        {
+            packet.data += decode_result;
+            packet.size -= decode_result;
+        }
+    }
+    while (data ? packet.size > 0 : got_frame);
+}
+
+void* measuring_thread(void* arg)
+{
+    ffquality_context *ffq_context = (ffquality_context*) arg;
+    ffquality_reserved *ffq_reserved = (ffquality_reserved*) ffq_context->reserved;
+
+    AVFrame *frame = avcodec_alloc_frame();
+
+    pthread_mutex_lock(&ffq_reserved->mutex);
+
+    while (true)
+    {
+        if (ffq_reserved->packets->empty())
+        {
+            // decode everything queued before stopping
+            if (ffq_reserved->closing) break;
+
+            pthread_cond_wait(&ffq_reserved->packet_cond, &ffq_reserved->mutex);
+            continue;
+        }
+
+        ffquality_packet packet = ffq_reserved->packets->front();
+        ffq_reserved->packets->pop_front();
+
+        pthread_mutex_unlock(&ffq_reserved->mutex);
+
+        decode_packet(ffq_reserved, frame, packet.data, packet.size, packet.pts);
+        av_free(packet.data);
+
+        pthread_mutex_lock(&ffq_reserved->mutex);
+    }
+
+    pthread_mutex_unlock(&ffq_reserved->mutex);
+
+    decode_packet(ffq_reserved, frame, NULL, 0, AV_NOPTS_VALUE);
+
+    av_free(frame);
+    frame = NULL;
+
+    return 0;
+}
+
+ffquality_error ffquality_get_summary(ffquality_context *ffq_context, ffquality_summary *summary)
+{
+    ffquality_reserved *ffq_reserved = (ffquality_reserved*) ffq_context->reserved;
+    if (!ffq_reserved) return FFQUALITY_NOT_INITIALIZED;
+
+    memset(summary, 0, sizeof(ffquality_summary));
+
+    if (ffq_reserved->open) pthread_mutex_lock(&ffq_reserved->mutex);
+
+    summary->frames = ffq_reserved->frames;
+    summary->frames_skipped = ffq_reserved->frames_skipped;
+
+    if (ffq_reserved->frames)
+    {
+        summary->psnr_y = psnr(ffq_reserved->sse[0], ffq_reserved->samples[0]);
+        summary->psnr_u = psnr(ffq_reserved->sse[1], ffq_reserved->samples[1]);
+        summary->psnr_v = psnr(ffq_reserved->sse[2], ffq_reserved->samples[2]);
+        summary->psnr = psnr(ffq_reserved->sse[0] + ffq_reserved->sse[1] + ffq_reserved->sse[2],
+                ffq_reserved->samples[0] + ffq_reserved->samples[1] + ffq_reserved->samples[2]);
+        summary->average_psnr = ffq_reserved->psnr_sum / ffq_reserved->frames;
+        summary->min_psnr = ffq_reserved->min_psnr;
+        summary->ssim = ffq_reserved->ssim_sum / ffq_reserved->frames;
+        summary->min_ssim = ffq_reserved->min_ssim;
+    }
+
+    if (ffq_reserved->open) pthread_mutex_unlock(&ffq_reserved->mutex);
+
+    return FFQUALITY_OK;
+}
+
+ffquality_error ffquality_close(ffquality_context *ffq_context)
+{
+    ffquality_reserved *ffq_reserved = (ffquality_reserved*) ffq_context->reserved;
+    if (!ffq_reserved) return FFQUALITY_NOT_INITIALIZED;
+    if (!ffq_reserved->open) return FFQUALITY_NOT_OPEN;
+
+    pthread_mutex_lock(&ffq_reserved->mutex);
+    ffq_reserved->closing = true;
+    pthread_cond_signal(&ffq_reserved->packet_cond);
+    pthread_mutex_unlock(&ffq_reserved->mutex);
+
+    if (ffq_reserved->task) ffpool_join(ffq_reserved->task, NULL);
+    ffq_reserved->task = NULL;
+
+    ffquality_summary summary;
+    ffquality_get_summary(ffq_context, &summary);
+
+    ffquality_error error = FFQUALITY_OK;
+
+    if (ffq_reserved->file)
+    {
+        FILE *file = ffq_reserved->file;
+        fprintf(file, "# frames %lld skipped %lld\n", (long long) summary.frames, (long long) summary.frames_skipped);
+        fprintf(file, "# psnr_y %.3f psnr_u %.3f psnr_v %.3f psnr %.3f\n",
+                summary.psnr_y, summary.psnr_u, summary.psnr_v, summary.psnr);
+        fprintf(file, "# average_psnr %.3f min_psnr %.3f\n", summary.average_psnr, summary.min_psnr);
+        fprintf(file, "# ssim %.5f min_ssim %.5f\n", summary.ssim, summary.min_ssim);
+
+        if (ferror(file)) error = FFQUALITY_WRITE_FAILED;
+        if (fclose(file) != 0) error = FFQUALITY_WRITE_FAILED;
+        ffq_reserved->file = NULL;
+    }
+
+    release_measuring(ffq_reserved);
+
+    return error;
+}
@@ -0,0 +1,143 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBQUALITY_H
+#define FFBBQUALITY_H
+
+// include math.h otherwise it will get included
+// by avformat.h and cause duplicate definition
+// errors because of C vs C++ functions
+#include <math.h>
+
+extern "C"
+{
+#define UINT64_C uint64_t
+#define INT64_C int64_t
+#include <libavformat/avformat.h>
+}
+
+#include <sys/types.h>
+
+typedef enum
+{
+    FFQUALITY_OK = 0,
+    FFQUALITY_NOT_INITIALIZED,
+    FFQUALITY_ALREADY_OPEN,
+    FFQUALITY_NOT_OPEN,
+    FFQUALITY_CODEC_NOT_FOUND,
+    FFQUALITY_OPEN_FAILED,
+    FFQUALITY_WRITE_FAILED,
+    FFQUALITY_THREAD_FAILED
+} ffquality_error;
+
+typedef struct
+{
+    int64_t frames;
+
+    /**
+     * Source frames that were not measured because the
+     * worker was max_pending frames behind the encoder.
+     */
+    int64_t frames_skipped;
+
+    /**
+     * PSNR in dB from the squared error of all the frames measured.
+     */
+    double psnr_y;
+    double psnr_u;
+    double psnr_v;
+    double psnr;
+
+    /**
+     * The mean and lowest PSNR of all planes of a frame.
+     */
+    double average_psnr;
+    double min_psnr;
+
+    /**
+     * The mean and lowest luma SSIM of a frame, over 8x8 windows every 4 pixels.
+     */
+    double ssim;
+    double min_ssim;
+} ffquality_summary;
+
+typedef struct
+{
+    /**
+     * Source frames kept while their packets wait to be decoded.
+     * Frames added beyond this are counted as skipped rather than
+     * slowing down the encoder.
+     */
+    int max_pending;
+
+    /**
+     * For internal use. Do not use.
+     */
+    void *reserved;
+} ffquality_context;
+
+/**
+ * Allocate the context with default values.
+ */
+ffquality_context *ffquality_alloc(void);
+
+/**
+ * Reset the context with default values.
+ * This closes the context if open.
+ */
+void ffquality_reset(ffquality_context *ffq_context);
+
+/**
+ * Free the context.
+ */
+ffquality_error ffquality_free(ffquality_context *ffq_context);
+
+/**
+ * Open a decoder for the output of the open encoder context and start
+ * the measuring thread. Each frame measured is written to the report
+ * at path as one line of comma separated values, after a header with
+ * the encoder settings, and the summary is appended on close. The path
+ * may be NULL to only keep the summary.
+ */
+ffquality_error ffquality_open(ffquality_context *ffq_context, const AVCodecContext *encoder_context,
+        const char *path);
+
+/**
+ * Keep a copy of a YUV420P frame about to be encoded. Frames must be
+ * added in presentation order, and are matched to the decoded frames
+ * by their pts.
+ */
+ffquality_error ffquality_add_source(ffquality_context *ffq_context, const AVFrame *frame);
+
+/**
+ * Queue a packet produced by the encoder for decoding, with the pts of the
+ * frame it was encoded from. AV_NOPTS_VALUE matches the frames in order.
+ */
+ffquality_error ffquality_add_packet(ffquality_context *ffq_context, const uint8_t *data, int size, int64_t pts);
+
+/**
+ * Decode the packets still queued, stop the measuring thread and
+ * write the summary to the report.
+ */
+ffquality_error ffquality_close(ffquality_context *ffq_context);
+
+ffquality_error ffquality_get_summary(ffquality_context *ffq_context, ffquality_summary *summary);
+
+/**
+ * The instruction set used to measure frames: "sse2", "neon" or "c".
+ */
+const char *ffquality_implementation(void);
+
+#endif
@@ -0,0 +1,831 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbregress.h"
+#include "ffbbdec.h"
+#include "ffbbenc.h"
+#include "ffbbquality.h"
+#include "ffbbstats.h"
+
+#include <libgen.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// frames waiting for the encoder before the clip is held back,
+// as the camera would rather drop them than queue them all
+#define MAX_QUEUE_DEPTH 4
+
+#define FRAME_DURATION 33333
+
+typedef struct
+{
+    ffregress_pattern pattern;
+    // NULL for a generated clip
+    char *path;
+    int width;
+    int height;
+} ffregress_clip;
+
+typedef struct
+{
+    CodecID codec_id;
+    int bit_rate;
+    int gop_size;
+} ffregress_codec;
+
+typedef struct
+{
+    ffregress_clip *clips;
+    int clip_count;
+    int clip_capacity;
+    ffregress_codec *codecs;
+    int codec_count;
+    int codec_capacity;
+    ffregress_result *results;
+    int result_count;
+    int result_capacity;
+} ffregress_reserved;
+
+// the encoded stream of one run, written by the encoder and read back by the decoder
+typedef struct
+{
+    uint8_t *data;
+    int64_t size;
+    int64_t capacity;
+    int64_t read;
+    // the size of each packet written, for decoders that need whole packets
+    int *packet_sizes;
+    int packet_count;
+    int packet_capacity;
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;
+    bool done;
+    int64_t done_time;
+} ffregress_stream;
+
+ffregress_context *ffregress_alloc()
+{
+    ffregress_context *ffr_context = (ffregress_context*) malloc(sizeof(ffregress_context));
+    memset(ffr_context, 0, sizeof(ffregress_context));
+
+    ffregress_reset(ffr_context);
+
+    return ffr_context;
+}
+
+static void ffregress_free_lists(ffregress_reserved *ffr_reserved)
+{
+    for (int i = 0; i < ffr_reserved->clip_count; i++)
+    {
+        free(ffr_reserved->clips[i].path);
+    }
+
+    free(ffr_reserved->clips);
+    free(ffr_reserved->codecs);
+    free(ffr_reserved->results);
+}
+
+void ffregress_reset(ffregress_context *ffr_context)
+{
+    ffregress_reserved *ffr_reserved = (ffregress_reserved*) ffr_context->reserved;
+
+    if (ffr_reserved) ffregress_free_lists(ffr_reserved);
+
+    if (!ffr_reserved) ffr_reserved = (ffregress_reserved*) malloc(sizeof(ffregress_reserved));
+    memset(ffr_reserved, 0, sizeof(ffregress_reserved));
+
+    memset(ffr_context, 0, sizeof(ffregress_context));
+    ffr_context->frame_count = 90;
+    ffr_context->tolerance.throughput = 0.10;
+    ffr_context->tolerance.latency = 0.25;
+    ffr_context->tolerance.size = 0.02;
+    ffr_context->tolerance.psnr = 0.1;
+    ffr_context->reserved = ffr_reserved;
+}
+
+ffregress_error ffregress_free(ffregress_context *ffr_context)
+{
+    ffregress_reserved *ffr_reserved = (ffregress_reserved*) ffr_context->reserved;
+    if (!ffr_reserved) return FFREGRESS_NOT_INITIALIZED;
+
+    ffregress_free_lists(ffr_reserved);
+
+    free(ffr_reserved);
+    ffr_context->reserved = NULL;
+
+    free(ffr_context);
+
+    return FFREGRESS_OK;
+}
+
+static ffregress_error add_clip(ffregress_context *ffr_context, ffregress_pattern pattern,
+        const char *path, int width, int height)
+{
+    ffregress_reserved *ffr_reserved = (ffregress_reserved*) ffr_context->reserved;
+    if (!ffr_reserved) return FFREGRESS_NOT_INITIALIZED;
+    if (width <= 0 || height <= 0 || (width & 1) || (height & 1)) return FFREGRESS_INVALID_SIZE;
+
+    if (ffr_reserved->clip_count == ffr_reserved->clip_capacity)
+    {
+        int capacity = ffr_reserved->clip_capacity ? ffr_reserved->clip_capacity * 2 : 8;
+        ffr_reserved->clips = (ffregress_clip*) realloc(ffr_reserved->clips, capacity * sizeof(ffregress_clip));
+        ffr_reserved->clip_capacity = capacity;
+    }
+
+    ffregress_clip *clip = &ffr_reserved->clips[ffr_reserved->clip_count++];
+    clip->pattern = pattern;
+    clip->path = path ? strdup(path) : NULL;
+    clip->width = width;
+    clip->height = height;
+
+    return FFREGRESS_OK;
+}
+
+ffregress_error ffregress_add_pattern(ffregress_context *ffr_context, ffregress_pattern pattern,
+        int width, int height)
+{
+    return add_clip(ffr_context, pattern, NULL, width, height);
+}
+
+ffregress_error ffregress_add_file(ffregress_context *ffr_context, const char *path,
+        int width, int height)
+{
+    return add_clip(ffr_context, FFREGRESS_GRADIENT, path, width, height);
+}
+
+ffregress_error ffregress_add_codec(ffregress_context *ffr_context, CodecID codec_id,
+        int bit_rate, int gop_size)
+{
+    ffregress_reserved *ffr_reserved = (ffregress_reserved*) ffr_context->reserved;
+    if (!ffr_reserved) return FFREGRESS_NOT_INITIALIZED;
+
+    AVCodec *decoder = avcodec_find_decoder(codec_id);
+
+    if (!decoder)
+    {
+        av_register_all();
+        decoder = avcodec_find_decoder(codec_id);
+    }
+
+    if (!avcodec_find_encoder(codec_id) || !decoder) return FFREGRESS_CODEC_NOT_FOUND;
+
+    if (ffr_reserved->codec_count == ffr_reserved->codec_capacity)
+    {
+        int capacity = ffr_reserved->codec_capacity ? ffr_reserved->codec_capacity * 2 : 4;
+        ffr_reserved->codecs = (ffregress_codec*) realloc(ffr_reserved->codecs, capacity * sizeof(ffregress_codec));
+        ffr_reserved->codec_capacity = capacity;
+    }
+
+    ffregress_codec *codec = &ffr_reserved->codecs[ffr_reserved->codec_count++];
+    codec->codec_id = codec_id;
+    codec->bit_rate = bit_rate;
+    codec->gop_size = gop_size;
+
+    return FFREGRESS_OK;
+}
+
+static const char *pattern_name(ffregress_pattern pattern)
+{
+    switch (pattern)
+    {
+        case FFREGRESS_GRADIENT:
+            return "gradient";
+        case FFREGRESS_CHECKERS:
+            return "checkers";
+        case FFREGRESS_NOISE:
+            return "noise";
+        case FFREGRESS_LOW_LIGHT:
+            return "lowlight";
+    }
+
+    return "unknown";
+}
+
+/**
+ * Draw frame n of a generated clip as NV12 with a stride of width.
+ */
+static void draw_pattern(ffregress_pattern pattern, int n, uint8_t *nv12, int width, int height)
+{
+    uint8_t *uv = &nv12[width * height];
+
+    // a linear congruential generator, so noise is the same everywhere
+    uint32_t seed = (uint32_t) n * 2654435761u + 1;
+
+    for (int y = 0; y < height; y++)
+    {
+        uint8_t *row = &nv12[y * width];
+
+        for (int x = 0; x < width; x++)
+        {
+            switch (pattern)
+            {
+                case FFREGRESS_GRADIENT:
+                    row[x] = (x + y + 2 * n) & 0xFF;
+                    break;
+                case FFREGRESS_CHECKERS:
+                    row[x] = (((x + 3 * n) >> 4) ^ ((y + n) >> 4)) & 1 ? 200 : 40;
+                    break;
+                case FFREGRESS_NOISE:
+                    seed = seed * 1664525 + 1013904223;
+                    row[x] = seed >> 24;
+                    break;
+                case FFREGRESS_LOW_LIGHT:
+                    seed = seed * 1664525 + 1013904223;
+                    row[x] = ((((x + 3 * n) >> 4) ^ ((y + n) >> 4)) & 1 ? 60 : 24) + (int) (seed >> 24) % 25 - 12;
+                    break;
+            }
+        }
+    }
+
+    for (int y = 0; y < height / 2; y++)
+    {
+        uint8_t *row = &uv[y * width];
+
+        for (int x = 0; x < width / 2; x++)
+        {
+            switch (pattern)
+            {
+                case FFREGRESS_GRADIENT:
+                    row[2 * x] = 96 + ((x + n) & 0x3F);
+                    row[2 * x + 1] = 96 + (y & 0x3F);
+                    break;
+                case FFREGRESS_CHECKERS:
+                    row[2 * x] = 128;
+                    row[2 * x + 1] = 128;
+                    break;
+                case FFREGRESS_NOISE:
+                    seed = seed * 1664525 + 1013904223;
+                    row[2 * x] = seed >> 24;
+                    row[2 * x + 1] = seed >> 16;
+                    break;
+                case FFREGRESS_LOW_LIGHT:
+                    seed = seed * 1664525 + 1013904223;
+                    row[2 * x] = 128 + (int) (seed >> 24) % 13 - 6;
+                    row[2 * x + 1] = 128 + (int) ((seed >> 16) & 0xFF) % 13 - 6;
+                    break;
+            }
+        }
+    }
+}
+
+static void regress_write_callback(ffenc_context *ffe_context, uint8_t *buf, ssize_t size, void *arg)
+{
+    ffregress_stream *stream = (ffregress_stream*) arg;
+
+    if (stream->size + size > stream->capacity)
+    {
+        int64_t capacity = FFMAX(stream->capacity * 2, stream->size + size);
+        stream->data = (uint8_t*) realloc(stream->data, capacity);
+        stream->capacity = capacity;
+    }
+
+    memcpy(&stream->data[stream->size], buf, size);
+    stream->size += size;
+
+    if (stream->packet_count == stream->packet_capacity)
+    {
+        int capacity = stream->packet_capacity ? stream->packet_capacity * 2 : 256;
+        stream->packet_sizes = (int*) realloc(stream->packet_sizes, capacity * sizeof(int));
+        stream->packet_capacity = capacity;
+    }
+
+    stream->packet_sizes[stream->packet_count++] = size;
+}
+
+static int regress_read_callback(ffdec_context *ffd_context, uint8_t *buf, ssize_t size, void *arg)
+{
+    ffregress_stream *stream = (ffregress_stream*) arg;
+
+    int read = (int) FFMIN((int64_t) size, stream->size - stream->read);
+    memcpy(buf, &stream->data[stream->read], read);
+    stream->read += read;
+
+    return read;
+}
+
+static void stream_done(ffregress_stream *stream)
+{
+    pthread_mutex_lock(&stream->mutex);
+    stream->done_time = av_gettime();
+    stream->done = true;
+    pthread_cond_signal(&stream->done_cond);
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+static void regress_encoder_close(ffenc_context *ffe_context, void *arg)
+{
+    stream_done((ffregress_stream*) arg);
+}
+
+static void regress_decoder_close(ffdec_context *ffd_context, void *arg)
+{
+    stream_done((ffregress_stream*) arg);
+}
+
+static void wait_stream(ffregress_stream *stream)
+{
+    pthread_mutex_lock(&stream->mutex);
+    while (!stream->done)
+    {
+        pthread_cond_wait(&stream->done_cond, &stream->mutex);
+    }
+    stream->done = false;
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+/**
+ * Encode the clip through ffenc as camera frames into the stream.
+ */
+static ffregress_error encode_clip(ffregress_context *ffr_context, ffregress_clip *clip,
+        ffregress_codec *codec, ffregress_stream *stream, ffregress_result *result)
+{
+    int width = clip->width;
+    int height = clip->height;
+    int frame_size = width * height * 3 / 2;
+
+    FILE *file = NULL;
+    int64_t file_frames = 0;
+
+    if (clip->path)
+    {
+        file = fopen(clip->path, "rb");
+        if (!file) return FFREGRESS_READ_FAILED;
+
+        fseek(file, 0, SEEK_END);
+        file_frames = ftell(file) / frame_size;
+
+        if (!file_frames)
+        {
+            fclose(file);
+            return FFREGRESS_READ_FAILED;
+        }
+    }
+
+    AVCodec *encoder = avcodec_find_encoder(codec->codec_id);
+    AVCodecContext *codec_context = avcodec_alloc_context3(encoder);
+    codec_context->pix_fmt = PIX_FMT_YUV420P;
+    codec_context->width = width;
+    codec_context->height = height;
+    codec_context->bit_rate = codec->bit_rate;
+    codec_context->time_base.num = 1;
+    codec_context->time_base.den = 30;
+    codec_context->ticks_per_frame = 2;
+    codec_context->gop_size = codec->gop_size;
+    codec_context->thread_count = 1;
+
+    if (avcodec_open2(codec_context, encoder, NULL) < 0)
+    {
+        av_free(codec_context);
+        if (file) fclose(file);
+        return FFREGRESS_OPEN_FAILED;
+    }
+
+    ffquality_context *ffq_context = ffquality_alloc();
+    ffq_context->max_pending = ffr_context->frame_count;
+
+    if (ffquality_open(ffq_context, codec_context, NULL) != FFQUALITY_OK)
+    {
+        ffquality_free(ffq_context);
+        avcodec_close(codec_context);
+        av_free(codec_context);
+        if (file) fclose(file);
+        return FFREGRESS_OPEN_FAILED;
+    }
+
+    ffenc_context *ffe_context = ffenc_alloc();
+    ffenc_set_write_callback(ffe_context, regress_write_callback, stream);
+    ffenc_set_close_callback(ffe_context, regress_encoder_close, stream);
+    ffenc_set_quality(ffe_context, ffq_context);
+    ffenc_set_denoise(ffe_context, ffr_context->denoise_strength, ffr_context->denoise_threshold);
+    ffe_context->codec_context = codec_context;
+
+    uint8_t *nv12 = (uint8_t*) malloc(frame_size);
+
+    camera_buffer_t buf;
+    memset(&buf, 0, sizeof(camera_buffer_t));
+    buf.frametype = CAMERA_FRAMETYPE_NV12;
+    buf.framebuf = nv12;
+    buf.framesize = frame_size;
+    buf.framedesc.nv12.width = width;
+    buf.framedesc.nv12.height = height;
+    buf.framedesc.nv12.stride = width;
+    buf.framedesc.nv12.uv_offset = width * height;
+    buf.framedesc.nv12.uv_stride = width;
+
+    ffregress_error error = FFREGRESS_OK;
+
+    int64_t start = av_gettime();
+    ffenc_start(ffe_context);
+
+    for (int n = 0; n < ffr_context->frame_count; n++)
+    {
+        if (file)
+        {
+            fseek(file, (n % file_frames) * frame_size, SEEK_SET);
+
+            if (fread(nv12, 1, frame_size, file) != (size_t) frame_size)
+            {
+                error = FFREGRESS_READ_FAILED;
+                break;
+            }
+        }
+        else
+        {
+            draw_pattern(clip->pattern, n, nv12, width, height);
+        }
+
+        ffenc_stats stats;
+        ffenc_get_stats(ffe_context, &stats);
+
+        while (stats.queue_depth >= MAX_QUEUE_DEPTH)
+        {
+            usleep(1000);
+            ffenc_get_stats(ffe_context, &stats);
+        }
+
+        buf.frametimestamp = n * FRAME_DURATION;
+        ffenc_add_frame(ffe_context, &buf);
+    }
+
+    ffenc_stop(ffe_context);
+    wait_stream(stream);
+
+    ffenc_stats stats;
+    ffenc_get_stats(ffe_context, &stats);
+
+    result->frames = stats.frames_in;
+    result->encode_fps = (double) stats.frames_in * 1000000 / FFMAX(stream->done_time - start, 1);
+    result->encode_p50 = stats.encode_time.p50;
+    result->encode_p99 = stats.encode_time.p99;
+    result->latency_p50 = stats.latency.p50;
+    result->latency_p99 = stats.latency.p99;
+    result->bytes = stats.bytes_out;
+    result->denoise_p50 = stats.denoise_time.p50;
+    result->denoise_p99 = stats.denoise_time.p99;
+
+    ffquality_close(ffq_context);
+
+    ffquality_summary summary;
+    ffquality_get_summary(ffq_context, &summary);
+    result->psnr = summary.psnr;
+
+    ffenc_close(ffe_context);
+    ffenc_free(ffe_context);
+    ffquality_free(ffq_context);
+
+    free(nv12);
+    if (file) fclose(file);
+
+    return error;
+}
+
+/**
+ * Decode the packets of the stream one at a time, for decoders that
+ * cannot take the fixed size reads of ffdec, timing each call as ffdec does.
+ */
+static ffregress_error decode_packets(AVCodecContext *codec_context, ffregress_stream *stream,
+        ffregress_result *result)
+{
+    AVFrame *frame = avcodec_alloc_frame();
+    ffstats_histogram decode_time;
+    memset(&decode_time, 0, sizeof(ffstats_histogram));
+
+    int buffer_size = 0;
+    uint8_t *buffer = NULL;
+    int64_t frames = 0;
+    int64_t offset = 0;
+
+    int64_t start = av_gettime();
+
+    for (int i = 0; i <= stream->packet_count; i++)
+    {
+        AVPacket packet;
+        av_init_packet(&packet);
+
+        // a last empty packet drains the frames the decoder holds
+        if (i < stream->packet_count)
+        {
+            int size = stream->packet_sizes[i];
+
+            if (size + FF_INPUT_BUFFER_PADDING_SIZE > buffer_size)
+            {
+                av_free(buffer);
+                buffer_size = size + FF_INPUT_BUFFER_PADDING_SIZE;
+                buffer = (uint8_t*) av_malloc(buffer_size);
+            }
+
+            memcpy(buffer, &stream->data[offset], size);
+            memset(&buffer[size], 0, FF_INPUT_BUFFER_PADDING_SIZE);
+            offset += size;
+
+            packet.data = buffer;
+            packet.size = size;
+        }
+        else
+        {
+            packet.data = NULL;
+            packet.size = 0;
+        }
+
+        int got_frame;
+
+        do
+        {
+            got_frame = 0;
+
+            int64_t decode_start = av_gettime();
+            int decode_result = avcodec_decode_video2(codec_context, frame, &got_frame, &packet);
+            ffstats_histogram_add(&decode_time, av_gettime() - decode_start);
+
+            if (decode_result < 0) break;
+            if (got_frame) frames++;
+        }
+        while (!packet.data && got_frame);
+    }
+
+    ffstats_times times;
+    ffstats_histogram_times(&decode_time, &times);
+
+    result->decode_fps = (double) frames * 1000000 / FFMAX(av_gettime() - start, 1);
+    result->decode_p50 = times.p50;
+    result->decode_p99 = times.p99;
+
+    av_free(buffer);
+    av_free(frame);
+
+    avcodec_close(codec_context);
+    av_free(codec_context);
+
+    return FFREGRESS_OK;
+}
+
+/**
+ * Decode the stream with ffdec as fast as it can read it.
+ */
+static ffregress_error decode_clip(ffregress_clip *clip, ffregress_codec *codec,
+        ffregress_stream *stream, ffregress_result *result)
+{
+    AVCodec *decoder = avcodec_find_decoder(codec->codec_id);
+    AVCodecContext *codec_context = avcodec_alloc_context3(decoder);
+    codec_context->pix_fmt = PIX_FMT_YUV420P;
+    codec_context->width = clip->width;
+    codec_context->height = clip->height;
+    codec_context->thread_count = 1;
+
+    // ffdec reads fixed size chunks rather than complete frames
+    bool truncated = decoder->capabilities & CODEC_CAP_TRUNCATED;
+    if (truncated) codec_context->flags |= CODEC_FLAG_TRUNCATED;
+
+    if (avcodec_open2(codec_context, decoder, NULL) < 0)
+    {
+        av_free(codec_context);
+        return FFREGRESS_OPEN_FAILED;
+    }
+
+    if (!truncated) return decode_packets(codec_context, stream, result);
+
+    ffdec_context *ffd_context = ffdec_alloc();
+    ffdec_set_read_callback(ffd_context, regress_read_callback, stream);
+    ffdec_set_close_callback(ffd_context, regress_decoder_close, stream);
+    ffd_context->codec_context = codec_context;
+
+    stream->read = 0;
+
+    int64_t start = av_gettime();
+    ffdec_start(ffd_context);
+    wait_stream(stream);
+
+    ffdec_stats stats;
+    ffdec_get_stats(ffd_context, &stats);
+
+    result->decode_fps = (double) stats.frames_in * 1000000 / FFMAX(stream->done_time - start, 1);
+    result->decode_p50 = stats.decode_time.p50;
+    result->decode_p99 = stats.decode_time.p99;
+
+    ffdec_close(ffd_context);
+    ffdec_free(ffd_context);
+
+    return FFREGRESS_OK;
+}
+
+ffregress_error ffregress_run(ffregress_context *ffr_context)
+{
+    ffregress_reserved *ffr_reserved = (ffregress_reserved*) ffr_context->reserved;
+    if (!ffr_reserved) return FFREGRESS_NOT_INITIALIZED;
+    if (!ffr_reserved->clip_count) return FFREGRESS_NO_CLIPS;
+    if (!ffr_reserved->codec_count) return FFREGRESS_NO_CODECS;
+
+    int result_count = ffr_reserved->clip_count * ffr_reserved->codec_count;
+
+    free(ffr_reserved->results);
+    ffr_reserved->results = (ffregress_result*) malloc(result_count * sizeof(ffregress_result));
+    memset(ffr_reserved->results, 0, result_count * sizeof(ffregress_result));
+    ffr_reserved->result_capacity = result_count;
+    ffr_reserved->result_count = 0;
+
+    ffregress_stream stream;
+    memset(&stream, 0, sizeof(ffregress_stream));
+    pthread_mutex_init(&stream.mutex, 0);
+    pthread_cond_init(&stream.done_cond, 0);
+
+    ffregress_error error = FFREGRESS_OK;
+
+    for (int i = 0; i < ffr_reserved->clip_count && error == FFREGRESS_OK; i++)
+    {
+        ffregress_clip *clip = &ffr_reserved->clips[i];
+
+        for (int j = 0; j < ffr_reserved->codec_count && error == FFREGRESS_OK; j++)
+        {
+            ffregress_codec *codec = &ffr_reserved->codecs[j];
+            ffregress_result *result = &ffr_reserved->results[ffr_reserved->result_count];
+
+            char *path = clip->path ? strdup(clip->path) : NULL;
+            snprintf(result->name, sizeof(result->name), "%s-%s-%dx%d",
+                    path ? basename(path) : pattern_name(clip->pattern),
+                    avcodec_find_encoder(codec->codec_id)->name, clip->width, clip->height);
+            free(path);
+
+            if (ffr_context->denoise_strength)
+            {
+                int length = strlen(result->name);
+                snprintf(&result->name[length], sizeof(result->name) - length, "-d%d", ffr_context->denoise_strength);
+            }
+
+            stream.size = 0;
+            stream.packet_count = 0;
+
+            error = encode_clip(ffr_context, clip, codec, &stream, result);
+            if (error == FFREGRESS_OK) error = decode_clip(clip, codec, &stream, result);
+            if (error == FFREGRESS_OK) ffr_reserved->result_count++;
+        }
+    }
+
+    free(stream.data);
+    stream.data = NULL;
+    free(stream.packet_sizes);
+    stream.packet_sizes = NULL;
+
+    pthread_mutex_destroy(&stream.mutex);
+    pthread_cond_destroy(&stream.done_cond);
+
+    return error;
+}
+
+ffregress_error ffregress_get_results(ffregress_context *ffr_context,
+        const ffregress_result **results, int *result_count)
+{
+    ffregress_reserved *ffr_reserved = (ffregress_reserved*) ffr_context->reserved;
+    if (!ffr_reserved) return FFREGRESS_NOT_INITIALIZED;
+
+    *results = ffr_reserved->results;
+    *result_count = ffr_reserved->result_count;
+
+    return FFREGRESS_OK;
+}
+
+#define BASELINE_FORMAT "%95s %lld %lf %lf %lld %lld %lld %lld %lld %lld %lld %lf"
+
+ffregress_error ffregress_write_baseline(ffregress_context *ffr_context, const char *path)
+{
+    ffregress_reserved *ffr_reserved = (ffregress_reserved*) ffr_context->reserved;
+    if (!ffr_reserved) return FFREGRESS_NOT_INITIALIZED;
+    if (!ffr_reserved->result_count) return FFREGRESS_NO_RESULTS;
+
+    FILE *file = fopen(path, "w");
+    if (!file) return FFREGRESS_WRITE_FAILED;
+
+    fprintf(file, "# name frames encode_fps decode_fps encode_p50 encode_p99 decode_p50 decode_p99 "
+            "latency_p50 latency_p99 bytes psnr\n");
+
+    for (int i = 0; i < ffr_reserved->result_count; i++)
+    {
+        ffregress_result *result = &ffr_reserved->results[i];
+
+        fprintf(file, "%s %lld %.2f %.2f %lld %lld %lld %lld %lld %lld %lld %.3f\n", result->name,
+                (long long) result->frames, result->encode_fps, result->decode_fps,
+                (long long) result->encode_p50, (long long) result->encode_p99,
+                (long long) result->decode_p50, (long long) result->decode_p99,
+                (long long) result->latency_p50, (long long) result->latency_p99,
+                (long long) result->bytes, result->psnr);
+    }
+
+    bool failed = ferror(file);
+    if (fclose(file) != 0) failed = true;
+
+    return failed ? FFREGRESS_WRITE_FAILED : FFREGRESS_OK;
+}
+
+static bool read_baseline(FILE *file, const char *name, ffregress_result *baseline)
+{
+    char line[512];
+    rewind(file);
+
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '#') continue;
+
+        long long frames, encode_p50, encode_p99, decode_p50, decode_p99, latency_p50, latency_p99, bytes;
+        memset(baseline, 0, sizeof(ffregress_result));
+
+        if (sscanf(line, BASELINE_FORMAT, baseline->name, &frames, &baseline->encode_fps,
+                &baseline->decode_fps, &encode_p50, &encode_p99, &decode_p50, &decode_p99,
+                &latency_p50, &latency_p99, &bytes, &baseline->psnr) != 12) continue;
+
+        if (strcmp(baseline->name, name)) continue;
+
+        baseline->frames = frames;
+        baseline->encode_p50 = encode_p50;
+        baseline->encode_p99 = encode_p99;
+        baseline->decode_p50 = decode_p50;
+        baseline->decode_p99 = decode_p99;
+        baseline->latency_p50 = latency_p50;
+        baseline->latency_p99 = latency_p99;
+        baseline->bytes = bytes;
+
+        return true;
+    }
+
+    return false;
+}
+
+ffregress_error ffregress_compare(ffregress_context *ffr_context, const char *path, FILE *report)
+{
+    ffregress_reserved *ffr_reserved = (ffregress_reserved*) ffr_context->reserved;
+    if (!ffr_reserved) return FFREGRESS_NOT_INITIALIZED;
+    if (!ffr_reserved->result_count) return FFREGRESS_NO_RESULTS;
+
+    FILE *file = fopen(path, "r");
+    if (!file) return FFREGRESS_READ_FAILED;
+
+    if (!report) report = stderr;
+
+    const ffregress_tolerance *tolerance = &ffr_context->tolerance;
+    ffregress_error error = FFREGRESS_OK;
+
+    for (int i = 0; i < ffr_reserved->result_count; i++)
+    {
+        ffregress_result *result = &ffr_reserved->results[i];
+        ffregress_result baseline;
+
+        // an unrecorded result could hide any regression, so it fails too
+        if (!read_baseline(file, result->name, &baseline))
+        {
+            fprintf(report, "MISS %s\n", result->name);
+            if (error == FFREGRESS_OK) error = FFREGRESS_NO_BASELINE;
+            continue;
+        }
+
+        char failures[512];
+        int length = 0;
+        failures[0] = '\0';
+
+#define REGRESSED(condition, format, value, base) \
+        if (condition) length += snprintf(&failures[length], sizeof(failures) - length, \
+                " " format, value, base)
+
+        REGRESSED(result->frames != baseline.frames,
+                "frames %lld != %lld", (long long) result->frames, (long long) baseline.frames);
+        REGRESSED(result->encode_fps < baseline.encode_fps * (1 - tolerance->throughput),
+                "encode_fps %.2f < %.2f", result->encode_fps, baseline.encode_fps);
+        REGRESSED(result->decode_fps < baseline.decode_fps * (1 - tolerance->throughput),
+                "decode_fps %.2f < %.2f", result->decode_fps, baseline.decode_fps);
+        REGRESSED(result->encode_p99 > baseline.encode_p99 * (1 + tolerance->latency),
+                "encode_p99 %lld > %lld", (long long) result->encode_p99, (long long) baseline.encode_p99);
+        REGRESSED(result->decode_p99 > baseline.decode_p99 * (1 + tolerance->latency),
+                "decode_p99 %lld > %lld", (long long) result->decode_p99, (long long) baseline.decode_p99);
+        REGRESSED(result->latency_p99 > baseline.latency_p99 * (1 + tolerance->latency),
+                "latency_p99 %lld > %lld", (long long) result->latency_p99, (long long) baseline.latency_p99);
+        REGRESSED(result->bytes > baseline.bytes * (1 + tolerance->size),
+                "bytes %lld > %lld", (long long) result->bytes, (long long) baseline.bytes);
+        REGRESSED(result->psnr < baseline.psnr - tolerance->psnr,
+                "psnr %.3f < %.3f", result->psnr, baseline.psnr);
+
+#undef REGRESSED
+
+        if (length)
+        {
+            fprintf(report, "FAIL %s:%s\n", result->name, failures);
+            error = FFREGRESS_REGRESSED;
+        }
+        else
+        {
+            fprintf(report, "PASS %s\n", result->name);
+        }
+    }
+
+    fclose(file);
+
+    return error;
+}
@@ -0,0 +1,221 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBREGRESS_H
+#define FFBBREGRESS_H
+
+// include math.h otherwise it will get included
+// by avformat.h and cause duplicate definition
+// errors because of C vs C++ functions
+#include <math.h>
+
+extern "C"
+{
+#define UINT64_C uint64_t
+#define INT64_C int64_t
+#include <libavformat/avformat.h>
+}
+
+#include <sys/types.h>
+
+typedef enum
+{
+    FFREGRESS_OK = 0,
+    FFREGRESS_NOT_INITIALIZED,
+    FFREGRESS_NO_CLIPS,
+    FFREGRESS_NO_CODECS,
+    FFREGRESS_CODEC_NOT_FOUND,
+    FFREGRESS_INVALID_SIZE,
+    FFREGRESS_OPEN_FAILED,
+    FFREGRESS_READ_FAILED,
+    FFREGRESS_WRITE_FAILED,
+    FFREGRESS_NO_RESULTS,
+
+    /**
+     * A result crossed a tolerance of its baseline.
+     */
+    FFREGRESS_REGRESSED,
+
+    /**
+     * A result has no baseline to be compared with.
+     */
+    FFREGRESS_NO_BASELINE
+} ffregress_error;
+
+typedef enum
+{
+    /**
+     * A diagonal gradient scrolling 2 pixels a frame. Cheap to encode.
+     */
+    FFREGRESS_GRADIENT = 0,
+
+    /**
+     * 16x16 checks panning 3 pixels right and 1 down a frame,
+     * for motion estimation.
+     */
+    FFREGRESS_CHECKERS,
+
+    /**
+     * Seeded noise that changes every frame, the worst case for size.
+     */
+    FFREGRESS_NOISE,
+
+    /**
+     * Dim checks panning as FFREGRESS_CHECKERS with seeded grain of up
+     * to 12 levels on every pixel, as a camera gives in low light.
+     */
+    FFREGRESS_LOW_LIGHT
+} ffregress_pattern;
+
+typedef struct
+{
+    /**
+     * "clip-codec-widthxheight", with "-d" and the strength for
+     * denoised runs, the key into the baseline.
+     */
+    char name[96];
+
+    int64_t frames;
+
+    /**
+     * Frames per second from the first frame added to the last packet
+     * written, and from the first read to the last frame decoded.
+     */
+    double encode_fps;
+    double decode_fps;
+
+    /**
+     * Microseconds per avcodec_encode_video2 and avcodec_decode_video2 call.
+     */
+    int64_t encode_p50;
+    int64_t encode_p99;
+    int64_t decode_p50;
+    int64_t decode_p99;
+
+    /**
+     * Microseconds from a frame being added to ffenc to its packet being written.
+     */
+    int64_t latency_p50;
+    int64_t latency_p99;
+
+    int64_t bytes;
+    double psnr;
+
+    /**
+     * Microseconds the denoiser spent per frame, not kept in the baseline.
+     */
+    int64_t denoise_p50;
+    int64_t denoise_p99;
+} ffregress_result;
+
+typedef struct
+{
+    /**
+     * Fractions the fps may fall and the p99 latency and size may grow
+     * by, and dB the PSNR may fall by, before a result regressed.
+     */
+    double throughput;
+    double latency;
+    double size;
+    double psnr;
+} ffregress_tolerance;
+
+typedef struct
+{
+    /**
+     * Frames encoded from every clip, 90 by default. Files
+     * with fewer frames are looped.
+     */
+    int frame_count;
+
+    /**
+     * Passed to ffenc_set_denoise, to compare the size of filtered and
+     * unfiltered clips. The PSNR is measured against the unfiltered
+     * clip, so it includes what the filter removed. 0 by default.
+     */
+    int denoise_strength;
+    int denoise_threshold;
+
+    ffregress_tolerance tolerance;
+
+    /**
+     * For internal use. Do not use.
+     */
+    void *reserved;
+} ffregress_context;
+
+/**
+ * Allocate the context with default values.
+ */
+ffregress_context *ffregress_alloc(void);
+
+/**
+ * Reset the context with default values.
+ * This removes the clips, codecs and results.
+ */
+void ffregress_reset(ffregress_context *ffr_context);
+
+/**
+ * Free the context.
+ */
+ffregress_error ffregress_free(ffregress_context *ffr_context);
+
+/**
+ * Add a generated clip. Sizes must be even, and the same pattern,
+ * size and frame_count always produce the same frames.
+ */
+ffregress_error ffregress_add_pattern(ffregress_context *ffr_context, ffregress_pattern pattern,
+        int width, int height);
+
+/**
+ * Add a recorded clip of raw NV12 frames with a stride of width.
+ */
+ffregress_error ffregress_add_file(ffregress_context *ffr_context, const char *path,
+        int width, int height);
+
+/**
+ * Encode every clip with the codec at the given settings. The codec must
+ * have an encoder and a decoder. Decoders that accept truncated packets
+ * read the output through ffdec as the preview does, the others are
+ * given the packets the encoder wrote one at a time.
+ */
+ffregress_error ffregress_add_codec(ffregress_context *ffr_context, CodecID codec_id,
+        int bit_rate, int gop_size);
+
+/**
+ * Feed every clip through ffenc as camera frames with every codec, then
+ * decode the output with ffdec and measure it against the clip with
+ * ffquality. Clips run one at a time on the calling thread, with a
+ * single codec thread so sizes and PSNR only change with the code.
+ */
+ffregress_error ffregress_run(ffregress_context *ffr_context);
+
+ffregress_error ffregress_get_results(ffregress_context *ffr_context,
+        const ffregress_result **results, int *result_count);
+
+/**
+ * Write the results as a baseline for later runs to compare against.
+ */
+ffregress_error ffregress_write_baseline(ffregress_context *ffr_context, const char *path);
+
+/**
+ * Compare the results with the baseline at path and write one line per
+ * result to report, or stderr if NULL. Returns FFREGRESS_REGRESSED if any
+ * result crossed a tolerance, otherwise FFREGRESS_NO_BASELINE if any result
+ * is missing from the baseline.
+ */
+ffregress_error ffregress_compare(ffregress_context *ffr_context, const char *path, FILE *report);
+
+#endif
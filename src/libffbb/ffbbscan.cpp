@@ -0,0 +1,373 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include "ffbbscan.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// bytes of the file mapped at a time by ffscan_file,
+// a multiple of the page size as mmap offsets must be
+#define FFSCAN_WINDOW_SIZE (16 * 1024 * 1024)
+
+// bytes after the start of a code needed to classify it,
+// the sequence header frame_rate_code is in the eighth byte
+#define FFSCAN_LOOKAHEAD 8
+
+#define SEQUENCE_HEADER_CODE 0xB3
+#define GOP_START_CODE 0xB8
+#define PICTURE_START_CODE 0x00
+
+typedef struct
+{
+    // stream offset of the first byte of the next part
+    int64_t offset;
+    // tail of the previous part that could not be classified yet
+    uint8_t carry[FFSCAN_LOOKAHEAD - 1];
+    int carry_size;
+    // first sequence or GOP header not yet claimed by a picture
+    int64_t pending;
+    ffindex_entry entry;
+    bool has_entry;
+    bool has_time_base;
+    int64_t gop_base;
+    int64_t frames;
+    ffscan_stats stats;
+} ffscan_reserved;
+
+static const AVRational frame_durations[] = {
+    { 0, 1 },
+    { 1001, 24000 },
+    { 1, 24 },
+    { 1, 25 },
+    { 1001, 30000 },
+    { 1, 30 },
+    { 1, 50 },
+    { 1001, 60000 },
+    { 1, 60 } };
+
+ffscan_context *ffscan_alloc()
+{
+    ffscan_context *ffs_context = (ffscan_context*) malloc(sizeof(ffscan_context));
+    memset(ffs_context, 0, sizeof(ffscan_context));
+
+    ffscan_reset(ffs_context);
+
+    return ffs_context;
+}
+
+void ffscan_reset(ffscan_context *ffs_context)
+{
+    ffscan_reserved *ffs_reserved = (ffscan_reserved*) ffs_context->reserved;
+    if (!ffs_reserved) ffs_reserved = (ffscan_reserved*) malloc(sizeof(ffscan_reserved));
+    memset(ffs_reserved, 0, sizeof(ffscan_reserved));
+
+    ffs_reserved->pending = -1;
+
+    memset(ffs_context, 0, sizeof(ffscan_context));
+    ffs_context->reserved = ffs_reserved;
+}
+
+ffscan_error ffscan_free(ffscan_context *ffs_context)
+{
+    free(ffs_context->reserved);
+    ffs_context->reserved = NULL;
+    free(ffs_context);
+    return FFSCAN_OK;
+}
+
+int64_t ffscan_find_start_code(const uint8_t *buf, int64_t from, int64_t end)
+{
+    int64_t i = from;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+
+    for (; i + 32 <= end; i += 32)
+    {
+        __m128i a0 = _mm_loadu_si128((const __m128i*) &buf[i]);
+        __m128i b0 = _mm_loadu_si128((const __m128i*) &buf[i + 1]);
+        __m128i c0 = _mm_loadu_si128((const __m128i*) &buf[i + 2]);
+        __m128i a1 = _mm_loadu_si128((const __m128i*) &buf[i + 16]);
+        __m128i b1 = _mm_loadu_si128((const __m128i*) &buf[i + 17]);
+        __m128i c1 = _mm_loadu_si128((const __m128i*) &buf[i + 18]);
+
+        __m128i m0 = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a0, zero),
+                _mm_cmpeq_epi8(b0, zero)), _mm_cmpeq_epi8(c0, one));
+        __m128i m1 = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a1, zero),
+                _mm_cmpeq_epi8(b1, zero)), _mm_cmpeq_epi8(c1, one));
+
+        uint32_t mask = _mm_movemask_epi8(m0) | (_mm_movemask_epi8(m1) << 16);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+
+    for (; i + 16 <= end; i += 16)
+    {
+        uint8x16_t a = vld1q_u8(&buf[i]);
+        uint8x16_t b = vld1q_u8(&buf[i + 1]);
+        uint8x16_t c = vld1q_u8(&buf[i + 2]);
+
+        uint8x16_t m = vandq_u8(vandq_u8(vceqq_u8(a, zero), vceqq_u8(b, zero)), vceqq_u8(c, one));
+        uint64x2_t m64 = vreinterpretq_u64_u8(m);
+        uint64_t lo = vgetq_lane_u64(m64, 0);
+        uint64_t hi = vgetq_lane_u64(m64, 1);
+
+        // lanes are little endian, so the lowest set byte is the first match
+        if (lo) return i + (__builtin_ctzll(lo) >> 3);
+        if (hi) return i + 8 + (__builtin_ctzll(hi) >> 3);
+    }
+#endif
+
+    for (; i < end; i++)
+    {
+        if (buf[i] == 0 && buf[i + 1] == 0 && buf[i + 2] == 1) return i;
+    }
+
+    return end;
+}
+
+int ffscan_find_sequence_header(const uint8_t *buf, int size, int *start)
+{
+    int sequence_header = -1;
+
+    for (int i = ffscan_find_start_code(buf, 0, size - 3); i < size - 3; i = ffscan_find_start_code(buf, i + 3, size - 3))
+    {
+        int code = buf[i + 3];
+
+        if (code == SEQUENCE_HEADER_CODE && sequence_header < 0)
+        {
+            sequence_header = i;
+        }
+        else if (sequence_header >= 0 && (code == GOP_START_CODE || code == PICTURE_START_CODE))
+        {
+            *start = sequence_header;
+            return i - sequence_header;
+        }
+    }
+
+    return 0;
+}
+
+static void ffscan_add_entry(ffscan_context *ffs_context, int64_t end)
+{
+    ffscan_reserved *ffs_reserved = (ffscan_reserved*) ffs_context->reserved;
+    if (!ffs_reserved->has_entry) return;
+
+    ffs_reserved->entry.size = end - ffs_reserved->entry.offset;
+    ffindex_add(ffs_context->ffi_context, &ffs_reserved->entry);
+    ffs_reserved->has_entry = false;
+}
+
+/**
+ * Classify the start code at p. Pictures become index entries, which
+ * begin at any sequence or GOP header in front of them so that every
+ * GOP start entry can be decoded from its offset.
+ */
+static void ffscan_start_code(ffscan_context *ffs_context, const uint8_t *p, int available, int64_t position)
+{
+    ffscan_reserved *ffs_reserved = (ffscan_reserved*) ffs_context->reserved;
+
+    int code = p[3];
+    ffs_reserved->stats.start_codes++;
+
+    if (code == SEQUENCE_HEADER_CODE || code == GOP_START_CODE)
+    {
+        if (ffs_reserved->pending < 0) ffs_reserved->pending = position;
+
+        if (code == SEQUENCE_HEADER_CODE && !ffs_reserved->has_time_base && available >= 8)
+        {
+            int frame_rate_code = p[7] & 0x0F;
+
+            if (frame_rate_code > 0 && frame_rate_code <= 8)
+            {
+                ffs_context->ffi_context->time_base = frame_durations[frame_rate_code];
+                ffs_reserved->has_time_base = true;
+            }
+        }
+    }
+    else if (code == PICTURE_START_CODE && available >= 6)
+    {
+        int temporal_reference = (p[4] << 2) | (p[5] >> 6);
+        int picture_type = (p[5] >> 3) & 7;
+
+        int64_t offset = ffs_reserved->pending >= 0 ? ffs_reserved->pending : position;
+        bool gop_start = picture_type == AV_PICTURE_TYPE_I && (ffs_reserved->pending >= 0 || !ffs_reserved->frames);
+
+        ffscan_add_entry(ffs_context, offset);
+
+        if (gop_start)
+        {
+            ffs_reserved->gop_base = ffs_reserved->frames;
+            ffs_reserved->stats.gops++;
+        }
+
+        ffindex_entry *entry = &ffs_reserved->entry;
+        entry->offset = offset;
+        entry->size = 0;
+        entry->pts = ffs_reserved->gop_base + temporal_reference;
+        entry->picture_type = picture_type;
+        entry->flags = gop_start ? FFINDEX_GOP_START : 0;
+        ffs_reserved->has_entry = true;
+
+        ffs_reserved->frames++;
+        ffs_reserved->stats.pictures++;
+        ffs_reserved->pending = -1;
+    }
+}
+
+ffscan_error ffscan_feed(ffscan_context *ffs_context, const uint8_t *buf, int64_t size)
+{
+    ffscan_reserved *ffs_reserved = (ffscan_reserved*) ffs_context->reserved;
+    if (!ffs_reserved) return FFSCAN_NOT_INITIALIZED;
+    if (!ffs_context->ffi_context) return FFSCAN_NO_INDEX;
+    if (size <= 0) return FFSCAN_OK;
+
+    int64_t start = av_gettime();
+
+    // codes that begin in the tail of the previous part
+    if (ffs_reserved->carry_size)
+    {
+        uint8_t joint[2 * FFSCAN_LOOKAHEAD];
+        int carry_size = ffs_reserved->carry_size;
+        int joint_size = carry_size + FFMIN(size, FFSCAN_LOOKAHEAD);
+        memcpy(joint, ffs_reserved->carry, carry_size);
+        memcpy(&joint[carry_size], buf, joint_size - carry_size);
+
+        for (int i = 0; i < carry_size && i + 4 <= joint_size; i++)
+        {
+            if (joint[i] != 0 || joint[i + 1] != 0 || joint[i + 2] != 1) continue;
+            ffscan_start_code(ffs_context, &joint[i], joint_size - i, ffs_reserved->offset - carry_size + i);
+        }
+    }
+
+    // codes closer than the lookahead to the end wait for the next part
+    int64_t end = size - (FFSCAN_LOOKAHEAD - 1);
+    int64_t i = 0;
+    while (end > 0 && (i = ffscan_find_start_code(buf, i, end)) < end)
+    {
+        ffscan_start_code(ffs_context, &buf[i], FFMIN(size - i, FFSCAN_LOOKAHEAD), ffs_reserved->offset + i);
+        i += 3;
+    }
+
+    ffs_reserved->carry_size = FFMIN(size, FFSCAN_LOOKAHEAD - 1);
+    memcpy(ffs_reserved->carry, &buf[size - ffs_reserved->carry_size], ffs_reserved->carry_size);
+
+    ffs_reserved->offset += size;
+    ffs_reserved->stats.bytes_scanned += size;
+    ffs_reserved->stats.elapsed += av_gettime() - start;
+
+    return FFSCAN_OK;
+}
+
+ffscan_error ffscan_finish(ffscan_context *ffs_context)
+{
+    ffscan_reserved *ffs_reserved = (ffscan_reserved*) ffs_context->reserved;
+    if (!ffs_reserved) return FFSCAN_NOT_INITIALIZED;
+    if (!ffs_context->ffi_context) return FFSCAN_NO_INDEX;
+
+    int carry_size = ffs_reserved->carry_size;
+    uint8_t *carry = ffs_reserved->carry;
+
+    for (int i = 0; i + 4 <= carry_size; i++)
+    {
+        if (carry[i] != 0 || carry[i + 1] != 0 || carry[i + 2] != 1) continue;
+        ffscan_start_code(ffs_context, &carry[i], carry_size - i, ffs_reserved->offset - carry_size + i);
+    }
+
+    ffs_reserved->carry_size = 0;
+
+    ffscan_add_entry(ffs_context, ffs_reserved->offset);
+
+    return FFSCAN_OK;
+}
+
+ffscan_error ffscan_file(ffscan_context *ffs_context, const char *path)
+{
+    ffscan_reserved *ffs_reserved = (ffscan_reserved*) ffs_context->reserved;
+    if (!ffs_reserved) return FFSCAN_NOT_INITIALIZED;
+    if (!ffs_context->ffi_context) return FFSCAN_NO_INDEX;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "could not open %s: %d: %s\n", path, errno, strerror(errno));
+        return FFSCAN_OPEN_FAILED;
+    }
+
+    struct stat buf;
+    if (fstat(fd, &buf) == -1)
+    {
+        close(fd);
+        return FFSCAN_OPEN_FAILED;
+    }
+
+    if (buf.st_size == 0)
+    {
+        close(fd);
+        return ffscan_finish(ffs_context);
+    }
+
+    ffscan_error error = FFSCAN_OK;
+
+    // map one window at a time, a multi-GB recording does not
+    // fit in the address space of a 32-bit process
+    for (off_t offset = 0; offset < buf.st_size && error == FFSCAN_OK; offset += FFSCAN_WINDOW_SIZE)
+    {
+        size_t size = (size_t) FFMIN((off_t) FFSCAN_WINDOW_SIZE, buf.st_size - offset);
+
+        uint8_t *data = (uint8_t*) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, offset);
+        if (data == MAP_FAILED)
+        {
+            fprintf(stderr, "could not map %s: %d: %s\n", path, errno, strerror(errno));
+            error = FFSCAN_MAP_FAILED;
+            break;
+        }
+
+        // a single front to back pass, let the kernel read ahead
+        madvise(data, size, MADV_SEQUENTIAL);
+
+        error = ffscan_feed(ffs_context, data, size);
+
+        munmap(data, size);
+    }
+
+    close(fd);
+
+    if (error == FFSCAN_OK) error = ffscan_finish(ffs_context);
+
+    return error;
+}
+
+ffscan_error ffscan_get_stats(ffscan_context *ffs_context, ffscan_stats *stats)
+{
+    ffscan_reserved *ffs_reserved = (ffscan_reserved*) ffs_context->reserved;
+    if (!ffs_reserved) return FFSCAN_NOT_INITIALIZED;
+    *stats = ffs_reserved->stats;
+    return FFSCAN_OK;
+}
@@ -0,0 +1,109 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBSCAN_H
+#define FFBBSCAN_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "ffbbindex.h"
+
+typedef enum
+{
+    FFSCAN_OK = 0,
+    FFSCAN_NOT_INITIALIZED,
+    FFSCAN_NO_INDEX,
+    FFSCAN_OPEN_FAILED,
+    FFSCAN_MAP_FAILED
+} ffscan_error;
+
+typedef struct
+{
+    int64_t bytes_scanned;
+    int64_t start_codes;
+    int64_t pictures;
+    int64_t gops;
+
+    /**
+     * Time spent inside ffscan_feed and ffscan_finish, in microseconds.
+     * bytes_scanned / elapsed gives the scan throughput.
+     */
+    int64_t elapsed;
+} ffscan_stats;
+
+typedef struct
+{
+    /**
+     * Receives one entry per picture. The pts is the display
+     * order frame number and time_base is set from the frame rate
+     * in the sequence header.
+     */
+    ffindex_context *ffi_context;
+
+    /**
+     * For internal use. Do not use.
+     */
+    void *reserved;
+} ffscan_context;
+
+/**
+ * Allocate the context with default values.
+ */
+ffscan_context *ffscan_alloc(void);
+
+/**
+ * Reset the context with default values.
+ */
+void ffscan_reset(ffscan_context *ffs_context);
+
+/**
+ * Free the context.
+ */
+ffscan_error ffscan_free(ffscan_context *ffs_context);
+
+/**
+ * Scan the next part of an MPEG-1/2 elementary stream. Parts must be
+ * fed in order and, except for the last one, be at least 16 bytes.
+ */
+ffscan_error ffscan_feed(ffscan_context *ffs_context, const uint8_t *buf, int64_t size);
+
+/**
+ * Flush the last picture into the index once the whole stream has been fed.
+ */
+ffscan_error ffscan_finish(ffscan_context *ffs_context);
+
+/**
+ * Map the file at path in windows and feed all of it.
+ */
+ffscan_error ffscan_file(ffscan_context *ffs_context, const char *path);
+
+ffscan_error ffscan_get_stats(ffscan_context *ffs_context, ffscan_stats *stats);
+
+/**
+ * Return the position of the first 00 00 01 prefix in buf[from, end),
+ * or end if there is none. buf must be readable up to end + 2.
+ * Uses NEON or SSE2 when the target has them.
+ */
+int64_t ffscan_find_start_code(const uint8_t *buf, int64_t from, int64_t end);
+
+/**
+ * Find the first sequence header in buf along with the extensions that
+ * follow it, up to the next GOP or picture header. Returns its size and
+ * sets start to its position, or returns 0 if buf holds no complete one.
+ */
+int ffscan_find_sequence_header(const uint8_t *buf, int size, int *start);
+
+#endif
@@ -0,0 +1,395 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbsched.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__QNX__)
+#include <sys/neutrino.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+/**
+ * The scheduling of a thread before it first applied a role.
+ */
+typedef struct
+{
+    bool saved;
+    // bit n once the thread counted itself in the status of role n
+    uint32_t roles;
+    int policy;
+    struct sched_param param;
+#if defined(__QNX__)
+    unsigned runmask;
+    bool runmask_saved;
+#elif defined(__linux__)
+    cpu_set_t cpu_set;
+    int nice;
+#endif
+} ffsched_thread_state;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static ffsched_policy policies[FFSCHED_ROLE_COUNT];
+static ffsched_status statuses[FFSCHED_ROLE_COUNT];
+
+static __thread ffsched_thread_state thread_state;
+
+// the last ffsched_restore that failed, and how many did
+static ffsched_error restore_error;
+static int restore_error_number;
+static int restore_failures;
+
+static const char *role_names[FFSCHED_ROLE_COUNT] =
+{
+    "capture", "encode", "write", "read", "decode", "present"
+};
+
+#if defined(__linux__)
+static pid_t thread_id()
+{
+    return syscall(SYS_gettid);
+}
+#endif
+
+static void save_thread_state()
+{
+    if (thread_state.saved) return;
+
+    pthread_getschedparam(pthread_self(), &thread_state.policy, &thread_state.param);
+
+#if defined(__linux__)
+    pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &thread_state.cpu_set);
+    errno = 0;
+    thread_state.nice = getpriority(PRIO_PROCESS, thread_id());
+    if (errno) thread_state.nice = 0;
+#endif
+
+    thread_state.saved = true;
+}
+
+static int set_affinity(uint32_t cpu_mask)
+{
+#if defined(__QNX__)
+    unsigned runmask = cpu_mask;
+    if (ThreadCtl(_NTO_TCTL_RUNMASK_GET_AND_SET, &runmask) == -1) return errno;
+
+    if (!thread_state.runmask_saved)
+    {
+        thread_state.runmask = runmask;
+        thread_state.runmask_saved = true;
+    }
+
+    return 0;
+#elif defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+
+    for (int cpu = 0; cpu < 32; cpu++)
+    {
+        if (cpu_mask & (1u << cpu)) CPU_SET(cpu, &cpu_set);
+    }
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set);
+#else
+    return ENOSYS;
+#endif
+}
+
+static uint32_t get_affinity(uint32_t cpu_mask)
+{
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set)) return 0;
+
+    cpu_mask = 0;
+
+    for (int cpu = 0; cpu < 32; cpu++)
+    {
+        if (CPU_ISSET(cpu, &cpu_set)) cpu_mask |= 1u << cpu;
+    }
+#endif
+
+    // QNX only reports the mask it replaces, which is the one set
+    return cpu_mask;
+}
+
+static int set_nice(int nice)
+{
+#if defined(__linux__)
+    return setpriority(PRIO_PROCESS, thread_id(), nice) == -1 ? errno : 0;
+#else
+    return ENOSYS;
+#endif
+}
+
+static int get_nice()
+{
+#if defined(__linux__)
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, thread_id());
+    return errno ? 0 : nice;
+#else
+    return 0;
+#endif
+}
+
+static int set_priority(ffsched_class sched_class, int priority)
+{
+    int policy = SCHED_OTHER;
+    if (sched_class == FFSCHED_FIFO) policy = SCHED_FIFO;
+    else if (sched_class == FFSCHED_RR) policy = SCHED_RR;
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(struct sched_param));
+
+#if !defined(__QNX__)
+    // other threads only have priority 0 outside of QNX
+    if (policy != SCHED_OTHER) param.sched_priority = priority;
+#else
+    param.sched_priority = priority;
+#endif
+
+    return pthread_setschedparam(pthread_self(), policy, &param);
+}
+
+static const char *class_names[] =
+{
+    "inherit", "other", "fifo", "rr"
+};
+
+static const char *policy_name(int policy)
+{
+    switch (policy)
+    {
+        case SCHED_FIFO:
+            return "fifo";
+        case SCHED_RR:
+            return "rr";
+        case SCHED_OTHER:
+            return "other";
+    }
+
+    return "unknown";
+}
+
+static const char *error_name(ffsched_error error)
+{
+    switch (error)
+    {
+        case FFSCHED_AFFINITY_FAILED:
+            return "affinity";
+        case FFSCHED_NICE_FAILED:
+            return "nice";
+        case FFSCHED_PRIORITY_FAILED:
+            return "priority";
+        default:
+            break;
+    }
+
+    return "none";
+}
+
+static void report_role(FILE *file, ffsched_role role, const ffsched_policy *policy,
+        const ffsched_status *status)
+{
+    fprintf(file, "ffsched: %-7s set cpus 0x%x nice %d %s priority %d",
+            role_names[role], policy->cpu_mask, policy->nice, class_names[policy->sched_class], policy->priority);
+
+    if (!status->threads)
+    {
+        fprintf(file, ", not started\n");
+        return;
+    }
+
+    fprintf(file, ", applied by %d thread%s: cpus 0x%x nice %d %s priority %d",
+            status->threads, status->threads == 1 ? "" : "s", status->cpu_mask, status->nice,
+            policy_name(status->policy), status->priority);
+
+    if (status->error != FFSCHED_OK)
+    {
+        fprintf(file, ", %s failed: %s", error_name(status->error), strerror(status->error_number));
+    }
+
+    fprintf(file, "\n");
+}
+
+ffsched_error ffsched_set_policy(ffsched_role role, const ffsched_policy *policy)
+{
+    if (role < 0 || role >= FFSCHED_ROLE_COUNT) return FFSCHED_INVALID_ROLE;
+
+    pthread_mutex_lock(&mutex);
+    policies[role] = *policy;
+    pthread_mutex_unlock(&mutex);
+
+    return FFSCHED_OK;
+}
+
+ffsched_error ffsched_apply(ffsched_role role)
+{
+    if (role < 0 || role >= FFSCHED_ROLE_COUNT) return FFSCHED_INVALID_ROLE;
+
+    pthread_mutex_lock(&mutex);
+    ffsched_policy policy = policies[role];
+    pthread_mutex_unlock(&mutex);
+
+    save_thread_state();
+
+    ffsched_error error = FFSCHED_OK;
+    int error_number = 0;
+
+    if (policy.cpu_mask && (error_number = set_affinity(policy.cpu_mask)))
+    {
+        error = FFSCHED_AFFINITY_FAILED;
+    }
+
+    int result;
+
+    if (policy.nice && (result = set_nice(policy.nice)) && error == FFSCHED_OK)
+    {
+        error = FFSCHED_NICE_FAILED;
+        error_number = result;
+    }
+
+    if (policy.sched_class != FFSCHED_INHERIT && (result = set_priority(policy.sched_class, policy.priority))
+            && error == FFSCHED_OK)
+    {
+        error = FFSCHED_PRIORITY_FAILED;
+        error_number = result;
+    }
+
+    ffsched_status status;
+    memset(&status, 0, sizeof(ffsched_status));
+    status.cpu_mask = get_affinity(policy.cpu_mask);
+    status.nice = get_nice();
+    status.error = error;
+    status.error_number = error_number;
+
+    struct sched_param param;
+    pthread_getschedparam(pthread_self(), &status.policy, &param);
+    status.priority = param.sched_priority;
+
+    // a thread applying a role again, such as an ffpool worker
+    // running its next task, only counts once for it
+    bool counted = thread_state.roles & (1u << role);
+    thread_state.roles |= 1u << role;
+
+    pthread_mutex_lock(&mutex);
+    status.threads = statuses[role].threads + (counted ? 0 : 1);
+    statuses[role] = status;
+    pthread_mutex_unlock(&mutex);
+
+    if (status.threads == 1 && !counted) report_role(stderr, role, &policy, &status);
+
+    return error;
+}
+
+ffsched_error ffsched_restore()
+{
+    if (!thread_state.saved) return FFSCHED_OK;
+
+    ffsched_error error = FFSCHED_OK;
+    int error_number = 0;
+    int result;
+
+#if defined(__QNX__)
+    if (thread_state.runmask_saved && ThreadCtl(_NTO_TCTL_RUNMASK, (void*) (uintptr_t) thread_state.runmask) == -1)
+    {
+        error = FFSCHED_AFFINITY_FAILED;
+        error_number = errno;
+    }
+#elif defined(__linux__)
+    if ((error_number = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &thread_state.cpu_set)))
+    {
+        error = FFSCHED_AFFINITY_FAILED;
+    }
+
+    // lowering the nice level again needs CAP_SYS_NICE, so an
+    // unprivileged worker keeps the level of its last role
+    if (get_nice() != thread_state.nice && (result = set_nice(thread_state.nice)) && error == FFSCHED_OK)
+    {
+        error = FFSCHED_NICE_FAILED;
+        error_number = result;
+    }
+#endif
+
+    if ((result = pthread_setschedparam(pthread_self(), thread_state.policy, &thread_state.param))
+            && error == FFSCHED_OK)
+    {
+        error = FFSCHED_PRIORITY_FAILED;
+        error_number = result;
+    }
+
+    if (error != FFSCHED_OK)
+    {
+        pthread_mutex_lock(&mutex);
+        restore_error = error;
+        restore_error_number = error_number;
+        restore_failures++;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    memset(&thread_state, 0, sizeof(ffsched_thread_state));
+
+    return error;
+}
+
+ffsched_error ffsched_get_status(ffsched_role role, ffsched_status *status)
+{
+    if (role < 0 || role >= FFSCHED_ROLE_COUNT) return FFSCHED_INVALID_ROLE;
+
+    pthread_mutex_lock(&mutex);
+    *status = statuses[role];
+    pthread_mutex_unlock(&mutex);
+
+    return FFSCHED_OK;
+}
+
+void ffsched_report(FILE *file)
+{
+    ffsched_policy policy[FFSCHED_ROLE_COUNT];
+    ffsched_status status[FFSCHED_ROLE_COUNT];
+
+    pthread_mutex_lock(&mutex);
+    memcpy(policy, policies, sizeof(policies));
+    memcpy(status, statuses, sizeof(statuses));
+    ffsched_error error = restore_error;
+    int error_number = restore_error_number;
+    int failures = restore_failures;
+    pthread_mutex_unlock(&mutex);
+
+    for (int role = 0; role < FFSCHED_ROLE_COUNT; role++)
+    {
+        report_role(file, (ffsched_role) role, &policy[role], &status[role]);
+    }
+
+    if (failures)
+    {
+        fprintf(file, "ffsched: restore failed %d time%s, last %s: %s\n", failures, failures == 1 ? "" : "s",
+                error_name(error), strerror(error_number));
+    }
+}
+
+const char *ffsched_role_name(ffsched_role role)
+{
+    if (role < 0 || role >= FFSCHED_ROLE_COUNT) return "unknown";
+    return role_names[role];
+}
@@ -0,0 +1,156 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBSCHED_H
+#define FFBBSCHED_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum
+{
+    FFSCHED_OK = 0,
+    FFSCHED_INVALID_ROLE,
+    FFSCHED_AFFINITY_FAILED,
+    FFSCHED_NICE_FAILED,
+
+    /**
+     * Usually SCHED_FIFO or SCHED_RR without the privilege to use them.
+     */
+    FFSCHED_PRIORITY_FAILED
+} ffsched_error;
+
+typedef enum
+{
+    /**
+     * The camera callback handing frames to ffenc.
+     */
+    FFSCHED_CAPTURE = 0,
+    FFSCHED_ENCODE,
+
+    /**
+     * The ffenc writing thread, which calls the write and packet callbacks.
+     */
+    FFSCHED_WRITE,
+
+    /**
+     * The ffplay worker reading ahead, and threads of the application
+     * feeding the decoder.
+     */
+    FFSCHED_READ,
+
+    /**
+     * The ffdec decoding thread and the offline and thumbnail workers.
+     */
+    FFSCHED_DECODE,
+
+    /**
+     * The ffsink presentation thread and ffplay playback.
+     */
+    FFSCHED_PRESENT,
+
+    FFSCHED_ROLE_COUNT
+} ffsched_role;
+
+typedef enum
+{
+    /**
+     * Keep the policy and priority of the thread.
+     */
+    FFSCHED_INHERIT = 0,
+    FFSCHED_OTHER,
+    FFSCHED_FIFO,
+    FFSCHED_RR
+} ffsched_class;
+
+typedef struct
+{
+    /**
+     * Processors the role may run on, bit n for processor n,
+     * or 0 to keep the affinity of the thread.
+     */
+    uint32_t cpu_mask;
+
+    /**
+     * Nice level of the thread on Linux, or 0 to keep it.
+     */
+    int nice;
+
+    ffsched_class sched_class;
+
+    /**
+     * Priority for FFSCHED_FIFO and FFSCHED_RR. On QNX it
+     * is also the priority of FFSCHED_OTHER.
+     */
+    int priority;
+} ffsched_policy;
+
+typedef struct
+{
+    /**
+     * Threads that applied the policy of the role.
+     */
+    int threads;
+
+    /**
+     * What the last of them read back after applying it.
+     */
+    uint32_t cpu_mask;
+    int nice;
+    int policy;
+    int priority;
+
+    /**
+     * The first part of the policy that could not be applied, and its errno.
+     */
+    ffsched_error error;
+    int error_number;
+} ffsched_status;
+
+/**
+ * Set the policy of a role, applied by threads of the role as they start.
+ * Every role keeps the scheduling of its thread until a policy is set.
+ */
+ffsched_error ffsched_set_policy(ffsched_role role, const ffsched_policy *policy);
+
+/**
+ * Apply the policy of the role to the calling thread. The first thread
+ * of each role writes what was applied to stderr. Every part of the
+ * policy is tried, and the first one that failed is returned.
+ */
+ffsched_error ffsched_apply(ffsched_role role);
+
+/**
+ * Restore the scheduling the calling thread had before ffsched_apply,
+ * so an ffpool worker does not keep the role of its last task. Every
+ * part is tried, and the first one that failed is returned and counted
+ * in ffsched_report. On Linux a thread cannot lower its nice level again
+ * without CAP_SYS_NICE, so an unprivileged worker keeps the nice level of
+ * a role that raised it, and FFSCHED_NICE_FAILED is returned.
+ */
+ffsched_error ffsched_restore(void);
+
+ffsched_error ffsched_get_status(ffsched_role role, ffsched_status *status);
+
+/**
+ * Write the policy set and applied for every role, one line each,
+ * and how often restoring the scheduling of a thread failed.
+ */
+void ffsched_report(FILE *file);
+
+const char *ffsched_role_name(ffsched_role role);
+
+#endif
@@ -0,0 +1,182 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbscreen.h"
+
+typedef struct
+{
+    QByteArray group;
+    QByteArray id;
+    screen_context_t screen_context;
+    screen_window_t screen_window;
+    screen_pixmap_t *screen_pixmaps;
+    int pixmap_count;
+} ffsink_screen;
+
+static ffsink_error screen_open(ffsink_context *ffk_context, void *arg, int width, int height,
+        ffsink_buffer *buffers, int buffer_count)
+{
+    ffsink_screen *screen = (ffsink_screen*) arg;
+
+    // the window outlives a reopen for a new frame size, so the
+    // application keeps the one it was given and its size
+    if (!screen->screen_window)
+    {
+        screen_create_context(&screen->screen_context, SCREEN_APPLICATION_CONTEXT);
+
+        screen_create_window_type(&screen->screen_window, screen->screen_context, SCREEN_CHILD_WINDOW);
+        screen_join_window_group(screen->screen_window, screen->group.constData());
+        screen_set_window_property_cv(screen->screen_window, SCREEN_PROPERTY_ID_STRING,
+                screen->id.length(), screen->id.constData());
+
+        int usage = SCREEN_USAGE_NATIVE;
+        screen_set_window_property_iv(screen->screen_window, SCREEN_PROPERTY_USAGE, &usage);
+
+        int z = -1;
+        screen_set_window_property_iv(screen->screen_window, SCREEN_PROPERTY_ZORDER, &z);
+
+        int pos[] = { 0, 0 };
+        screen_set_window_property_iv(screen->screen_window, SCREEN_PROPERTY_POSITION, pos);
+    }
+
+    screen_context_t screen_context = screen->screen_context;
+    screen_window_t screen_window = screen->screen_window;
+
+    int video_size[] = { width, height };
+    screen_set_window_property_iv(screen_window, SCREEN_PROPERTY_BUFFER_SIZE, video_size);
+    screen_set_window_property_iv(screen_window, SCREEN_PROPERTY_SOURCE_SIZE, video_size);
+
+    // double buffer the window so a post does not wait on the previous one
+    screen_create_window_buffers(screen_window, 2);
+
+    screen_pixmap_t *screen_pixmaps = (screen_pixmap_t*) malloc(buffer_count * sizeof(screen_pixmap_t));
+
+    for (int i = 0; i < buffer_count; i++)
+    {
+        screen_pixmap_t screen_pix;
+        screen_create_pixmap(&screen_pix, screen_context);
+
+        int usage = SCREEN_USAGE_WRITE | SCREEN_USAGE_NATIVE;
+        screen_set_pixmap_property_iv(screen_pix, SCREEN_PROPERTY_USAGE, &usage);
+
+        int format = SCREEN_FORMAT_YUV420;
+        screen_set_pixmap_property_iv(screen_pix, SCREEN_PROPERTY_FORMAT, &format);
+
+        screen_set_pixmap_property_iv(screen_pix, SCREEN_PROPERTY_BUFFER_SIZE, video_size);
+
+        screen_create_pixmap_buffer(screen_pix);
+
+        screen_buffer_t screen_pixel_buffer;
+        screen_get_pixmap_property_pv(screen_pix, SCREEN_PROPERTY_RENDER_BUFFERS, (void**) &screen_pixel_buffer);
+
+        int stride;
+        screen_get_buffer_property_iv(screen_pixel_buffer, SCREEN_PROPERTY_STRIDE, &stride);
+
+        unsigned char *ptr = NULL;
+        screen_get_buffer_property_pv(screen_pixel_buffer, SCREEN_PROPERTY_POINTER, (void**) &ptr);
+
+        ffsink_buffer *buffer = &buffers[i];
+        buffer->data[0] = ptr;
+        buffer->data[1] = buffer->data[0] + (height * stride);
+        buffer->data[2] = buffer->data[1] + (height * stride) / 4;
+        buffer->linesize[0] = stride;
+        buffer->linesize[1] = stride / 2;
+        buffer->linesize[2] = stride / 2;
+        buffer->opaque = screen_pixel_buffer;
+
+        screen_pixmaps[i] = screen_pix;
+    }
+
+    screen->screen_pixmaps = screen_pixmaps;
+    screen->pixmap_count = buffer_count;
+
+    return FFSINK_OK;
+}
+
+static ffsink_error screen_present(ffsink_context *ffk_context, void *arg, ffsink_buffer *buffer)
+{
+    ffsink_screen *screen = (ffsink_screen*) arg;
+
+    screen_buffer_t screen_pixel_buffer = (screen_buffer_t) buffer->opaque;
+
+    screen_buffer_t screen_buffer[2];
+    screen_get_window_property_pv(screen->screen_window, SCREEN_PROPERTY_RENDER_BUFFERS, (void**) screen_buffer);
+
+    int attribs[] = { SCREEN_BLIT_SOURCE_WIDTH, buffer->width, SCREEN_BLIT_SOURCE_HEIGHT, buffer->height, SCREEN_BLIT_END };
+    screen_blit(screen->screen_context, screen_buffer[0], screen_pixel_buffer, attribs);
+
+    int dirty_rects[] = { 0, 0, buffer->width, buffer->height };
+    screen_post_window(screen->screen_window, screen_buffer[0], 1, dirty_rects, 0);
+
+    return FFSINK_OK;
+}
+
+static void screen_close(ffsink_context *ffk_context, void *arg, ffsink_buffer *buffers, int buffer_count)
+{
+    ffsink_screen *screen = (ffsink_screen*) arg;
+
+    for (int i = 0; i < screen->pixmap_count; i++)
+    {
+        screen_destroy_pixmap(screen->screen_pixmaps[i]);
+    }
+
+    free(screen->screen_pixmaps);
+    screen->screen_pixmaps = NULL;
+    screen->pixmap_count = 0;
+
+    screen_destroy_window_buffers(screen->screen_window);
+}
+
+static void screen_release(void *arg)
+{
+    ffsink_screen *screen = (ffsink_screen*) arg;
+
+    if (screen->screen_window) screen_destroy_window(screen->screen_window);
+    if (screen->screen_context) screen_destroy_context(screen->screen_context);
+
+    delete screen;
+}
+
+static const ffsink_interface screen_interface = {
+        screen_open, screen_present, screen_close, screen_release };
+
+ffsink_error ffsink_use_screen(ffsink_context *ffk_context, QString group, QString id)
+{
+    ffsink_screen *screen = new ffsink_screen();
+    screen->group = group.toAscii();
+    screen->id = id.toAscii();
+
+    ffsink_error error = ffsink_set_interface(ffk_context, &screen_interface, screen);
+    if (error != FFSINK_OK) delete screen;
+
+    return error;
+}
+
+ffsink_error ffsink_get_screen_window(ffsink_context *ffk_context, screen_window_t *window)
+{
+    const ffsink_interface *interface;
+    void *arg;
+
+    ffsink_error error = ffsink_get_interface(ffk_context, &interface, &arg);
+    if (error != FFSINK_OK) return error;
+    if (interface != &screen_interface) return FFSINK_NO_INTERFACE;
+
+    ffsink_screen *screen = (ffsink_screen*) arg;
+    if (!screen->screen_window) return FFSINK_NOT_OPEN;
+
+    *window = screen->screen_window;
+
+    return FFSINK_OK;
+}
@@ -0,0 +1,37 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBSCREEN_H
+#define FFBBSCREEN_H
+
+#include "ffbbsink.h"
+
+#include <screen/screen.h>
+#include <QString>
+
+/**
+ * Present frames in a child window of the given window group. Each
+ * buffer of the swap chain is a pixmap that the presentation thread
+ * blits into the window, so decoding the next frame never waits on it.
+ */
+ffsink_error ffsink_use_screen(ffsink_context *ffk_context, QString group, QString id);
+
+/**
+ * The window created when the sink was first opened. It is kept when
+ * a frame of a new size reopens the sink, until the sink is freed.
+ */
+ffsink_error ffsink_get_screen_window(ffsink_context *ffk_context, screen_window_t *window);
+
+#endif
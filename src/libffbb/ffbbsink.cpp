@@ -0,0 +1,555 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbsink.h"
+#include "ffbbcopy.h"
+#include "ffbbpool.h"
+#include "ffbbsched.h"
+#include "ffbbtrace.h"
+
+extern "C"
+{
+#include <libavutil/adler32.h>
+}
+
+#include <pthread.h>
+
+typedef struct
+{
+    const ffsink_interface *interface;
+    void *interface_arg;
+    bool open;
+    bool running;
+    int width;
+    int height;
+    ffsink_buffer *buffers;
+    bool *allocated;
+    int buffer_count;
+    // buffers are used round robin and presented in order, so
+    // buffer n % buffer_count is free once n - released < buffer_count
+    int64_t acquired;
+    int64_t queued;
+    int64_t released;
+    pthread_mutex_t mutex;
+    pthread_cond_t free_cond;
+    pthread_cond_t queued_cond;
+    ffpool_task *task;
+    ffsink_stats stats;
+} ffsink_reserved;
+
+typedef struct
+{
+    char *path;
+    FILE *file;
+    // set once the sink first opened, the file is kept until the interface is released
+    bool opened;
+    int width;
+    int height;
+} ffsink_file;
+
+void* presentation_thread(void* arg);
+
+ffsink_context *ffsink_alloc()
+{
+    ffsink_context *ffk_context = (ffsink_context*) malloc(sizeof(ffsink_context));
+    memset(ffk_context, 0, sizeof(ffsink_context));
+
+    ffsink_reset(ffk_context);
+
+    return ffk_context;
+}
+
+static void ffsink_release_interface(ffsink_reserved *ffk_reserved)
+{
+    const ffsink_interface *interface = ffk_reserved->interface;
+    if (interface && interface->release) interface->release(ffk_reserved->interface_arg);
+
+    ffk_reserved->interface = NULL;
+    ffk_reserved->interface_arg = NULL;
+}
+
+void ffsink_reset(ffsink_context *ffk_context)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+
+    if (ffk_reserved)
+    {
+        ffsink_close(ffk_context);
+        ffsink_release_interface(ffk_reserved);
+    }
+
+    if (!ffk_reserved) ffk_reserved = (ffsink_reserved*) malloc(sizeof(ffsink_reserved));
+    memset(ffk_reserved, 0, sizeof(ffsink_reserved));
+
+    memset(ffk_context, 0, sizeof(ffsink_context));
+    ffk_context->buffer_count = 3;
+    ffk_context->frame_rate = (AVRational) { 30, 1 };
+    ffk_context->codec_id = CODEC_ID_MPEG2VIDEO;
+    ffk_context->reserved = ffk_reserved;
+}
+
+ffsink_error ffsink_free(ffsink_context *ffk_context)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    if (!ffk_reserved) return FFSINK_NOT_INITIALIZED;
+
+    ffsink_close(ffk_context);
+    ffsink_release_interface(ffk_reserved);
+
+    free(ffk_reserved);
+    ffk_context->reserved = NULL;
+
+    free(ffk_context);
+
+    return FFSINK_OK;
+}
+
+ffsink_error ffsink_set_interface(ffsink_context *ffk_context, const ffsink_interface *interface, void *arg)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    if (!ffk_reserved) return FFSINK_NOT_INITIALIZED;
+    if (ffk_reserved->open) return FFSINK_ALREADY_OPEN;
+
+    ffsink_release_interface(ffk_reserved);
+
+    ffk_reserved->interface = interface;
+    ffk_reserved->interface_arg = arg;
+
+    return FFSINK_OK;
+}
+
+ffsink_error ffsink_get_interface(ffsink_context *ffk_context, const ffsink_interface **interface, void **arg)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    if (!ffk_reserved) return FFSINK_NOT_INITIALIZED;
+    if (!ffk_reserved->interface) return FFSINK_NO_INTERFACE;
+
+    *interface = ffk_reserved->interface;
+    *arg = ffk_reserved->interface_arg;
+
+    return FFSINK_OK;
+}
+
+ffsink_error ffsink_open(ffsink_context *ffk_context, int width, int height)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    if (!ffk_reserved) return FFSINK_NOT_INITIALIZED;
+    if (ffk_reserved->open) return FFSINK_ALREADY_OPEN;
+
+    const ffsink_interface *interface = ffk_reserved->interface;
+    if (!interface) return FFSINK_NO_INTERFACE;
+
+    int buffer_count = FFMAX(1, ffk_context->buffer_count);
+
+    ffsink_buffer *buffers = (ffsink_buffer*) malloc(buffer_count * sizeof(ffsink_buffer));
+    memset(buffers, 0, buffer_count * sizeof(ffsink_buffer));
+
+    if (interface->open)
+    {
+        ffsink_error error = interface->open(ffk_context, ffk_reserved->interface_arg,
+                width, height, buffers, buffer_count);
+
+        if (error != FFSINK_OK)
+        {
+            free(buffers);
+            return error;
+        }
+    }
+
+    bool *allocated = (bool*) malloc(buffer_count * sizeof(bool));
+
+    for (int i = 0; i < buffer_count; i++)
+    {
+        allocated[i] = !buffers[i].data[0];
+
+        if (allocated[i])
+        {
+            // the interface has no memory of its own for this buffer
+            AVPicture picture;
+            avpicture_alloc(&picture, PIX_FMT_YUV420P, width, height);
+
+            for (int plane = 0; plane < 3; plane++)
+            {
+                buffers[i].data[plane] = picture.data[plane];
+                buffers[i].linesize[plane] = picture.linesize[plane];
+            }
+        }
+
+        buffers[i].width = width;
+        buffers[i].height = height;
+    }
+
+    ffk_reserved->width = width;
+    ffk_reserved->height = height;
+    ffk_reserved->buffers = buffers;
+    ffk_reserved->allocated = allocated;
+    ffk_reserved->buffer_count = buffer_count;
+
+    // frames keep their numbers over a reopen, every one queued was presented by the close
+    ffk_reserved->acquired = ffk_reserved->released;
+    ffk_reserved->queued = ffk_reserved->released;
+
+    pthread_mutex_init(&ffk_reserved->mutex, 0);
+    pthread_cond_init(&ffk_reserved->free_cond, 0);
+    pthread_cond_init(&ffk_reserved->queued_cond, 0);
+
+    ffk_reserved->open = true;
+    ffk_reserved->running = true;
+
+    if (ffpool_submit(&presentation_thread, ffk_context, &ffk_reserved->task) != FFPOOL_OK)
+    {
+        // nothing was queued, so closing only hands back the buffers
+        ffk_reserved->running = false;
+        ffsink_close(ffk_context);
+        return FFSINK_THREAD_FAILED;
+    }
+
+    return FFSINK_OK;
+}
+
+ffsink_error ffsink_present(ffsink_context *ffk_context, const AVFrame *frame)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    if (!ffk_reserved) return FFSINK_NOT_INITIALIZED;
+
+    if (!ffk_reserved->open)
+    {
+        ffsink_error error = ffsink_open(ffk_context, frame->width, frame->height);
+        if (error != FFSINK_OK) return error;
+    }
+
+    if (frame->width != ffk_reserved->width || frame->height != ffk_reserved->height)
+    {
+        // present the frames queued at the old size, then swap the chain for one of the new size
+        ffsink_close(ffk_context);
+
+        ffsink_error error = ffsink_open(ffk_context, frame->width, frame->height);
+        if (error != FFSINK_OK) return error;
+    }
+
+    int width = ffk_reserved->width;
+    int height = ffk_reserved->height;
+
+    pthread_mutex_lock(&ffk_reserved->mutex);
+
+    int64_t n = ffk_reserved->acquired;
+
+    if (n - ffk_reserved->released >= ffk_reserved->buffer_count)
+    {
+        int64_t wait_start = av_gettime();
+        FFTRACE_BEGIN("ffsink_wait", n);
+
+        while (n - ffk_reserved->released >= ffk_reserved->buffer_count)
+        {
+            pthread_cond_wait(&ffk_reserved->free_cond, &ffk_reserved->mutex);
+        }
+
+        FFTRACE_END("ffsink_wait", n);
+        ffk_reserved->stats.wait_time += av_gettime() - wait_start;
+    }
+
+    ffk_reserved->acquired++;
+
+    pthread_mutex_unlock(&ffk_reserved->mutex);
+
+    ffsink_buffer *buffer = &ffk_reserved->buffers[n % ffk_reserved->buffer_count];
+    buffer->frame_number = n;
+
+    ffcopy_plane(buffer->data[0], buffer->linesize[0], frame->data[0], frame->linesize[0], width, height);
+    ffcopy_plane(buffer->data[1], buffer->linesize[1], frame->data[1], frame->linesize[1], (width + 1) / 2, (height + 1) / 2);
+    ffcopy_plane(buffer->data[2], buffer->linesize[2], frame->data[2], frame->linesize[2], (width + 1) / 2, (height + 1) / 2);
+
+    pthread_mutex_lock(&ffk_reserved->mutex);
+    ffk_reserved->queued++;
+    pthread_cond_signal(&ffk_reserved->queued_cond);
+    pthread_mutex_unlock(&ffk_reserved->mutex);
+
+    return FFSINK_OK;
+}
+
+void* presentation_thread(void* arg)
+{
+    ffsink_context *ffk_context = (ffsink_context*) arg;
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    const ffsink_interface *interface = ffk_reserved->interface;
+
+    FFTRACE_THREAD_NAME("ffsink");
+    ffsched_apply(FFSCHED_PRESENT);
+
+    pthread_mutex_lock(&ffk_reserved->mutex);
+
+    while (true)
+    {
+        if (ffk_reserved->released == ffk_reserved->queued)
+        {
+            // drain the queue before stopping
+            if (!ffk_reserved->running) break;
+
+            pthread_cond_wait(&ffk_reserved->queued_cond, &ffk_reserved->mutex);
+            continue;
+        }
+
+        ffsink_buffer *buffer = &ffk_reserved->buffers[ffk_reserved->released % ffk_reserved->buffer_count];
+
+        pthread_mutex_unlock(&ffk_reserved->mutex);
+
+        int64_t present_start = av_gettime();
+        FFTRACE_BEGIN("present", buffer->frame_number);
+
+        if (interface->present) interface->present(ffk_context, ffk_reserved->interface_arg, buffer);
+
+        FFTRACE_END("present", buffer->frame_number);
+        int64_t present_time = av_gettime() - present_start;
+
+        pthread_mutex_lock(&ffk_reserved->mutex);
+
+        ffk_reserved->stats.present_time += present_time;
+        ffk_reserved->stats.frames_presented++;
+        ffk_reserved->released++;
+        pthread_cond_signal(&ffk_reserved->free_cond);
+    }
+
+    pthread_mutex_unlock(&ffk_reserved->mutex);
+
+    return 0;
+}
+
+ffsink_error ffsink_close(ffsink_context *ffk_context)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    if (!ffk_reserved) return FFSINK_NOT_INITIALIZED;
+    if (!ffk_reserved->open) return FFSINK_NOT_OPEN;
+
+    pthread_mutex_lock(&ffk_reserved->mutex);
+    ffk_reserved->running = false;
+    pthread_cond_signal(&ffk_reserved->queued_cond);
+    pthread_mutex_unlock(&ffk_reserved->mutex);
+
+    if (ffk_reserved->task) ffpool_join(ffk_reserved->task, NULL);
+    ffk_reserved->task = NULL;
+
+    const ffsink_interface *interface = ffk_reserved->interface;
+    if (interface->close) interface->close(ffk_context, ffk_reserved->interface_arg,
+            ffk_reserved->buffers, ffk_reserved->buffer_count);
+
+    for (int i = 0; i < ffk_reserved->buffer_count; i++)
+    {
+        if (!ffk_reserved->allocated[i]) continue;
+
+        // avpicture_alloc made all the planes one allocation
+        AVPicture picture;
+        memset(&picture, 0, sizeof(AVPicture));
+        picture.data[0] = ffk_reserved->buffers[i].data[0];
+        avpicture_free(&picture);
+    }
+
+    free(ffk_reserved->buffers);
+    ffk_reserved->buffers = NULL;
+
+    free(ffk_reserved->allocated);
+    ffk_reserved->allocated = NULL;
+
+    pthread_mutex_destroy(&ffk_reserved->mutex);
+    pthread_cond_destroy(&ffk_reserved->free_cond);
+    pthread_cond_destroy(&ffk_reserved->queued_cond);
+
+    ffk_reserved->open = false;
+
+    return FFSINK_OK;
+}
+
+ffsink_error ffsink_get_stats(ffsink_context *ffk_context, ffsink_stats *stats)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    if (!ffk_reserved) return FFSINK_NOT_INITIALIZED;
+
+    if (ffk_reserved->open) pthread_mutex_lock(&ffk_reserved->mutex);
+    *stats = ffk_reserved->stats;
+    stats->queued = (int) (ffk_reserved->queued - ffk_reserved->released);
+    if (ffk_reserved->open) pthread_mutex_unlock(&ffk_reserved->mutex);
+
+    return FFSINK_OK;
+}
+
+static const ffsink_interface null_interface = { NULL, NULL, NULL, NULL };
+
+ffsink_error ffsink_use_null(ffsink_context *ffk_context)
+{
+    return ffsink_set_interface(ffk_context, &null_interface, NULL);
+}
+
+static ffsink_file *ffsink_file_alloc(const char *path)
+{
+    ffsink_file *file = (ffsink_file*) malloc(sizeof(ffsink_file));
+    memset(file, 0, sizeof(ffsink_file));
+    if (path) file->path = strdup(path);
+    return file;
+}
+
+static void ffsink_file_release(void *arg)
+{
+    ffsink_file *file = (ffsink_file*) arg;
+    if (file->file) fclose(file->file);
+    free(file->path);
+    free(file);
+}
+
+static ffsink_error ffsink_file_open(ffsink_file *file)
+{
+    if (file->opened || !file->path) return FFSINK_OK;
+
+    file->file = fopen(file->path, "wb");
+
+    if (!file->file)
+    {
+        fprintf(stderr, "could not open %s: %d: %s\n", file->path, errno, strerror(errno));
+        return FFSINK_OPEN_FAILED;
+    }
+
+    return FFSINK_OK;
+}
+
+static void ffsink_file_close(ffsink_context *ffk_context, void *arg, ffsink_buffer *buffers, int buffer_count)
+{
+    ffsink_file *file = (ffsink_file*) arg;
+    if (file->file) fflush(file->file);
+}
+
+static ffsink_error checksum_open(ffsink_context *ffk_context, void *arg, int width, int height,
+        ffsink_buffer *buffers, int buffer_count)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    ffsink_file *file = (ffsink_file*) arg;
+
+    // the running checksum carries on over a new frame size
+    if (file->opened) return FFSINK_OK;
+
+    ffsink_error error = ffsink_file_open(file);
+    if (error != FFSINK_OK) return error;
+
+    ffk_reserved->stats.checksum = 1;
+    file->opened = true;
+
+    return FFSINK_OK;
+}
+
+static ffsink_error checksum_present(ffsink_context *ffk_context, void *arg, ffsink_buffer *buffer)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    ffsink_file *file = (ffsink_file*) arg;
+
+    unsigned long checksum = 1;
+    unsigned long running = ffk_reserved->stats.checksum;
+
+    for (int plane = 0; plane < 3; plane++)
+    {
+        int width = plane ? (buffer->width + 1) / 2 : buffer->width;
+        int height = plane ? (buffer->height + 1) / 2 : buffer->height;
+
+        for (int i = 0; i < height; i++)
+        {
+            const uint8_t *row = &buffer->data[plane][i * buffer->linesize[plane]];
+            checksum = av_adler32_update(checksum, row, width);
+            running = av_adler32_update(running, row, width);
+        }
+    }
+
+    // only the presentation thread writes it
+    ffk_reserved->stats.checksum = running;
+
+    if (file->file) fprintf(file->file, "%lld, 0x%08lx\n", (long long) buffer->frame_number, checksum);
+
+    return FFSINK_OK;
+}
+
+static const ffsink_interface checksum_interface = {
+        checksum_open, checksum_present, ffsink_file_close, ffsink_file_release };
+
+ffsink_error ffsink_use_checksum(ffsink_context *ffk_context, const char *path)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    if (!ffk_reserved) return FFSINK_NOT_INITIALIZED;
+    if (ffk_reserved->open) return FFSINK_ALREADY_OPEN;
+
+    return ffsink_set_interface(ffk_context, &checksum_interface, ffsink_file_alloc(path));
+}
+
+static ffsink_error y4m_open(ffsink_context *ffk_context, void *arg, int width, int height,
+        ffsink_buffer *buffers, int buffer_count)
+{
+    ffsink_file *file = (ffsink_file*) arg;
+
+    // a YUV4MPEG2 stream has one frame size
+    if (file->opened) return width == file->width && height == file->height ? FFSINK_OK : FFSINK_SIZE_CHANGED;
+
+    ffsink_error error = ffsink_file_open(file);
+    if (error != FFSINK_OK) return error;
+
+    file->opened = true;
+    file->width = width;
+    file->height = height;
+
+    // MPEG-1 and JPEG site chroma between the luma samples,
+    // MPEG-2 and later codecs site it with the left column
+    const char *chroma;
+    switch (ffk_context->codec_id)
+    {
+        case CODEC_ID_MPEG1VIDEO:
+        case CODEC_ID_MJPEG:
+            chroma = "420jpeg";
+            break;
+        default:
+            chroma = "420mpeg2";
+            break;
+    }
+
+    AVRational frame_rate = ffk_context->frame_rate;
+    fprintf(file->file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C%s\n", width, height, frame_rate.num, frame_rate.den, chroma);
+
+    return FFSINK_OK;
+}
+
+static ffsink_error y4m_present(ffsink_context *ffk_context, void *arg, ffsink_buffer *buffer)
+{
+    ffsink_file *file = (ffsink_file*) arg;
+
+    bool written = fputs("FRAME\n", file->file) >= 0;
+
+    for (int plane = 0; plane < 3 && written; plane++)
+    {
+        int width = plane ? (buffer->width + 1) / 2 : buffer->width;
+        int height = plane ? (buffer->height + 1) / 2 : buffer->height;
+
+        for (int i = 0; i < height && written; i++)
+        {
+            written = fwrite(&buffer->data[plane][i * buffer->linesize[plane]], 1, width, file->file) == (size_t) width;
+        }
+    }
+
+    return written ? FFSINK_OK : FFSINK_WRITE_FAILED;
+}
+
+static const ffsink_interface y4m_interface = {
+        y4m_open, y4m_present, ffsink_file_close, ffsink_file_release };
+
+ffsink_error ffsink_use_y4m(ffsink_context *ffk_context, const char *path)
+{
+    ffsink_reserved *ffk_reserved = (ffsink_reserved*) ffk_context->reserved;
+    if (!ffk_reserved) return FFSINK_NOT_INITIALIZED;
+    if (ffk_reserved->open) return FFSINK_ALREADY_OPEN;
+    if (!path) return FFSINK_OPEN_FAILED;
+
+    return ffsink_set_interface(ffk_context, &y4m_interface, ffsink_file_alloc(path));
+}
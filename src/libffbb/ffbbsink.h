@@ -0,0 +1,207 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBSINK_H
+#define FFBBSINK_H
+
+// include math.h otherwise it will get included
+// by avformat.h and cause duplicate definition
+// errors because of C vs C++ functions
+#include <math.h>
+
+extern "C"
+{
+#define UINT64_C uint64_t
+#define INT64_C int64_t
+#include <libavformat/avformat.h>
+}
+
+#include <sys/types.h>
+
+typedef enum
+{
+    FFSINK_OK = 0,
+    FFSINK_NOT_INITIALIZED,
+    FFSINK_NO_INTERFACE,
+    FFSINK_ALREADY_OPEN,
+    FFSINK_NOT_OPEN,
+    FFSINK_OPEN_FAILED,
+    FFSINK_WRITE_FAILED,
+    FFSINK_SIZE_CHANGED,
+    FFSINK_THREAD_FAILED
+} ffsink_error;
+
+/**
+ * One buffer of the swap chain, holding a YUV420P picture.
+ */
+typedef struct
+{
+    uint8_t *data[3];
+    int linesize[3];
+    int width;
+    int height;
+
+    /**
+     * Counts the frames passed to ffsink_present, starting at 0.
+     */
+    int64_t frame_number;
+
+    /**
+     * Free for the interface to use.
+     */
+    void *opaque;
+} ffsink_buffer;
+
+typedef struct ffsink_context ffsink_context;
+
+/**
+ * The presentation side of a sink. All calls are made with the
+ * arg given to ffsink_set_interface.
+ */
+typedef struct
+{
+    /**
+     * Prepare to present width x height frames. The interface may point
+     * the buffers at memory of its own, such as pixmaps; any buffer left
+     * without data is allocated by the sink.
+     */
+    ffsink_error (*open)(ffsink_context *ffk_context, void *arg, int width, int height,
+            ffsink_buffer *buffers, int buffer_count);
+
+    /**
+     * Called on the presentation thread with each filled buffer, in order.
+     */
+    ffsink_error (*present)(ffsink_context *ffk_context, void *arg, ffsink_buffer *buffer);
+
+    /**
+     * Called once every queued buffer was presented.
+     */
+    void (*close)(ffsink_context *ffk_context, void *arg, ffsink_buffer *buffers, int buffer_count);
+
+    /**
+     * Release arg when the interface is replaced or the context freed. May be NULL.
+     */
+    void (*release)(void *arg);
+} ffsink_interface;
+
+typedef struct
+{
+    int64_t frames_presented;
+
+    /**
+     * Frames queued and waiting for presentation.
+     */
+    int queued;
+
+    /**
+     * Microseconds ffsink_present waited for a free buffer.
+     */
+    int64_t wait_time;
+
+    /**
+     * Microseconds spent in the interface present call.
+     */
+    int64_t present_time;
+
+    /**
+     * Running Adler-32 of every frame presented, for the checksum sink.
+     */
+    uint32_t checksum;
+} ffsink_stats;
+
+struct ffsink_context
+{
+    /**
+     * Buffers in the swap chain. ffsink_present only waits once all
+     * of them are queued for presentation.
+     */
+    int buffer_count;
+
+    /**
+     * Frame rate written by sinks that record one.
+     */
+    AVRational frame_rate;
+
+    /**
+     * Codec the frames were decoded from. Sinks that record the
+     * chroma siting, such as YUV4MPEG2, pick it from this.
+     */
+    enum CodecID codec_id;
+
+    /**
+     * For internal use. Do not use.
+     */
+    void *reserved;
+};
+
+/**
+ * Allocate the context with default values.
+ */
+ffsink_context *ffsink_alloc(void);
+
+/**
+ * Reset the context with default values.
+ * This closes the sink if open and releases the interface.
+ */
+void ffsink_reset(ffsink_context *ffk_context);
+
+/**
+ * Free the context.
+ */
+ffsink_error ffsink_free(ffsink_context *ffk_context);
+
+ffsink_error ffsink_set_interface(ffsink_context *ffk_context, const ffsink_interface *interface, void *arg);
+
+ffsink_error ffsink_get_interface(ffsink_context *ffk_context, const ffsink_interface **interface, void **arg);
+
+/**
+ * Present nothing. Measures the cost of decoding and copying alone.
+ */
+ffsink_error ffsink_use_null(ffsink_context *ffk_context);
+
+/**
+ * Keep a running checksum of the frames presented and, if path is
+ * not NULL, write one "frame_number, adler32" line per frame to it.
+ */
+ffsink_error ffsink_use_checksum(ffsink_context *ffk_context, const char *path);
+
+/**
+ * Write the frames presented to a YUV4MPEG2 file at path. The stream
+ * has the size of the first frame, and frames of another size are
+ * refused with FFSINK_SIZE_CHANGED.
+ */
+ffsink_error ffsink_use_y4m(ffsink_context *ffk_context, const char *path);
+
+/**
+ * Create the swap chain and start the presentation thread. Opening is
+ * optional; ffsink_present opens the sink with the size of the first frame.
+ */
+ffsink_error ffsink_open(ffsink_context *ffk_context, int width, int height);
+
+/**
+ * Copy a YUV420P frame into the next free buffer and queue it. A frame
+ * of another size than the sink was opened with closes it, which presents
+ * the frames still queued, and reopens it at the new size.
+ */
+ffsink_error ffsink_present(ffsink_context *ffk_context, const AVFrame *frame);
+
+/**
+ * Present what is still queued, then stop the presentation thread.
+ */
+ffsink_error ffsink_close(ffsink_context *ffk_context);
+
+ffsink_error ffsink_get_stats(ffsink_context *ffk_context, ffsink_stats *stats);
+
+#endif
@@ -0,0 +1,133 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbstats.h"
+
+#include <string.h>
+
+#define SECOND 1000000
+
+void ffstats_write_begin(volatile uint32_t *sequence)
+{
+    *sequence = *sequence + 1;
+    __sync_synchronize();
+}
+
+void ffstats_write_end(volatile uint32_t *sequence)
+{
+    __sync_synchronize();
+    *sequence = *sequence + 1;
+}
+
+void ffstats_read(const volatile uint32_t *sequence, const void *src, void *dst, size_t size)
+{
+    uint32_t before;
+    uint32_t after;
+
+    do
+    {
+        before = *sequence;
+        __sync_synchronize();
+        memcpy(dst, src, size);
+        __sync_synchronize();
+        after = *sequence;
+    }
+    while ((before & 1) || before != after);
+}
+
+void ffstats_update_peak(volatile int *peak, int value)
+{
+    int current = *peak;
+    while (value > current)
+    {
+        int previous = __sync_val_compare_and_swap(peak, current, value);
+        if (previous == current) break;
+        current = previous;
+    }
+}
+
+static int bucket_index(int64_t time)
+{
+    if (time < 4) return time < 0 ? 0 : (int) time;
+
+    int octave = 63 - __builtin_clzll((uint64_t) time);
+    int index = 4 * (octave - 1) + (int) ((time >> (octave - 2)) & 3);
+
+    return index < FFSTATS_BUCKETS ? index : FFSTATS_BUCKETS - 1;
+}
+
+static int64_t bucket_upper_bound(int index)
+{
+    if (index < 4) return index;
+
+    int octave = index / 4 + 1;
+    int64_t width = (int64_t) 1 << (octave - 2);
+    return (4 + index % 4) * width + width - 1;
+}
+
+void ffstats_histogram_add(ffstats_histogram *histogram, int64_t time)
+{
+    histogram->counts[bucket_index(time)]++;
+    if (time > histogram->max) histogram->max = time;
+}
+
+static int64_t percentile(const ffstats_histogram *histogram, int64_t count, int percent)
+{
+    // the smallest time at least percent of the samples are at or under
+    int64_t rank = (count * percent + 99) / 100;
+    int64_t seen = 0;
+
+    for (int i = 0; i < FFSTATS_BUCKETS; i++)
+    {
+        seen += histogram->counts[i];
+        if (seen < rank) continue;
+
+        int64_t time = bucket_upper_bound(i);
+        return time < histogram->max ? time : histogram->max;
+    }
+
+    return histogram->max;
+}
+
+void ffstats_histogram_times(const ffstats_histogram *histogram, ffstats_times *times)
+{
+    memset(times, 0, sizeof(ffstats_times));
+
+    for (int i = 0; i < FFSTATS_BUCKETS; i++)
+    {
+        times->count += histogram->counts[i];
+    }
+
+    if (!times->count) return;
+
+    times->p50 = percentile(histogram, times->count, 50);
+    times->p90 = percentile(histogram, times->count, 90);
+    times->p99 = percentile(histogram, times->count, 99);
+    times->max = histogram->max;
+}
+
+void ffstats_rate_add(ffstats_rate *rate, int64_t bytes, int64_t now)
+{
+    if (!rate->window_start) rate->window_start = now;
+
+    rate->window_bytes += bytes;
+
+    int64_t elapsed = now - rate->window_start;
+    if (elapsed < SECOND) return;
+
+    rate->bitrate = rate->window_bytes * 8 * SECOND / elapsed;
+    rate->window_start = now;
+    rate->window_bytes = 0;
+}
@@ -0,0 +1,86 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBSTATS_H
+#define FFBBSTATS_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/**
+ * Histogram buckets. Times below 4 us have a bucket each, and every
+ * doubling above that is split into 4, up to about 2 seconds.
+ */
+#define FFSTATS_BUCKETS 80
+
+/**
+ * Percentiles of the times recorded, in microseconds. They are the upper
+ * bound of the histogram bucket the percentile falls in, so they are at
+ * most a quarter over the exact value.
+ */
+typedef struct
+{
+    int64_t count;
+    int64_t p50;
+    int64_t p90;
+    int64_t p99;
+    int64_t max;
+} ffstats_times;
+
+typedef struct
+{
+    int64_t counts[FFSTATS_BUCKETS];
+    int64_t max;
+} ffstats_histogram;
+
+typedef struct
+{
+    int64_t window_start;
+    int64_t window_bytes;
+
+    /**
+     * Bits per second over the last complete window of a second.
+     */
+    int64_t bitrate;
+} ffstats_rate;
+
+/**
+ * Statistics are written by the thread that owns them and read by any
+ * other one with a sequence lock: the writer makes the sequence odd while
+ * it updates, and a reader copies the block and retries if the sequence
+ * was odd or changed meanwhile. Neither side ever waits on the other,
+ * but each block must have a single writer.
+ */
+void ffstats_write_begin(volatile uint32_t *sequence);
+
+void ffstats_write_end(volatile uint32_t *sequence);
+
+void ffstats_read(const volatile uint32_t *sequence, const void *src, void *dst, size_t size);
+
+/**
+ * Raise peak to value if it is higher, from any thread.
+ */
+void ffstats_update_peak(volatile int *peak, int value);
+
+void ffstats_histogram_add(ffstats_histogram *histogram, int64_t time);
+
+void ffstats_histogram_times(const ffstats_histogram *histogram, ffstats_times *times);
+
+/**
+ * Count bytes produced or consumed at now, in microseconds.
+ */
+void ffstats_rate_add(ffstats_rate *rate, int64_t bytes, int64_t now);
+
+#endif
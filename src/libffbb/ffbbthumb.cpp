@@ -0,0 +1,755 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include "ffbbthumb.h"
+#include "ffbbindex.h"
+#include "ffbbpool.h"
+#include "ffbbscan.h"
+#include "ffbbsched.h"
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define SEQUENCE_HEADER_CODE 0xB3
+#define SEQUENCE_END_CODE 0xB7
+
+// the sequence header is searched for in the start of the recording
+#define SEQUENCE_HEADER_SEARCH_SIZE (64 * 1024)
+
+typedef struct
+{
+    char *path;
+    char *index_path;
+    char *output_path;
+} ffthumb_file;
+
+typedef struct
+{
+    void (*done_callback)(ffthumb_context *fft_context, const char *path, ffthumb_error error, void *arg);
+    void *done_callback_arg;
+    ffthumb_file *files;
+    int file_count;
+    int file_capacity;
+    pthread_mutex_t mutex;
+    int next_file;
+} ffthumb_reserved;
+
+typedef struct
+{
+    ffthumb_context *fft_context;
+    AVCodec *codec;
+    AVCodecContext *codec_context;
+    AVFrame *frame;
+    ffpool_task *task;
+} ffthumb_worker;
+
+typedef struct
+{
+    uint8_t *rgb;
+    int width;
+    int height;
+    int stride;
+} ffthumb_sheet;
+
+// avcodec_open2 and avcodec_close are not thread safe
+static pthread_mutex_t codec_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void* thumbnail_thread(void* arg);
+
+ffthumb_context *ffthumb_alloc()
+{
+    ffthumb_context *fft_context = (ffthumb_context*) malloc(sizeof(ffthumb_context));
+    memset(fft_context, 0, sizeof(ffthumb_context));
+
+    ffthumb_reset(fft_context);
+
+    return fft_context;
+}
+
+static void ffthumb_free_files(ffthumb_reserved *fft_reserved)
+{
+    for (int i = 0; i < fft_reserved->file_count; i++)
+    {
+        free(fft_reserved->files[i].path);
+        free(fft_reserved->files[i].index_path);
+        free(fft_reserved->files[i].output_path);
+    }
+
+    free(fft_reserved->files);
+    fft_reserved->files = NULL;
+    fft_reserved->file_count = 0;
+    fft_reserved->file_capacity = 0;
+}
+
+void ffthumb_reset(ffthumb_context *fft_context)
+{
+    ffthumb_reserved *fft_reserved = (ffthumb_reserved*) fft_context->reserved;
+
+    if (fft_reserved) ffthumb_free_files(fft_reserved);
+
+    if (!fft_reserved) fft_reserved = (ffthumb_reserved*) malloc(sizeof(ffthumb_reserved));
+    memset(fft_reserved, 0, sizeof(ffthumb_reserved));
+
+    memset(fft_context, 0, sizeof(ffthumb_context));
+    fft_context->codec_id = CODEC_ID_MPEG2VIDEO;
+    fft_context->thumbnail_width = 160;
+    fft_context->columns = 4;
+    fft_context->max_thumbnails = 16;
+    fft_context->lowres = -1;
+    fft_context->format = FFTHUMB_PPM;
+    fft_context->reserved = fft_reserved;
+}
+
+ffthumb_error ffthumb_free(ffthumb_context *fft_context)
+{
+    ffthumb_reserved *fft_reserved = (ffthumb_reserved*) fft_context->reserved;
+    if (!fft_reserved) return FFTHUMB_NOT_INITIALIZED;
+
+    ffthumb_free_files(fft_reserved);
+
+    free(fft_reserved);
+    fft_context->reserved = NULL;
+
+    free(fft_context);
+
+    return FFTHUMB_OK;
+}
+
+ffthumb_error ffthumb_set_done_callback(ffthumb_context *fft_context,
+        void (*done_callback)(ffthumb_context *fft_context, const char *path, ffthumb_error error, void *arg),
+        void *arg)
+{
+    ffthumb_reserved *fft_reserved = (ffthumb_reserved*) fft_context->reserved;
+    if (!fft_reserved) return FFTHUMB_NOT_INITIALIZED;
+    fft_reserved->done_callback = done_callback;
+    fft_reserved->done_callback_arg = arg;
+    return FFTHUMB_OK;
+}
+
+ffthumb_error ffthumb_add_file(ffthumb_context *fft_context,
+        const char *path, const char *index_path, const char *output_path)
+{
+    ffthumb_reserved *fft_reserved = (ffthumb_reserved*) fft_context->reserved;
+    if (!fft_reserved) return FFTHUMB_NOT_INITIALIZED;
+
+    if (fft_reserved->file_count == fft_reserved->file_capacity)
+    {
+        int capacity = fft_reserved->file_capacity ? fft_reserved->file_capacity * 2 : 16;
+        fft_reserved->files = (ffthumb_file*) realloc(fft_reserved->files, capacity * sizeof(ffthumb_file));
+        fft_reserved->file_capacity = capacity;
+    }
+
+    ffthumb_file *file = &fft_reserved->files[fft_reserved->file_count++];
+    file->path = strdup(path);
+    file->index_path = index_path ? strdup(index_path) : NULL;
+    file->output_path = strdup(output_path);
+
+    return FFTHUMB_OK;
+}
+
+/**
+ * Average each 2x2 block of src into one pixel of dst, which is
+ * width x height. src must have at least twice as many rows and columns.
+ */
+static void halve_plane(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height)
+{
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t *row0 = src + (2 * y) * src_stride;
+        const uint8_t *row1 = row0 + src_stride;
+        uint8_t *out = dst + y * dst_stride;
+
+        int x = 0;
+
+#if defined(__SSE2__)
+        const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i lo = _mm_avg_epu8(_mm_loadu_si128((const __m128i*) &row0[2 * x]),
+                    _mm_loadu_si128((const __m128i*) &row1[2 * x]));
+            __m128i hi = _mm_avg_epu8(_mm_loadu_si128((const __m128i*) &row0[2 * x + 16]),
+                    _mm_loadu_si128((const __m128i*) &row1[2 * x + 16]));
+
+            // average the even and odd columns as 16 bit lanes
+            lo = _mm_avg_epu16(_mm_and_si128(lo, low_bytes), _mm_srli_epi16(lo, 8));
+            hi = _mm_avg_epu16(_mm_and_si128(hi, low_bytes), _mm_srli_epi16(hi, 8));
+
+            _mm_storeu_si128((__m128i*) &out[x], _mm_packus_epi16(lo, hi));
+        }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+        for (; x + 16 <= width; x += 16)
+        {
+            // vld2 splits the even and odd columns
+            uint8x16x2_t a = vld2q_u8(&row0[2 * x]);
+            uint8x16x2_t b = vld2q_u8(&row1[2 * x]);
+
+            uint8x16_t even = vrhaddq_u8(a.val[0], b.val[0]);
+            uint8x16_t odd = vrhaddq_u8(a.val[1], b.val[1]);
+
+            vst1q_u8(&out[x], vrhaddq_u8(even, odd));
+        }
+#endif
+
+        // rows then columns, each rounded as (a + b + 1) >> 1 like the SIMD averages
+        for (; x < width; x++)
+        {
+            int even = (row0[2 * x] + row1[2 * x] + 1) >> 1;
+            int odd = (row0[2 * x + 1] + row1[2 * x + 1] + 1) >> 1;
+            out[x] = (even + odd + 1) >> 1;
+        }
+    }
+}
+
+static inline uint8_t clip_uint8(int value)
+{
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+/**
+ * Scale a YUV420P picture into a width x height tile of RGB24 pixels.
+ * The picture is halved in SIMD until it is less than twice the tile
+ * size, then sampled to the exact size.
+ */
+static void draw_thumbnail(const AVPicture *picture, int picture_width, int picture_height,
+        uint8_t *rgb, int rgb_stride, int width, int height)
+{
+    AVPicture scaled[2];
+    AVPicture *src = (AVPicture*) picture;
+    int src_width = picture_width;
+    int src_height = picture_height;
+    int current = 0;
+    bool allocated[2] = { false, false };
+
+    while (src_width >= width * 2 && src_height >= height * 2)
+    {
+        // keep the sizes even so the chroma planes halve exactly
+        int dst_width = (src_width / 2) & ~1;
+        int dst_height = (src_height / 2) & ~1;
+
+        AVPicture *dst = &scaled[current];
+        if (allocated[current]) avpicture_free(dst);
+        if (avpicture_alloc(dst, PIX_FMT_YUV420P, dst_width, dst_height) < 0) break;
+        allocated[current] = true;
+
+        halve_plane(src->data[0], src->linesize[0], dst->data[0], dst->linesize[0], dst_width, dst_height);
+        halve_plane(src->data[1], src->linesize[1], dst->data[1], dst->linesize[1], dst_width / 2, dst_height / 2);
+        halve_plane(src->data[2], src->linesize[2], dst->data[2], dst->linesize[2], dst_width / 2, dst_height / 2);
+
+        src = dst;
+        src_width = dst_width;
+        src_height = dst_height;
+        current ^= 1;
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        int sy = y * src_height / height;
+        const uint8_t *srcy = src->data[0] + sy * src->linesize[0];
+        const uint8_t *srcu = src->data[1] + (sy / 2) * src->linesize[1];
+        const uint8_t *srcv = src->data[2] + (sy / 2) * src->linesize[2];
+        uint8_t *out = rgb + y * rgb_stride;
+
+        for (int x = 0; x < width; x++)
+        {
+            int sx = x * src_width / width;
+
+            // BT.601 limited range, in 16.16 fixed point
+            int c = (srcy[sx] - 16) * 76309;
+            int d = srcu[sx / 2] - 128;
+            int e = srcv[sx / 2] - 128;
+
+            out[3 * x + 0] = clip_uint8((c + 104597 * e + 32768) >> 16);
+            out[3 * x + 1] = clip_uint8((c - 25674 * d - 53278 * e + 32768) >> 16);
+            out[3 * x + 2] = clip_uint8((c + 132201 * d + 32768) >> 16);
+        }
+    }
+
+    if (allocated[0]) avpicture_free(&scaled[0]);
+    if (allocated[1]) avpicture_free(&scaled[1]);
+}
+
+static ffthumb_error write_ppm(const char *path, ffthumb_sheet *sheet)
+{
+    FILE *file = fopen(path, "wb");
+
+    if (!file)
+    {
+        fprintf(stderr, "could not open %s: %d: %s\n", path, errno, strerror(errno));
+        return FFTHUMB_WRITE_FAILED;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", sheet->width, sheet->height);
+
+    bool written = true;
+    for (int y = 0; y < sheet->height && written; y++)
+    {
+        written = fwrite(sheet->rgb + y * sheet->stride, 3, sheet->width, file) == (size_t) sheet->width;
+    }
+
+    if (fclose(file) != 0) written = false;
+
+    return written ? FFTHUMB_OK : FFTHUMB_WRITE_FAILED;
+}
+
+static ffthumb_error write_png(const char *path, ffthumb_sheet *sheet)
+{
+    AVCodec *codec = avcodec_find_encoder(CODEC_ID_PNG);
+    if (!codec) return FFTHUMB_NO_PNG_ENCODER;
+
+    AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+    codec_context->pix_fmt = PIX_FMT_RGB24;
+    codec_context->width = sheet->width;
+    codec_context->height = sheet->height;
+    codec_context->time_base = (AVRational) { 1, 1 };
+
+    pthread_mutex_lock(&codec_mutex);
+    int open_result = avcodec_open2(codec_context, codec, NULL);
+    pthread_mutex_unlock(&codec_mutex);
+
+    if (open_result < 0)
+    {
+        av_free(codec_context);
+        return FFTHUMB_NO_PNG_ENCODER;
+    }
+
+    AVFrame *frame = avcodec_alloc_frame();
+    frame->data[0] = sheet->rgb;
+    frame->linesize[0] = sheet->stride;
+    frame->width = sheet->width;
+    frame->height = sheet->height;
+    frame->format = PIX_FMT_RGB24;
+
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+
+    int got_packet = 0;
+    ffthumb_error error = FFTHUMB_WRITE_FAILED;
+
+    if (avcodec_encode_video2(codec_context, &packet, frame, &got_packet) >= 0 && got_packet)
+    {
+        FILE *file = fopen(path, "wb");
+
+        if (file)
+        {
+            bool written = fwrite(packet.data, 1, packet.size, file) == (size_t) packet.size;
+            if (fclose(file) == 0 && written) error = FFTHUMB_OK;
+        }
+        else
+        {
+            fprintf(stderr, "could not open %s: %d: %s\n", path, errno, strerror(errno));
+        }
+
+        av_free_packet(&packet);
+    }
+
+    av_free(frame);
+    frame = NULL;
+
+    pthread_mutex_lock(&codec_mutex);
+    avcodec_close(codec_context);
+    pthread_mutex_unlock(&codec_mutex);
+
+    av_free(codec_context);
+    codec_context = NULL;
+
+    return error;
+}
+
+/**
+ * Read size bytes at offset, retrying short reads.
+ */
+static bool read_at(int fd, uint8_t *buf, int64_t size, int64_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t read_result = pread(fd, buf, size, offset);
+        if (read_result < 0 && errno == EINTR) continue;
+        if (read_result <= 0) return false;
+
+        buf += read_result;
+        size -= read_result;
+        offset += read_result;
+    }
+
+    return true;
+}
+
+/**
+ * Pick the decoder lowres level for a recording picture_width pixels wide.
+ * Unless one is set, this is the largest level that still decodes at
+ * least as wide as a thumbnail, so the halving starts from full detail.
+ */
+static int thumbnail_lowres(ffthumb_context *fft_context, const AVCodec *codec, int picture_width)
+{
+    int max_lowres = codec->max_lowres;
+    if (fft_context->lowres >= 0) return FFMIN(fft_context->lowres, max_lowres);
+
+    int lowres = 0;
+    while (lowres < max_lowres && -((-picture_width) >> (lowres + 1)) >= fft_context->thumbnail_width) lowres++;
+
+    return lowres;
+}
+
+/**
+ * Open the worker decoder at lowres, reopening it if it is open at another level.
+ */
+static bool open_decoder(ffthumb_worker *worker, int lowres)
+{
+    AVCodecContext *codec_context = worker->codec_context;
+    if (codec_context->codec && codec_context->lowres == lowres) return true;
+
+    pthread_mutex_lock(&codec_mutex);
+    if (codec_context->codec) avcodec_close(codec_context);
+    codec_context->lowres = lowres;
+    int open_result = avcodec_open2(codec_context, worker->codec, NULL);
+    pthread_mutex_unlock(&codec_mutex);
+
+    return open_result >= 0;
+}
+
+/**
+ * Decode the single keyframe at entry. The decoder is flushed first and
+ * the picture is followed by a sequence end code so it comes out at once.
+ */
+static bool decode_keyframe(ffthumb_worker *worker, int fd, int64_t length,
+        const uint8_t *sequence_header, int sequence_header_size, const ffindex_entry *entry)
+{
+    AVCodecContext *codec_context = worker->codec_context;
+    AVFrame *frame = worker->frame;
+
+    if (entry->offset < 0 || entry->size <= 0 || entry->offset + entry->size > length) return false;
+
+    int size = sequence_header_size + entry->size + 4;
+
+    uint8_t *buffer = (uint8_t*) av_malloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
+
+    uint8_t *picture = buffer + sequence_header_size;
+    if (!read_at(fd, picture, entry->size, entry->offset))
+    {
+        av_free(buffer);
+        return false;
+    }
+
+    if (entry->size >= 4 && picture[0] == 0x00 && picture[1] == 0x00 &&
+            picture[2] == 0x01 && picture[3] == SEQUENCE_HEADER_CODE)
+    {
+        // the picture carries its own sequence header
+        memmove(buffer, picture, entry->size);
+        size -= sequence_header_size;
+    }
+    else
+    {
+        memcpy(buffer, sequence_header, sequence_header_size);
+    }
+
+    memset(buffer + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    uint8_t *end = buffer + size - 4;
+    end[0] = 0x00;
+    end[1] = 0x00;
+    end[2] = 0x01;
+    end[3] = SEQUENCE_END_CODE;
+
+    avcodec_flush_buffers(codec_context);
+
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = buffer;
+    packet.size = size;
+
+    int got_frame = 0;
+
+    while (!got_frame && packet.size > 0)
+    {
+        int decode_result = avcodec_decode_video2(codec_context, frame, &got_frame, &packet);
+        if (decode_result < 0) break;
+
+        packet.size -= decode_result;
+        packet.data += decode_result;
+    }
+
+    if (!got_frame)
+    {
+        // reset the AVPacket
+        av_init_packet(&packet);
+        packet.data = NULL;
+        packet.size = 0;
+
+        avcodec_decode_video2(codec_context, frame, &got_frame, &packet);
+    }
+
+    av_free(buffer);
+    buffer = NULL;
+
+    return got_frame && frame->data[0];
+}
+
+static ffthumb_error make_contact_sheet(ffthumb_worker *worker, ffthumb_file *file)
+{
+    ffthumb_context *fft_context = worker->fft_context;
+
+    int fd = open(file->path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "could not open %s: %d: %s\n", file->path, errno, strerror(errno));
+        return FFTHUMB_OPEN_FAILED;
+    }
+
+    struct stat buf;
+    if (fstat(fd, &buf) == -1 || buf.st_size == 0)
+    {
+        close(fd);
+        return FFTHUMB_NO_KEYFRAMES;
+    }
+
+    int64_t length = buf.st_size;
+
+    // the recording is read with pread, a multi-GB file does not fit
+    // in the address space of a 32-bit process
+    int header_size = FFMIN(length, SEQUENCE_HEADER_SEARCH_SIZE);
+    uint8_t *header = (uint8_t*) malloc(header_size);
+
+    if (!read_at(fd, header, header_size, 0))
+    {
+        fprintf(stderr, "could not read %s: %d: %s\n", file->path, errno, strerror(errno));
+        free(header);
+        close(fd);
+        return FFTHUMB_READ_FAILED;
+    }
+
+    ffindex_context *ffi_context = ffindex_alloc();
+
+    if (!file->index_path || ffindex_load(ffi_context, file->index_path, length) != FFINDEX_OK ||
+            ffindex_count(ffi_context) == 0)
+    {
+        ffindex_reset(ffi_context);
+
+        ffscan_context *ffs_context = ffscan_alloc();
+        ffs_context->ffi_context = ffi_context;
+        ffscan_file(ffs_context, file->path);
+        ffscan_free(ffs_context);
+        ffs_context = NULL;
+    }
+
+    int start = 0;
+    int sequence_header_size = ffscan_find_sequence_header(header, header_size, &start);
+    const uint8_t *sequence_header = header + start;
+
+    // horizontal_size_value is the 12 bits after the start code
+    int picture_width = 0;
+    if (sequence_header_size >= 6) picture_width = (sequence_header[4] << 4) | (sequence_header[5] >> 4);
+
+    if (!open_decoder(worker, thumbnail_lowres(fft_context, worker->codec, picture_width)))
+    {
+        ffindex_free(ffi_context);
+        free(header);
+        close(fd);
+        return FFTHUMB_CODEC_NOT_OPEN;
+    }
+
+    int64_t gop_count = ffindex_gop_count(ffi_context);
+    int count = FFMIN(gop_count, fft_context->max_thumbnails);
+
+    ffthumb_sheet sheet;
+    memset(&sheet, 0, sizeof(ffthumb_sheet));
+
+    int columns = FFMAX(1, FFMIN(fft_context->columns, count));
+    int rows = count ? (count + columns - 1) / columns : 0;
+    int thumbnail_width = fft_context->thumbnail_width;
+    int thumbnail_height = fft_context->thumbnail_height;
+    int thumbnails = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        ffindex_gop gop;
+        ffindex_entry entry;
+
+        if (ffindex_get_gop(ffi_context, i * gop_count / count, &gop) != FFINDEX_OK) continue;
+        if (ffindex_get(ffi_context, gop.first_entry, &entry) != FFINDEX_OK) continue;
+        if (entry.picture_type != AV_PICTURE_TYPE_I) continue;
+
+        if (!decode_keyframe(worker, fd, length, sequence_header, sequence_header_size, &entry)) continue;
+
+        AVFrame *frame = worker->frame;
+        AVCodecContext *codec_context = worker->codec_context;
+        int width = codec_context->width;
+        int height = codec_context->height;
+
+        if (!sheet.rgb)
+        {
+            // size the sheet from the first keyframe
+            if (thumbnail_height <= 0) thumbnail_height = FFMAX(1, thumbnail_width * height / width);
+
+            sheet.width = columns * thumbnail_width;
+            sheet.height = rows * thumbnail_height;
+            sheet.stride = sheet.width * 3;
+            sheet.rgb = (uint8_t*) malloc(sheet.stride * sheet.height);
+            memset(sheet.rgb, 0, sheet.stride * sheet.height);
+        }
+
+        uint8_t *tile = sheet.rgb + (i / columns) * thumbnail_height * sheet.stride
+                + (i % columns) * thumbnail_width * 3;
+
+        draw_thumbnail((AVPicture*) frame, width, height, tile, sheet.stride, thumbnail_width, thumbnail_height);
+        thumbnails++;
+    }
+
+    close(fd);
+
+    free(header);
+    header = NULL;
+
+    ffindex_free(ffi_context);
+    ffi_context = NULL;
+
+    ffthumb_error error = FFTHUMB_NO_KEYFRAMES;
+
+    if (thumbnails)
+    {
+        if (fft_context->format == FFTHUMB_PNG) error = write_png(file->output_path, &sheet);
+        else error = write_ppm(file->output_path, &sheet);
+    }
+
+    free(sheet.rgb);
+    sheet.rgb = NULL;
+
+    return error;
+}
+
+void* thumbnail_thread(void* arg)
+{
+    ffthumb_worker *worker = (ffthumb_worker*) arg;
+    ffthumb_context *fft_context = worker->fft_context;
+    ffthumb_reserved *fft_reserved = (ffthumb_reserved*) fft_context->reserved;
+
+    ffsched_apply(FFSCHED_DECODE);
+
+    while (true)
+    {
+        pthread_mutex_lock(&fft_reserved->mutex);
+        int n = fft_reserved->next_file++;
+        pthread_mutex_unlock(&fft_reserved->mutex);
+
+        if (n >= fft_reserved->file_count) break;
+
+        ffthumb_file *file = &fft_reserved->files[n];
+        ffthumb_error error = make_contact_sheet(worker, file);
+
+        if (fft_reserved->done_callback) fft_reserved->done_callback(
+                fft_context, file->path, error, fft_reserved->done_callback_arg);
+    }
+
+    return 0;
+}
+
+ffthumb_error ffthumb_run(ffthumb_context *fft_context)
+{
+    ffthumb_reserved *fft_reserved = (ffthumb_reserved*) fft_context->reserved;
+    if (!fft_reserved) return FFTHUMB_NOT_INITIALIZED;
+    if (!fft_reserved->file_count) return FFTHUMB_NO_FILES;
+
+    AVCodec *codec = avcodec_find_decoder(fft_context->codec_id);
+
+    if (!codec)
+    {
+        av_register_all();
+        codec = avcodec_find_decoder(fft_context->codec_id);
+        if (!codec) return FFTHUMB_CODEC_NOT_FOUND;
+    }
+
+    int thread_count = fft_context->thread_count;
+    if (thread_count <= 0) thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = FFMAX(1, FFMIN(thread_count, fft_reserved->file_count));
+
+    fft_reserved->next_file = 0;
+    pthread_mutex_init(&fft_reserved->mutex, 0);
+
+    ffthumb_worker *workers = (ffthumb_worker*) malloc(thread_count * sizeof(ffthumb_worker));
+    int worker_count = 0;
+    bool submit_failed = false;
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+        codec_context->pix_fmt = PIX_FMT_YUV420P;
+        codec_context->thread_count = 1;
+        codec_context->skip_loop_filter = AVDISCARD_ALL;
+
+        ffthumb_worker *worker = &workers[worker_count];
+        worker->fft_context = fft_context;
+        worker->codec = codec;
+        worker->codec_context = codec_context;
+
+        // opened at the configured level to check the codec, each file
+        // reopens it at the level that suits its picture width
+        if (!open_decoder(worker, thumbnail_lowres(fft_context, codec, 0)))
+        {
+            av_free(codec_context);
+            continue;
+        }
+
+        worker->frame = avcodec_alloc_frame();
+        worker->task = NULL;
+
+        // the workers already started share out the files between them
+        if (ffpool_submit(&thumbnail_thread, worker, &worker->task) != FFPOOL_OK)
+        {
+            pthread_mutex_lock(&codec_mutex);
+            avcodec_close(codec_context);
+            pthread_mutex_unlock(&codec_mutex);
+
+            av_free(codec_context);
+            av_free(worker->frame);
+            submit_failed = true;
+            continue;
+        }
+
+        worker_count++;
+    }
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        if (workers[i].task) ffpool_join(workers[i].task, NULL);
+
+        pthread_mutex_lock(&codec_mutex);
+        avcodec_close(workers[i].codec_context);
+        pthread_mutex_unlock(&codec_mutex);
+
+        av_free(workers[i].codec_context);
+        av_free(workers[i].frame);
+    }
+
+    free(workers);
+    workers = NULL;
+
+    pthread_mutex_destroy(&fft_reserved->mutex);
+
+    if (!worker_count) return submit_failed ? FFTHUMB_THREAD_FAILED : FFTHUMB_CODEC_NOT_OPEN;
+
+    return FFTHUMB_OK;
+}
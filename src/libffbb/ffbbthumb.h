@@ -0,0 +1,137 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBTHUMB_H
+#define FFBBTHUMB_H
+
+// include math.h otherwise it will get included
+// by avformat.h and cause duplicate definition
+// errors because of C vs C++ functions
+#include <math.h>
+
+extern "C"
+{
+#define UINT64_C uint64_t
+#define INT64_C int64_t
+#include <libavformat/avformat.h>
+}
+
+#include <sys/types.h>
+
+typedef enum
+{
+    FFTHUMB_OK = 0,
+    FFTHUMB_NOT_INITIALIZED,
+    FFTHUMB_NO_FILES,
+    FFTHUMB_CODEC_NOT_FOUND,
+    FFTHUMB_CODEC_NOT_OPEN,
+    FFTHUMB_OPEN_FAILED,
+    FFTHUMB_READ_FAILED,
+    FFTHUMB_NO_KEYFRAMES,
+    FFTHUMB_DECODE_FAILED,
+    FFTHUMB_NO_PNG_ENCODER,
+    FFTHUMB_WRITE_FAILED,
+    FFTHUMB_THREAD_FAILED
+} ffthumb_error;
+
+typedef enum
+{
+    FFTHUMB_PPM = 0,
+    FFTHUMB_PNG
+} ffthumb_format;
+
+typedef struct
+{
+    /**
+     * The codec the recordings were encoded with.
+     */
+    enum CodecID codec_id;
+
+    /**
+     * Width of each thumbnail. The height follows the video
+     * aspect ratio unless thumbnail_height is set.
+     */
+    int thumbnail_width;
+    int thumbnail_height;
+
+    /**
+     * Thumbnails per row of the contact sheet.
+     */
+    int columns;
+
+    /**
+     * The most thumbnails to take from one recording. Keyframes
+     * are picked evenly across the recording when it has more.
+     */
+    int max_thumbnails;
+
+    /**
+     * Decoder lowres level, clamped to what the codec supports. -1 picks
+     * the largest level that still decodes at least thumbnail_width wide.
+     */
+    int lowres;
+
+    /**
+     * Files processed in parallel, 0 for one per core.
+     */
+    int thread_count;
+
+    ffthumb_format format;
+
+    /**
+     * For internal use. Do not use.
+     */
+    void *reserved;
+} ffthumb_context;
+
+/**
+ * Allocate the context with default values.
+ */
+ffthumb_context *ffthumb_alloc(void);
+
+/**
+ * Reset the context with default values.
+ * This drops all files added.
+ */
+void ffthumb_reset(ffthumb_context *fft_context);
+
+/**
+ * Free the context.
+ */
+ffthumb_error ffthumb_free(ffthumb_context *fft_context);
+
+/**
+ * Called from a worker thread once a recording is done, with
+ * FFTHUMB_OK if its contact sheet was written.
+ */
+ffthumb_error ffthumb_set_done_callback(ffthumb_context *fft_context,
+        void (*done_callback)(ffthumb_context *fft_context, const char *path, ffthumb_error error, void *arg),
+        void *arg);
+
+/**
+ * Queue a recording. Keyframes are located with the sidecar at
+ * index_path when it loads, otherwise by scanning the recording.
+ * index_path may be NULL.
+ */
+ffthumb_error ffthumb_add_file(ffthumb_context *fft_context,
+        const char *path, const char *index_path, const char *output_path);
+
+/**
+ * Write the contact sheet of every queued recording, decoding only
+ * their keyframes. Returns once all of them are done.
+ */
+ffthumb_error ffthumb_run(ffthumb_context *fft_context);
+
+#endif
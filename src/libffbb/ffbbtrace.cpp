@@ -0,0 +1,167 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbtrace.h"
+
+#if defined(FFTRACE)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct
+{
+    int64_t time;
+    const char *name;
+    int64_t value;
+    char phase;
+} fftrace_record;
+
+typedef struct fftrace_buffer
+{
+    struct fftrace_buffer *next;
+    int tid;
+    const char *volatile name;
+    // records below count are complete and never change again
+    volatile int count;
+    volatile int dropped;
+    fftrace_record records[FFTRACE_BUFFER_EVENTS];
+} fftrace_buffer;
+
+// buffers are pushed at the head and kept until the process exits,
+// so the events of threads that finished can still be written
+static fftrace_buffer *volatile buffers = NULL;
+static volatile int buffer_count = 0;
+static __thread fftrace_buffer *thread_buffer = NULL;
+
+static fftrace_buffer *get_buffer()
+{
+    fftrace_buffer *buffer = thread_buffer;
+    if (buffer) return buffer;
+
+    buffer = (fftrace_buffer*) calloc(1, sizeof(fftrace_buffer));
+    buffer->tid = __sync_add_and_fetch(&buffer_count, 1);
+
+    fftrace_buffer *head;
+    do
+    {
+        head = buffers;
+        buffer->next = head;
+    }
+    while (!__sync_bool_compare_and_swap(&buffers, head, buffer));
+
+    thread_buffer = buffer;
+    return buffer;
+}
+
+void fftrace_event(char phase, const char *name, int64_t value)
+{
+    fftrace_buffer *buffer = get_buffer();
+
+    int count = buffer->count;
+    if (count == FFTRACE_BUFFER_EVENTS)
+    {
+        buffer->dropped++;
+        return;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    fftrace_record *record = &buffer->records[count];
+    record->time = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    record->name = name;
+    record->value = value;
+    record->phase = phase;
+
+    // publish the record before the count fftrace_write reads
+    __sync_synchronize();
+    buffer->count = count + 1;
+}
+
+void fftrace_thread_name(const char *name)
+{
+    get_buffer()->name = name;
+}
+
+fftrace_error fftrace_write(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) return FFTRACE_WRITE_FAILED;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    bool first = true;
+
+    for (fftrace_buffer *buffer = buffers; buffer; buffer = buffer->next)
+    {
+        int count = buffer->count;
+        __sync_synchronize();
+
+        const char *name = buffer->name;
+
+        if (name)
+        {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", buffer->tid, name);
+            first = false;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            fftrace_record *record = &buffer->records[i];
+
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld.%03d,\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"%s\":%lld}}", first ? "" : ",\n",
+                    record->name, record->phase, (long long) (record->time / 1000), (int) (record->time % 1000),
+                    buffer->tid, record->phase == 'C' ? "value" : "id", (long long) record->value);
+            first = false;
+        }
+
+        if (buffer->dropped && count)
+        {
+            int64_t time = buffer->records[count - 1].time;
+
+            fprintf(file, "%s{\"name\":\"dropped\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld.%03d,\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"events\":%d}}", first ? "" : ",\n",
+                    (long long) (time / 1000), (int) (time % 1000), buffer->tid, buffer->dropped);
+            first = false;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+
+    bool failed = ferror(file);
+    if (fclose(file) != 0) failed = true;
+
+    return failed ? FFTRACE_WRITE_FAILED : FFTRACE_OK;
+}
+
+#else
+
+void fftrace_event(char phase, const char *name, int64_t value)
+{
+}
+
+void fftrace_thread_name(const char *name)
+{
+}
+
+fftrace_error fftrace_write(const char *path)
+{
+    return FFTRACE_DISABLED;
+}
+
+#endif
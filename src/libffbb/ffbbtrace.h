@@ -0,0 +1,75 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBTRACE_H
+#define FFBBTRACE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/**
+ * Events each thread can record. Once its buffer is full a
+ * thread's further events are dropped and counted.
+ */
+#define FFTRACE_BUFFER_EVENTS (64 * 1024)
+
+typedef enum
+{
+    FFTRACE_OK = 0,
+    FFTRACE_DISABLED,
+    FFTRACE_WRITE_FAILED
+} fftrace_error;
+
+/**
+ * Tracing is compiled in only when FFTRACE is defined, otherwise the
+ * macros expand to nothing. Each thread records into a buffer of its own,
+ * so recording an event takes no lock and costs a clock read and a few
+ * stores. Names must be string literals, as only the pointer is kept.
+ */
+#if defined(FFTRACE)
+
+#define FFTRACE_BEGIN(name, id) fftrace_event('B', name, id)
+#define FFTRACE_END(name, id) fftrace_event('E', name, id)
+#define FFTRACE_COUNTER(name, value) fftrace_event('C', name, value)
+#define FFTRACE_THREAD_NAME(name) fftrace_thread_name(name)
+
+#else
+
+#define FFTRACE_BEGIN(name, id) do {} while (0)
+#define FFTRACE_END(name, id) do {} while (0)
+#define FFTRACE_COUNTER(name, value) do {} while (0)
+#define FFTRACE_THREAD_NAME(name) do {} while (0)
+
+#endif
+
+/**
+ * Record an event of the calling thread. Use the macros instead.
+ * Begin and end events take a frame or packet id, and counters a value.
+ */
+void fftrace_event(char phase, const char *name, int64_t value);
+
+/**
+ * Name the calling thread in the trace.
+ */
+void fftrace_thread_name(const char *name);
+
+/**
+ * Write the events recorded so far as Chrome trace JSON, which
+ * chrome://tracing and the Perfetto UI open. Threads may keep
+ * recording meanwhile. Returns FFTRACE_DISABLED without FFTRACE.
+ */
+fftrace_error fftrace_write(const char *path);
+
+#endif
@@ -0,0 +1,225 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Measure the capture to enqueue jitter of a simulated camera callback
+ * while encoder threads load every processor, first with the scheduling
+ * the threads start with and then with the capture and encode policies
+ * the app sets. Linux only.
+ */
+
+#include "ffbbsched.h"
+#include "ffbbstats.h"
+
+#include <deque>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FRAME_DURATION 33333
+#define FRAME_WIDTH 288
+#define FRAME_HEIGHT 512
+#define FRAME_SIZE (FRAME_WIDTH * FRAME_HEIGHT * 3 / 2)
+
+// frames waiting for the encoder before the oldest is dropped
+#define MAX_QUEUE_DEPTH 4
+
+typedef struct
+{
+    int frame_count;
+    uint8_t *camera_frame;
+    std::deque<uint8_t*> *queue;
+    pthread_mutex_t mutex;
+    volatile bool running;
+    ffstats_histogram jitter;
+    int64_t frames_dropped;
+} jitter_run;
+
+static int64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Wake up every frame duration like the camera callback, copy the
+ * frame and queue it for the encoder, timing from the due time of
+ * the frame to it being queued.
+ */
+static void* capture_thread(void* arg)
+{
+    jitter_run *run = (jitter_run*) arg;
+
+    ffsched_apply(FFSCHED_CAPTURE);
+
+    int64_t due = now();
+
+    for (int i = 0; i < run->frame_count; i++)
+    {
+        due += FRAME_DURATION;
+
+        struct timespec ts;
+        ts.tv_sec = due / 1000000;
+        ts.tv_nsec = (due % 1000000) * 1000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+        uint8_t *frame = (uint8_t*) malloc(FRAME_SIZE);
+        memcpy(frame, run->camera_frame, FRAME_SIZE);
+
+        pthread_mutex_lock(&run->mutex);
+
+        if (run->queue->size() >= MAX_QUEUE_DEPTH)
+        {
+            free(run->queue->front());
+            run->queue->pop_front();
+            run->frames_dropped++;
+        }
+
+        run->queue->push_back(frame);
+
+        pthread_mutex_unlock(&run->mutex);
+
+        ffstats_histogram_add(&run->jitter, now() - due);
+    }
+
+    run->running = false;
+
+    return 0;
+}
+
+/**
+ * Take frames off the queue and spend as long on each as a busy encoder.
+ */
+static void* encode_thread(void* arg)
+{
+    jitter_run *run = (jitter_run*) arg;
+
+    ffsched_apply(FFSCHED_ENCODE);
+
+    uint8_t *work = (uint8_t*) malloc(FRAME_SIZE);
+    memset(work, 0, FRAME_SIZE);
+    volatile uint32_t sum = 0;
+
+    while (run->running)
+    {
+        pthread_mutex_lock(&run->mutex);
+        uint8_t *frame = NULL;
+
+        if (!run->queue->empty())
+        {
+            frame = run->queue->front();
+            run->queue->pop_front();
+        }
+
+        pthread_mutex_unlock(&run->mutex);
+
+        if (frame) memcpy(work, frame, FRAME_SIZE);
+        free(frame);
+
+        for (int pass = 0; pass < 4; pass++)
+        {
+            uint32_t total = 0;
+            for (int i = 0; i < FRAME_SIZE; i++) total += work[i] * (pass + i);
+            sum += total;
+        }
+    }
+
+    free(work);
+
+    return 0;
+}
+
+static void run_jitter(const char *name, int frame_count, int encode_threads)
+{
+    jitter_run run;
+    memset(&run, 0, sizeof(jitter_run));
+    run.frame_count = frame_count;
+    run.camera_frame = (uint8_t*) malloc(FRAME_SIZE);
+    memset(run.camera_frame, 0x80, FRAME_SIZE);
+    run.queue = new std::deque<uint8_t*>();
+    run.running = true;
+    pthread_mutex_init(&run.mutex, 0);
+
+    pthread_t *encoders = (pthread_t*) malloc(encode_threads * sizeof(pthread_t));
+
+    for (int i = 0; i < encode_threads; i++)
+    {
+        pthread_create(&encoders[i], 0, &encode_thread, &run);
+    }
+
+    pthread_t capture;
+    pthread_create(&capture, 0, &capture_thread, &run);
+    pthread_join(capture, NULL);
+
+    for (int i = 0; i < encode_threads; i++)
+    {
+        pthread_join(encoders[i], NULL);
+    }
+
+    ffstats_times times;
+    ffstats_histogram_times(&run.jitter, &times);
+
+    printf("%-15s %lld frames, jitter p50 %lld us p90 %lld us p99 %lld us max %lld us, %lld dropped\n",
+            name, (long long) times.count, (long long) times.p50, (long long) times.p90,
+            (long long) times.p99, (long long) times.max, (long long) run.frames_dropped);
+
+    while (!run.queue->empty())
+    {
+        free(run.queue->front());
+        run.queue->pop_front();
+    }
+
+    delete run.queue;
+    free(encoders);
+    free(run.camera_frame);
+    pthread_mutex_destroy(&run.mutex);
+}
+
+int main(int argc, char **argv)
+{
+    int frame_count = argc > 1 ? atoi(argv[1]) : 150;
+    if (frame_count <= 0) frame_count = 150;
+
+    int processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processors < 1) processors = 1;
+
+    // one encoder per processor keeps every core busy
+    int encode_threads = processors;
+
+    printf("%d processors, %d encode threads, %d frames of %d us\n",
+            processors, encode_threads, frame_count, FRAME_DURATION);
+
+    run_jitter("without policy", frame_count, encode_threads);
+
+    // capture alone on the first processor ahead of everything, and the
+    // encoders niced on the others, as the app does with SCHEDULE_THREADS
+    uint32_t all = processors >= 32 ? 0xFFFFFFFF : (1u << processors) - 1;
+
+    ffsched_policy capture = { 0x1, 0, FFSCHED_FIFO, 10 };
+    ffsched_policy encode = { processors > 1 ? all & ~0x1u : 0, 10, FFSCHED_INHERIT, 0 };
+
+    ffsched_set_policy(FFSCHED_CAPTURE, &capture);
+    ffsched_set_policy(FFSCHED_ENCODE, &encode);
+
+    run_jitter("with policy", frame_count, encode_threads);
+
+    ffsched_report(stdout);
+
+    return 0;
+}